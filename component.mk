@@ -6,4 +6,16 @@
 COMPONENT_SRCDIRS := .
 COMPONENT_ADD_INCLUDEDIRS := . ./include
 
-COMPONENT_EMBED_FILES := files/style.min.css
\ No newline at end of file
+# Static files of the web interface, from files/. They are embedded gzipped, along with a hash of
+# their content used as ETag. See esp32_manager_webconfig_asset_t.
+ESP32_MANAGER_ASSETS := style.min.css
+
+COMPONENT_EMBED_FILES := $(addprefix $(COMPONENT_BUILD_DIR)/,$(addsuffix .gz,$(ESP32_MANAGER_ASSETS)))
+COMPONENT_EMBED_TXTFILES := $(addprefix $(COMPONENT_BUILD_DIR)/,$(addsuffix .etag,$(ESP32_MANAGER_ASSETS)))
+COMPONENT_EXTRA_CLEAN := $(COMPONENT_EMBED_FILES) $(COMPONENT_EMBED_TXTFILES)
+
+$(COMPONENT_BUILD_DIR)/%.gz: $(COMPONENT_PATH)/files/%
+	gzip -9 -n -c $< > $@
+
+$(COMPONENT_BUILD_DIR)/%.etag: $(COMPONENT_PATH)/files/%
+	printf '"%s"' `md5sum $< | cut -c 1-16` > $@
@@ -22,6 +22,36 @@ esp_err_t esp32_manager_init()
         return ESP_FAIL;
     }
 
+    // Start worker for asynchronous operations
+    e = esp32_manager_async_init();
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Async worker started");
+    } else {
+        ESP_LOGE(TAG, "Error starting async worker");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+    // Map the partition before memory-mapped entries are registered
+    e = esp32_manager_mmap_init();
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Memory-mapped partition ready");
+    } else {
+        ESP_LOGE(TAG, "Error mapping partition");
+        return ESP_FAIL;
+    }
+#endif
+
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+    // Check for a snapshot before any namespace is loaded
+    e = esp32_manager_rtc_init();
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Warm restart. Values will be restored from RTC memory.");
+    } else {
+        ESP_LOGD(TAG, "Cold boot. Values will be loaded from NVS.");
+    }
+#endif
+
     // Initialize networking
     e = esp32_manager_network_init();
     if(e == ESP_OK) {
@@ -0,0 +1,243 @@
+/**
+ * esp32_manager_async.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_async.h"
+#include "esp32_manager_rtc.h"
+#include "esp32_manager_profile.h"
+
+static const char * TAG = "esp32_manager_async";
+
+/**
+ * Operation queued for the worker task
+ */
+typedef struct {
+    esp32_manager_async_op_t op;
+    esp32_manager_namespace_t * namespace;
+    esp32_manager_async_cb_t cb;
+    void * arg;
+} esp32_manager_async_job_t;
+
+static QueueHandle_t esp32_manager_async_queue = NULL;
+static esp32_manager_async_stats_t esp32_manager_async_stats;
+
+static esp_err_t esp32_manager_async_queue_job(esp32_manager_async_op_t op, esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg);
+static void esp32_manager_async_task(void * arg);
+static esp_err_t esp32_manager_async_run(esp32_manager_async_job_t * job);
+static bool esp32_manager_async_registered(esp32_manager_namespace_t * namespace);
+
+esp_err_t esp32_manager_async_init()
+{
+    if(esp32_manager_async_queue != NULL) {
+        return ESP_OK;
+    }
+
+    memset(&esp32_manager_async_stats, 0, sizeof(esp32_manager_async_stats));
+
+    esp32_manager_async_queue = xQueueCreate(ESP32_MANAGER_ASYNC_QUEUE_SIZE, sizeof(esp32_manager_async_job_t));
+    if(esp32_manager_async_queue == NULL) {
+        ESP_LOGE(TAG, "Error creating queue");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if(xTaskCreate(esp32_manager_async_task, "esp32_manager_async", ESP32_MANAGER_ASYNC_TASK_STACK_SIZE, NULL, ESP32_MANAGER_ASYNC_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating worker task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_commit_to_nvs_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg)
+{
+    return esp32_manager_async_queue_job(ESP32_MANAGER_ASYNC_COMMIT, namespace, cb, arg);
+}
+
+esp_err_t esp32_manager_read_from_nvs_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg)
+{
+    return esp32_manager_async_queue_job(ESP32_MANAGER_ASYNC_READ, namespace, cb, arg);
+}
+
+esp_err_t esp32_manager_reset_namespace_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg)
+{
+    return esp32_manager_async_queue_job(ESP32_MANAGER_ASYNC_RESET, namespace, cb, arg);
+}
+
+const esp32_manager_async_stats_t * esp32_manager_async_get_stats()
+{
+    return &esp32_manager_async_stats;
+}
+
+static esp_err_t esp32_manager_async_queue_job(esp32_manager_async_op_t op, esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg)
+{
+    if(namespace == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(esp32_manager_async_queue == NULL) {
+        ESP_LOGE(TAG, "Worker not running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp32_manager_async_job_t job = {
+        .op = op,
+        .namespace = namespace,
+        .cb = cb,
+        .arg = arg
+    };
+    if(xQueueSend(esp32_manager_async_queue, &job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Queue full, operation on namespace %s dropped", namespace->key);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+static void esp32_manager_async_task(void * arg)
+{
+    esp32_manager_async_job_t job;
+
+    while(1) {
+        if(xQueueReceive(esp32_manager_async_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+        esp_err_t e = esp32_manager_async_run(&job);
+        if(job.cb != NULL) {
+            job.cb(job.namespace, job.op, e, job.arg);
+        }
+    }
+}
+
+/**
+ * Runs an operation ESP32_MANAGER_ASYNC_CHUNK_SIZE entries at a time. Between steps the worker
+ * sleeps for a tick, so tasks of any priority get the CPU and the NVS lock.
+ *
+ * Each step runs in a read-side section and first checks that the namespace is still registered.
+ * Unregistering waits for that section, so a step never uses a namespace, or its NVS handle, after
+ * esp32_manager_unregister_namespace() returns, and the remaining steps are cancelled.
+ */
+static esp_err_t esp32_manager_async_run(esp32_manager_async_job_t * job)
+{
+    esp32_manager_namespace_t * namespace = job->namespace;
+    esp_err_t e = ESP_OK;
+    uint16_t set_count = 0;
+    uint16_t error_count = 0;
+    uint32_t max_busy_time = 0;
+    int64_t start_time = esp_timer_get_time();
+    uint8_t parity;
+
+    parity = esp32_manager_read_enter();
+    if(!esp32_manager_async_registered(namespace)) {
+        e = ESP_ERR_NOT_FOUND;
+    } else if(job->op == ESP32_MANAGER_ASYNC_RESET && esp32_manager_validate_namespace(namespace) != ESP_OK) {
+        e = ESP_ERR_INVALID_ARG;
+    }
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+    // Same as esp32_manager_read_from_nvs(), values come from the snapshot on wake from deep sleep
+    else if(job->op == ESP32_MANAGER_ASYNC_READ) {
+        uint8_t * snapshot = esp32_manager_entries_snapshot(namespace, 0, namespace->size);
+        if(esp32_manager_rtc_restore_namespace(namespace) == ESP_OK) {
+            esp32_manager_entries_notify(namespace, snapshot, 0, namespace->size);
+            free(snapshot);
+            esp32_manager_read_exit(parity);
+            return ESP_OK;
+        }
+        free(snapshot);
+    }
+#endif
+    esp32_manager_read_exit(parity);
+    if(e != ESP_OK) {
+        return e;
+    }
+
+    for(uint16_t first=0; first < namespace->size; first += ESP32_MANAGER_ASYNC_CHUNK_SIZE) {
+        int64_t step_start_time = esp_timer_get_time();
+        uint8_t * snapshot = NULL;
+
+        parity = esp32_manager_read_enter();
+        if(!esp32_manager_async_registered(namespace)) {
+            esp32_manager_read_exit(parity);
+            ESP_LOGW(TAG, "Namespace %s unregistered, operation %d cancelled", namespace->key, job->op);
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        switch(job->op) {
+            case ESP32_MANAGER_ASYNC_COMMIT:
+                e = esp32_manager_commit_entries_to_nvs(namespace, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE, &set_count);
+            break;
+            case ESP32_MANAGER_ASYNC_READ:
+                snapshot = esp32_manager_entries_snapshot(namespace, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+                e = esp32_manager_read_entries_from_nvs(namespace, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+                esp32_manager_entries_notify(namespace, snapshot, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+            break;
+            case ESP32_MANAGER_ASYNC_RESET:
+                snapshot = esp32_manager_entries_snapshot(namespace, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+                e = esp32_manager_reset_entries(namespace, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+                esp32_manager_entries_notify(namespace, snapshot, first, ESP32_MANAGER_ASYNC_CHUNK_SIZE);
+            break;
+        }
+        esp32_manager_read_exit(parity);
+        free(snapshot);
+        if(e != ESP_OK) {
+            ++error_count;
+        }
+
+        uint32_t busy_time = (uint32_t) (esp_timer_get_time() - step_start_time);
+        max_busy_time = MAX(max_busy_time, busy_time);
+        ++esp32_manager_async_stats.steps;
+
+        vTaskDelay(1); // Yield
+    }
+
+    if(job->op == ESP32_MANAGER_ASYNC_COMMIT) {
+        // Errors setting single entries are logged only, same as esp32_manager_commit_to_nvs()
+        e = ESP_OK;
+        if(set_count > 0) {
+            int64_t step_start_time = esp_timer_get_time();
+            parity = esp32_manager_read_enter();
+            if(!esp32_manager_async_registered(namespace)) {
+                e = ESP_ERR_NOT_FOUND;
+            } else if(nvs_commit(namespace->nvs_handle) != ESP_OK) {
+                ESP_LOGE(TAG, "Could not commit namespace %s to NVS", namespace->key);
+                e = ESP_FAIL;
+            }
+            esp32_manager_read_exit(parity);
+            max_busy_time = MAX(max_busy_time, (uint32_t) (esp_timer_get_time() - step_start_time));
+        }
+    } else {
+        e = (error_count > 0) ? ESP_FAIL : ESP_OK;
+    }
+
+    if(job->op == ESP32_MANAGER_ASYNC_READ) { // Same as esp32_manager_read_from_nvs()
+        parity = esp32_manager_read_enter();
+        if(esp32_manager_async_registered(namespace)) {
+            esp32_manager_profile_resume(namespace);
+        }
+        esp32_manager_read_exit(parity);
+    }
+
+    uint32_t total_time = (uint32_t) (esp_timer_get_time() - start_time);
+    esp32_manager_async_stats.last_busy_time = max_busy_time;
+    esp32_manager_async_stats.last_total_time = total_time;
+    esp32_manager_async_stats.max_busy_time = MAX(esp32_manager_async_stats.max_busy_time, max_busy_time);
+    ++esp32_manager_async_stats.operations;
+
+    ESP_LOGD(TAG, "Namespace %s: operation %d done in %u us, longest step %u us", namespace->key, job->op, total_time, max_busy_time);
+
+    return e;
+}
+
+/**
+ * Must be called inside a read-side section
+ */
+static bool esp32_manager_async_registered(esp32_manager_namespace_t * namespace)
+{
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        if(esp32_manager_namespaces[i] == namespace) {
+            return true;
+        }
+    }
+    return false;
+}
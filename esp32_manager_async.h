@@ -0,0 +1,125 @@
+/**
+ * esp32_manager_async.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_ASYNC_H_
+#define _ESP32_MANAGER_ASYNC_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP32_MANAGER_ASYNC_CHUNK_SIZE      CONFIG_ESP32_MANAGER_ASYNC_CHUNK_SIZE       /*!< Entries processed per step before yielding */
+#define ESP32_MANAGER_ASYNC_TASK_PRIORITY   CONFIG_ESP32_MANAGER_ASYNC_TASK_PRIORITY    /*!< Priority of the worker task */
+#define ESP32_MANAGER_ASYNC_TASK_STACK_SIZE 3072    /*!< Stack of the worker task */
+#define ESP32_MANAGER_ASYNC_QUEUE_SIZE      8       /*!< Operations waiting for the worker task */
+
+/**
+ * Operations run by the worker task
+ */
+typedef enum {
+    ESP32_MANAGER_ASYNC_COMMIT = 0, /*!< esp32_manager_commit_to_nvs() */
+    ESP32_MANAGER_ASYNC_READ,       /*!< esp32_manager_read_from_nvs() */
+    ESP32_MANAGER_ASYNC_RESET       /*!< esp32_manager_reset_namespace() */
+} esp32_manager_async_op_t;
+
+/**
+ * Completion callback. Runs on the worker task.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   op operation completed
+ * @param   result what the synchronous version of the operation would have returned
+ * @param   arg user argument
+ */
+typedef void (*esp32_manager_async_cb_t)(esp32_manager_namespace_t * namespace, esp32_manager_async_op_t op, esp_err_t result, void * arg);
+
+/**
+ * Worker statistics
+ */
+typedef struct {
+    uint32_t operations;        /*!< Operations completed */
+    uint32_t steps;             /*!< Steps run */
+    uint32_t max_busy_time;     /*!< Longest step in microseconds, as run by the worker. Not how long other tasks waited for it. */
+    uint32_t last_busy_time;    /*!< Longest step of the last operation in microseconds, as run by the worker */
+    uint32_t last_total_time;   /*!< Time from start to completion of the last operation in microseconds, yields included */
+} esp32_manager_async_stats_t;
+
+/**
+ * @brief   Initialize esp32_manager_async
+ *
+ *          Starts the worker task. Called by esp32_manager_init().
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NO_MEM worker task or queue could not be created
+ */
+esp_err_t esp32_manager_async_init();
+
+/**
+ * @brief   Commit a namespace to NVS in chunks, on the worker task
+ *
+ *          Entries are set ESP32_MANAGER_ASYNC_CHUNK_SIZE at a time, yielding between steps,
+ *          and committed once at the end. Each step runs in a read-side section. If the namespace
+ *          is unregistered in between, the remaining steps are skipped and the callback gets
+ *          ESP_ERR_NOT_FOUND.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   cb completion callback, can be NULL
+ * @param   arg user argument for the callback
+ * @return  ESP_OK operation queued
+ *          ESP_ERR_INVALID_ARG invalid namespace
+ *          ESP_ERR_INVALID_STATE worker not running
+ *          ESP_ERR_NO_MEM queue full
+ */
+esp_err_t esp32_manager_commit_to_nvs_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg);
+
+/**
+ * @brief   Read a namespace from NVS in chunks, on the worker task
+ *
+ *          Entries are looked up by key ESP32_MANAGER_ASYNC_CHUNK_SIZE at a time, yielding between steps.
+ *          The NVS iterator used by the bulk load cannot survive other tasks writing NVS in between.
+ *          esp32_manager_entry_changed() is called for every entry whose value changed.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   cb completion callback, can be NULL
+ * @param   arg user argument for the callback
+ * @return  See esp32_manager_commit_to_nvs_async()
+ */
+esp_err_t esp32_manager_read_from_nvs_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg);
+
+/**
+ * @brief   Reset a namespace to its defaults in chunks, on the worker task
+ *
+ *          esp32_manager_entry_changed() is called for every entry whose value changed.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   cb completion callback, can be NULL
+ * @param   arg user argument for the callback
+ * @return  See esp32_manager_commit_to_nvs_async()
+ */
+esp_err_t esp32_manager_reset_namespace_async(esp32_manager_namespace_t * namespace, esp32_manager_async_cb_t cb, void * arg);
+
+/**
+ * @brief   Get worker statistics
+ *
+ * @return  Pointer to the statistics
+ */
+const esp32_manager_async_stats_t * esp32_manager_async_get_stats();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_ASYNC_H_
@@ -0,0 +1,153 @@
+/**
+ * esp32_manager_compress.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_compress.h"
+
+esp_err_t esp32_manager_compress(const uint8_t * src, size_t length, uint8_t ** dst, size_t * dst_length)
+{
+    if(length > UINT16_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t * buffer = malloc(sizeof(esp32_manager_compress_header_t) + length);
+    if(buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp32_manager_compress_header_t * header = (esp32_manager_compress_header_t *) buffer;
+    header->magic = ESP32_MANAGER_COMPRESS_MAGIC;
+    header->length = (uint16_t) length;
+
+    // Output is limited to the input length, anything longer is not worth it
+    size_t compressed = esp32_manager_lzss_encode(src, length, &buffer[sizeof(*header)], length);
+    if(compressed > 0 && compressed < length) {
+        header->method = ESP32_MANAGER_COMPRESS_METHOD_LZSS;
+    } else {
+        header->method = ESP32_MANAGER_COMPRESS_METHOD_NONE;
+        memcpy(&buffer[sizeof(*header)], src, length);
+        compressed = length;
+    }
+
+    *dst = buffer;
+    *dst_length = sizeof(*header) + compressed;
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_compressed_length(const uint8_t * src, size_t length, size_t * original_length)
+{
+    const esp32_manager_compress_header_t * header = (const esp32_manager_compress_header_t *) src;
+
+    if(length < sizeof(*header) || header->magic != ESP32_MANAGER_COMPRESS_MAGIC) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *original_length = header->length;
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_decompress(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_size)
+{
+    const esp32_manager_compress_header_t * header = (const esp32_manager_compress_header_t *) src;
+    size_t original_length;
+
+    if(esp32_manager_compressed_length(src, length, &original_length) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if(original_length > dst_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    src += sizeof(*header);
+    length -= sizeof(*header);
+    switch(header->method) {
+        case ESP32_MANAGER_COMPRESS_METHOD_NONE:
+            if(length != original_length) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(dst, src, length);
+            return ESP_OK;
+        case ESP32_MANAGER_COMPRESS_METHOD_LZSS:
+            return esp32_manager_lzss_decode(src, length, dst, original_length);
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+
+size_t esp32_manager_lzss_encode(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_size)
+{
+    size_t position = 0;
+    size_t out = 0;
+
+    while(position < length) {
+        if(out >= dst_size) return 0;
+        size_t flags_position = out++;
+        uint8_t flags = 0;
+
+        for(uint8_t bit=0; bit < 8 && position < length; ++bit) {
+            // Longest match in the window. Matches can overlap the current position.
+            size_t best_length = 0;
+            size_t best_distance = 0;
+            size_t max_length = MIN(ESP32_MANAGER_LZSS_MAX_MATCH, length - position);
+            size_t start = (position > ESP32_MANAGER_LZSS_WINDOW_SIZE) ? position - ESP32_MANAGER_LZSS_WINDOW_SIZE : 0;
+            for(size_t candidate = start; candidate < position; ++candidate) {
+                size_t match_length = 0;
+                while(match_length < max_length && src[candidate + match_length] == src[position + match_length]) {
+                    ++match_length;
+                }
+                if(match_length > best_length) {
+                    best_length = match_length;
+                    best_distance = position - candidate;
+                    if(match_length == max_length) break;
+                }
+            }
+
+            if(best_length >= ESP32_MANAGER_LZSS_MIN_MATCH) {
+                if(out + 2 > dst_size) return 0;
+                dst[out++] = (uint8_t) (best_distance -1);
+                dst[out++] = (uint8_t) ((((best_distance -1) >> 8) << 6) | (best_length - ESP32_MANAGER_LZSS_MIN_MATCH));
+                position += best_length;
+            } else {
+                if(out + 1 > dst_size) return 0;
+                flags |= 1 << bit;
+                dst[out++] = src[position++];
+            }
+        }
+        dst[flags_position] = flags;
+    }
+
+    return out;
+}
+
+esp_err_t esp32_manager_lzss_decode(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_length)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while(out < dst_length) {
+        if(in >= length) return ESP_ERR_INVALID_SIZE;
+        uint8_t flags = src[in++];
+
+        for(uint8_t bit=0; bit < 8 && out < dst_length; ++bit) {
+            if(flags & (1 << bit)) { // Literal
+                if(in >= length) return ESP_ERR_INVALID_SIZE;
+                dst[out++] = src[in++];
+            } else { // Match
+                if(in + 2 > length) return ESP_ERR_INVALID_SIZE;
+                size_t distance = (src[in] | ((src[in +1] >> 6) << 8)) +1;
+                size_t match_length = (src[in +1] & 0x3F) + ESP32_MANAGER_LZSS_MIN_MATCH;
+                in += 2;
+                if(distance > out || out + match_length > dst_length) return ESP_ERR_INVALID_SIZE;
+                while(match_length--) { // Byte by byte, matches can overlap
+                    dst[out] = dst[out - distance];
+                    ++out;
+                }
+            }
+        }
+    }
+
+    return ESP_OK;
+}
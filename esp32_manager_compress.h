@@ -0,0 +1,108 @@
+/**
+ * esp32_manager_compress.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_COMPRESS_H_
+#define _ESP32_MANAGER_COMPRESS_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP32_MANAGER_COMPRESS_MAGIC        0xC5    /*!< First byte of compressed values */
+#define ESP32_MANAGER_COMPRESS_METHOD_NONE  0       /*!< Stored as is. Used when compression does not save space. */
+#define ESP32_MANAGER_COMPRESS_METHOD_LZSS  1       /*!< LZSS, see esp32_manager_lzss_encode() */
+
+#define ESP32_MANAGER_LZSS_WINDOW_SIZE      1024    /*!< Longest distance to a match */
+#define ESP32_MANAGER_LZSS_MIN_MATCH        3       /*!< Shorter matches are stored as literals */
+#define ESP32_MANAGER_LZSS_MAX_MATCH        (ESP32_MANAGER_LZSS_MIN_MATCH + 63) /*!< Longest match a token can hold */
+
+/**
+ * Header stored in front of compressed values
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t magic;      /*!< ESP32_MANAGER_COMPRESS_MAGIC */
+    uint8_t method;     /*!< ESP32_MANAGER_COMPRESS_METHOD_x */
+    uint16_t length;    /*!< Length of the original value, little endian */
+} esp32_manager_compress_header_t;
+
+/**
+ * @brief   Compress a value and prepend a header
+ *
+ *          Values that do not get smaller are stored as is, with method ESP32_MANAGER_COMPRESS_METHOD_NONE.
+ *
+ * @param   src value
+ * @param   length length of the value, up to UINT16_MAX
+ * @param   dst output, allocated with malloc. Free it after use.
+ * @param   dst_length length of the output
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE value too long
+ *          ESP_ERR_NO_MEM not enough memory
+ */
+esp_err_t esp32_manager_compress(const uint8_t * src, size_t length, uint8_t ** dst, size_t * dst_length);
+
+/**
+ * @brief   Get the original length of a compressed value
+ *
+ * @param   src compressed value, with header
+ * @param   length length of the compressed value
+ * @param   original_length output length
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG not a compressed value
+ */
+esp_err_t esp32_manager_compressed_length(const uint8_t * src, size_t length, size_t * original_length);
+
+/**
+ * @brief   Decompress a value generated by esp32_manager_compress()
+ *
+ * @param   src compressed value, with header
+ * @param   length length of the compressed value
+ * @param   dst output buffer
+ * @param   dst_size size of the output buffer. See esp32_manager_compressed_length().
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG not a compressed value
+ *          ESP_ERR_INVALID_SIZE corrupted value or output buffer too small
+ */
+esp_err_t esp32_manager_decompress(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_size);
+
+/**
+ * @brief   LZSS encoder
+ *
+ *          Tokens are grouped by 8 behind a flags byte, least significant bit first. A set flag is a literal
+ *          byte. A clear flag is a 2 bytes match: 10 bits of distance -1 and 6 bits of length -3.
+ *          Needs no memory besides the output buffer.
+ *
+ * @param   src input
+ * @param   length input length
+ * @param   dst output buffer
+ * @param   dst_size output buffer size
+ * @return  output length, or 0 if it does not fit dst
+ */
+size_t esp32_manager_lzss_encode(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_size);
+
+/**
+ * @brief   LZSS decoder
+ *
+ * @param   src input
+ * @param   length input length
+ * @param   dst output buffer
+ * @param   dst_length exact output length
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE corrupted input
+ */
+esp_err_t esp32_manager_lzss_decode(const uint8_t * src, size_t length, uint8_t * dst, size_t dst_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_COMPRESS_H_
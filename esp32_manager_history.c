@@ -0,0 +1,129 @@
+/**
+ * esp32_manager_history.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_history.h"
+
+static const char * TAG = "esp32_manager_history";
+
+static portMUX_TYPE esp32_manager_history_mux = portMUX_INITIALIZER_UNLOCKED; /*!< Protects tiers from concurrent set and read */
+
+static esp_err_t esp32_manager_history_entry_to_double(esp32_manager_entry_t * entry, double * value);
+static void esp32_manager_history_push(esp32_manager_history_tier_t * tier, uint32_t timestamp, float value);
+
+esp_err_t esp32_manager_history_add(esp32_manager_entry_t * entry)
+{
+    double value;
+
+    if(entry == NULL || entry->history == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if(esp32_manager_history_entry_to_double(entry, &value) != ESP_OK) {
+        ESP_LOGE(TAG, "Entry %s is not numeric, history not supported", entry->key);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    uint32_t now = (uint32_t) time(NULL);
+
+    portENTER_CRITICAL(&esp32_manager_history_mux);
+    for(uint8_t i=0; i < entry->history->size; ++i) {
+        esp32_manager_history_tier_t * tier = &entry->history->tiers[i];
+        if(tier->period == 0) { // Raw tier
+            esp32_manager_history_push(tier, now, (float) value);
+            continue;
+        }
+        // Downsampled tier. Close the current period if this value belongs to a later one.
+        if(tier->sum_count > 0 && now >= tier->period_start + tier->period) {
+            esp32_manager_history_push(tier, tier->period_start, (float) (tier->sum / tier->sum_count));
+            tier->sum = 0;
+            tier->sum_count = 0;
+        }
+        if(tier->sum_count == 0) {
+            tier->period_start = now - (now % tier->period);
+        }
+        tier->sum += value;
+        ++tier->sum_count;
+    }
+    portEXIT_CRITICAL(&esp32_manager_history_mux);
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_history_get(esp32_manager_history_t * history, uint8_t tier, uint16_t index, esp32_manager_history_sample_t * sample)
+{
+    if(history == NULL || sample == NULL || tier >= history->size) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp32_manager_history_tier_t * t = &history->tiers[tier];
+    esp_err_t e = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&esp32_manager_history_mux);
+    if(index < t->count) {
+        // Oldest sample sits right after the newest one once the ring is full
+        *sample = t->samples[(t->head + t->depth - t->count + index) % t->depth];
+        e = ESP_OK;
+    }
+    portEXIT_CRITICAL(&esp32_manager_history_mux);
+
+    return e;
+}
+
+uint16_t esp32_manager_history_count(esp32_manager_history_t * history, uint8_t tier)
+{
+    if(history == NULL || tier >= history->size) {
+        return 0;
+    }
+
+    return history->tiers[tier].count;
+}
+
+size_t esp32_manager_history_size(esp32_manager_history_t * history)
+{
+    if(history == NULL) {
+        return 0;
+    }
+
+    size_t size = sizeof(esp32_manager_history_t);
+    for(uint8_t i=0; i < history->size; ++i) {
+        size += sizeof(esp32_manager_history_tier_t) + history->tiers[i].depth * sizeof(esp32_manager_history_sample_t);
+    }
+
+    return size;
+}
+
+static void esp32_manager_history_push(esp32_manager_history_tier_t * tier, uint32_t timestamp, float value)
+{
+    if(tier->depth == 0 || tier->samples == NULL) return;
+
+    tier->samples[tier->head].timestamp = timestamp;
+    tier->samples[tier->head].value = value;
+    tier->head = (tier->head +1) % tier->depth;
+    if(tier->count < tier->depth) {
+        ++tier->count;
+    }
+}
+
+static esp_err_t esp32_manager_history_entry_to_double(esp32_manager_entry_t * entry, double * value)
+{
+    switch(entry->type) {
+        case i8: *value = *((int8_t *) entry->value); break;
+        case u8: *value = *((uint8_t *) entry->value); break;
+        case i16: *value = *((int16_t *) entry->value); break;
+        case u16: *value = *((uint16_t *) entry->value); break;
+        case i32: *value = *((int32_t *) entry->value); break;
+        case u32: *value = *((uint32_t *) entry->value); break;
+        case i64: *value = *((int64_t *) entry->value); break;
+        case u64: *value = *((uint64_t *) entry->value); break;
+        case flt: *value = *((float *) entry->value); break;
+        case dbl: *value = *((double *) entry->value); break;
+        default:
+            return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,100 @@
+/**
+ * esp32_manager_history.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_HISTORY_H_
+#define _ESP32_MANAGER_HISTORY_H_
+
+#include <time.h>
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * History sample
+ */
+typedef struct {
+    uint32_t timestamp;     /*!< Seconds, as returned by time(). Start of the period for averaged tiers. */
+    float value;            /*!< Value, or average value over the period */
+} esp32_manager_history_sample_t;
+
+/**
+ * Ring buffer of samples at a given resolution
+ */
+typedef struct {
+    uint32_t period;        /*!< Seconds averaged into each sample. 0 stores every value as it is set. */
+    uint16_t depth;         /*!< Number of samples the tier can hold */
+    esp32_manager_history_sample_t * samples; /*!< Storage for depth samples */
+    uint16_t head;          /*!< Position of the next sample to write */
+    uint16_t count;         /*!< Number of samples stored */
+    double sum;             /*!< Sum of the values set during the current period */
+    uint32_t sum_count;     /*!< Number of values set during the current period */
+    uint32_t period_start;  /*!< Start of the current period */
+} esp32_manager_history_tier_t;
+
+/**
+ * History of a numeric entry. Attach it to the entry's history field before registering it.
+ *
+ * All memory is provided by the application, so the cost of each history is fixed and known
+ * at registration. See esp32_manager_history_size().
+ */
+typedef struct esp32_manager_history {
+    esp32_manager_history_tier_t * tiers;   /*!< Tiers, usually from finest to coarsest resolution */
+    uint8_t size;                           /*!< Number of tiers */
+} esp32_manager_history_t;
+
+/**
+ * @brief   Add the current value of an entry to its history
+ *
+ *          Called on every change notified with esp32_manager_entry_changed().
+ *
+ * @param   entry pointer to the entry
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_SUPPORTED entry has no history or is not numeric
+ */
+esp_err_t esp32_manager_history_add(esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Get a sample from a history tier
+ *
+ * @param   history pointer to the history
+ * @param   tier tier index
+ * @param   index sample index, 0 being the oldest sample stored
+ * @param   sample output sample
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND tier or sample do not exist
+ */
+esp_err_t esp32_manager_history_get(esp32_manager_history_t * history, uint8_t tier, uint16_t index, esp32_manager_history_sample_t * sample);
+
+/**
+ * @brief   Number of samples stored in a history tier
+ *
+ * @param   history pointer to the history
+ * @param   tier tier index
+ * @return  Number of samples, 0 if the tier does not exist
+ */
+uint16_t esp32_manager_history_count(esp32_manager_history_t * history, uint8_t tier);
+
+/**
+ * @brief   Memory used by a history
+ *
+ * @param   history pointer to the history
+ * @return  Bytes used by the history, its tiers and their samples
+ */
+size_t esp32_manager_history_size(esp32_manager_history_t * history);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_HISTORY_H_
@@ -0,0 +1,96 @@
+/**
+ * esp32_manager_journal.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_journal.h"
+
+static const char * TAG = "esp32_manager_journal";
+
+static esp32_manager_journal_record_t esp32_manager_journal[ESP32_MANAGER_JOURNAL_SIZE]; /*!< Record of seq is at seq % size */
+static uint32_t esp32_manager_journal_last = 0;     /*!< Last sequence number assigned */
+static uint32_t esp32_manager_journal_floor = 0;    /*!< Clients that synced before this sequence number need a full resync */
+static portMUX_TYPE esp32_manager_journal_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t esp32_manager_journal_append(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+
+uint32_t esp32_manager_journal_record(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    portENTER_CRITICAL(&esp32_manager_journal_mux);
+    uint32_t seq = esp32_manager_journal_append(namespace, entry);
+    entry->modified_seq = seq;
+    namespace->modified_seq = seq;
+    portEXIT_CRITICAL(&esp32_manager_journal_mux);
+
+    return seq;
+}
+
+uint32_t esp32_manager_journal_invalidate(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    portENTER_CRITICAL(&esp32_manager_journal_mux);
+    for(uint16_t i=0; i < ESP32_MANAGER_JOURNAL_SIZE; ++i) {
+        if(esp32_manager_journal[i].namespace == namespace && (entry == NULL || esp32_manager_journal[i].entry == entry)) {
+            esp32_manager_journal[i].namespace = NULL;
+            esp32_manager_journal[i].entry = NULL;
+        }
+    }
+    uint32_t seq = esp32_manager_journal_append(NULL, NULL);
+    esp32_manager_journal_floor = seq;
+    namespace->modified_seq = seq;
+    portEXIT_CRITICAL(&esp32_manager_journal_mux);
+
+    ESP_LOGD(TAG, "Registration of %s changed at seq %u. Clients need a full resync.", namespace->key, seq);
+    return seq;
+}
+
+uint32_t esp32_manager_journal_seq()
+{
+    return __atomic_load_n(&esp32_manager_journal_last, __ATOMIC_SEQ_CST);
+}
+
+esp_err_t esp32_manager_journal_since(uint32_t since, uint32_t until, esp32_manager_query_cb_t cb, void * arg)
+{
+    esp32_manager_journal_record_t record;
+    esp_err_t e = ESP_OK;
+
+    if(cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(since > until) { // Sequence numbers restart on boot
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for(uint32_t seq = since +1; seq <= until && e == ESP_OK; ++seq) {
+        portENTER_CRITICAL(&esp32_manager_journal_mux);
+        record = esp32_manager_journal[seq % ESP32_MANAGER_JOURNAL_SIZE];
+        uint32_t floor = esp32_manager_journal_floor;
+        portEXIT_CRITICAL(&esp32_manager_journal_mux);
+
+        if(since < floor || record.seq != seq) { // Registrations changed or record overwritten by newer changes
+            return ESP_ERR_INVALID_STATE;
+        }
+        // Skip purged records and changes superseded by a later one of the same entry
+        if(record.entry != NULL && record.entry->modified_seq == seq) {
+            e = cb(record.namespace, record.entry, arg);
+        }
+    }
+
+    return e;
+}
+
+/**
+ * Must be called with the journal mux taken
+ */
+static uint32_t esp32_manager_journal_append(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    uint32_t seq = esp32_manager_journal_last +1;
+    esp32_manager_journal_record_t * record = &esp32_manager_journal[seq % ESP32_MANAGER_JOURNAL_SIZE];
+    record->seq = seq;
+    record->namespace = namespace;
+    record->entry = entry;
+    __atomic_store_n(&esp32_manager_journal_last, seq, __ATOMIC_SEQ_CST);
+    return seq;
+}
@@ -0,0 +1,87 @@
+/**
+ * esp32_manager_journal.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_JOURNAL_H_
+#define _ESP32_MANAGER_JOURNAL_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP32_MANAGER_JOURNAL_SIZE  CONFIG_ESP32_MANAGER_JOURNAL_SIZE  /*!< Number of changes kept in the journal */
+
+/**
+ * Journal record. There is one record per sequence number.
+ */
+typedef struct {
+    uint32_t seq;                       /*!< Sequence number of the change */
+    esp32_manager_namespace_t * namespace;  /*!< Namespace of the entry changed */
+    esp32_manager_entry_t * entry;      /*!< Entry changed. NULL for registration changes and purged records. */
+} esp32_manager_journal_record_t;
+
+/**
+ * @brief   Record a change of an entry value
+ *
+ *          Assigns the next sequence number and stamps it on the entry and its namespace.
+ *          Called by esp32_manager_entry_changed().
+ *
+ * @param   namespace pointer to the namespace
+ * @param   entry pointer to the entry
+ * @return  Sequence number of the change
+ */
+uint32_t esp32_manager_journal_record(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Record a registration change
+ *
+ *          Entries added or removed cannot be expressed as value changes, so clients that synced
+ *          before this point need a full resync. Records of the namespace, or only of the entry if
+ *          it is not NULL, are purged so the journal no longer points to them.
+ *          Called by the registry with the registry mutex taken, before waiting for readers.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   entry pointer to the entry, or NULL for the whole namespace
+ * @return  Sequence number of the change
+ */
+uint32_t esp32_manager_journal_invalidate(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Current sequence number
+ *
+ * @return  Sequence number of the last change, 0 if nothing changed since boot
+ */
+uint32_t esp32_manager_journal_seq();
+
+/**
+ * @brief   Visit entries changed after a sequence number
+ *
+ *          Each entry is visited once, at the position of its last change, in sequence order.
+ *          The cost depends on the number of changes and not on the number of entries.
+ *          Call it inside a read-side section.
+ *
+ * @param   since Sequence number already known by the client
+ * @param   until Last sequence number to visit, usually esp32_manager_journal_seq()
+ * @param   cb Callback called for each entry changed
+ * @param   arg Argument passed to the callback
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_STATE journal wrapped or registrations changed after since, full resync needed
+ *          ESP_ERR_INVALID_ARG cb is NULL
+ *          Any other value returned by the callback
+ */
+esp_err_t esp32_manager_journal_since(uint32_t since, uint32_t until, esp32_manager_query_cb_t cb, void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_JOURNAL_H_
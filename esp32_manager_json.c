@@ -0,0 +1,308 @@
+/**
+ * esp32_manager_json.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_json.h"
+
+static const char * TAG = "esp32_manager_json";
+
+/**
+ * Parser states
+ */
+enum {
+    JSON_START = 0,         /*!< Before the object */
+    JSON_MEMBER_OR_END,     /*!< After '{' */
+    JSON_MEMBER,            /*!< After ',' */
+    JSON_KEY,               /*!< In a member name */
+    JSON_COLON,             /*!< After a member name */
+    JSON_VALUE,             /*!< After ':' */
+    JSON_STRING,            /*!< In a string value */
+    JSON_NUMBER,            /*!< In a number */
+    JSON_LITERAL,           /*!< In true, false or null */
+    JSON_ARRAY_ITEM_OR_END, /*!< After '[' */
+    JSON_ARRAY_ITEM,        /*!< After ',' in an array */
+    JSON_ARRAY_STRING,      /*!< In a string of an array */
+    JSON_ARRAY_NEXT,        /*!< After a string of an array */
+    JSON_NEXT,              /*!< After a member value */
+    JSON_ESCAPE,            /*!< After '\' in a string */
+    JSON_UNICODE,           /*!< In the hex digits of a \uXXXX escape */
+    JSON_DONE               /*!< After the object */
+};
+
+#define JSON_IS_SPACE(c)    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+static esp_err_t esp32_manager_json_append(esp32_manager_json_parser_t * parser, uint8_t string_state, char c);
+static esp_err_t esp32_manager_json_emit(esp32_manager_json_parser_t * parser);
+
+void esp32_manager_json_parser_init(esp32_manager_json_parser_t * parser, char * value, size_t value_size, esp32_manager_json_member_cb_t cb, void * arg)
+{
+    memset(parser, 0, sizeof(esp32_manager_json_parser_t));
+    parser->state = JSON_START;
+    parser->value = value;
+    parser->value_size = value_size;
+    parser->cb = cb;
+    parser->arg = arg;
+    parser->error = ESP_OK;
+}
+
+esp_err_t esp32_manager_json_parse(esp32_manager_json_parser_t * parser, const char * data, size_t length)
+{
+    size_t i = 0;
+
+    while(i < length && parser->error == ESP_OK) {
+        char c = data[i];
+        bool consumed = true; // Characters ending numbers and literals are parsed again in JSON_NEXT
+
+        switch(parser->state) {
+            case JSON_START:
+                if(c == '{') {
+                    parser->state = JSON_MEMBER_OR_END;
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            case JSON_MEMBER_OR_END:
+            case JSON_MEMBER:
+                if(c == '"') {
+                    parser->key_length = 0;
+                    parser->value_length = 0;
+                    parser->state = JSON_KEY;
+                } else if(c == '}' && parser->state == JSON_MEMBER_OR_END) {
+                    parser->state = JSON_DONE;
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            case JSON_KEY:
+            case JSON_STRING:
+            case JSON_ARRAY_STRING:
+                if(c == '\\') {
+                    parser->string_state = parser->state;
+                    parser->state = JSON_ESCAPE;
+                } else if(c == '"') {
+                    if(parser->state == JSON_KEY) {
+                        parser->state = JSON_COLON;
+                    } else if(parser->state == JSON_STRING) {
+                        parser->type = ESP32_MANAGER_JSON_STRING;
+                        parser->error = esp32_manager_json_emit(parser);
+                    } else {
+                        parser->state = JSON_ARRAY_NEXT;
+                    }
+                } else if((uint8_t) c < 0x20) { // Control characters must be escaped
+                    parser->error = ESP_ERR_INVALID_ARG;
+                } else {
+                    parser->error = esp32_manager_json_append(parser, parser->state, c);
+                }
+            break;
+            case JSON_ESCAPE:
+                switch(c) {
+                    case '"':
+                    case '\\':
+                    case '/': break;
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case 'u':
+                        parser->unicode = 0;
+                        parser->unicode_digits = 4;
+                        parser->state = JSON_UNICODE;
+                    break;
+                    default:
+                        parser->error = ESP_ERR_INVALID_ARG;
+                    break;
+                }
+                if(parser->state == JSON_ESCAPE && parser->error == ESP_OK) {
+                    parser->error = esp32_manager_json_append(parser, parser->string_state, c);
+                    parser->state = parser->string_state;
+                }
+            break;
+            case JSON_UNICODE:
+                if(c >= '0' && c <= '9') {
+                    parser->unicode = (parser->unicode << 4) | (c - '0');
+                } else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                    parser->unicode = (parser->unicode << 4) | ((c | 0x20) - 'a' + 10);
+                } else {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                    break;
+                }
+                if(--parser->unicode_digits == 0) { // Encoded as UTF-8
+                    uint16_t u = parser->unicode;
+                    char utf8[3];
+                    uint8_t utf8_length;
+                    if(u == 0 || (u >= 0xD800 && u <= 0xDFFF)) { // NUL would cut the string. Surrogate pairs are not supported.
+                        parser->error = ESP_ERR_INVALID_ARG;
+                        break;
+                    } else if(u < 0x80) {
+                        utf8[0] = u;
+                        utf8_length = 1;
+                    } else if(u < 0x800) {
+                        utf8[0] = 0xC0 | (u >> 6);
+                        utf8[1] = 0x80 | (u & 0x3F);
+                        utf8_length = 2;
+                    } else {
+                        utf8[0] = 0xE0 | (u >> 12);
+                        utf8[1] = 0x80 | ((u >> 6) & 0x3F);
+                        utf8[2] = 0x80 | (u & 0x3F);
+                        utf8_length = 3;
+                    }
+                    for(uint8_t j=0; j < utf8_length && parser->error == ESP_OK; ++j) {
+                        parser->error = esp32_manager_json_append(parser, parser->string_state, utf8[j]);
+                    }
+                    parser->state = parser->string_state;
+                }
+            break;
+            case JSON_COLON:
+                if(c == ':') {
+                    parser->state = JSON_VALUE;
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            case JSON_VALUE:
+                if(c == '"') {
+                    parser->state = JSON_STRING;
+                } else if(c == '-' || (c >= '0' && c <= '9')) {
+                    parser->error = esp32_manager_json_append(parser, JSON_NUMBER, c);
+                    parser->state = JSON_NUMBER;
+                } else if(c == 't' || c == 'f' || c == 'n') {
+                    parser->error = esp32_manager_json_append(parser, JSON_LITERAL, c);
+                    parser->state = JSON_LITERAL;
+                } else if(c == '[') {
+                    parser->state = JSON_ARRAY_ITEM_OR_END;
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG; // Nested objects are not supported
+                }
+            break;
+            case JSON_NUMBER:
+                if((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                    parser->error = esp32_manager_json_append(parser, JSON_NUMBER, c);
+                } else {
+                    parser->type = ESP32_MANAGER_JSON_NUMBER;
+                    parser->error = esp32_manager_json_emit(parser);
+                    consumed = false;
+                }
+            break;
+            case JSON_LITERAL:
+                if(c >= 'a' && c <= 'z') {
+                    parser->error = esp32_manager_json_append(parser, JSON_LITERAL, c);
+                    if(parser->error != ESP_OK) parser->error = ESP_ERR_INVALID_ARG;
+                } else {
+                    parser->value[parser->value_length] = 0;
+                    if(!strcmp(parser->value, "true")) {
+                        parser->type = ESP32_MANAGER_JSON_TRUE;
+                        strcpy(parser->value, "1");
+                    } else if(!strcmp(parser->value, "false")) {
+                        parser->type = ESP32_MANAGER_JSON_FALSE;
+                        strcpy(parser->value, "0");
+                    } else if(!strcmp(parser->value, "null")) {
+                        parser->type = ESP32_MANAGER_JSON_NULL;
+                        parser->value[0] = 0;
+                    } else {
+                        parser->error = ESP_ERR_INVALID_ARG;
+                        break;
+                    }
+                    parser->value_length = strlen(parser->value);
+                    parser->error = esp32_manager_json_emit(parser);
+                    consumed = false;
+                }
+            break;
+            case JSON_ARRAY_ITEM_OR_END:
+            case JSON_ARRAY_ITEM:
+                if(c == '"') {
+                    parser->state = JSON_ARRAY_STRING;
+                } else if(c == ']' && parser->state == JSON_ARRAY_ITEM_OR_END) {
+                    parser->type = ESP32_MANAGER_JSON_ARRAY;
+                    parser->error = esp32_manager_json_emit(parser);
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG; // Only arrays of strings are supported
+                }
+            break;
+            case JSON_ARRAY_NEXT:
+                if(c == ',') {
+                    parser->error = esp32_manager_json_append(parser, JSON_ARRAY_STRING, ',');
+                    parser->state = JSON_ARRAY_ITEM;
+                } else if(c == ']') {
+                    parser->type = ESP32_MANAGER_JSON_ARRAY;
+                    parser->error = esp32_manager_json_emit(parser);
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            case JSON_NEXT:
+                if(c == ',') {
+                    parser->state = JSON_MEMBER;
+                } else if(c == '}') {
+                    parser->state = JSON_DONE;
+                } else if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            case JSON_DONE:
+                if(!JSON_IS_SPACE(c)) {
+                    parser->error = ESP_ERR_INVALID_ARG;
+                }
+            break;
+            default:
+                parser->error = ESP_ERR_INVALID_STATE;
+            break;
+        }
+
+        if(consumed) {
+            ++i;
+        }
+    }
+
+    if(parser->error != ESP_OK) {
+        ESP_LOGD(TAG, "Parse error %s in state %u", esp_err_to_name(parser->error), parser->state);
+    }
+    return parser->error;
+}
+
+esp_err_t esp32_manager_json_parser_end(esp32_manager_json_parser_t * parser)
+{
+    if(parser->error != ESP_OK) {
+        return parser->error;
+    }
+    return (parser->state == JSON_DONE) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * Adds a character to the member name or value, depending on the state it is parsed in
+ */
+static esp_err_t esp32_manager_json_append(esp32_manager_json_parser_t * parser, uint8_t string_state, char c)
+{
+    if(string_state == JSON_KEY) {
+        if(parser->key_length >= ESP32_MANAGER_JSON_KEY_MAX_LENGTH) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        parser->key[parser->key_length++] = c;
+        parser->key[parser->key_length] = 0;
+    } else {
+        if(parser->value_length >= parser->value_size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        parser->value[parser->value_length++] = c;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Passes the member parsed to the callback
+ */
+static esp_err_t esp32_manager_json_emit(esp32_manager_json_parser_t * parser)
+{
+    esp_err_t e = ESP_OK;
+
+    parser->key[parser->key_length] = 0;
+    parser->value[parser->value_length] = 0;
+    if(parser->cb != NULL) {
+        e = parser->cb(parser->key, parser->value, parser->type, parser->arg);
+    }
+    parser->state = JSON_NEXT;
+    return e;
+}
@@ -0,0 +1,107 @@
+/**
+ * esp32_manager_json.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_JSON_H_
+#define _ESP32_MANAGER_JSON_H_
+
+#include <string.h>
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP32_MANAGER_JSON_KEY_MAX_LENGTH       15      /*!< Longest member name. Same as ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH. */
+
+/**
+ * Type of a member value
+ */
+typedef enum {
+    ESP32_MANAGER_JSON_STRING = 0,  /*!< String, unescaped */
+    ESP32_MANAGER_JSON_NUMBER,      /*!< Number, as written */
+    ESP32_MANAGER_JSON_TRUE,        /*!< true. Value is "1". */
+    ESP32_MANAGER_JSON_FALSE,       /*!< false. Value is "0". */
+    ESP32_MANAGER_JSON_NULL,        /*!< null. Value is empty. */
+    ESP32_MANAGER_JSON_ARRAY        /*!< Array of strings. Value is the comma-separated list of the strings. */
+} esp32_manager_json_type_t;
+
+/**
+ * Called for every member of the object, as soon as its value is complete
+ *
+ * @param   key member name
+ * @param   value member value, see esp32_manager_json_type_t
+ * @param   type type of the value
+ * @param   arg user argument
+ * @return  ESP_OK to go on. Other values stop the parser and are returned by esp32_manager_json_parse().
+ */
+typedef esp_err_t (* esp32_manager_json_member_cb_t)(const char * key, char * value, esp32_manager_json_type_t type, void * arg);
+
+/**
+ * Streaming parser of a flat JSON object, such as {"key": "value", "number": 1.5, "list": ["a", "b"]}.
+ *
+ * Input is fed in pieces of any size, so it never needs to be in memory at once, and nothing is
+ * allocated: the parser only holds the member being parsed, its value in a buffer of the caller. Nested objects and arrays of other
+ * than strings are not supported.
+ */
+typedef struct {
+    uint8_t state;                                      /*!< Where in the object the parser is */
+    uint8_t string_state;                               /*!< State to return to at the end of a string */
+    esp32_manager_json_type_t type;                     /*!< Type of the value being parsed */
+    char key[ESP32_MANAGER_JSON_KEY_MAX_LENGTH +1];     /*!< Name of the member being parsed */
+    size_t key_length;
+    char * value;                                       /*!< Value of the member being parsed, once unescaped */
+    size_t value_size;                                  /*!< Longest value */
+    size_t value_length;
+    uint16_t unicode;                                   /*!< Code point of a \uXXXX escape being parsed */
+    uint8_t unicode_digits;                             /*!< Hex digits of the escape left to parse */
+    esp32_manager_json_member_cb_t cb;
+    void * arg;
+    esp_err_t error;                                    /*!< First error. The parser stops on it. */
+} esp32_manager_json_parser_t;
+
+/**
+ * @brief   Initialize a parser
+ *
+ * @param   parser parser
+ * @param   value buffer for member values, of value_size +1 bytes. Literals such as false need 5.
+ * @param   value_size longest value
+ * @param   cb called for every member
+ * @param   arg user argument for cb
+ */
+void esp32_manager_json_parser_init(esp32_manager_json_parser_t * parser, char * value, size_t value_size, esp32_manager_json_member_cb_t cb, void * arg);
+
+/**
+ * @brief   Parse the next piece of the input
+ *
+ * @param   parser parser
+ * @param   data input
+ * @param   length length of the input
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG syntax error or unsupported JSON
+ *          ESP_ERR_INVALID_SIZE member name or value too long
+ *          Error returned by the callback
+ */
+esp_err_t esp32_manager_json_parse(esp32_manager_json_parser_t * parser, const char * data, size_t length);
+
+/**
+ * @brief   Check that the input was a complete object
+ *
+ * @param   parser parser
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_STATE input ended before the end of the object
+ *          Error returned by esp32_manager_json_parse() before
+ */
+esp_err_t esp32_manager_json_parser_end(esp32_manager_json_parser_t * parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_JSON_H_
@@ -0,0 +1,276 @@
+/**
+ * esp32_manager_mmap.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_mmap.h"
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const char * TAG = "esp32_manager_mmap";
+
+#ifdef ESP_PLATFORM
+static const esp_partition_t * esp32_manager_mmap_partition = NULL;
+static spi_flash_mmap_handle_t esp32_manager_mmap_handle;
+#else
+static uint8_t * esp32_manager_mmap_host = NULL;   /*!< Writable mapping of the host stand-in file */
+#endif
+
+static const uint8_t * esp32_manager_mmap_base = NULL; /*!< Partition mapped into the data address space */
+static uint32_t esp32_manager_mmap_size = 0;
+
+static esp_err_t esp32_manager_mmap_erase(uint32_t offset, uint32_t size);
+static esp_err_t esp32_manager_mmap_program(uint32_t offset, const void * data, size_t length);
+static uint32_t esp32_manager_mmap_crc32(uint32_t crc, const uint8_t * data, size_t length);
+
+esp_err_t esp32_manager_mmap_init()
+{
+    if(esp32_manager_mmap_base != NULL) {
+        return ESP_OK;
+    }
+
+#ifdef ESP_PLATFORM
+    esp32_manager_mmap_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ESP32_MANAGER_MMAP_PARTITION_LABEL);
+    if(esp32_manager_mmap_partition == NULL) {
+        ESP_LOGE(TAG, "Partition %s not found", ESP32_MANAGER_MMAP_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void * base;
+    if(esp_partition_mmap(esp32_manager_mmap_partition, 0, esp32_manager_mmap_partition->size, SPI_FLASH_MMAP_DATA, &base, &esp32_manager_mmap_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Partition %s could not be mapped", ESP32_MANAGER_MMAP_PARTITION_LABEL);
+        return ESP_FAIL;
+    }
+    esp32_manager_mmap_size = esp32_manager_mmap_partition->size;
+#else
+    // Host builds: a file stands in for the partition. New files start erased, like flash.
+    int fd = open(ESP32_MANAGER_MMAP_HOST_FILE, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        ESP_LOGE(TAG, "File %s could not be opened", ESP32_MANAGER_MMAP_HOST_FILE);
+        return ESP_ERR_NOT_FOUND;
+    }
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    if(file_size < ESP32_MANAGER_MMAP_HOST_SIZE && ftruncate(fd, ESP32_MANAGER_MMAP_HOST_SIZE) != 0) {
+        close(fd);
+        return ESP_FAIL;
+    }
+    void * base = mmap(NULL, ESP32_MANAGER_MMAP_HOST_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        ESP_LOGE(TAG, "File %s could not be mapped", ESP32_MANAGER_MMAP_HOST_FILE);
+        return ESP_FAIL;
+    }
+    esp32_manager_mmap_host = (uint8_t *) base;
+    if(file_size < ESP32_MANAGER_MMAP_HOST_SIZE) {
+        memset(&esp32_manager_mmap_host[file_size], 0xFF, ESP32_MANAGER_MMAP_HOST_SIZE - file_size);
+    }
+    esp32_manager_mmap_size = ESP32_MANAGER_MMAP_HOST_SIZE;
+#endif
+
+    esp32_manager_mmap_base = (const uint8_t *) base;
+    ESP_LOGD(TAG, "Partition %s mapped, %u bytes", ESP32_MANAGER_MMAP_PARTITION_LABEL, esp32_manager_mmap_size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_mmap_attach(esp32_manager_entry_t * entry)
+{
+    if(esp32_manager_mmap_base == NULL) {
+        ESP_LOGE(TAG, "Partition not mapped");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if(entry == NULL || entry->value == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(entry->type != text && entry->type != password && entry->type != blob && entry->type != image) {
+        ESP_LOGE(TAG, "Entry %s: only text, password, blob and image entries can be memory-mapped", entry->key);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp32_manager_mmap_value_t * value = (esp32_manager_mmap_value_t *) entry->value;
+    if(value->offset % ESP32_MANAGER_MMAP_SECTOR_SIZE != 0 || value->size % ESP32_MANAGER_MMAP_SECTOR_SIZE != 0
+            || value->size == 0 || value->offset + value->size > esp32_manager_mmap_size) {
+        ESP_LOGE(TAG, "Entry %s: slot at 0x%x of %u bytes is misaligned or out of the partition", entry->key, value->offset, value->size);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    value->data = NULL;
+    value->length = 0;
+
+    const esp32_manager_mmap_header_t * header = (const esp32_manager_mmap_header_t *) &esp32_manager_mmap_base[value->offset];
+    const uint8_t * data = (const uint8_t *) &header[1];
+    if(header->magic != ESP32_MANAGER_MMAP_MAGIC) {
+        ESP_LOGD(TAG, "Entry %s: slot is empty", entry->key);
+        return ESP_OK;
+    }
+    if(header->length > value->size - sizeof(esp32_manager_mmap_header_t)
+            || esp32_manager_mmap_crc32(0, data, header->length) != header->crc) {
+        ESP_LOGW(TAG, "Entry %s: slot is corrupted, ignored", entry->key);
+        return ESP_OK;
+    }
+
+    value->length = header->length;
+    value->data = data;
+    ESP_LOGD(TAG, "Entry %s: %u bytes mapped at 0x%x", entry->key, value->length, value->offset);
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_mmap_get(esp32_manager_entry_t * entry, const void ** data, size_t * length)
+{
+    if(entry == NULL || data == NULL || length == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp32_manager_mmap_value_t * value = (esp32_manager_mmap_value_t *) entry->value;
+    const uint8_t * mapped = __atomic_load_n(&value->data, __ATOMIC_SEQ_CST);
+    if(mapped == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *data = mapped;
+    *length = value->length;
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_mmap_write_begin(esp32_manager_mmap_writer_t * writer, esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, size_t length)
+{
+    if(writer == NULL || namespace == NULL || entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp32_manager_mmap_value_t * value = (esp32_manager_mmap_value_t *) entry->value;
+    if(length > value->size - sizeof(esp32_manager_mmap_header_t)) {
+        ESP_LOGE(TAG, "Entry %s: %u bytes do not fit the slot", entry->key, length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Drop the current value and wait for readers that might still be sending it
+    __atomic_store_n(&value->data, NULL, __ATOMIC_SEQ_CST);
+    esp32_manager_synchronize();
+    value->length = 0;
+
+    // Only the sectors the new value needs
+    uint32_t erase_size = sizeof(esp32_manager_mmap_header_t) + length;
+    erase_size = (erase_size + ESP32_MANAGER_MMAP_SECTOR_SIZE -1) / ESP32_MANAGER_MMAP_SECTOR_SIZE * ESP32_MANAGER_MMAP_SECTOR_SIZE;
+    if(esp32_manager_mmap_erase(value->offset, erase_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Entry %s: slot could not be erased", entry->key);
+        return ESP_FAIL;
+    }
+
+    writer->namespace = namespace;
+    writer->entry = entry;
+    writer->length = length;
+    writer->position = 0;
+    writer->crc = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_mmap_write(esp32_manager_mmap_writer_t * writer, const void * data, size_t length)
+{
+    if(writer == NULL || writer->entry == NULL || (data == NULL && length > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(writer->position + length > writer->length) {
+        ESP_LOGE(TAG, "Entry %s: more data than announced", writer->entry->key);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp32_manager_mmap_value_t * value = (esp32_manager_mmap_value_t *) writer->entry->value;
+    if(esp32_manager_mmap_program(value->offset + sizeof(esp32_manager_mmap_header_t) + writer->position, data, length) != ESP_OK) {
+        ESP_LOGE(TAG, "Entry %s: write error", writer->entry->key);
+        return ESP_FAIL;
+    }
+    writer->crc = esp32_manager_mmap_crc32(writer->crc, (const uint8_t *) data, length);
+    writer->position += length;
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_mmap_write_end(esp32_manager_mmap_writer_t * writer)
+{
+    if(writer == NULL || writer->entry == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(writer->position != writer->length) {
+        ESP_LOGE(TAG, "Entry %s: %u of %u bytes written", writer->entry->key, writer->position, writer->length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp32_manager_mmap_value_t * value = (esp32_manager_mmap_value_t *) writer->entry->value;
+    esp32_manager_mmap_header_t header = {
+        .magic = ESP32_MANAGER_MMAP_MAGIC,
+        .length = writer->length,
+        .crc = writer->crc,
+        .reserved = 0xFFFFFFFF
+    };
+    if(esp32_manager_mmap_program(value->offset, &header, sizeof(header)) != ESP_OK) {
+        ESP_LOGE(TAG, "Entry %s: header could not be written", writer->entry->key);
+        return ESP_FAIL;
+    }
+
+    value->length = writer->length;
+    __atomic_store_n(&value->data, &esp32_manager_mmap_base[value->offset + sizeof(esp32_manager_mmap_header_t)], __ATOMIC_SEQ_CST);
+    ESP_LOGD(TAG, "Entry %s: %u bytes written", writer->entry->key, value->length);
+
+    esp32_manager_entry_changed(writer->namespace, writer->entry);
+    writer->entry = NULL;
+
+    return ESP_OK;
+}
+
+static esp_err_t esp32_manager_mmap_erase(uint32_t offset, uint32_t size)
+{
+#ifdef ESP_PLATFORM
+    return esp_partition_erase_range(esp32_manager_mmap_partition, offset, size);
+#else
+    memset(&esp32_manager_mmap_host[offset], 0xFF, size);
+    return ESP_OK;
+#endif
+}
+
+static esp_err_t esp32_manager_mmap_program(uint32_t offset, const void * data, size_t length)
+{
+#ifdef ESP_PLATFORM
+    return esp_partition_write(esp32_manager_mmap_partition, offset, data, length);
+#else
+    // Like NOR flash, programming can only clear bits
+    for(size_t i=0; i < length; ++i) {
+        esp32_manager_mmap_host[offset + i] &= ((const uint8_t *) data)[i];
+    }
+    return ESP_OK;
+#endif
+}
+
+/**
+ * CRC32 that can be computed in pieces, starting with crc = 0
+ */
+static uint32_t esp32_manager_mmap_crc32(uint32_t crc, const uint8_t * data, size_t length)
+{
+    crc = ~crc;
+    for(size_t i=0; i < length; ++i) {
+        crc ^= data[i];
+        for(uint8_t bit=0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+#endif // CONFIG_ESP32_MANAGER_MMAP
@@ -0,0 +1,158 @@
+/**
+ * esp32_manager_mmap.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_MMAP_H_
+#define _ESP32_MANAGER_MMAP_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+
+#define ESP32_MANAGER_MMAP_PARTITION_LABEL  CONFIG_ESP32_MANAGER_MMAP_PARTITION_LABEL /*!< Label of the data partition holding the values */
+#define ESP32_MANAGER_MMAP_MAGIC            0x4d4d3345  /*!< Marks a slot with a complete value */
+#define ESP32_MANAGER_MMAP_SECTOR_SIZE      4096        /*!< Flash erase unit. Slots are aligned to it. */
+
+#ifndef ESP32_MANAGER_MMAP_HOST_FILE
+#define ESP32_MANAGER_MMAP_HOST_FILE        "esp32_manager_mmap.bin"    /*!< File standing in for the partition on host builds */
+#endif
+#ifndef ESP32_MANAGER_MMAP_HOST_SIZE
+#define ESP32_MANAGER_MMAP_HOST_SIZE        (64 * 1024) /*!< Size of the host stand-in */
+#endif
+
+/**
+ * Slot header, at the beginning of the slot and followed by the value.
+ *
+ * Written last, so a value interrupted while being written is never taken as valid.
+ */
+typedef struct {
+    uint32_t magic;     /*!< ESP32_MANAGER_MMAP_MAGIC when the slot holds a value */
+    uint32_t length;    /*!< Length of the value */
+    uint32_t crc;       /*!< CRC32 of the value */
+    uint32_t reserved;
+} esp32_manager_mmap_header_t;
+
+/**
+ * Value of an entry flagged with ESP32_MANAGER_ATTR_MMAP. The entry's value field points to it.
+ *
+ * Each entry owns a fixed slot of the partition, chosen by the application like the memory of
+ * other values. Slots must not overlap.
+ */
+typedef struct {
+    uint32_t offset;        /*!< Offset of the slot in the partition, multiple of ESP32_MANAGER_MMAP_SECTOR_SIZE */
+    uint32_t size;          /*!< Size of the slot, multiple of ESP32_MANAGER_MMAP_SECTOR_SIZE. Holds the header and the value. */
+    const uint8_t * data;   /*!< Value in mapped flash. NULL while the slot is empty or being written. */
+    uint32_t length;        /*!< Length of the value */
+} esp32_manager_mmap_value_t;
+
+/**
+ * Partition writer. Values are written in pieces, so they never need to fit in RAM.
+ */
+typedef struct {
+    esp32_manager_namespace_t * namespace;
+    esp32_manager_entry_t * entry;
+    uint32_t length;        /*!< Length announced to esp32_manager_mmap_write_begin() */
+    uint32_t position;      /*!< Bytes written so far */
+    uint32_t crc;           /*!< Running CRC32 of the bytes written */
+} esp32_manager_mmap_writer_t;
+
+/**
+ * @brief   Initialize esp32_manager_mmap
+ *
+ *          Maps the whole partition into the data address space. On host builds, a file of
+ *          ESP32_MANAGER_MMAP_HOST_SIZE bytes is mapped instead and created erased if missing.
+ *          Called by esp32_manager_init().
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND partition not found
+ *          ESP_FAIL partition could not be mapped
+ */
+esp_err_t esp32_manager_mmap_init();
+
+/**
+ * @brief   Attach an entry to its slot
+ *
+ *          Validates the slot and points the value to it if it holds a complete value.
+ *          Called by esp32_manager_register_entry() for entries flagged with ESP32_MANAGER_ATTR_MMAP.
+ *
+ * @param   entry pointer to the entry
+ * @return  ESP_OK success, even if the slot is empty
+ *          ESP_ERR_INVALID_STATE partition not mapped
+ *          ESP_ERR_INVALID_ARG slot out of the partition, misaligned, or entry type not supported
+ */
+esp_err_t esp32_manager_mmap_attach(esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Get the value of an entry without copying it
+ *
+ *          The pointer stays valid until the read-side section it was taken in is exited. See
+ *          esp32_manager_read_enter().
+ *
+ * @param   entry pointer to the entry
+ * @param   data output pointer to the value in mapped flash
+ * @param   length output length of the value
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND slot is empty
+ *          ESP_ERR_INVALID_ARG entry not flagged with ESP32_MANAGER_ATTR_MMAP
+ */
+esp_err_t esp32_manager_mmap_get(esp32_manager_entry_t * entry, const void ** data, size_t * length);
+
+/**
+ * @brief   Start writing a new value of an entry
+ *
+ *          The current value is dropped, readers still using it are waited for, and the slot is
+ *          erased. Must not be called from inside a read-side section.
+ *
+ * @param   writer writer to initialize
+ * @param   namespace pointer to the namespace of the entry
+ * @param   entry pointer to the entry
+ * @param   length total length of the new value
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE value does not fit the slot
+ *          ESP_ERR_INVALID_ARG entry not flagged with ESP32_MANAGER_ATTR_MMAP
+ *          ESP_FAIL flash error
+ */
+esp_err_t esp32_manager_mmap_write_begin(esp32_manager_mmap_writer_t * writer, esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, size_t length);
+
+/**
+ * @brief   Write the next piece of a value
+ *
+ * @param   writer writer started with esp32_manager_mmap_write_begin()
+ * @param   data data to write
+ * @param   length length of the data
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE more data than announced
+ *          ESP_FAIL flash error
+ */
+esp_err_t esp32_manager_mmap_write(esp32_manager_mmap_writer_t * writer, const void * data, size_t length);
+
+/**
+ * @brief   Complete a value
+ *
+ *          Writes the slot header, makes the new value visible and notifies the change.
+ *
+ * @param   writer writer started with esp32_manager_mmap_write_begin()
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE less data written than announced, the slot stays empty
+ *          ESP_FAIL flash error
+ */
+esp_err_t esp32_manager_mmap_write_end(esp32_manager_mmap_writer_t * writer);
+
+#endif // CONFIG_ESP32_MANAGER_MMAP
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_MMAP_H_
@@ -27,6 +27,7 @@ esp32_manager_entry_t esp32_manager_mqtt_entry_broker_url = {
     .friendly = ESP32_MANAGER_MQTT_BROKER_URL_FRIENDLY,
     .type = text,
     .value = (void *) esp32_manager_mqtt_broker_url,
+    .size = sizeof(esp32_manager_mqtt_broker_url),
     .default_value = (void *) ESP32_MANAGER_MQTT_BROKER_URL_DEFAULT,
     .attributes = ESP32_MANAGER_ATTR_READWRITE,
     .from_string = &esp32_manager_mqtt_entry_broker_url_from_string
@@ -103,6 +104,9 @@ esp_err_t esp32_manager_mqtt_publish_entry(esp32_manager_namespace_t * namespace
         return ESP_ERR_INVALID_ARG;
     }
 
+    // Namespace and entry must not be unregistered while publishing
+    uint8_t parity = esp32_manager_read_enter();
+
     char topic[ESP32_MANAGER_MQTT_TOPIC_MAX_LENGTH] = "/";
     strcat(topic, esp32_manager_network_hostname);
     strcat(topic, "/");
@@ -110,13 +114,66 @@ esp_err_t esp32_manager_mqtt_publish_entry(esp32_manager_namespace_t * namespace
     strcat(topic, "/");
     strcat(topic, entry->key);
 
-    char value_str[10]; // FIXME Magic number
-    if(entry->to_string(entry, value_str) != ESP_OK) { // If value cannot ve read, publish keyword NULL
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+        // Published straight from mapped flash. The slot is not erased until the read-side section ends.
+        const void * data;
+        size_t length;
+        int msg_id = -1;
+        if(esp32_manager_mmap_get(entry, &data, &length) == ESP_OK) {
+            msg_id = esp_mqtt_client_publish(esp32_manager_mqtt_client, topic, (const char *) data, length, 0, false);
+        } else {
+            msg_id = esp_mqtt_client_publish(esp32_manager_mqtt_client, topic, "NULL", 4, 0, false);
+        }
+        esp32_manager_read_exit(parity);
+        ESP_LOGD(TAG, "Publish msg %d to server %s with topic %s from mapped flash", msg_id, esp32_manager_mqtt_broker_url, topic);
+        return ESP_OK;
+    }
+#endif
+
+    // Buffer sized to the value, long text values included
+    size_t value_size = ESP32_MANAGER_MQTT_VALUE_MIN_SIZE;
+    if(entry->value != NULL) {
+        value_size = MAX(value_size, esp32_manager_entry_string_length(entry) +1);
+    }
+    char * value_str = malloc(value_size);
+    if(value_str == NULL) {
+        esp32_manager_read_exit(parity);
+        ESP_LOGE(TAG, "Not enough memory to publish entry %s.%s", namespace->key, entry->key);
+        return ESP_ERR_NO_MEM;
+    }
+    if(entry->to_string(entry, value_str, value_size) != ESP_OK) { // If value cannot ve read, publish keyword NULL
         strcpy(value_str, "NULL");
     }
 
+    esp32_manager_read_exit(parity);
+
     int msg_id = esp_mqtt_client_publish(esp32_manager_mqtt_client, topic, value_str, strlen(value_str), 0, false);
     ESP_LOGD(TAG, "Publish msg %d to server %s with topic %s and content %s", msg_id, esp32_manager_mqtt_broker_url, topic, value_str);
+    free(value_str);
+
+    return ESP_OK;
+}
+
+static esp_err_t esp32_manager_mqtt_publish_prefix_cb(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg)
+{
+    esp_err_t e = esp32_manager_mqtt_publish_entry(namespace, entry);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error publishing entry %s.%s", namespace->key, entry->key);
+    }
+    return e;
+}
+
+esp_err_t esp32_manager_mqtt_publish_prefix(const char * namespace_prefix, const char * entry_prefix)
+{
+    // Check if MQTT client has a valid connection
+    if(esp32_manager_mqtt_client == NULL) {
+        return ESP_FAIL;
+    }
+
+    if(esp32_manager_query_prefix(namespace_prefix, entry_prefix, esp32_manager_mqtt_publish_prefix_cb, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
     return ESP_OK;
 }
@@ -192,8 +249,8 @@ esp_err_t esp32_manager_mqtt_entry_broker_url_from_string(esp32_manager_entry_t
         return ESP_ERR_INVALID_ARG;
     }
 
-    uint8_t broker_url_len = strlen(source);
-    if((broker_url_len == 0) || (broker_url_len > ESP32_MANAGER_MQTT_BROKER_URL_MAX_LENGTH)) {
+    size_t broker_url_len = strlen(source);
+    if((broker_url_len == 0) || (broker_url_len >= entry->size)) {
         ESP_LOGE(TAG, "Error: MQTT broker url length %u", broker_url_len);
         return ESP_FAIL;
     }
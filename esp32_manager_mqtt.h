@@ -38,6 +38,7 @@ extern esp32_manager_entry_t * esp32_manager_mqtt_entries[ESP32_MANAGER_MQTT_NAM
 
 /** @brief  MQTT handlers and parameters */
 #define ESP32_MANAGER_MQTT_TOPIC_MAX_LENGTH     255 // FIXME Base this number on slashes, hostname, namespace and entries max length
+#define ESP32_MANAGER_MQTT_VALUE_MIN_SIZE       32  // Room for values of custom to_string methods, which may not use the entry value
 extern esp_mqtt_client_handle_t esp32_manager_mqtt_client;
 
 /**
@@ -60,6 +61,19 @@ esp_err_t esp32_manager_mqtt_init();
  */
 esp_err_t esp32_manager_mqtt_publish_entry(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
 
+/**
+ * @brief   Publish values of all entries matching namespace and entry key prefixes
+ *
+ *          Each entry is published as in esp32_manager_mqtt_publish_entry(). Uses the sorted
+ *          directory, so only matching entries are visited.
+ *
+ * @param   namespace_prefix Prefix of the namespace keys. NULL or "" for all namespaces.
+ * @param   entry_prefix Prefix of the entry keys. NULL or "" for all entries.
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_mqtt_publish_prefix(const char * namespace_prefix, const char * entry_prefix);
+
 /**
  * @brief   Event handler for mqtt legacy event loop
  *
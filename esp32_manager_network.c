@@ -5,6 +5,9 @@
  * This code is licensed under the MIT License.
  */
 
+ #include <stdlib.h>
+ #include <sys/param.h>
+
  #include "esp32_manager_network.h"
 
 static const char * TAG = "esp32_manager_network";
@@ -15,6 +18,17 @@ char esp32_manager_network_password[] = ESP32_MANAGER_NETWORK_PASSWORD_DEFAULT;
 
 uint8_t esp32_manager_network_status = 0;
 
+static esp32_manager_network_scan_t esp32_manager_network_scan;   /*!< Results of the last scan, and whether one is running */
+static TickType_t esp32_manager_network_scan_time;              /*!< When the results were taken */
+static bool esp32_manager_network_scan_valid = false;            /*!< A scan ended since boot */
+static portMUX_TYPE esp32_manager_network_scan_mux = portMUX_INITIALIZER_UNLOCKED;  /*!< Guards the scan, read by the server and written by the event task */
+static esp32_manager_network_ap_t esp32_manager_network_scan_results[ESP32_MANAGER_NETWORK_SCAN_SIZE]; /*!< Only used by the event task */
+
+static void esp32_manager_network_scan_done(uint32_t status);
+#if ESP32_MANAGER_NETWORK_SCAN_PERIOD > 0
+static void esp32_manager_network_scan_timer_cb(TimerHandle_t timer);
+#endif
+
 esp32_manager_entry_t * esp32_manager_network_entries[];
 
 esp32_manager_namespace_t esp32_manager_network_namespace = {
@@ -29,6 +43,7 @@ esp32_manager_entry_t esp32_manager_network_entry_hostname = {
     .friendly = ESP32_MANAGER_NETWORK_HOSTNAME_FRIENDLY,
     .type = text,
     .value = (void *) esp32_manager_network_hostname,
+    .size = sizeof(esp32_manager_network_hostname),
     .default_value = (void *) ESP32_MANAGER_NETWORK_HOSTNAME_DEFAULT,
     .attributes = ESP32_MANAGER_ATTR_READWRITE,
     .from_string = &esp32_manager_network_entry_hostname_from_string
@@ -39,6 +54,7 @@ esp32_manager_entry_t esp32_manager_network_entry_ssid = {
     .friendly = ESP32_MANAGER_NETWORK_SSID_FRIENDLY,
     .type = text,
     .value = (void *) esp32_manager_network_ssid,
+    .size = sizeof(esp32_manager_network_ssid),
     .default_value = (void *) ESP32_MANAGER_NETWORK_SSID_DEFAULT,
     .attributes = ESP32_MANAGER_ATTR_READWRITE,
     .from_string = &esp32_manager_network_entry_ssid_from_string,
@@ -50,6 +66,7 @@ esp32_manager_entry_t esp32_manager_network_entry_password = {
     .friendly = ESP32_MANAGER_NETWORK_PASSWORD_FRIENDLY,
     .type = password,
     .value = (void *) esp32_manager_network_password,
+    .size = sizeof(esp32_manager_network_password),
     .default_value = (void *) ESP32_MANAGER_NETWORK_PASSWORD_DEFAULT,
     .attributes = ESP32_MANAGER_ATTR_WRITE,
     .from_string = &esp32_manager_network_entry_password_from_string
@@ -145,6 +162,14 @@ esp_err_t esp32_manager_network_init()
         return ESP_FAIL;
     }
 
+#if ESP32_MANAGER_NETWORK_SCAN_PERIOD > 0
+    TimerHandle_t scan_timer = xTimerCreate("esp32_manager_scan", pdMS_TO_TICKS(ESP32_MANAGER_NETWORK_SCAN_PERIOD * 1000), pdTRUE, NULL, esp32_manager_network_scan_timer_cb);
+    if(scan_timer == NULL || xTimerStart(scan_timer, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Error starting scan timer");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
     return ESP_OK;
 }
 
@@ -276,6 +301,140 @@ esp_err_t esp32_manager_network_wifi_stop()
     return esp_wifi_stop();
 }
 
+esp_err_t esp32_manager_network_scan_start()
+{
+    esp_err_t e;
+    wifi_scan_config_t scan_config = {
+        .ssid = NULL,
+        .bssid = NULL,
+        .channel = 0,
+        .show_hidden = false
+    };
+
+    portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+    if(esp32_manager_network_scan.scanning) {
+        portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+        return ESP_OK;
+    }
+    esp32_manager_network_scan.scanning = true; // Before starting, the scan can end right away
+    ++esp32_manager_network_scan.seq;
+    portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+
+    e = esp_wifi_scan_start(&scan_config, false);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "WiFi scan started");
+    } else {
+        ESP_LOGD(TAG, "Error starting WiFi scan: %s", esp_err_to_name(e));
+        portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+        esp32_manager_network_scan.scanning = false;
+        ++esp32_manager_network_scan.seq;
+        portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+    }
+    return e;
+}
+
+void esp32_manager_network_scan_get(esp32_manager_network_scan_t * scan)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+    memcpy(scan, &esp32_manager_network_scan, sizeof(esp32_manager_network_scan_t));
+    scan->age = esp32_manager_network_scan_valid ? (now - esp32_manager_network_scan_time) * portTICK_PERIOD_MS : UINT32_MAX;
+    portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+}
+
+/**
+ * Adds an access point to the results, sorted by signal. Only the strongest access point of each SSID is kept.
+ */
+static uint8_t esp32_manager_network_scan_insert(esp32_manager_network_ap_t * results, uint8_t size, const wifi_ap_record_t * record)
+{
+    uint8_t i;
+
+    if(record->ssid[0] == 0) { // Hidden network
+        return size;
+    }
+
+    for(i=0; i < size; ++i) {
+        if(!strcmp(results[i].ssid, (const char *) record->ssid)) {
+            if(results[i].rssi >= record->rssi) {
+                return size;
+            }
+            memmove(&results[i], &results[i+1], (size - i -1) * sizeof(esp32_manager_network_ap_t));
+            --size;
+            break;
+        }
+    }
+
+    for(i=0; i < size && results[i].rssi >= record->rssi; ++i);
+    if(i >= ESP32_MANAGER_NETWORK_SCAN_SIZE) {
+        return size;
+    }
+    if(size == ESP32_MANAGER_NETWORK_SCAN_SIZE) { // Weakest one makes room
+        --size;
+    }
+    memmove(&results[i+1], &results[i], (size - i) * sizeof(esp32_manager_network_ap_t));
+    strlcpy(results[i].ssid, (const char *) record->ssid, sizeof(results[i].ssid));
+    results[i].rssi = record->rssi;
+    results[i].channel = record->primary;
+    results[i].authmode = record->authmode;
+    return size +1;
+}
+
+/**
+ * Takes the records of a scan started by esp32_manager_network_scan_start(). Runs in the event task.
+ */
+static void esp32_manager_network_scan_done(uint32_t status)
+{
+    uint16_t records_size = 0;
+    uint8_t size = 0;
+    wifi_ap_record_t * records;
+    wifi_ap_record_t record; // If there is no memory for all records. Getting them also frees the list in the driver.
+
+    portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+    bool scanning = esp32_manager_network_scan.scanning;
+    portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+    if(!scanning) { // Started by someone else, records are theirs
+        return;
+    }
+
+    esp_wifi_scan_get_ap_num(&records_size);
+    records_size = MIN(records_size, ESP32_MANAGER_NETWORK_SCAN_RECORDS_MAX);
+    records = (records_size > 1) ? malloc(records_size * sizeof(wifi_ap_record_t)) : NULL;
+    if(records == NULL) {
+        records = &record;
+        records_size = MIN(records_size, 1);
+    }
+    if(records_size > 0 && esp_wifi_scan_get_ap_records(&records_size, records) != ESP_OK) {
+        records_size = 0;
+    }
+    for(uint16_t i=0; i < records_size; ++i) {
+        size = esp32_manager_network_scan_insert(esp32_manager_network_scan_results, size, &records[i]);
+    }
+    if(records != &record) {
+        free(records);
+    }
+
+    portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+    if(status == 0) { // Results of a failed scan are not better than the previous ones
+        memcpy(esp32_manager_network_scan.aps, esp32_manager_network_scan_results, size * sizeof(esp32_manager_network_ap_t));
+        esp32_manager_network_scan.size = size;
+        esp32_manager_network_scan_time = xTaskGetTickCount();
+        esp32_manager_network_scan_valid = true;
+    }
+    esp32_manager_network_scan.scanning = false;
+    ++esp32_manager_network_scan.seq;
+    portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
+
+    ESP_LOGD(TAG, "WiFi scan done: %u networks", size);
+}
+
+#if ESP32_MANAGER_NETWORK_SCAN_PERIOD > 0
+static void esp32_manager_network_scan_timer_cb(TimerHandle_t timer)
+{
+    esp32_manager_network_scan_start();
+}
+#endif
+
 bool esp32_manager_network_connected()
 {
     return (esp32_manager_network_status & ESP32_MANAGER_NETWORK_STATUS_CONNECTED) ? true : false;
@@ -302,6 +461,7 @@ esp_err_t esp32_manager_network_event_handler(void * context, system_event_t * e
         break;
         case SYSTEM_EVENT_SCAN_DONE:
             ESP_LOGD(TAG, "Event: SCAN_DONE");
+            esp32_manager_network_scan_done(event->event_info.scan_done.status);
             esp_event_post(ESP32_MANAGER_NETWORK_EVENT_BASE, ESP32_MANAGER_NETWORK_EVENT_SCAN_DONE, NULL, 0, portMAX_DELAY);
         break;
         case SYSTEM_EVENT_STA_START:
@@ -311,6 +471,12 @@ esp_err_t esp32_manager_network_event_handler(void * context, system_event_t * e
         break;
         case SYSTEM_EVENT_STA_STOP:
             ESP_LOGD(TAG, "Event: STA_STOP");
+            portENTER_CRITICAL(&esp32_manager_network_scan_mux);
+            if(esp32_manager_network_scan.scanning) { // Scan cancelled, it will not end
+                esp32_manager_network_scan.scanning = false;
+                ++esp32_manager_network_scan.seq;
+            }
+            portEXIT_CRITICAL(&esp32_manager_network_scan_mux);
             esp_event_post(ESP32_MANAGER_NETWORK_EVENT_BASE, ESP32_MANAGER_NETWORK_EVENT_STA_STOP, NULL, 0, portMAX_DELAY);
         break;
         case SYSTEM_EVENT_STA_CONNECTED:
@@ -431,7 +597,7 @@ esp_err_t esp32_manager_network_entry_hostname_from_string(esp32_manager_entry_t
     }
 
     char hostname[ESP32_MANAGER_NETWORK_HOSTNAME_MAX_LENGTH +1]; // Temporary strin to process the new hostname on
-    uint8_t hostname_len = strlen(source);
+    size_t hostname_len = strlen(source);
     if((hostname_len == 0) || (hostname_len > ESP32_MANAGER_NETWORK_HOSTNAME_MAX_LENGTH)) {
         ESP_LOGE(TAG, "Hostname esp32_manager_network_entry_hostname_from_string: length %u", hostname_len);
         return ESP_FAIL;
@@ -478,7 +644,7 @@ esp_err_t esp32_manager_network_entry_ssid_from_string(esp32_manager_entry_t * e
     }
 
     char ssid[ESP32_MANAGER_NETWORK_SSID_MAX_LENGTH +1];
-    uint8_t ssid_len = strlen(source);
+    size_t ssid_len = strlen(source);
     if((ssid_len == 0) || (ssid_len > ESP32_MANAGER_NETWORK_SSID_MAX_LENGTH)) {
         ESP_LOGE(TAG, "Error esp32_manager_network_entry_ssid_from_string: length %u", ssid_len);
         return ESP_FAIL;
@@ -499,75 +665,64 @@ esp_err_t esp32_manager_network_entry_ssid_from_string(esp32_manager_entry_t * e
     return ESP_OK;
 }
 
-esp_err_t esp32_manager_network_entry_ssid_html_form_widget(char * buffer, esp32_manager_entry_t * entry, size_t buffer_size)
-{
-    esp_err_t e;
+// 0: entry key, 1: SSID, 2: signal. The SSID is copied from the text of the link, so it is never part of the script.
+static const esp32_manager_webconfig_fragment_t esp32_manager_network_template_ssid_row[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<tr><td><a href=\"#\" onclick=\"document.getElementById('", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("').value=this.textContent;\">", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("</a></td><td>", 2 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT("</td></tr>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
 
-    if(buffer == NULL || entry == NULL || buffer_size == 0) {
+// 0: entry friendly name, 1: entry key, 2: value
+static const esp32_manager_webconfig_fragment_t esp32_manager_network_template_ssid_input[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("<br/><input type=\"text\" id=\"", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("\" name=\"", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("\" value=\"", 2),
+    WEBCONFIG_MANAGER_FRAGMENT("\" />", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+esp_err_t esp32_manager_network_entry_ssid_html_form_widget(struct esp32_manager_webconfig_chunk * chunk, esp32_manager_entry_t * entry)
+{
+    if(chunk == NULL || entry == NULL) {
         ESP_LOGE(TAG, "Error esp32_manager_network_entry_ssid_html_form_widget: invalid args");
         return ESP_ERR_INVALID_ARG;
     }
 
-    wifi_scan_config_t scan_config = {
-        .ssid = NULL,
-        .bssid = NULL,
-        .channel = 0,
-        .show_hidden = false
-    };
-
-    strlcpy(buffer, "<div>", buffer_size);
+    esp32_manager_network_scan_t scan;
+    esp32_manager_network_scan_get(&scan);
+    if(!scan.scanning && scan.age > ESP32_MANAGER_NETWORK_SCAN_MAX_AGE_MS) { // Fresh results for the next time
+        scan.scanning = (esp32_manager_network_scan_start() == ESP_OK);
+    }
 
-    e = esp_wifi_scan_start(&scan_config, true);
-    if(e != ESP_OK) {
-        ESP_LOGE(TAG, "Error starting WiFi scan: %s", esp_err_to_name(e));
-    } else { // Scan successful
-        ESP_LOGD(TAG, "WiFi scan started");
+    esp32_manager_webconfig_chunk_puts(chunk, "<div>");
 
-        uint16_t ap_records_size = 10;
-        wifi_ap_record_t ap_records[10];
-        e = esp_wifi_scan_get_ap_records(&ap_records_size, ap_records);
-        if(e != ESP_OK) {
-            ESP_LOGE(TAG, "Error getting WiFi scan records: %s", esp_err_to_name(e));
-        } else { // Got scan records
-            ESP_LOGD(TAG, "Got WiFi scan records");
-            // Print AP list
-            // Table header
-
-            strlcat(buffer, "<table><thead><tr><th>SSID</th><th>Signal</th></tr></thead><tbody>", buffer_size);
-            for(uint8_t i=0; i < ap_records_size; ++i) {
-                strlcat(buffer, "<tr><td><a href=\"#\" onclick=\"document.getElementById('", buffer_size);
-                strlcat(buffer, (char *) entry->key, buffer_size);
-                strlcat(buffer, "').value='", buffer_size);
-                strlcat(buffer, (char *) ap_records[i].ssid, buffer_size);
-                strlcat(buffer, "';\">", buffer_size);
-                strlcat(buffer, (char *) ap_records[i].ssid, buffer_size);
-                strlcat(buffer, "</a></td><td>", buffer_size);
-                if(ap_records[i].rssi > -60) {
-                    strlcat(buffer, "Excellent", buffer_size);
-                } else if(ap_records[i].rssi > -70) {
-                    strlcat(buffer, "Good", buffer_size);
-                } else if(ap_records[i].rssi > -80) {
-                    strlcat(buffer, "Poor", buffer_size);
-                } else {
-                    strlcat(buffer, "Bad", buffer_size);
-                }
-                strlcat(buffer, "</td></tr>", buffer_size); // close column, close row
+    if(scan.size > 0) {
+        esp32_manager_webconfig_chunk_puts(chunk, "<table><thead><tr><th>SSID</th><th>Signal</th></tr></thead><tbody>");
+        for(uint8_t i=0; i < scan.size; ++i) {
+            const char * values[] = { entry->key, scan.aps[i].ssid, NULL };
+            if(scan.aps[i].rssi > -60) {
+                values[2] = "Excellent";
+            } else if(scan.aps[i].rssi > -70) {
+                values[2] = "Good";
+            } else if(scan.aps[i].rssi > -80) {
+                values[2] = "Poor";
+            } else {
+                values[2] = "Bad";
             }
-            strlcat(buffer, "</tbody></table>", buffer_size);
+            esp32_manager_webconfig_render(chunk, esp32_manager_network_template_ssid_row, values);
         }
+        esp32_manager_webconfig_chunk_puts(chunk, "</tbody></table>");
+    } else if(scan.scanning) {
+        esp32_manager_webconfig_chunk_puts(chunk, "<p>Looking for networks, reload the page in a few seconds to see them.</p>");
     }
 
-    strlcat(buffer, entry->friendly, buffer_size);
-    strlcat(buffer, "<br/>", buffer_size);
-    strlcat(buffer, "<input type=\"text\" id=\"", buffer_size);
-    strlcat(buffer, entry->key, buffer_size);
-    strlcat(buffer, "\" name=\"", buffer_size);
-    strlcat(buffer, entry->key, buffer_size);
-    strlcat(buffer, "\" value=\"", buffer_size);
-    strlcat(buffer, (char *) entry->value, buffer_size);
-    strlcat(buffer, "\" />", buffer_size);
+    const char * values[] = { entry->friendly, entry->key, (char *) entry->value };
+    esp32_manager_webconfig_render(chunk, esp32_manager_network_template_ssid_input, values);
 
-    return ESP_OK;
+    return esp32_manager_webconfig_chunk_puts(chunk, "</div>");
 }
 
 esp_err_t esp32_manager_network_entry_password_from_string(esp32_manager_entry_t * entry, char * source)
@@ -582,7 +737,7 @@ esp_err_t esp32_manager_network_entry_password_from_string(esp32_manager_entry_t
         return ESP_ERR_INVALID_ARG;
     }
 
-    uint8_t password_len = strlen(source);
+    size_t password_len = strlen(source);
     if((password_len < ESP32_MANAGER_NETWORK_PASSWORD_MIN_LENGTH) || (password_len > ESP32_MANAGER_NETWORK_PASSWORD_MAX_LENGTH)) {
         ESP_LOGE(TAG, "Error esp32_manager_network_entry_password_from_string: length %u", password_len);
         return ESP_FAIL;
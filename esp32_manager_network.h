@@ -20,6 +20,7 @@
 #include "esp_event_loop.h"
 #include "tcpip_adapter.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 
 #include "esp32_manager.h"
 
@@ -51,6 +52,32 @@ extern "C" {
 #define ESP32_MANAGER_NETWORK_AP_SSID         CONFIG_ESP32_MANAGER_NETWORK_AP_SSID  /*!< SSID to use when creating an AP */
 #define ESP32_MANAGER_NETWORK_AP_PASSWORD     CONFIG_ESP32_MANAGER_NETWORK_AP_PASSWORD      /*!< Password of the AP created */
 
+#define ESP32_MANAGER_NETWORK_SCAN_SIZE         16      /*!< Networks kept from a scan, strongest first */
+#define ESP32_MANAGER_NETWORK_SCAN_RECORDS_MAX  32      /*!< Access points read from a scan. Several can have the same SSID. */
+#define ESP32_MANAGER_NETWORK_SCAN_MAX_AGE_MS   30000   /*!< Age of the results after which the SSID widget starts a new scan */
+#define ESP32_MANAGER_NETWORK_SCAN_PERIOD       CONFIG_ESP32_MANAGER_NETWORK_SCAN_PERIOD    /*!< Seconds between scans. 0 to scan on demand only. */
+
+/**
+ * Network found by a scan
+ */
+typedef struct {
+    char ssid[ESP32_MANAGER_NETWORK_SSID_MAX_LENGTH +1];
+    int8_t rssi;                /*!< Strongest signal of its access points, in dBm */
+    uint8_t channel;            /*!< Channel of the strongest access point */
+    wifi_auth_mode_t authmode;
+} esp32_manager_network_ap_t;
+
+/**
+ * Results of the last scan
+ */
+typedef struct {
+    esp32_manager_network_ap_t aps[ESP32_MANAGER_NETWORK_SCAN_SIZE];    /*!< Sorted by signal, strongest first. One per SSID. */
+    uint8_t size;               /*!< Networks in aps */
+    bool scanning;              /*!< A scan is running */
+    uint32_t seq;               /*!< Changes every time a scan starts or ends */
+    uint32_t age;               /*!< Milliseconds since the results were taken. UINT32_MAX before the first scan. */
+} esp32_manager_network_scan_t;
+
 /**
  * Mode to start WiFi in
  */
@@ -174,6 +201,27 @@ bool esp32_manager_network_got_ip();
  */
 bool esp32_manager_network_is_ap();
 
+/**
+ * @brief   Start a WiFi scan in the background
+ *
+ *          Returns immediately. When the scan ends, its results replace those returned by
+ *          esp32_manager_network_scan_get(), and a ESP32_MANAGER_NETWORK_EVENT_SCAN_DONE event is posted.
+ *          Scans started with esp_wifi_scan_start() are not taken into the results.
+ *
+ * @return  ESP_OK success, or a scan was already running
+ *          Error returned by esp_wifi_scan_start(), such as when WiFi is not started or is connecting
+ */
+esp_err_t esp32_manager_network_scan_start();
+
+/**
+ * @brief   Get the results of the last scan
+ *
+ *          Never blocks. Results are copied, so they do not change while used.
+ *
+ * @param   scan where to copy the results
+ */
+void esp32_manager_network_scan_get(esp32_manager_network_scan_t * scan);
+
 /**
  * @brief   Event handler for network events.
  *
@@ -203,7 +251,19 @@ esp_err_t esp32_manager_network_entry_hostname_from_string(esp32_manager_entry_t
  */
 esp_err_t esp32_manager_network_entry_ssid_from_string(esp32_manager_entry_t * entry, char * source);
 
-esp_err_t esp32_manager_network_entry_ssid_html_form_widget(char * buffer, esp32_manager_entry_t * entry, size_t buffer_size);
+/**
+ * @brief   webconfig form widget for the ssid, with a list of the networks in range
+ *
+ *          Networks are those of the last scan. A new scan is started in the background when they
+ *          are older than ESP32_MANAGER_NETWORK_SCAN_MAX_AGE_MS, for the next time the page is loaded.
+ *
+ * @param   chunk chunked response to send the HTML generated to
+ * @param   entry pointer to entry
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG invalid arguments
+ *          ESP_FAIL error sending the response
+ */
+esp_err_t esp32_manager_network_entry_ssid_html_form_widget(struct esp32_manager_webconfig_chunk * chunk, esp32_manager_entry_t * entry);
 
 /**
  * @brief   esp32_manager callback to update password from string
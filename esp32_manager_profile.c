@@ -0,0 +1,541 @@
+/**
+ * esp32_manager_profile.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_profile.h"
+
+static const char * TAG = "esp32_manager_profile";
+
+/**
+ * Serialized values of a namespace
+ */
+typedef struct {
+    esp32_manager_namespace_t * namespace;
+    uint8_t * buffer;   /*!< NULL when the namespace is not stored */
+    size_t length;
+} esp32_manager_profile_blob_t;
+
+static SemaphoreHandle_t esp32_manager_profile_mutex = NULL;  /*!< Serializes activations and their resumption */
+static char * esp32_manager_profile_pending = NULL;     /*!< Activation interrupted by a reset: profile name and the keys of the namespaces not committed yet, each null-terminated */
+static size_t esp32_manager_profile_pending_length = 0;
+
+static esp_err_t esp32_manager_profile_pending_store(const char * pending, size_t length);
+static esp_err_t esp32_manager_profile_open(const char * name, nvs_open_mode mode, nvs_handle * handle);
+static esp_err_t esp32_manager_profile_load(nvs_handle handle, esp32_manager_namespace_t * namespace, esp32_manager_profile_blob_t * blob);
+static esp_err_t esp32_manager_profile_load_current(esp32_manager_namespace_t * namespace, esp32_manager_profile_blob_t * blob);
+static esp_err_t esp32_manager_profile_validate(const uint8_t * buffer, size_t length);
+static bool esp32_manager_profile_find(const esp32_manager_profile_blob_t * blob, const char * key, const uint8_t ** value, size_t * value_size);
+static bool esp32_manager_profile_differ(const esp32_manager_profile_blob_t * a, const esp32_manager_profile_blob_t * b, const char * key);
+
+esp_err_t esp32_manager_profile_init()
+{
+    nvs_handle handle;
+    size_t length = 0;
+
+    if(esp32_manager_profile_mutex == NULL) {
+        esp32_manager_profile_mutex = xSemaphoreCreateMutex();
+        if(esp32_manager_profile_mutex == NULL) {
+            ESP_LOGE(TAG, "Not enough memory to create mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(esp32_manager_profile_mutex, portMAX_DELAY);
+    free(esp32_manager_profile_pending);
+    esp32_manager_profile_pending = NULL;
+    esp32_manager_profile_pending_length = 0;
+
+    if(nvs_open(ESP32_MANAGER_STORAGE_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        if(nvs_get_blob(handle, ESP32_MANAGER_PROFILE_PENDING_KEY, NULL, &length) == ESP_OK && length > 0) {
+            esp32_manager_profile_pending = malloc(length +1);
+            if(esp32_manager_profile_pending != NULL && nvs_get_blob(handle, ESP32_MANAGER_PROFILE_PENDING_KEY, esp32_manager_profile_pending, &length) == ESP_OK) {
+                esp32_manager_profile_pending[length] = 0; // Terminates a damaged marker
+                esp32_manager_profile_pending_length = length;
+                ESP_LOGW(TAG, "Activation of profile %s was interrupted. It is finished as its namespaces are read from NVS.", esp32_manager_profile_pending);
+            } else {
+                free(esp32_manager_profile_pending);
+                esp32_manager_profile_pending = NULL;
+            }
+        }
+        nvs_close(handle);
+    }
+    xSemaphoreGive(esp32_manager_profile_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_profile_save(const char * name)
+{
+    esp_err_t e;
+    nvs_handle handle;
+    esp32_manager_profile_blob_t blob;
+
+    e = esp32_manager_profile_open(name, NVS_READWRITE, &handle);
+    if(e != ESP_OK) {
+        return (e == ESP_ERR_INVALID_ARG) ? e : ESP_FAIL;
+    }
+
+    // Replace the whole profile, so namespaces no longer registered do not linger
+    e = nvs_erase_all(handle);
+
+    uint8_t parity = esp32_manager_read_enter();
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && e == ESP_OK; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace == NULL) continue;
+
+        e = esp32_manager_profile_load_current(namespace, &blob);
+        if(e == ESP_OK) {
+            e = nvs_set_blob(handle, namespace->key, blob.buffer, blob.length);
+            free(blob.buffer);
+        }
+        if(e != ESP_OK) {
+            ESP_LOGE(TAG, "Error saving namespace %s to profile %s: %s", namespace->key, name, esp_err_to_name(e));
+        }
+    }
+    esp32_manager_read_exit(parity);
+
+    if(e == ESP_OK) {
+        e = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if(e == ESP_OK) {
+        ESP_LOGI(TAG, "Profile %s saved", name);
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error saving profile %s", name);
+        return (e == ESP_ERR_NO_MEM) ? e : ESP_FAIL;
+    }
+}
+
+esp_err_t esp32_manager_profile_activate(const char * name)
+{
+    esp_err_t e;
+    nvs_handle handle;
+    esp32_manager_profile_blob_t blobs[ESP32_MANAGER_NAMESPACES_SIZE];
+    esp32_manager_profile_blob_t olds[ESP32_MANAGER_NAMESPACES_SIZE];
+    uint8_t error_count = 0;
+
+    e = esp32_manager_profile_open(name, NVS_READONLY, &handle);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Profile %s not found", name);
+        return (e == ESP_ERR_INVALID_ARG) ? e : ESP_ERR_NOT_FOUND;
+    }
+
+    memset(blobs, 0, sizeof(blobs));
+    memset(olds, 0, sizeof(olds));
+
+    uint8_t parity = esp32_manager_read_enter();
+
+    // Read the whole profile, check every value fits its entry, and keep the current values to roll back to
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && e == ESP_OK; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace == NULL) continue;
+
+        e = esp32_manager_profile_load(handle, namespace, &blobs[i]);
+        if(e != ESP_OK || blobs[i].buffer == NULL) continue; // Namespaces not in the profile keep their values
+
+        e = esp32_manager_profile_validate(blobs[i].buffer, blobs[i].length);
+        if(e == ESP_OK) {
+            e = esp32_manager_namespace_check_serialized(namespace, blobs[i].buffer, blobs[i].length);
+        }
+        if(e != ESP_OK) {
+            ESP_LOGE(TAG, "Profile %s: namespace %s is corrupted or does not fit its entries", name, namespace->key);
+        } else {
+            e = esp32_manager_profile_load_current(namespace, &olds[i]);
+        }
+    }
+    nvs_close(handle);
+
+    // Namespaces to commit, stored until all are committed, so a reset in between finishes the activation on the next boot
+    char pending[ESP32_MANAGER_PROFILE_NAME_MAX_LENGTH +1 + ESP32_MANAGER_NAMESPACES_SIZE * (ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1)];
+    size_t pending_length = 0;
+    if(e == ESP_OK) {
+        pending_length = strlen(name) +1;
+        memcpy(pending, name, pending_length);
+        for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+            if(blobs[i].buffer == NULL) continue;
+            size_t key_length = strlen(blobs[i].namespace->key) +1;
+            memcpy(&pending[pending_length], blobs[i].namespace->key, key_length);
+            pending_length += key_length;
+        }
+        xSemaphoreTake(esp32_manager_profile_mutex, portMAX_DELAY);
+        e = esp32_manager_profile_pending_store(pending, pending_length);
+        if(e == ESP_OK) { // Replaces an activation interrupted before
+            free(esp32_manager_profile_pending);
+            esp32_manager_profile_pending = NULL;
+            esp32_manager_profile_pending_length = 0;
+        } else {
+            xSemaphoreGive(esp32_manager_profile_mutex);
+        }
+    }
+
+    if(e == ESP_OK) {
+        // Switch the values of every namespace before committing any, so a failed commit can undo them all
+        for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+            if(blobs[i].buffer == NULL) continue;
+            esp32_manager_namespace_deserialize(blobs[i].namespace, blobs[i].buffer, blobs[i].length);
+        }
+        for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && e == ESP_OK; ++i) {
+            if(blobs[i].buffer == NULL) continue;
+            if(esp32_manager_commit_to_nvs(blobs[i].namespace) != ESP_OK) {
+                ESP_LOGE(TAG, "Error committing namespace %s", blobs[i].namespace->key);
+                e = ESP_FAIL;
+            }
+        }
+
+        if(e != ESP_OK) {
+            // Roll back every namespace, including the ones already committed
+            for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+                if(olds[i].buffer == NULL) continue;
+                esp32_manager_namespace_deserialize(olds[i].namespace, olds[i].buffer, olds[i].length);
+                if(esp32_manager_commit_to_nvs(olds[i].namespace) != ESP_OK) {
+                    ++error_count;
+                }
+            }
+        }
+
+        // NVS holds one profile or the other again. Otherwise the marker stays, and the next boot finishes the activation.
+        if(error_count == 0) {
+            esp32_manager_profile_pending_store(NULL, 0);
+        }
+        xSemaphoreGive(esp32_manager_profile_mutex);
+
+        if(e == ESP_OK) {
+            // Notify once the whole profile is in place
+            for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+                esp32_manager_namespace_t * namespace = blobs[i].namespace;
+                if(blobs[i].buffer == NULL) continue;
+
+                for(uint16_t j=0; j < namespace->size; ++j) {
+                    esp32_manager_entry_t * entry = namespace->entries[j]; // Read slot once, it can be cleared concurrently
+                    if(entry == NULL) continue;
+                    const uint8_t * value;
+                    size_t value_size;
+                    if(esp32_manager_profile_find(&blobs[i], entry->key, &value, &value_size) // Entries not in the profile keep their value
+                            && esp32_manager_profile_differ(&olds[i], &blobs[i], entry->key)) {
+                        esp32_manager_entry_changed(namespace, entry);
+                    }
+                }
+            }
+        }
+    }
+
+    esp32_manager_read_exit(parity);
+
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        free(blobs[i].buffer);
+        free(olds[i].buffer);
+    }
+
+    if(e == ESP_OK) {
+        ESP_LOGI(TAG, "Profile %s activated", name);
+    } else if(error_count > 0) {
+        ESP_LOGE(TAG, "Profile %s not activated, and %u namespaces could not be rolled back in NVS", name, error_count);
+    } else {
+        ESP_LOGE(TAG, "Profile %s not activated: %s", name, esp_err_to_name(e));
+    }
+    return e;
+}
+
+esp_err_t esp32_manager_profile_diff(const char * name_a, const char * name_b, esp32_manager_query_cb_t cb, void * arg)
+{
+    esp_err_t e = ESP_OK;
+    nvs_handle handle_a, handle_b;
+    esp32_manager_profile_blob_t a, b;
+
+    if(cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(name_a != NULL && esp32_manager_profile_open(name_a, NVS_READONLY, &handle_a) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if(name_b != NULL && esp32_manager_profile_open(name_b, NVS_READONLY, &handle_b) != ESP_OK) {
+        if(name_a != NULL) nvs_close(handle_a);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t parity = esp32_manager_read_enter();
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && e == ESP_OK; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace == NULL) continue;
+
+        a.buffer = b.buffer = NULL;
+        e = (name_a != NULL) ? esp32_manager_profile_load(handle_a, namespace, &a) : esp32_manager_profile_load_current(namespace, &a);
+        if(e == ESP_OK) {
+            e = (name_b != NULL) ? esp32_manager_profile_load(handle_b, namespace, &b) : esp32_manager_profile_load_current(namespace, &b);
+        }
+        if(e == ESP_OK && a.buffer != NULL) e = esp32_manager_profile_validate(a.buffer, a.length);
+        if(e == ESP_OK && b.buffer != NULL) e = esp32_manager_profile_validate(b.buffer, b.length);
+
+        for(uint16_t j=0; j < namespace->size && e == ESP_OK; ++j) {
+            esp32_manager_entry_t * entry = namespace->entries[j]; // Read slot once, it can be cleared concurrently
+            if(entry == NULL) continue;
+            if(esp32_manager_profile_differ(&a, &b, entry->key)) {
+                e = cb(namespace, entry, arg);
+            }
+        }
+        free(a.buffer);
+        free(b.buffer);
+    }
+    esp32_manager_read_exit(parity);
+
+    if(name_a != NULL) nvs_close(handle_a);
+    if(name_b != NULL) nvs_close(handle_b);
+
+    return e;
+}
+
+esp_err_t esp32_manager_profile_resume(esp32_manager_namespace_t * namespace)
+{
+    esp_err_t e;
+    nvs_handle handle;
+    esp32_manager_profile_blob_t blob = { .buffer = NULL };
+    char * key = NULL;
+
+    if(esp32_manager_profile_pending == NULL || namespace == NULL) { // Nothing interrupted, the common case
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(esp32_manager_profile_mutex, portMAX_DELAY);
+    size_t name_length = (esp32_manager_profile_pending != NULL) ? strlen(esp32_manager_profile_pending) +1 : 0;
+    for(size_t position = name_length; position < esp32_manager_profile_pending_length; position += strlen(&esp32_manager_profile_pending[position]) +1) {
+        if(!strcmp(&esp32_manager_profile_pending[position], namespace->key)) {
+            key = &esp32_manager_profile_pending[position];
+            break;
+        }
+    }
+    if(key == NULL) {
+        xSemaphoreGive(esp32_manager_profile_mutex);
+        return ESP_OK;
+    }
+
+    e = esp32_manager_profile_open(esp32_manager_profile_pending, NVS_READONLY, &handle);
+    if(e == ESP_OK) {
+        e = esp32_manager_profile_load(handle, namespace, &blob);
+        nvs_close(handle);
+    }
+    if(e == ESP_OK && blob.buffer != NULL) {
+        e = esp32_manager_profile_validate(blob.buffer, blob.length);
+        if(e == ESP_OK) {
+            e = esp32_manager_namespace_check_serialized(namespace, blob.buffer, blob.length);
+        }
+        if(e == ESP_OK) {
+            uint8_t * snapshot = esp32_manager_entries_snapshot(namespace, 0, namespace->size);
+            esp32_manager_namespace_deserialize(namespace, blob.buffer, blob.length);
+            e = esp32_manager_commit_to_nvs(namespace);
+            esp32_manager_entries_notify(namespace, snapshot, 0, namespace->size);
+            free(snapshot);
+        }
+    }
+    free(blob.buffer);
+
+    if(e == ESP_OK) {
+        ESP_LOGI(TAG, "Namespace %s committed to finish the activation of profile %s", namespace->key, esp32_manager_profile_pending);
+    } else {
+        ESP_LOGE(TAG, "Error finishing the activation of profile %s on namespace %s: %s", esp32_manager_profile_pending, namespace->key, esp_err_to_name(e));
+    }
+
+    // Done with this namespace either way. A profile that cannot be applied would fail on every boot.
+    size_t key_length = strlen(key) +1;
+    memmove(key, key + key_length, esp32_manager_profile_pending_length - (key - esp32_manager_profile_pending) - key_length);
+    esp32_manager_profile_pending_length -= key_length;
+    if(esp32_manager_profile_pending_length > name_length) {
+        esp32_manager_profile_pending_store(esp32_manager_profile_pending, esp32_manager_profile_pending_length);
+    } else {
+        esp32_manager_profile_pending_store(NULL, 0);
+        ESP_LOGI(TAG, "Activation of profile %s finished", esp32_manager_profile_pending);
+        free(esp32_manager_profile_pending);
+        esp32_manager_profile_pending = NULL;
+        esp32_manager_profile_pending_length = 0;
+    }
+    xSemaphoreGive(esp32_manager_profile_mutex);
+
+    return e;
+}
+
+esp_err_t esp32_manager_profile_erase(const char * name)
+{
+    nvs_handle handle;
+
+    if(esp32_manager_profile_open(name, NVS_READWRITE, &handle) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t e = nvs_erase_all(handle);
+    if(e == ESP_OK) {
+        e = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Profile %s erased", name);
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error erasing profile %s", name);
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * Stores the activation marker, or erases it when pending is NULL. Call it holding the mutex.
+ */
+static esp_err_t esp32_manager_profile_pending_store(const char * pending, size_t length)
+{
+    nvs_handle handle;
+
+    esp_err_t e = nvs_open(ESP32_MANAGER_STORAGE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if(e == ESP_OK) {
+        if(pending != NULL) {
+            e = nvs_set_blob(handle, ESP32_MANAGER_PROFILE_PENDING_KEY, pending, length);
+        } else {
+            e = nvs_erase_key(handle, ESP32_MANAGER_PROFILE_PENDING_KEY);
+            e = (e == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : e;
+        }
+        if(e == ESP_OK) {
+            e = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error storing the activation marker: %s", esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t esp32_manager_profile_open(const char * name, nvs_open_mode mode, nvs_handle * handle)
+{
+    char nvs_namespace[sizeof(ESP32_MANAGER_PROFILE_NVS_PREFIX) + ESP32_MANAGER_PROFILE_NAME_MAX_LENGTH];
+
+    if(name == NULL || strlen(name) == 0 || strlen(name) > ESP32_MANAGER_PROFILE_NAME_MAX_LENGTH) {
+        ESP_LOGE(TAG, "Invalid profile name");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    strcpy(nvs_namespace, ESP32_MANAGER_PROFILE_NVS_PREFIX);
+    strcat(nvs_namespace, name);
+
+    return nvs_open(nvs_namespace, mode, handle);
+}
+
+/**
+ * Loads the blob of a namespace from a profile. Not stored is not an error, blob->buffer is NULL then.
+ */
+static esp_err_t esp32_manager_profile_load(nvs_handle handle, esp32_manager_namespace_t * namespace, esp32_manager_profile_blob_t * blob)
+{
+    blob->namespace = namespace;
+    blob->buffer = NULL;
+    blob->length = 0;
+
+    esp_err_t e = nvs_get_blob(handle, namespace->key, NULL, &blob->length);
+    if(e == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    } else if(e != ESP_OK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    blob->buffer = malloc(MAX(blob->length, 1));
+    if(blob->buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if(nvs_get_blob(handle, namespace->key, blob->buffer, &blob->length) != ESP_OK) {
+        free(blob->buffer);
+        blob->buffer = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t esp32_manager_profile_load_current(esp32_manager_namespace_t * namespace, esp32_manager_profile_blob_t * blob)
+{
+    size_t size = 0;
+
+    blob->namespace = namespace;
+
+    // Same record layout as esp32_manager_namespace_serialize()
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i];
+        if(entry == NULL) continue;
+        size += 1 + strlen(entry->key) + 2 + esp32_manager_entry_value_size(entry);
+    }
+
+    blob->buffer = malloc(MAX(size, 1));
+    if(blob->buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t e = esp32_manager_namespace_serialize(namespace, blob->buffer, size, &blob->length);
+    if(e != ESP_OK) {
+        free(blob->buffer);
+        blob->buffer = NULL;
+    }
+
+    return e;
+}
+
+static esp_err_t esp32_manager_profile_validate(const uint8_t * buffer, size_t length)
+{
+    size_t position = 0;
+
+    while(position < length) {
+        size_t key_len = buffer[position++];
+        if(key_len == 0 || key_len > ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH || position + key_len + 2 > length) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        position += key_len;
+        size_t value_size = buffer[position] | (buffer[position +1] << 8);
+        position += 2 + value_size;
+    }
+
+    return (position == length) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static bool esp32_manager_profile_find(const esp32_manager_profile_blob_t * blob, const char * key, const uint8_t ** value, size_t * value_size)
+{
+    size_t key_len = strlen(key);
+    size_t position = 0;
+
+    if(blob->buffer == NULL) {
+        return false;
+    }
+
+    while(position < blob->length) { // Blob already validated
+        size_t record_key_len = blob->buffer[position++];
+        const char * record_key = (const char *) &blob->buffer[position];
+        position += record_key_len;
+        *value_size = blob->buffer[position] | (blob->buffer[position +1] << 8);
+        position += 2;
+        if(record_key_len == key_len && !memcmp(record_key, key, key_len)) {
+            *value = &blob->buffer[position];
+            return true;
+        }
+        position += *value_size;
+    }
+
+    return false;
+}
+
+static bool esp32_manager_profile_differ(const esp32_manager_profile_blob_t * a, const esp32_manager_profile_blob_t * b, const char * key)
+{
+    const uint8_t * value_a, * value_b;
+    size_t size_a, size_b;
+
+    bool found_a = esp32_manager_profile_find(a, key, &value_a, &size_a);
+    bool found_b = esp32_manager_profile_find(b, key, &value_b, &size_b);
+
+    if(!found_a && !found_b) {
+        return false;
+    } else if(found_a != found_b) {
+        return true;
+    } else {
+        return size_a != size_b || memcmp(value_a, value_b, size_a) != 0;
+    }
+}
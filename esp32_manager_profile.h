@@ -0,0 +1,130 @@
+/**
+ * esp32_manager_profile.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_PROFILE_H_
+#define _ESP32_MANAGER_PROFILE_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP32_MANAGER_PROFILE_NVS_PREFIX        "p_"    /*!< Prefix of the NVS namespaces that store profiles */
+#define ESP32_MANAGER_PROFILE_NAME_MAX_LENGTH   13      /*!< Maximum length of a profile name, so prefix and name fit an NVS namespace key */
+#define ESP32_MANAGER_PROFILE_PENDING_KEY       "profile_act"   /*!< Key of the activation marker in ESP32_MANAGER_STORAGE_NVS_NAMESPACE */
+
+/**
+ * @brief   Initialize esp32_manager_profile
+ *
+ *          Reads the marker of an activation interrupted by a reset, if any. Called by
+ *          esp32_manager_storage_init().
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NO_MEM not enough memory
+ */
+esp_err_t esp32_manager_profile_init();
+
+/**
+ * @brief   Save the current values of all registered namespaces as a profile
+ *
+ *          Profiles are stored in their own NVS namespace, "p_[name]", with a blob per manager
+ *          namespace in the format of esp32_manager_namespace_serialize(). Saving over an existing
+ *          profile replaces it.
+ *
+ * @param   name profile name
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG name is NULL or too long
+ *          ESP_ERR_NO_MEM not enough memory
+ *          ESP_FAIL error writing to NVS
+ */
+esp_err_t esp32_manager_profile_save(const char * name);
+
+/**
+ * @brief   Activate a profile
+ *
+ *          The whole profile is read and every value checked against its entry before any value
+ *          is changed. Values of all namespaces in the profile are then switched, and only then
+ *          committed to NVS, one namespace at a time. If a commit fails, every namespace is put back
+ *          to its previous values and committed again. esp32_manager_entry_changed() is called for
+ *          every entry whose value changed once the whole profile is in place. Namespaces not stored
+ *          in the profile keep their values.
+ *
+ *          Before the first commit, the profile name and its namespaces are stored as a marker in
+ *          ESP32_MANAGER_STORAGE_NVS_NAMESPACE, and the marker is erased once NVS holds one whole
+ *          profile again. If a reset interrupts the commits, the marker is found on the next boot and
+ *          the activation is finished by esp32_manager_profile_resume() as namespaces are read.
+ *
+ *          Values are copied over the application's variables, so tasks reading entries while the
+ *          profile switches can see some namespaces switched and others not yet.
+ *
+ * @param   name profile name
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND profile does not exist
+ *          ESP_ERR_INVALID_SIZE profile is corrupted or a value does not fit its entry, nothing was changed
+ *          ESP_ERR_NO_MEM not enough memory, nothing was changed
+ *          ESP_FAIL error storing the marker, nothing was changed, or error committing to NVS, previous
+ *          values were restored. If they could not be committed either, the marker is kept and the
+ *          activation is finished on the next boot.
+ */
+esp_err_t esp32_manager_profile_activate(const char * name);
+
+/**
+ * @brief   Finish an activation interrupted by a reset on a namespace
+ *
+ *          Called by esp32_manager_read_from_nvs() and its asynchronous version once a namespace is
+ *          loaded. If it is one of the namespaces an interrupted activation did not get to commit, the
+ *          values of the profile are set and committed, and esp32_manager_entry_changed() is called for
+ *          every entry that changed. The marker is erased once all its namespaces are done. Does
+ *          nothing otherwise.
+ *
+ * @param   namespace pointer to the namespace
+ * @return  ESP_OK success, or nothing to finish
+ *          Error loading or committing the profile. The namespace is not tried again.
+ */
+esp_err_t esp32_manager_profile_resume(esp32_manager_namespace_t * namespace);
+
+/**
+ * @brief   Compare two profiles
+ *
+ *          Calls cb for every registered entry whose value differs between both profiles, including
+ *          entries stored in only one of them. The callback runs inside a read-side section.
+ *
+ * @param   name_a profile name, or NULL for the current values
+ * @param   name_b profile name, or NULL for the current values
+ * @param   cb Callback called for each entry that differs
+ * @param   arg Argument passed to the callback
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND a profile does not exist
+ *          ESP_ERR_INVALID_SIZE a profile is corrupted
+ *          ESP_ERR_INVALID_ARG cb is NULL
+ *          Any other value returned by the callback
+ */
+esp_err_t esp32_manager_profile_diff(const char * name_a, const char * name_b, esp32_manager_query_cb_t cb, void * arg);
+
+/**
+ * @brief   Erase a profile from NVS
+ *
+ * @param   name profile name
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND profile does not exist
+ *          ESP_FAIL error erasing NVS
+ */
+esp_err_t esp32_manager_profile_erase(const char * name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_PROFILE_H_
@@ -0,0 +1,215 @@
+/**
+ * esp32_manager_rtc.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_rtc.h"
+
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_ota_ops.h"
+#endif
+
+static const char * TAG = "esp32_manager_rtc";
+
+#ifdef ESP_PLATFORM
+static RTC_NOINIT_ATTR uint32_t esp32_manager_rtc_region[ESP32_MANAGER_RTC_SNAPSHOT_SIZE / sizeof(uint32_t)]; /*!< Survives deep sleep, not initialized on boot */
+#else
+static uint32_t esp32_manager_rtc_region[ESP32_MANAGER_RTC_SNAPSHOT_SIZE / sizeof(uint32_t)]; /*!< Host stand-in for RTC slow memory */
+#endif
+
+static bool esp32_manager_rtc_warm = false;  /*!< Snapshot validated on init. The header magic is cleared at that point. */
+static uint8_t esp32_manager_rtc_restored[ESP32_MANAGER_CHOICES_BITSET_SIZE(ESP32_MANAGER_NAMESPACES_SIZE)]; /*!< Records already restored, by position in the snapshot */
+static esp32_manager_rtc_stats_t esp32_manager_rtc_stats;
+
+static void esp32_manager_rtc_firmware_id(uint8_t * firmware_id);
+static uint32_t esp32_manager_rtc_crc32(const uint8_t * data, size_t length);
+
+esp_err_t esp32_manager_rtc_init()
+{
+    esp32_manager_rtc_header_t * header = (esp32_manager_rtc_header_t *) esp32_manager_rtc_region;
+    uint8_t * payload = (uint8_t *) &header[1];
+    uint8_t firmware_id[ESP32_MANAGER_RTC_FIRMWARE_ID_SIZE];
+
+    memset(&esp32_manager_rtc_stats, 0, sizeof(esp32_manager_rtc_stats));
+    memset(esp32_manager_rtc_restored, 0, sizeof(esp32_manager_rtc_restored));
+    esp32_manager_rtc_warm = false;
+
+#ifdef ESP_PLATFORM
+    if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) { // Power on or reset, RTC memory content is not reliable
+        ESP_LOGD(TAG, "Cold boot");
+        header->magic = 0;
+        return ESP_ERR_NOT_FOUND;
+    }
+#endif
+
+    if(header->magic != ESP32_MANAGER_RTC_MAGIC) {
+        ESP_LOGD(TAG, "No snapshot found");
+        return ESP_ERR_NOT_FOUND;
+    }
+    header->magic = 0; // Consume the snapshot. Sleeping again without a new snapshot means a cold load.
+
+    esp32_manager_rtc_firmware_id(firmware_id);
+    if(memcmp(header->firmware_id, firmware_id, sizeof(firmware_id)) != 0) {
+        ESP_LOGW(TAG, "Snapshot was taken by a different firmware");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if(header->length > ESP32_MANAGER_RTC_SNAPSHOT_SIZE - sizeof(esp32_manager_rtc_header_t)
+            || esp32_manager_rtc_crc32(payload, header->length) != header->crc) {
+        ESP_LOGW(TAG, "Snapshot is corrupted");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp32_manager_rtc_warm = true;
+    esp32_manager_rtc_stats.warm = true;
+    ESP_LOGD(TAG, "Warm restart. Snapshot of %u bytes found.", header->length);
+
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_rtc_snapshot()
+{
+    esp_err_t e = ESP_OK;
+    esp32_manager_rtc_header_t * header = (esp32_manager_rtc_header_t *) esp32_manager_rtc_region;
+    uint8_t * payload = (uint8_t *) &header[1];
+    size_t payload_size = ESP32_MANAGER_RTC_SNAPSHOT_SIZE - sizeof(esp32_manager_rtc_header_t);
+    size_t position = 0;
+
+    header->magic = 0; // Invalid while it is being written
+
+    uint8_t parity = esp32_manager_read_enter();
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && e == ESP_OK; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace == NULL) continue;
+
+        // [key length][key][data length][data]
+        size_t key_len = strlen(namespace->key);
+        size_t length;
+        if(position + 1 + key_len + 2 > payload_size) {
+            e = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        payload[position] = (uint8_t) key_len;
+        memcpy(&payload[position +1], namespace->key, key_len);
+        e = esp32_manager_namespace_serialize(namespace, &payload[position + 1 + key_len + 2], payload_size - (position + 1 + key_len + 2), &length);
+        if(e == ESP_OK) {
+            payload[position + 1 + key_len] = (uint8_t) length;
+            payload[position + 1 + key_len + 1] = (uint8_t) (length >> 8);
+            position += 1 + key_len + 2 + length;
+        }
+    }
+    esp32_manager_read_exit(parity);
+
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Values do not fit the RTC snapshot (%u bytes)", ESP32_MANAGER_RTC_SNAPSHOT_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp32_manager_rtc_firmware_id(header->firmware_id);
+    header->length = position;
+    header->crc = esp32_manager_rtc_crc32(payload, position);
+    if(!esp32_manager_rtc_stats.warm) { // Keep the cold boot measurement across warm restarts
+        header->nvs_load_time = esp32_manager_rtc_stats.nvs_load_time;
+    }
+    header->magic = ESP32_MANAGER_RTC_MAGIC;
+
+    ESP_LOGD(TAG, "Snapshot of %u bytes taken", position);
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_rtc_restore_namespace(esp32_manager_namespace_t * namespace)
+{
+    if(!esp32_manager_rtc_warm) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    esp32_manager_rtc_header_t * header = (esp32_manager_rtc_header_t *) esp32_manager_rtc_region;
+    const uint8_t * payload = (const uint8_t *) &header[1];
+    size_t key_len = strlen(namespace->key);
+    size_t position = 0;
+    uint8_t record = 0;
+
+    while(position + 3 <= header->length && record < ESP32_MANAGER_NAMESPACES_SIZE) {
+        size_t record_key_len = payload[position];
+        if(position + 1 + record_key_len + 2 > header->length) break;
+        size_t length = payload[position + 1 + record_key_len] | (payload[position + 1 + record_key_len + 1] << 8);
+        const uint8_t * data = &payload[position + 1 + record_key_len + 2];
+        if(position + 1 + record_key_len + 2 + length > header->length) break;
+
+        if(record_key_len == key_len && !memcmp(&payload[position +1], namespace->key, key_len)) {
+            // The snapshot holds the values at sleep time. Once restored, reads come from NVS again, so
+            // reloading after a commit gets the committed values and not the snapshot.
+            if(ESP32_MANAGER_CHOICES_BITSET_GET(esp32_manager_rtc_restored, record)) {
+                ESP_LOGD(TAG, "Namespace %s already restored from the snapshot", namespace->key);
+                return ESP_ERR_NOT_FOUND;
+            }
+            ESP32_MANAGER_CHOICES_BITSET_SET(esp32_manager_rtc_restored, record);
+            esp_err_t e = esp32_manager_namespace_deserialize(namespace, data, length);
+            if(e == ESP_OK) {
+                uint32_t restore_time = esp_timer_get_time() - start_time;
+                esp32_manager_rtc_stats.restore_time += restore_time;
+                // Cold boot NVS time of the whole boot minus time restoring so far
+                esp32_manager_rtc_stats.saved_time = (header->nvs_load_time > esp32_manager_rtc_stats.restore_time) ? header->nvs_load_time - esp32_manager_rtc_stats.restore_time : 0;
+                ESP_LOGI(TAG, "Namespace %s restored from RTC memory in %u us. Estimated time saved so far: %u us", namespace->key, restore_time, esp32_manager_rtc_stats.saved_time);
+            }
+            return e;
+        }
+        position += 1 + record_key_len + 2 + length;
+        ++record;
+    }
+
+    ESP_LOGD(TAG, "Namespace %s not found in snapshot", namespace->key);
+    return ESP_ERR_NOT_FOUND;
+}
+
+void esp32_manager_rtc_account_nvs_load(int64_t time)
+{
+    esp32_manager_rtc_stats.nvs_load_time += (uint32_t) time;
+}
+
+const esp32_manager_rtc_stats_t * esp32_manager_rtc_get_stats()
+{
+    return &esp32_manager_rtc_stats;
+}
+
+uint8_t * esp32_manager_rtc_get_region(size_t * size)
+{
+    if(size != NULL) {
+        *size = sizeof(esp32_manager_rtc_region);
+    }
+    return (uint8_t *) esp32_manager_rtc_region;
+}
+
+static void esp32_manager_rtc_firmware_id(uint8_t * firmware_id)
+{
+#ifdef ESP_PLATFORM
+    memcpy(firmware_id, esp_ota_get_app_description()->app_elf_sha256, ESP32_MANAGER_RTC_FIRMWARE_ID_SIZE);
+#else
+    // Host builds: identify the build by its compilation time
+    const char * build = __DATE__ " " __TIME__;
+    uint32_t crc = esp32_manager_rtc_crc32((const uint8_t *) build, strlen(build));
+    memset(firmware_id, 0, ESP32_MANAGER_RTC_FIRMWARE_ID_SIZE);
+    memcpy(firmware_id, &crc, sizeof(crc));
+#endif
+}
+
+static uint32_t esp32_manager_rtc_crc32(const uint8_t * data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for(size_t i=0; i < length; ++i) {
+        crc ^= data[i];
+        for(uint8_t bit=0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+#endif // CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
@@ -0,0 +1,120 @@
+/**
+ * esp32_manager_rtc.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_RTC_H_
+#define _ESP32_MANAGER_RTC_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+
+#define ESP32_MANAGER_RTC_SNAPSHOT_SIZE     CONFIG_ESP32_MANAGER_RTC_SNAPSHOT_SIZE  /*!< Bytes of RTC slow memory reserved for the snapshot */
+#define ESP32_MANAGER_RTC_MAGIC             0x45334d52  /*!< Marks a valid snapshot header */
+#define ESP32_MANAGER_RTC_FIRMWARE_ID_SIZE  8           /*!< Bytes of the firmware ELF SHA256 used to identify the firmware */
+
+/**
+ * Snapshot header. Stored at the beginning of the RTC region, followed by the payload.
+ *
+ * The payload is a sequence of namespace records: key length (1 byte), key, data length (2 bytes)
+ * and data as generated by esp32_manager_namespace_serialize().
+ */
+typedef struct {
+    uint32_t magic;                 /*!< ESP32_MANAGER_RTC_MAGIC when the snapshot is valid */
+    uint8_t firmware_id[ESP32_MANAGER_RTC_FIRMWARE_ID_SIZE]; /*!< Firmware that took the snapshot */
+    uint32_t length;                /*!< Payload length */
+    uint32_t crc;                   /*!< CRC32 of the payload */
+    uint32_t nvs_load_time;         /*!< Microseconds spent loading from NVS on the last cold boot */
+} esp32_manager_rtc_header_t;
+
+/**
+ * Statistics of the current boot
+ */
+typedef struct {
+    bool warm;                      /*!< A valid snapshot was found on wake */
+    uint32_t restore_time;          /*!< Microseconds spent restoring namespaces from the snapshot */
+    uint32_t nvs_load_time;         /*!< Microseconds spent loading namespaces from NVS */
+    uint32_t saved_time;            /*!< Estimated microseconds saved by a warm restart */
+} esp32_manager_rtc_stats_t;
+
+/**
+ * @brief   Initialize esp32_manager_rtc
+ *
+ *          Checks whether the device woke up from deep sleep with a valid snapshot for this firmware.
+ *          The snapshot is consumed, so a later wake without a new snapshot falls back to NVS.
+ *          Must be called before any namespace is read from NVS.
+ *
+ * @return  ESP_OK: warm restart, values will be restored from the snapshot
+ *          ESP_ERR_NOT_FOUND: cold boot or no valid snapshot
+ */
+esp_err_t esp32_manager_rtc_init();
+
+/**
+ * @brief   Take a snapshot of all registered namespaces into RTC slow memory
+ *
+ *          Call right before esp_deep_sleep_start().
+ *
+ * @return  ESP_OK: success
+ *          ESP_ERR_INVALID_SIZE: values do not fit ESP32_MANAGER_RTC_SNAPSHOT_SIZE
+ */
+esp_err_t esp32_manager_rtc_snapshot();
+
+/**
+ * @brief   Restore a namespace from the snapshot
+ *
+ *          Called by esp32_manager_read_from_nvs() on warm restarts. Each namespace is restored once:
+ *          later calls return ESP_ERR_NOT_FOUND, so reloading a namespace reads it from NVS.
+ *
+ * @param   namespace pointer to the namespace
+ * @return  ESP_OK: namespace restored
+ *          ESP_ERR_NOT_FOUND: cold boot or namespace not in the snapshot
+ *          ESP_ERR_INVALID_SIZE: snapshot data is corrupted
+ */
+esp_err_t esp32_manager_rtc_restore_namespace(esp32_manager_namespace_t * namespace);
+
+/**
+ * @brief   Account time spent loading namespaces from NVS
+ *
+ *          Stored with the next snapshot to estimate the time a warm restart saves.
+ *
+ * @param   time microseconds spent on esp32_manager_read_from_nvs()
+ */
+void esp32_manager_rtc_account_nvs_load(int64_t time);
+
+/**
+ * @brief   Get statistics of the current boot
+ *
+ * @return  Pointer to the statistics
+ */
+const esp32_manager_rtc_stats_t * esp32_manager_rtc_get_stats();
+
+/**
+ * @brief   Get the RTC region that holds the snapshot
+ *
+ *          On the ESP32 it lives in RTC slow memory. On other targets it is a regular static
+ *          buffer, so snapshots can be taken, corrupted and restored from host tests.
+ *
+ * @param   size size of the region
+ * @return  Pointer to the region
+ */
+uint8_t * esp32_manager_rtc_get_region(size_t * size);
+
+#endif // CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_RTC_H_
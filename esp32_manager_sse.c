@@ -0,0 +1,393 @@
+/**
+ * esp32_manager_sse.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include <sys/param.h>
+
+#include "esp32_manager_sse.h"
+
+#ifdef CONFIG_ESP32_MANAGER_SSE
+
+static const char * TAG = "esp32_manager_sse";
+
+#define ESP32_MANAGER_SSE_FD_PENDING        -2  /*!< Slot taken by a stream whose headers are being sent */
+#define ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE 8   /*!< Room for the chunk size line before the events */
+
+static esp32_manager_sse_client_t esp32_manager_sse_clients[ESP32_MANAGER_SSE_CLIENTS_SIZE];
+static portMUX_TYPE esp32_manager_sse_mux = portMUX_INITIALIZER_UNLOCKED;  /*!< Guards the clients, shared with the tasks making changes */
+static httpd_handle_t esp32_manager_sse_server = NULL;
+static TaskHandle_t esp32_manager_sse_task_handle = NULL;
+
+/** Only used by the sender task */
+static esp32_manager_sse_key_t esp32_manager_sse_queue[ESP32_MANAGER_SSE_QUEUE_SIZE];
+static char esp32_manager_sse_value[ESP32_MANAGER_SSE_BUFFER_SIZE +1];
+static char esp32_manager_sse_chunk[ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE + ESP32_MANAGER_SSE_BUFFER_SIZE + 2];
+static size_t esp32_manager_sse_chunk_length = 0;
+
+static const httpd_uri_t esp32_manager_sse_uri = {
+    .uri = ESP32_MANAGER_SSE_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_sse_uri_handler,
+    .user_ctx = NULL
+};
+
+static void esp32_manager_sse_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg);
+static void esp32_manager_sse_task(void * arg);
+
+esp_err_t esp32_manager_sse_init()
+{
+    if(esp32_manager_sse_task_handle != NULL) {
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+        esp32_manager_sse_clients[i].fd = -1;
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(xTaskCreate(esp32_manager_sse_task, "esp32_manager_sse", ESP32_MANAGER_SSE_TASK_STACK_SIZE, NULL, ESP32_MANAGER_SSE_TASK_PRIORITY, &esp32_manager_sse_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating sender task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return esp32_manager_add_change_listener(esp32_manager_sse_changed, NULL);
+}
+
+esp_err_t esp32_manager_sse_start(httpd_handle_t server)
+{
+    esp_err_t e;
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+        esp32_manager_sse_clients[i].fd = -1;
+    }
+    esp32_manager_sse_server = server;
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    e = httpd_register_uri_handler(server, &esp32_manager_sse_uri);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Registered uri %s", esp32_manager_sse_uri.uri);
+    } else {
+        ESP_LOGE(TAG, "Error registering uri %s: %s", esp32_manager_sse_uri.uri, esp_err_to_name(e));
+    }
+    return e;
+}
+
+void esp32_manager_sse_stop()
+{
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+        esp32_manager_sse_clients[i].fd = -1;
+    }
+    esp32_manager_sse_server = NULL;
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+}
+
+/**
+ * Finds the client of a socket. Call it inside the critical section.
+ */
+static esp32_manager_sse_client_t * esp32_manager_sse_find_client(int fd)
+{
+    for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+        if(esp32_manager_sse_clients[i].fd == fd) {
+            return &esp32_manager_sse_clients[i];
+        }
+    }
+    return NULL;
+}
+
+void esp32_manager_sse_closed(int fd)
+{
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    esp32_manager_sse_client_t * client = (fd >= 0) ? esp32_manager_sse_find_client(fd) : NULL;
+    if(client != NULL) {
+        client->fd = -1;
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(client != NULL) {
+        ESP_LOGD(TAG, "Stream %d closed", fd);
+    }
+}
+
+/**
+ * Change listener. Only queues keys and wakes up the sender task, which reads the values.
+ */
+static void esp32_manager_sse_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg)
+{
+    bool wake = false;
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+        esp32_manager_sse_client_t * client = &esp32_manager_sse_clients[i];
+        if(client->fd < 0 || (client->namespace_key[0] != 0 && strcmp(client->namespace_key, namespace->key))) continue;
+
+        bool queued = false;
+        for(uint8_t j=0; j < client->count && !queued; ++j) {
+            queued = (!strcmp(client->queue[j].entry_key, entry->key) && !strcmp(client->queue[j].namespace_key, namespace->key));
+        }
+        if(queued) {
+            continue; // Value is read when sent, the latest one goes out
+        }
+        if(client->count < ESP32_MANAGER_SSE_QUEUE_SIZE) {
+            strcpy(client->queue[client->count].namespace_key, namespace->key);
+            strcpy(client->queue[client->count].entry_key, entry->key);
+            ++client->count;
+        } else {
+            client->overflow = true; // Client is too slow, it will be told to resync
+        }
+        wake = true;
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(wake && esp32_manager_sse_task_handle != NULL) {
+        xTaskNotifyGive(esp32_manager_sse_task_handle);
+    }
+}
+
+/**
+ * Sends the events in the chunk buffer as one chunk
+ */
+static esp_err_t esp32_manager_sse_flush(httpd_handle_t server, int fd)
+{
+    char header[ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE +1];
+    size_t header_length;
+
+    if(esp32_manager_sse_chunk_length == 0) {
+        return ESP_OK;
+    }
+
+    // [size in hex]\r\n[events]\r\n, with the size line right before the events
+    header_length = sprintf(header, "%x\r\n", esp32_manager_sse_chunk_length);
+    char * data = esp32_manager_sse_chunk + ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE - header_length;
+    memcpy(data, header, header_length);
+    memcpy(esp32_manager_sse_chunk + ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE + esp32_manager_sse_chunk_length, "\r\n", 2);
+    size_t length = header_length + esp32_manager_sse_chunk_length + 2;
+    esp32_manager_sse_chunk_length = 0;
+
+    while(length > 0) {
+        int sent = httpd_socket_send(server, fd, data, length, 0);
+        if(sent <= 0) {
+            return ESP_FAIL;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Adds text to the chunk buffer, sending it when full. Events can span chunks.
+ */
+static esp_err_t esp32_manager_sse_append(httpd_handle_t server, int fd, const char * text, size_t length)
+{
+    while(length > 0) {
+        if(esp32_manager_sse_chunk_length == ESP32_MANAGER_SSE_BUFFER_SIZE && esp32_manager_sse_flush(server, fd) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        size_t n = MIN(length, ESP32_MANAGER_SSE_BUFFER_SIZE - esp32_manager_sse_chunk_length);
+        memcpy(esp32_manager_sse_chunk + ESP32_MANAGER_SSE_CHUNK_HEADER_SIZE + esp32_manager_sse_chunk_length, text, n);
+        esp32_manager_sse_chunk_length += n;
+        text += n;
+        length -= n;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Adds a change event. Line breaks in the value start new data lines.
+ */
+static esp_err_t esp32_manager_sse_append_change(httpd_handle_t server, int fd, const esp32_manager_sse_key_t * key)
+{
+    char header[64];
+    uint32_t seq;
+    char * value = esp32_manager_sse_value;
+    esp_err_t e;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(key->namespace_key);
+    esp32_manager_entry_t * entry = (namespace != NULL) ? esp32_manager_find_entry(namespace, key->entry_key) : NULL;
+    if(entry == NULL) { // Unregistered since it changed
+        esp32_manager_read_exit(parity);
+        return ESP_OK;
+    }
+    seq = entry->modified_seq;
+    e = entry->to_string(entry, value, sizeof(esp32_manager_sse_value));
+    if(e == ESP_ERR_INVALID_SIZE) { // Longer than the buffer, converted on the heap
+        size_t value_length = esp32_manager_entry_string_length(entry);
+        value = (value_length > 0) ? malloc(value_length +1) : NULL;
+        e = (value != NULL) ? entry->to_string(entry, value, value_length +1) : ESP_ERR_NO_MEM;
+    }
+    if(e != ESP_OK) { // Memory-mapped values, or no memory for them. Only the change is announced.
+        if(value != esp32_manager_sse_value) {
+            free(value);
+        }
+        value = NULL;
+    }
+    esp32_manager_read_exit(parity); // Values are sent outside of the read section, sending can block
+
+    int length = snprintf(header, sizeof(header), "event: change\nid: %u\ndata: %s.%s%s", seq, key->namespace_key, key->entry_key, (value != NULL) ? "=" : "");
+    e = esp32_manager_sse_append(server, fd, header, length);
+
+    // Chunks are sent as the buffer fills, so values of any length are streamed through it
+    const char * line = value;
+    while(line != NULL && e == ESP_OK) {
+        size_t line_length = strcspn(line, "\r\n");
+        e = esp32_manager_sse_append(server, fd, line, line_length);
+        line += line_length;
+        if(*line == 0) break;
+        line += (line[0] == '\r' && line[1] == '\n') ? 2 : 1;
+        if(e == ESP_OK) {
+            e = esp32_manager_sse_append(server, fd, "\ndata: ", 7);
+        }
+    }
+    if(value != esp32_manager_sse_value) {
+        free(value);
+    }
+
+    return (e == ESP_OK) ? esp32_manager_sse_append(server, fd, "\n\n", 2) : ESP_FAIL;
+}
+
+/**
+ * Sends the events, or a heartbeat, of a client
+ */
+static void esp32_manager_sse_send(esp32_manager_sse_client_t * client)
+{
+    esp_err_t e = ESP_OK;
+    httpd_handle_t server;
+    uint8_t count;
+    bool overflow;
+    bool heartbeat;
+    int fd;
+
+    // Take the queue, so changes can be queued again while sending
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    fd = client->fd;
+    server = esp32_manager_sse_server;
+    count = client->count;
+    overflow = client->overflow;
+    heartbeat = (xTaskGetTickCount() - client->last_sent) >= pdMS_TO_TICKS(ESP32_MANAGER_SSE_HEARTBEAT_MS);
+    memcpy(esp32_manager_sse_queue, client->queue, count * sizeof(esp32_manager_sse_key_t));
+    client->count = 0;
+    client->overflow = false;
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(fd < 0 || server == NULL || (count == 0 && !overflow && !heartbeat)) {
+        return;
+    }
+
+    esp32_manager_sse_chunk_length = 0;
+    if(overflow) { // Changes still queued are covered by the resync
+        e = esp32_manager_sse_append(server, fd, "event: resync\ndata:\n\n", 21);
+    } else {
+        for(uint8_t i=0; i < count && e == ESP_OK; ++i) {
+            e = esp32_manager_sse_append_change(server, fd, &esp32_manager_sse_queue[i]);
+        }
+    }
+    if(e == ESP_OK && esp32_manager_sse_chunk_length == 0) {
+        e = esp32_manager_sse_append(server, fd, ": heartbeat\n\n", 13);
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_sse_flush(server, fd);
+    }
+
+    if(e != ESP_OK) {
+        ESP_LOGW(TAG, "Error sending to stream %d, closing", fd);
+        esp32_manager_sse_closed(fd);
+        httpd_sess_trigger_close(server, fd);
+        return;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    if(client->fd == fd) {
+        client->last_sent = xTaskGetTickCount();
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+}
+
+/**
+ * Sender task. Wakes up on changes, or for heartbeats, and then waits an interval so changes
+ * made in the meantime are coalesced.
+ */
+static void esp32_manager_sse_task(void * arg)
+{
+    while(true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ESP32_MANAGER_SSE_HEARTBEAT_MS));
+        for(uint8_t i=0; i < ESP32_MANAGER_SSE_CLIENTS_SIZE; ++i) {
+            esp32_manager_sse_send(&esp32_manager_sse_clients[i]);
+        }
+        vTaskDelay(pdMS_TO_TICKS(ESP32_MANAGER_SSE_INTERVAL_MS));
+    }
+}
+
+esp_err_t esp32_manager_sse_uri_handler(httpd_req_t * req)
+{
+    esp_err_t e;
+    char query[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH + sizeof(ESP32_MANAGER_SSE_URI_PARAM_NAMESPACE) +2];
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1] = "";
+    int fd = httpd_req_to_sockfd(req);
+
+    // Namespace to stream, all of them if missing
+    e = httpd_req_get_url_query_str(req, query, sizeof(query));
+    if(e == ESP_OK) {
+        e = httpd_query_key_value(query, ESP32_MANAGER_SSE_URI_PARAM_NAMESPACE, namespace_key, sizeof(namespace_key));
+    }
+    if(e == ESP_OK) {
+        uint8_t parity = esp32_manager_read_enter();
+        e = (esp32_manager_find_namespace(namespace_key) != NULL) ? ESP_OK : ESP_ERR_NOT_FOUND;
+        esp32_manager_read_exit(parity);
+    } else if(e == ESP_ERR_NOT_FOUND) {
+        namespace_key[0] = 0;
+        e = ESP_OK;
+    }
+    if(e != ESP_OK) {
+        ESP_LOGD(TAG, "Namespace not found");
+        httpd_resp_set_status(req, HTTPD_404);
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    esp32_manager_sse_client_t * client = esp32_manager_sse_find_client(-1);
+    if(client != NULL) {
+        client->fd = ESP32_MANAGER_SSE_FD_PENDING; // Not streamed to until the headers are sent
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(client == NULL) {
+        ESP_LOGW(TAG, "No room for more streams");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    // Headers and a first chunk. The response is never finished, chunks are sent by the sender task.
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    e = httpd_resp_send_chunk(req, "retry: 3000\n\n", 13);
+
+    portENTER_CRITICAL(&esp32_manager_sse_mux);
+    if(e == ESP_OK) {
+        strcpy(client->namespace_key, namespace_key);
+        client->count = 0;
+        client->overflow = false;
+        client->last_sent = xTaskGetTickCount();
+        client->fd = fd;
+    } else {
+        client->fd = -1;
+    }
+    portEXIT_CRITICAL(&esp32_manager_sse_mux);
+
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening stream: %s", esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+    ESP_LOGD(TAG, "Stream %d opened for %s", fd, (namespace_key[0] != 0) ? namespace_key : "all namespaces");
+    return ESP_OK;
+}
+
+#endif // CONFIG_ESP32_MANAGER_SSE
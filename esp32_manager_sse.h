@@ -0,0 +1,119 @@
+/**
+ * esp32_manager_sse.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_SSE_H_
+#define _ESP32_MANAGER_SSE_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp32_manager_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_ESP32_MANAGER_SSE
+
+#define ESP32_MANAGER_SSE_URL               "/events"   /*!< uri of the event stream */
+#define ESP32_MANAGER_SSE_URI_PARAM_NAMESPACE "namespace" /*!< Namespace to stream. All of them if missing. */
+#define ESP32_MANAGER_SSE_CLIENTS_SIZE      CONFIG_ESP32_MANAGER_SSE_CLIENTS    /*!< Streams open at the same time */
+#define ESP32_MANAGER_SSE_INTERVAL_MS       CONFIG_ESP32_MANAGER_SSE_INTERVAL   /*!< Shortest time between two events of the same entry */
+#define ESP32_MANAGER_SSE_HEARTBEAT_MS      15000   /*!< Time without events before a heartbeat is sent */
+#define ESP32_MANAGER_SSE_QUEUE_SIZE        16      /*!< Entries changed and not sent yet, per stream */
+#define ESP32_MANAGER_SSE_BUFFER_SIZE       2048    /*!< Events sent in one chunk, and values converted without the heap */
+#define ESP32_MANAGER_SSE_TASK_PRIORITY     5       /*!< Priority of the sender task, same as the server task */
+#define ESP32_MANAGER_SSE_TASK_STACK_SIZE   3072    /*!< Stack of the sender task */
+
+/**
+ * Entry changed and not sent yet
+ */
+typedef struct {
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];
+    char entry_key[ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH +1];
+} esp32_manager_sse_key_t;
+
+/**
+ * Open event stream
+ *
+ * Changes are queued by key and sent by the sender task at most once per interval, with the value
+ * read at that moment. However often an entry changes, it takes one place in the queue and one event
+ * per interval. When the queue is full, changes are dropped and the client is told to resync instead.
+ */
+typedef struct {
+    int fd;                                                             /*!< Socket. -1 for a free slot. */
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];      /*!< Namespace streamed. Empty for all. */
+    esp32_manager_sse_key_t queue[ESP32_MANAGER_SSE_QUEUE_SIZE];        /*!< Entries changed, not sent yet */
+    uint8_t count;                                                      /*!< Entries in the queue */
+    bool overflow;                                                      /*!< Changes were dropped */
+    TickType_t last_sent;                                               /*!< When something was last sent, for heartbeats */
+} esp32_manager_sse_client_t;
+
+/**
+ * @brief   Initialize esp32_manager_sse
+ *
+ *          Starts the sender task and adds the change listener. Called by esp32_manager_webconfig_init().
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NO_MEM could not create the task or add the change listener
+ */
+esp_err_t esp32_manager_sse_init();
+
+/**
+ * @brief   Register the event stream uri on a server
+ *
+ *          Called by esp32_manager_webconfig_webserver_start(). Streams of a previous server are dropped.
+ *
+ * @param   server server handle
+ * @return  ESP_OK success
+ *          Error returned by httpd_register_uri_handler()
+ */
+esp_err_t esp32_manager_sse_start(httpd_handle_t server);
+
+/**
+ * @brief   Drop all streams before the server stops
+ *
+ *          Called by esp32_manager_webconfig_webserver_stop().
+ */
+void esp32_manager_sse_stop();
+
+/**
+ * @brief   Forget a stream whose socket is being closed
+ *
+ *          Called from the server's close function for every socket. Other sockets are ignored.
+ *
+ * @param   fd socket
+ */
+void esp32_manager_sse_closed(int fd);
+
+/**
+ * @brief   Handler of the event stream uri
+ *
+ *          Sends the response headers and hands the socket to the sender task, so the stream does not
+ *          keep the server busy. The response is chunked and never ends. Events are:
+ *          - event: change, with the sequence number of the change as id and [namespace].[entry]=[value]
+ *            as data. Values with line breaks take several data lines.
+ *          - event: resync, when changes were dropped because the client did not keep up.
+ *          A comment line is sent as heartbeat when there were no events for a while.
+ *
+ * @param   req request
+ * @return  ESP_OK success
+ *          ESP_FAIL error sending the headers
+ */
+esp_err_t esp32_manager_sse_uri_handler(httpd_req_t * req);
+
+#endif // CONFIG_ESP32_MANAGER_SSE
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_SSE_H_
@@ -6,15 +6,110 @@
  */
 
 #include "esp32_manager_storage.h"
+#include "esp32_manager_rtc.h"
+#include "esp32_manager_history.h"
+#include "esp32_manager_journal.h"
+#include "esp32_manager_compress.h"
+#include "esp32_manager_mmap.h"
+#include "esp32_manager_profile.h"
 
 static const char * TAG = "esp32_manager_storage";
 
+static esp_err_t esp32_manager_choices_build_lookup(const esp32_manager_choices_t * choices);
+static const uint16_t * esp32_manager_choices_lookup(const esp32_manager_choices_t * choices);
+static esp_err_t esp32_manager_entry_format(esp32_manager_entry_t * entry, char * dest, size_t size, size_t * length);
+#ifdef CONFIG_ESP32_MANAGER_NVS_BULK_LOAD
+#define ESP32_MANAGER_NVS_BULK_TABLE_MAX_SIZE   512 /*!< Buckets for the largest namespace, 255 entries at most half full */
+static esp_err_t esp32_manager_read_from_nvs_bulk(esp32_manager_namespace_t * namespace);
+static uint32_t esp32_manager_key_hash(const char * key);
+#endif
+static esp_err_t esp32_manager_entry_load_from_nvs(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+static esp_err_t esp32_manager_entry_read_from_nvs(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+static esp_err_t esp32_manager_entry_commit_compressed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+static esp_err_t esp32_manager_entry_read_compressed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+static esp_err_t esp32_manager_namespace_deserialize_records(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length, bool apply);
+static int esp32_manager_storage_orphan_compare(const void * a, const void * b);
+static void esp32_manager_storage_record_namespace(const char * key);
+
 esp32_manager_namespace_t * esp32_manager_namespaces[ESP32_MANAGER_NAMESPACES_SIZE];
 
+static uint32_t esp32_manager_epoch = 0;            /*!< Grace period counter. Its lowest bit selects the active reader counter. */
+static uint32_t esp32_manager_readers[2] = {0, 0};  /*!< Readers inside a read-side section, per epoch parity */
+static SemaphoreHandle_t esp32_manager_registry_mutex = NULL;  /*!< Serializes writers (register/unregister). Never taken by readers. */
+static SemaphoreHandle_t esp32_manager_synchronize_mutex = NULL;   /*!< Serializes grace periods, so their epoch flips do not interleave */
+
+/**
+ * Listeners of esp32_manager_entry_changed()
+ */
+typedef struct {
+    esp32_manager_change_cb_t cb;   /*!< NULL for a free slot */
+    void * arg;
+} esp32_manager_change_listener_t;
+
+static esp32_manager_change_listener_t esp32_manager_change_listeners[ESP32_MANAGER_CHANGE_LISTENERS_SIZE];
+static portMUX_TYPE esp32_manager_change_listeners_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Option indexes sorted by key, for options tables without a lookup of their own.
+ * One per table, built on the first registration that uses it and kept, so tables can be const.
+ */
+typedef struct esp32_manager_choices_index {
+    const esp32_manager_choices_t * choices;
+    struct esp32_manager_choices_index * next;
+    uint16_t lookup[];
+} esp32_manager_choices_index_t;
+
+static esp32_manager_choices_index_t * esp32_manager_choices_indexes = NULL; /*!< Added to by writers, never removed from */
+
+/**
+ * Directory of registered entries, sorted by namespace key and entry key.
+ * Rebuilt by writers on every registration change and swapped in atomically.
+ */
+typedef struct {
+    esp32_manager_namespace_t * namespace;
+    esp32_manager_entry_t * entry;
+} esp32_manager_directory_item_t;
+
+typedef struct {
+    uint16_t size;
+    esp32_manager_directory_item_t items[];
+} esp32_manager_directory_t;
+
+static esp32_manager_directory_t * esp32_manager_directory = NULL;
+
+/**
+ * Key left in NVS without a registered entry, collected by esp32_manager_storage_gc()
+ */
+typedef struct {
+    char namespace_key[NVS_KEY_NAME_MAX_SIZE];  /*!< Namespace names and keys have the same maximum length */
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    bool registered;    /*!< Its namespace is registered, only some of its keys are orphaned */
+} esp32_manager_storage_orphan_t;
+
+static esp_err_t esp32_manager_directory_rebuild();
+static esp_err_t esp32_manager_directory_walk(const char * namespace_prefix, const char * entry_first, const char * entry_last, const char * entry_prefix, esp32_manager_query_cb_t cb, void * arg);
+
 esp_err_t esp32_manager_storage_init()
 {
     esp_err_t e;
 
+    // Create registry mutex for writers
+    if(esp32_manager_registry_mutex == NULL) {
+        esp32_manager_registry_mutex = xSemaphoreCreateMutex();
+        if(esp32_manager_registry_mutex == NULL) {
+            ESP_LOGE(TAG, "Not enough memory to create registry mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if(esp32_manager_synchronize_mutex == NULL) {
+        esp32_manager_synchronize_mutex = xSemaphoreCreateMutex();
+        if(esp32_manager_synchronize_mutex == NULL) {
+            ESP_LOGE(TAG, "Not enough memory to create synchronize mutex");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     // Initialize NVS storage
     ESP_LOGD(TAG, "Initializing NVS storage");
     e = nvs_flash_init();
@@ -36,7 +131,8 @@ esp_err_t esp32_manager_storage_init()
         }
     }
 
-    return ESP_OK;
+    // A profile activation interrupted by a reset is finished as namespaces are read
+    return esp32_manager_profile_init();
 }
 
 esp_err_t esp32_manager_register_namespace(esp32_manager_namespace_t * namespace)
@@ -52,10 +148,13 @@ esp_err_t esp32_manager_register_namespace(esp32_manager_namespace_t * namespace
 
     uint8_t i;
 
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
     // Check if namespace is already registered
     for(i = 0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
         if(esp32_manager_namespaces[i] == namespace) {
             ESP_LOGE(TAG, "Namespace %s already registered", namespace->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
             return ESP_ERR_INVALID_STATE;
         }
     }
@@ -63,24 +162,56 @@ esp_err_t esp32_manager_register_namespace(esp32_manager_namespace_t * namespace
     // Register namespace
     for(i=0; i<ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
         if(esp32_manager_namespaces[i] == NULL) {
-            esp32_manager_namespaces[i] = namespace;
             ESP_LOGD(TAG, "Opening NVS for R/W");
             e = nvs_open(namespace->key, NVS_READWRITE, &namespace->nvs_handle);
             if(e == ESP_OK) {
+                esp32_manager_storage_record_namespace(namespace->key);
+                // Publish the namespace only once it is fully usable, readers may pick it up right away
+                __atomic_store_n(&esp32_manager_namespaces[i], namespace, __ATOMIC_SEQ_CST);
+                esp32_manager_journal_invalidate(namespace, NULL);
+                esp32_manager_directory_rebuild();
+                xSemaphoreGive(esp32_manager_registry_mutex);
                 ESP_LOGD(TAG, "Namespace %s registered. NVS open for R/W.", namespace->key);
                 return ESP_OK;
             } else {
+                xSemaphoreGive(esp32_manager_registry_mutex);
                 ESP_LOGE(TAG, "Cannot open namespace \"%s\" with read/write access: %s", namespace->key, esp_err_to_name(e));
                 return ESP_FAIL;
             }
         }
     }
-    if(i >= ESP32_MANAGER_NAMESPACES_SIZE) {
-        ESP_LOGE(TAG, "Not enough memory to register namespace %s", namespace->key);
-        return ESP_ERR_NO_MEM;
+
+    xSemaphoreGive(esp32_manager_registry_mutex);
+    ESP_LOGE(TAG, "Not enough memory to register namespace %s", namespace->key);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp32_manager_unregister_namespace(esp32_manager_namespace_t * namespace)
+{
+    if(namespace == NULL) {
+        ESP_LOGE(TAG, "Error unregistering namespace: Argument NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "Unregistering namespace: %s", namespace->key);
+
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
+    for(uint8_t i = 0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        if(esp32_manager_namespaces[i] == namespace) {
+            __atomic_store_n(&esp32_manager_namespaces[i], NULL, __ATOMIC_SEQ_CST);
+            esp32_manager_journal_invalidate(namespace, NULL);
+            esp32_manager_directory_rebuild(); // Waits for readers that might still be using the namespace
+            nvs_close(namespace->nvs_handle);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            ESP_LOGD(TAG, "Namespace %s unregistered. NVS closed.", namespace->key);
+            return ESP_OK;
+        }
     }
 
-    return ESP_FAIL;
+    xSemaphoreGive(esp32_manager_registry_mutex);
+    ESP_LOGE(TAG, "Namespace %s is not registered", namespace->key);
+    return ESP_ERR_NOT_FOUND;
 }
 
 esp_err_t esp32_manager_register_entry(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
@@ -95,14 +226,73 @@ esp_err_t esp32_manager_register_entry(esp32_manager_namespace_t * namespace, es
 
     uint8_t i;
 
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
     // Check if entry is already registered
     for(i = 0; i < namespace->size; ++i) {
         if(namespace->entries[i] == entry) {
             ESP_LOGE(TAG, "Entry %s already registered", entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
             return ESP_ERR_INVALID_STATE;
         }
     }
 
+    // Options are required for choice types
+    if(entry->type == single_choice || entry->type == multiple_choice) {
+        if(entry->choices == NULL || entry->choices->keys == NULL || entry->choices->size == 0) {
+            ESP_LOGE(TAG, "Entry %s.%s has no options", namespace->key, entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if(entry->type == single_choice && entry->choices->size > ESP32_MANAGER_CHOICES_SINGLE_MAX_SIZE) {
+            ESP_LOGE(TAG, "Entry %s.%s has too many options", namespace->key, entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if(esp32_manager_choices_lookup(entry->choices) == NULL) {
+            if(esp32_manager_choices_build_lookup(entry->choices) != ESP_OK) {
+                ESP_LOGE(TAG, "Not enough memory to build options lookup for entry %s.%s", namespace->key, entry->key);
+                xSemaphoreGive(esp32_manager_registry_mutex);
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+
+    // History is only supported on numeric entries
+    if(entry->history != NULL) {
+        if(entry->type > dbl) {
+            ESP_LOGE(TAG, "Entry %s.%s is not numeric, history not supported", namespace->key, entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            return ESP_ERR_INVALID_ARG;
+        }
+        ESP_LOGI(TAG, "Entry %s.%s keeps history using %u bytes", namespace->key, entry->key, esp32_manager_history_size(entry->history));
+    }
+
+    // Strings are copied into the application's buffer, so its size must be known and fit the default
+    if((entry->type == text || entry->type == password) && (entry->attributes & ESP32_MANAGER_ATTR_MMAP) == 0) {
+        if(entry->size == 0 || (entry->default_value != NULL && strlen((char *) entry->default_value) >= entry->size)) {
+            ESP_LOGE(TAG, "Entry %s.%s has no buffer size, or its default does not fit", namespace->key, entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // Memory-mapped values live in their partition slot, never in NVS
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+        if(entry->default_value != NULL || esp32_manager_mmap_attach(entry) != ESP_OK) {
+            ESP_LOGE(TAG, "Entry %s.%s could not be memory-mapped", namespace->key, entry->key);
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            return ESP_ERR_INVALID_ARG;
+        }
+        entry->attributes |= ESP32_MANAGER_ATTR_NO_FLASH;
+#else
+        ESP_LOGE(TAG, "Entry %s.%s is memory-mapped, but ESP32_MANAGER_MMAP is disabled", namespace->key, entry->key);
+        xSemaphoreGive(esp32_manager_registry_mutex);
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+
     // Register entry
     for(i=0; i < namespace->size; ++i) {
         if(namespace->entries[i] == NULL) {
@@ -116,63 +306,477 @@ esp_err_t esp32_manager_register_entry(esp32_manager_namespace_t * namespace, es
                 entry->to_string = &esp32_manager_entry_to_string_default;
             }
             // Add entry to namespace
-            namespace->entries[i] = entry;
+            __atomic_store_n(&namespace->entries[i], entry, __ATOMIC_SEQ_CST);
+            esp32_manager_journal_invalidate(namespace, entry);
+            esp32_manager_directory_rebuild();
+            xSemaphoreGive(esp32_manager_registry_mutex);
             ESP_LOGD(TAG, "Entry %s.%s registered", namespace->key, entry->key);
             return ESP_OK;
         }
     }
-    if(i >= ESP32_MANAGER_NAMESPACES_SIZE) { // The loop ended without registering entry
-        ESP_LOGE(TAG, "Not enough memory to register entry %s.%s", namespace->key, entry->key);
-        return ESP_ERR_NO_MEM;
+
+    // The loop ended without registering entry
+    xSemaphoreGive(esp32_manager_registry_mutex);
+    ESP_LOGE(TAG, "Not enough memory to register entry %s.%s", namespace->key, entry->key);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp32_manager_unregister_entry(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    if(namespace == NULL || entry == NULL) {
+        ESP_LOGE(TAG, "Error unregistering entry: Invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "Unregistering entry: %s.%s", namespace->key, entry->key);
+
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        if(namespace->entries[i] == entry) {
+            __atomic_store_n(&namespace->entries[i], NULL, __ATOMIC_SEQ_CST);
+            esp32_manager_journal_invalidate(namespace, entry);
+            esp32_manager_directory_rebuild(); // Waits for readers that might still be using the entry
+            xSemaphoreGive(esp32_manager_registry_mutex);
+            ESP_LOGD(TAG, "Entry %s.%s unregistered", namespace->key, entry->key);
+            return ESP_OK;
+        }
+    }
+
+    xSemaphoreGive(esp32_manager_registry_mutex);
+    ESP_LOGE(TAG, "Entry %s.%s is not registered", namespace->key, entry->key);
+    return ESP_ERR_NOT_FOUND;
+}
+
+uint8_t esp32_manager_read_enter()
+{
+    uint8_t parity = __atomic_load_n(&esp32_manager_epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&esp32_manager_readers[parity], 1, __ATOMIC_SEQ_CST);
+    return parity;
+}
+
+void esp32_manager_read_exit(uint8_t parity)
+{
+    __atomic_fetch_sub(&esp32_manager_readers[parity & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+void esp32_manager_synchronize()
+{
+    // A reader can sample the parity, get preempted across a whole flip and wait, and only then count itself
+    // on the old parity. It cannot hold pointers unpublished before that flip, but it can hold pointers
+    // unpublished before the next one, which only waits for the other parity. Flipping twice and waiting for
+    // both counters covers it: after the second wait, every reader counted on either parity entered after
+    // the pointers were unpublished.
+    xSemaphoreTake(esp32_manager_synchronize_mutex, portMAX_DELAY);
+    for(uint8_t flip=0; flip < 2; ++flip) {
+        uint8_t parity = __atomic_fetch_add(&esp32_manager_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while(__atomic_load_n(&esp32_manager_readers[parity], __ATOMIC_SEQ_CST) != 0) {
+            vTaskDelay(1);
+        }
+    }
+    xSemaphoreGive(esp32_manager_synchronize_mutex);
+}
+
+esp_err_t esp32_manager_query_prefix(const char * namespace_prefix, const char * entry_prefix, esp32_manager_query_cb_t cb, void * arg)
+{
+    return esp32_manager_directory_walk(namespace_prefix, entry_prefix, NULL, entry_prefix, cb, arg);
+}
+
+esp_err_t esp32_manager_query_range(const char * namespace_prefix, const char * entry_first, const char * entry_last, esp32_manager_query_cb_t cb, void * arg)
+{
+    return esp32_manager_directory_walk(namespace_prefix, entry_first, entry_last, NULL, cb, arg);
+}
+
+/**
+ * Order of directory items: namespace key, namespace pointer (namespaces sharing a key), entry key
+ */
+static int esp32_manager_directory_compare_namespace(const esp32_manager_directory_item_t * item, const esp32_manager_namespace_t * namespace)
+{
+    int comparison = strcmp(item->namespace->key, namespace->key);
+    if(comparison == 0 && item->namespace != namespace) {
+        comparison = ((uintptr_t) item->namespace < (uintptr_t) namespace) ? -1 : 1;
+    }
+    return comparison;
+}
+
+static int esp32_manager_directory_compare_items(const void * a, const void * b)
+{
+    const esp32_manager_directory_item_t * item_a = (const esp32_manager_directory_item_t *) a;
+    const esp32_manager_directory_item_t * item_b = (const esp32_manager_directory_item_t *) b;
+
+    int comparison = esp32_manager_directory_compare_namespace(item_a, item_b->namespace);
+    if(comparison == 0) {
+        comparison = strcmp(item_a->entry->key, item_b->entry->key);
+    }
+    return comparison;
+}
+
+/**
+ * Builds a new directory from the registry and swaps it in. Must be called by writers holding the registry mutex.
+ * Always waits for a grace period, so pointers unpublished before calling it are no longer in use when it returns.
+ */
+static esp_err_t esp32_manager_directory_rebuild()
+{
+    uint16_t size = 0;
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i];
+        if(namespace == NULL) continue;
+        for(uint16_t j=0; j < namespace->size; ++j) {
+            if(namespace->entries[j] != NULL) ++size;
+        }
+    }
+
+    esp32_manager_directory_t * directory = malloc(sizeof(esp32_manager_directory_t) + size * sizeof(esp32_manager_directory_item_t));
+    if(directory != NULL) {
+        directory->size = 0;
+        for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+            esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i];
+            if(namespace == NULL) continue;
+            for(uint16_t j=0; j < namespace->size; ++j) {
+                if(namespace->entries[j] == NULL) continue;
+                directory->items[directory->size].namespace = namespace;
+                directory->items[directory->size].entry = namespace->entries[j];
+                ++directory->size;
+            }
+        }
+        qsort(directory->items, directory->size, sizeof(esp32_manager_directory_item_t), esp32_manager_directory_compare_items);
+    } else {
+        ESP_LOGE(TAG, "Not enough memory to rebuild directory. Queries will return no results.");
+    }
+
+    esp32_manager_directory_t * old_directory = __atomic_exchange_n(&esp32_manager_directory, directory, __ATOMIC_SEQ_CST);
+    esp32_manager_synchronize(); // Wait for queries that might still be walking the old directory
+    free(old_directory);
+
+    return (directory != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t esp32_manager_directory_walk(const char * namespace_prefix, const char * entry_first, const char * entry_last, const char * entry_prefix, esp32_manager_query_cb_t cb, void * arg)
+{
+    esp_err_t e = ESP_OK;
+
+    if(cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t namespace_prefix_len = (namespace_prefix != NULL) ? strlen(namespace_prefix) : 0;
+    size_t entry_prefix_len = (entry_prefix != NULL) ? strlen(entry_prefix) : 0;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_directory_t * directory = __atomic_load_n(&esp32_manager_directory, __ATOMIC_SEQ_CST);
+    if(directory == NULL) {
+        esp32_manager_read_exit(parity);
+        return ESP_OK;
+    }
+
+    // First item whose namespace key is not below the prefix
+    uint16_t low = 0, high = directory->size;
+    while(low < high) {
+        uint16_t middle = (low + high) / 2;
+        if(namespace_prefix_len > 0 && strcmp(directory->items[middle].namespace->key, namespace_prefix) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    uint16_t i = low;
+    while(i < directory->size && e == ESP_OK) {
+        esp32_manager_namespace_t * namespace = directory->items[i].namespace;
+        if(namespace_prefix_len > 0 && strncmp(namespace->key, namespace_prefix, namespace_prefix_len) != 0) {
+            break; // Past the namespaces matching the prefix
+        }
+
+        // End of this namespace's block
+        low = i; high = directory->size;
+        while(low < high) {
+            uint16_t middle = (low + high) / 2;
+            if(esp32_manager_directory_compare_namespace(&directory->items[middle], namespace) <= 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        uint16_t block_end = low;
+
+        // First entry in the block not below entry_first
+        if(entry_first != NULL) {
+            low = i; high = block_end;
+            while(low < high) {
+                uint16_t middle = (low + high) / 2;
+                if(strcmp(directory->items[middle].entry->key, entry_first) < 0) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            i = low;
+        }
+
+        for(; i < block_end && e == ESP_OK; ++i) {
+            esp32_manager_entry_t * entry = directory->items[i].entry;
+            if(entry_prefix_len > 0 && strncmp(entry->key, entry_prefix, entry_prefix_len) != 0) break;
+            if(entry_last != NULL && strcmp(entry->key, entry_last) >= 0) break;
+            e = cb(namespace, entry, arg);
+        }
+        i = block_end;
+    }
+
+    esp32_manager_read_exit(parity);
+
+    return e;
+}
+
+esp32_manager_namespace_t * esp32_manager_find_namespace(const char * key)
+{
+    if(key == NULL) return NULL;
+
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = __atomic_load_n(&esp32_manager_namespaces[i], __ATOMIC_SEQ_CST);
+        if(namespace != NULL && !strcmp(namespace->key, key)) {
+            return namespace;
+        }
+    }
+
+    return NULL;
+}
+
+esp32_manager_entry_t * esp32_manager_find_entry(esp32_manager_namespace_t * namespace, const char * key)
+{
+    if(namespace == NULL || key == NULL) return NULL;
+
+    for(uint8_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = __atomic_load_n(&namespace->entries[i], __ATOMIC_SEQ_CST);
+        if(entry != NULL && !strcmp(entry->key, key)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t esp32_manager_entry_set_from_string(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, char * source)
+{
+    if(namespace == NULL || entry == NULL || source == NULL || entry->from_string == NULL) {
+        ESP_LOGE(TAG, "Error setting entry: invalid arguments");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+        ESP_LOGE(TAG, "Entry %s.%s is memory-mapped, write it with esp32_manager_mmap_write()", namespace->key, entry->key);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    esp_err_t e = entry->from_string(entry, source);
+    if(e == ESP_OK) {
+        esp32_manager_entry_changed(namespace, entry);
+    }
+
+    return e;
+}
+
+void esp32_manager_entry_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    if(namespace == NULL || entry == NULL) return;
+
+    esp32_manager_journal_record(namespace, entry);
+
+    if(entry->history != NULL) {
+        esp32_manager_history_add(entry);
+    }
+
+    // Copied so listeners run outside the critical section and can be added or removed meanwhile
+    esp32_manager_change_listener_t listeners[ESP32_MANAGER_CHANGE_LISTENERS_SIZE];
+    portENTER_CRITICAL(&esp32_manager_change_listeners_mux);
+    memcpy(listeners, esp32_manager_change_listeners, sizeof(listeners));
+    portEXIT_CRITICAL(&esp32_manager_change_listeners_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_CHANGE_LISTENERS_SIZE; ++i) {
+        if(listeners[i].cb != NULL) {
+            listeners[i].cb(namespace, entry, listeners[i].arg);
+        }
+    }
+}
+
+esp_err_t esp32_manager_add_change_listener(esp32_manager_change_cb_t cb, void * arg)
+{
+    esp_err_t e = ESP_ERR_NO_MEM;
+
+    if(cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_change_listeners_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_CHANGE_LISTENERS_SIZE; ++i) {
+        if(esp32_manager_change_listeners[i].cb == NULL) {
+            esp32_manager_change_listeners[i].cb = cb;
+            esp32_manager_change_listeners[i].arg = arg;
+            e = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&esp32_manager_change_listeners_mux);
+
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "No room for more change listeners");
+    }
+    return e;
+}
+
+esp_err_t esp32_manager_remove_change_listener(esp32_manager_change_cb_t cb, void * arg)
+{
+    esp_err_t e = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&esp32_manager_change_listeners_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_CHANGE_LISTENERS_SIZE; ++i) {
+        if(esp32_manager_change_listeners[i].cb == cb && esp32_manager_change_listeners[i].arg == arg) {
+            esp32_manager_change_listeners[i].cb = NULL;
+            esp32_manager_change_listeners[i].arg = NULL;
+            e = ESP_OK;
+            break;
+        }
     }
+    portEXIT_CRITICAL(&esp32_manager_change_listeners_mux);
 
-    return ESP_FAIL;
+    return e;
 }
 
-esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, char * dest)
+esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, char * dest, size_t size)
 {
-    if(entry == NULL || dest == NULL) {
+    size_t length;
+
+    if(entry == NULL || dest == NULL || size == 0) {
         ESP_LOGE(TAG, "entry and source cannot be NULL" );
         return ESP_ERR_INVALID_ARG;
     }
 
+    esp_err_t e = esp32_manager_entry_format(entry, dest, size, &length);
+    if(e == ESP_OK && length >= size) {
+        ESP_LOGD(TAG, "Entry %s needs %u bytes to be converted to string, %u available", entry->key, length +1, size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return e;
+}
+
+size_t esp32_manager_entry_string_length(esp32_manager_entry_t * entry)
+{
+    size_t length;
+
+    if(entry == NULL || esp32_manager_entry_format(entry, NULL, 0, &length) != ESP_OK) {
+        return 0;
+    }
+    return length;
+}
+
+size_t esp32_manager_entry_string_max_length(esp32_manager_entry_t * entry)
+{
+    size_t length = 0;
+
+    switch(entry->type) {
+        case text:
+        case password:
+        case blob:
+        case image:
+            return (entry->size > 0) ? entry->size -1 : 0;
+        case single_choice:
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                length = MAX(length, strlen(entry->choices->keys[i]));
+            }
+            return length;
+        case multiple_choice: // Every option selected, comma-separated
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                length += strlen(entry->choices->keys[i]) +1;
+            }
+            return (length > 0) ? length -1 : 0;
+        default:
+            return ESP32_MANAGER_NUMBER_MAX_LENGTH;
+    }
+}
+
+/**
+ * Appends src to dest as far as it fits, always null-terminated. Advances length by the full length of src,
+ * so it ends up as the length the whole string would have.
+ */
+static void esp32_manager_string_append(char * dest, size_t size, size_t * length, const char * src)
+{
+    size_t src_length = strlen(src);
+    if(*length < size) {
+        size_t copy = MIN(src_length, size - *length -1);
+        memcpy(&dest[*length], src, copy);
+        dest[*length + copy] = 0;
+    }
+    *length += src_length;
+}
+
+/**
+ * Writes the value as text into dest, truncated to size bytes, and the length of the whole text into length.
+ * dest can be NULL with size 0 to get the length only.
+ */
+static esp_err_t esp32_manager_entry_format(esp32_manager_entry_t * entry, char * dest, size_t size, size_t * length)
+{
+    int n = 0;
+
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) { // Not copied, see esp32_manager_mmap_get()
+        ESP_LOGD(TAG, "Entry %s is memory-mapped", entry->key);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    *length = 0;
+    if(size > 0) {
+        *dest = 0;
+    }
+
     switch(entry->type) {
         case i8:
-            sprintf(dest, "%d", (signed int) *((int8_t *) entry->value));
+            n = snprintf(dest, size, "%d", (signed int) *((int8_t *) entry->value));
         break;
         case u8:
-            sprintf(dest, "%u", (unsigned int) *((uint8_t *) entry->value));
+            n = snprintf(dest, size, "%u", (unsigned int) *((uint8_t *) entry->value));
         break;
         case i16:
-            sprintf(dest, "%d", (signed int) *((int16_t *) entry->value));
+            n = snprintf(dest, size, "%d", (signed int) *((int16_t *) entry->value));
         break;
         case u16:
-            sprintf(dest, "%u", (unsigned int) *((uint16_t *) entry->value));
+            n = snprintf(dest, size, "%u", (unsigned int) *((uint16_t *) entry->value));
         break;
         case i32:
-            sprintf(dest, "%d", (signed int) *((int32_t *) entry->value));
+            n = snprintf(dest, size, "%d", (signed int) *((int32_t *) entry->value));
         break;
         case u32:
-            sprintf(dest, "%u", (unsigned int) *((uint32_t *) entry->value));
+            n = snprintf(dest, size, "%u", (unsigned int) *((uint32_t *) entry->value));
         break;
         case i64:
-            sprintf(dest, "%ld", (signed long int) *((int64_t *) entry->value));
+            n = snprintf(dest, size, "%ld", (signed long int) *((int64_t *) entry->value));
         break;
         case u64:
-            sprintf(dest, "%lu", (unsigned long int) *((uint64_t *) entry->value));
+            n = snprintf(dest, size, "%lu", (unsigned long int) *((uint64_t *) entry->value));
         break;
         case flt:
-            sprintf(dest, "%f", (float) *((float *) entry->value));
+            n = snprintf(dest, size, "%f", (float) *((float *) entry->value));
         break;
         case dbl:
-            sprintf(dest, "%lf", (double) *((double *) entry->value));
+            n = snprintf(dest, size, "%lf", (double) *((double *) entry->value));
         break;
         case text:
         case password:
-            strcpy(dest, (char *) entry->value);
+            esp32_manager_string_append(dest, size, length, (char *) entry->value);
         break;
         case single_choice:
-        case multiple_choice:
+            if(*((uint8_t *) entry->value) >= entry->choices->size) {
+                ESP_LOGE(TAG, "Entry %s has an invalid option selected", entry->key);
+                return ESP_FAIL;
+            }
+            esp32_manager_string_append(dest, size, length, entry->choices->keys[*((uint8_t *) entry->value)]);
+        break;
+        case multiple_choice: // Comma-separated list of selected option keys
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                if(ESP32_MANAGER_CHOICES_BITSET_GET(entry->value, i)) {
+                    if(*length > 0) {
+                        esp32_manager_string_append(dest, size, length, ",");
+                    }
+                    esp32_manager_string_append(dest, size, length, entry->choices->keys[i]);
+                }
+            }
+        break;
         case blob:
         case image:
             ESP_LOGE(TAG, "Not implemented yet");
@@ -184,6 +788,10 @@ esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, c
         break;
     }
 
+    if(n < 0) {
+        return ESP_FAIL;
+    }
+    *length += n;
     return ESP_OK;
 }
 
@@ -194,6 +802,10 @@ esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry,
         return ESP_ERR_INVALID_ARG;
     }
 
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
     uint64_t unumber;
     int64_t inumber;
 
@@ -231,19 +843,51 @@ esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry,
             *((uint64_t *) entry->value) = (uint64_t) unumber;
             break;
         case text: // This type needs to be null-terminated
-            strcpy((char *) entry->value, source);
-            break;
         case password:
+            if(strlen(source) >= entry->size) {
+                ESP_LOGE(TAG, "Value for entry %s does not fit its buffer of %u bytes", entry->key, entry->size);
+                return ESP_ERR_INVALID_SIZE;
+            }
             strcpy((char *) entry->value, source);
             break;
-        // TODO Implement these cases
-        case flt:
-        case dbl:
         case single_choice:
-        case multiple_choice:
-        case blob: // Data structures, binary and other non-null-terminated types go here
-        case image:
-            ESP_LOGE(TAG, "Not implemented");
+            inumber = esp32_manager_choices_find(entry->choices, source, strlen(source));
+            if(inumber < 0) {
+                ESP_LOGE(TAG, "Entry %s has no option %s", entry->key, source);
+                return ESP_FAIL;
+            }
+            *((uint8_t *) entry->value) = (uint8_t) inumber;
+            break;
+        case multiple_choice: ; // Comma-separated list of option keys
+            // First pass validates all keys so the value is not left half-updated on error
+            for(uint8_t pass = 0; pass < 2; ++pass) {
+                if(pass == 1) {
+                    memset(entry->value, 0, ESP32_MANAGER_CHOICES_BITSET_SIZE(entry->choices->size));
+                }
+                const char * option = source;
+                while(*option != 0) {
+                    size_t option_len = strcspn(option, ",");
+                    if(option_len > 0) {
+                        inumber = esp32_manager_choices_find(entry->choices, option, option_len);
+                        if(inumber < 0) {
+                            ESP_LOGE(TAG, "Entry %s has no option %.*s", entry->key, (int) option_len, option);
+                            return ESP_FAIL;
+                        }
+                        if(pass == 1) {
+                            ESP32_MANAGER_CHOICES_BITSET_SET(entry->value, inumber);
+                        }
+                    }
+                    option += option_len;
+                    if(*option == ',') ++option;
+                }
+            }
+            break;
+        // TODO Implement these cases
+        case flt:
+        case dbl:
+        case blob: // Data structures, binary and other non-null-terminated types go here
+        case image:
+            ESP_LOGE(TAG, "Not implemented");
             return ESP_FAIL;
             //nvs_set_blob(handle->nvs_handle, entry->key, entry->value, size);
         break;
@@ -258,18 +902,60 @@ esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry,
 
 esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace)
 {
-    esp_err_t e = ESP_OK;
+    esp_err_t e;
     uint16_t entries_to_commit_counter = 0;
 
     if(namespace == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    for(uint16_t i=0; i < namespace->size; ++i) {
+    int64_t start_time = esp_timer_get_time();
+    esp32_manager_commit_entries_to_nvs(namespace, 0, namespace->size, &entries_to_commit_counter);
+
+    if(entries_to_commit_counter > 0) {
+        e = nvs_commit(namespace->nvs_handle);
+        if(e == ESP_OK) {
+            ESP_LOGD(TAG, "Namespace %s commited to NVS in %u us", namespace->key, (uint32_t) (esp_timer_get_time() - start_time));
+            return ESP_OK;
+        } else {
+            ESP_LOGE(TAG, "Could not commit namespace %s to NVS", namespace->key);
+            return ESP_FAIL;
+        }
+    } else {
+        ESP_LOGD(TAG, "Nothing to commit in namespace %s", namespace->key);
+        return ESP_OK;
+    }
+}
+
+esp_err_t esp32_manager_commit_entries_to_nvs(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count, uint16_t * set_count)
+{
+    esp_err_t e = ESP_OK;
+    uint16_t error_count = 0;
+
+    if(namespace == NULL || set_count == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
         esp32_manager_entry_t * entry = namespace->entries[i];
 
+        if(entry == NULL) continue; // Skip empty or unregistered slots
         if((entry->attributes & ESP32_MANAGER_ATTR_NO_FLASH) != 0) continue; // Skip if flagged as NO_FLASH
 
+#ifdef CONFIG_ESP32_MANAGER_SPARSE_PERSISTENCE
+        if(esp32_manager_entry_is_default(entry)) { // Defaults are not stored, missing keys load as default
+            e = nvs_erase_key(namespace->nvs_handle, entry->key);
+            if(e == ESP_OK) {
+                ESP_LOGD(TAG, "Entry %s.%s back to default, erased from NVS", namespace->key, entry->key);
+                ++(*set_count);
+            } else if(e != ESP_ERR_NVS_NOT_FOUND) {
+                ESP_LOGE(TAG, "Entry %s.%s could not be erased from NVS", namespace->key, entry->key);
+                ++error_count;
+            }
+            continue;
+        }
+#endif
+
         switch(entry->type) {
             case i8:
                 e = nvs_set_i8(namespace->nvs_handle, entry->key, *((int8_t *) entry->value));
@@ -288,9 +974,11 @@ esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace)
                 e = nvs_set_i32(namespace->nvs_handle, entry->key, *((int32_t *) entry->value));
             break;
             case u32:
-            case multiple_choice: // Change this to a different integral type to allow for other than 32 options
                 e = nvs_set_u32(namespace->nvs_handle, entry->key, *((uint32_t *) entry->value));
             break;
+            case multiple_choice:
+                e = nvs_set_blob(namespace->nvs_handle, entry->key, entry->value, ESP32_MANAGER_CHOICES_BITSET_SIZE(entry->choices->size));
+            break;
             case i64:
                 e = nvs_set_i64(namespace->nvs_handle, entry->key, *((int64_t *) entry->value));
             break;
@@ -305,7 +993,11 @@ esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace)
             break;
             case text: // This type needs to be null-terminated
             case password:
-                e = nvs_set_str(namespace->nvs_handle, entry->key, (char *) entry->value);
+                if((entry->attributes & ESP32_MANAGER_ATTR_COMPRESS) != 0) {
+                    e = esp32_manager_entry_commit_compressed(namespace, entry);
+                } else {
+                    e = nvs_set_str(namespace->nvs_handle, entry->key, (char *) entry->value);
+                }
             break;
             case blob: // Data structures, binary and other non-null-terminated types go here
             case image:
@@ -319,119 +1011,407 @@ esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace)
         // Check for errors
         if(e == ESP_OK) {
             ESP_LOGD(TAG, "Entry %s.%s set for NVS commit", namespace->key, entry->key);
-            ++entries_to_commit_counter;
+            ++(*set_count);
         } else {
             ESP_LOGE(TAG, "Entry %s.%s could not be set for NVS commit", namespace->key, entry->key);
+            ++error_count;
         }
 
     }
 
-    if(entries_to_commit_counter > 0) {
-        e = nvs_commit(namespace->nvs_handle);
-        if(e == ESP_OK) {
-            ESP_LOGD(TAG, "Namespace %s commited to NVS", namespace->key);
-            return ESP_OK;
-        } else {
-            ESP_LOGE(TAG, "Could not commit namespace %s to NVS", namespace->key);
-            return ESP_FAIL;
-        }
-    } else {
-        ESP_LOGD(TAG, "Nothing to commit in namespace %s", namespace->key);
-        return ESP_OK;
-    }
+    return (error_count > 0) ? ESP_FAIL : ESP_OK;
 }
 
 esp_err_t esp32_manager_read_from_nvs(esp32_manager_namespace_t * namespace)
 {
-    esp_err_t e = ESP_OK;
-    uint8_t error_counter = 0; // When reading an entry from NVS throws error, it will retry to read it a number of times.
-
-    size_t blob_length; // length parameter for blob values
+    esp_err_t e;
 
     if(namespace == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    // Loading changes values too, for the journal, history and ETags
+    uint8_t * snapshot = esp32_manager_entries_snapshot(namespace, 0, namespace->size);
+
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+    // On wake from deep sleep values come from the RTC memory snapshot. NVS is only read on cold boot.
+    if(esp32_manager_rtc_restore_namespace(namespace) == ESP_OK) {
+        esp32_manager_entries_notify(namespace, snapshot, 0, namespace->size);
+        free(snapshot);
+        return ESP_OK;
+    }
+#endif
+
+    int64_t start_time = esp_timer_get_time();
+
+#ifdef CONFIG_ESP32_MANAGER_NVS_BULK_LOAD
+#ifdef CONFIG_ESP32_MANAGER_SPARSE_PERSISTENCE
+    // Only values that differ from default are stored. Start from defaults so missing keys need no lookup.
     for(uint16_t i=0; i < namespace->size; ++i) {
         esp32_manager_entry_t * entry = namespace->entries[i];
+        if(entry == NULL || entry->default_value == NULL) continue;
+        if((entry->attributes & ESP32_MANAGER_ATTR_NO_FLASH) != 0) continue;
+        esp32_manager_reset_entry(entry);
+    }
+#endif
+    e = esp32_manager_read_from_nvs_bulk(namespace);
+#else
+    e = esp32_manager_read_entries_from_nvs(namespace, 0, namespace->size);
+#endif
+
+    int64_t load_time = esp_timer_get_time() - start_time;
+    ESP_LOGD(TAG, "Namespace %s loaded from NVS in %u us", namespace->key, (uint32_t) load_time);
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+    esp32_manager_rtc_account_nvs_load(load_time);
+#endif
+
+    esp32_manager_entries_notify(namespace, snapshot, 0, namespace->size);
+    free(snapshot);
+
+    esp32_manager_profile_resume(namespace);
 
+    return e;
+}
+
+/**
+ * Per-key load: one keyed lookup per registered entry. With sparse persistence, only for the keys stored.
+ */
+esp_err_t esp32_manager_read_entries_from_nvs(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count)
+{
+    if(namespace == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#ifdef CONFIG_ESP32_MANAGER_SPARSE_PERSISTENCE
+    // Most entries hold their default and have no key. Walk the stored keys once to know which ones do.
+    uint8_t stored[ESP32_MANAGER_CHOICES_BITSET_SIZE(UINT8_MAX +1)];
+    nvs_entry_info_t info;
+    memset(stored, 0, sizeof(stored));
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace->key, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it); // Releases the iterator at the end
+        for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
+            esp32_manager_entry_t * entry = namespace->entries[i];
+            if(entry != NULL && !strcmp(entry->key, info.key)) {
+                ESP32_MANAGER_CHOICES_BITSET_SET(stored, i);
+                break;
+            }
+        }
+    }
+#endif
+
+    for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i];
+
+        if(entry == NULL) continue; // Skip empty or unregistered slots
         if((entry->attributes & ESP32_MANAGER_ATTR_NO_FLASH) != 0) continue; // Skip if flagged as NO_FLASH
 
-        switch(entry->type) {
-            case i8:
-                e = nvs_get_i8(namespace->nvs_handle, entry->key, (int8_t *) entry->value);
-            break;
-            case u8:
-            case single_choice:
-                e = nvs_get_u8(namespace->nvs_handle, entry->key, (uint8_t *) entry->value);
-            break;
-            case i16:
-                e = nvs_get_i16(namespace->nvs_handle, entry->key, (int16_t *) entry->value);
-            break;
-            case u16:
-                e = nvs_get_u16(namespace->nvs_handle, entry->key, (uint16_t *) entry->value);
-            break;
-            case i32:
-                e = nvs_get_i32(namespace->nvs_handle, entry->key, (int32_t *) entry->value);
-            break;
-            case u32:
-            case multiple_choice:
-                e = nvs_get_u32(namespace->nvs_handle, entry->key, (uint32_t *) entry->value);
-            break;
-            case i64:
-                e = nvs_get_i64(namespace->nvs_handle, entry->key, (int64_t *) entry->value);
-            break;
-            case u64:
-                e = nvs_get_u64(namespace->nvs_handle, entry->key, (uint64_t *) entry->value);
-            break;
-            case flt:
-                blob_length = sizeof(float);
-                e = nvs_get_blob(namespace->nvs_handle, entry->key, entry->value, &blob_length);
-            break;
-            case dbl:
-                blob_length = sizeof(double);
-                e = nvs_get_blob(namespace->nvs_handle, entry->key, entry->value, &blob_length);
-            case text:
-            case password: ; // ; is an empty statement because labels need to be followed by a statement, not a declaration.
-                size_t len; // nvs_get_str needs a non-zero pointer to store the string length, even if we don't need it.
-                e = nvs_get_str(namespace->nvs_handle, entry->key, (char *) entry->value, &len);
-            break;
-            case blob:
-            case image:
-                ESP_LOGE(TAG, "Blob and image support not implemented yet");
+#ifdef CONFIG_ESP32_MANAGER_SPARSE_PERSISTENCE
+        if(entry->default_value != NULL) { // Only values that differ from default are stored
+            esp32_manager_reset_entry(entry);
+        }
+        if(!ESP32_MANAGER_CHOICES_BITSET_GET(stored, i)) continue; // Nothing stored, no lookup
+#endif
+
+        if(esp32_manager_entry_load_from_nvs(namespace, entry) != ESP_OK) {
+            ESP_LOGE(TAG, "Erasing entry %s.%s.", namespace->key, entry->key);
+            esp_err_t e = nvs_erase_key(namespace->nvs_handle, entry->key); // Erase the entry
+            if(e != ESP_OK) {
+                ESP_LOGE(TAG, "Entry %s.%s could not be erased from NVS: %s", namespace->key, entry->key, esp_err_to_name(e));
+                return ESP_FAIL;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ESP32_MANAGER_NVS_BULK_LOAD
+/**
+ * Bulk load: walks the keys stored in the namespace once and only reads those that exist.
+ * Entries are matched by key through a hash table on the stack, so no lookup is spent on entries never saved.
+ */
+static esp_err_t esp32_manager_read_from_nvs_bulk(esp32_manager_namespace_t * namespace)
+{
+    uint8_t table[ESP32_MANAGER_NVS_BULK_TABLE_MAX_SIZE]; // Entry index +1, 0 for empty buckets
+    uint8_t failed[ESP32_MANAGER_CHOICES_BITSET_SIZE(UINT8_MAX +1)]; // Entries to erase once the iterator is released
+    uint16_t table_size = 2;
+    uint16_t stored = 0;
+    esp_err_t e = ESP_OK;
+
+    // Open addressing table, at most half full
+    while(table_size < 2 * namespace->size) {
+        table_size <<= 1;
+    }
+    memset(table, 0, table_size);
+    memset(failed, 0, sizeof(failed));
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i];
+        if(entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_NO_FLASH) != 0) continue;
+        uint16_t bucket = esp32_manager_key_hash(entry->key) & (table_size -1);
+        while(table[bucket] != 0) {
+            bucket = (bucket +1) & (table_size -1);
+        }
+        table[bucket] = i +1;
+    }
+
+    nvs_entry_info_t info;
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace->key, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it); // Releases the iterator at the end
+        ++stored;
+
+        esp32_manager_entry_t * entry = NULL;
+        uint16_t bucket = esp32_manager_key_hash(info.key) & (table_size -1);
+        while(table[bucket] != 0) {
+            esp32_manager_entry_t * candidate = namespace->entries[table[bucket] -1];
+            if(candidate != NULL && !strcmp(candidate->key, info.key)) {
+                entry = candidate;
+                break;
+            }
+            bucket = (bucket +1) & (table_size -1);
+        }
+        if(entry == NULL) {
+            ESP_LOGD(TAG, "Key %s.%s stored in NVS is not registered", namespace->key, info.key);
+            continue;
+        }
+
+        if(esp32_manager_entry_load_from_nvs(namespace, entry) != ESP_OK) {
+            ESP32_MANAGER_CHOICES_BITSET_SET(failed, table[bucket] -1);
+        }
+    }
+
+    // Erase entries that could not be read, the iterator must not be used while NVS is modified
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        if(ESP32_MANAGER_CHOICES_BITSET_GET(failed, i) && namespace->entries[i] != NULL) {
+            ESP_LOGE(TAG, "Erasing entry %s.%s.", namespace->key, namespace->entries[i]->key);
+            if(nvs_erase_key(namespace->nvs_handle, namespace->entries[i]->key) != ESP_OK) {
+                ESP_LOGE(TAG, "Entry %s.%s could not be erased from NVS", namespace->key, namespace->entries[i]->key);
                 e = ESP_FAIL;
-                //nvs_set_blob(namespace->nvs_handle, entry->key, entry->value, size);
-            break;
-            default:
-                ESP_LOGE(TAG, "Entry %s.%s is of an unknown type", namespace->key, entry->key);
-                e = ESP_OK;
-            break;
+            }
         }
-        if(e == ESP_OK) { // Entry read successfully from NVS
-            ESP_LOGD(TAG, "Entry %s.%s read from NVS", namespace->key, entry->key);
-            error_counter = 0;
-        } else if(e == ESP_ERR_NVS_NOT_FOUND) { // Entry not found in NVS. Not an error.
-            error_counter = 0;
-            ESP_LOGD(TAG, "Entry %s.%s not found in NVS", namespace->key, entry->key); // Todo: Should this be a warning, informational or just debug?
-        } else {
-            ESP_LOGW(TAG, "Entry %s.%s could not be read from NVS. It will be erased.", namespace->key, entry->key); // Something went wrong
-            if(error_counter > 0) { // If we tried already
-                ESP_LOGE(TAG, "Erasing entry %s.%s.", namespace->key, entry->key);
-                e = nvs_erase_key(namespace->nvs_handle, entry->key); // Erase the entry
-                if(e != ESP_OK) {
-                    ESP_LOGE(TAG, "Entry %s.%s could not be erased from NVS: %s", namespace->key, entry->key, esp_err_to_name(e));
-                    return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Namespace %s: %u keys stored in NVS", namespace->key, stored);
+    return e;
+}
+
+/**
+ * FNV-1a
+ */
+static uint32_t esp32_manager_key_hash(const char * key)
+{
+    uint32_t hash = 2166136261u;
+    while(*key) {
+        hash = (hash ^ (uint8_t) *key++) * 16777619u;
+    }
+    return hash;
+}
+#endif // CONFIG_ESP32_MANAGER_NVS_BULK_LOAD
+
+/**
+ * Reads an entry and retries once on error. Not finding the entry is not an error.
+ * Entries that still cannot be read must be erased by the caller.
+ */
+static esp_err_t esp32_manager_entry_load_from_nvs(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    esp_err_t e = esp32_manager_entry_read_from_nvs(namespace, entry);
+    if(e != ESP_OK && e != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "Retrying to read entry %s.%s", namespace->key, entry->key);
+        e = esp32_manager_entry_read_from_nvs(namespace, entry);
+    }
+
+    if(e == ESP_OK) { // Entry read successfully from NVS
+        ESP_LOGD(TAG, "Entry %s.%s read from NVS", namespace->key, entry->key);
+    } else if(e == ESP_ERR_NVS_NOT_FOUND) { // Entry not found in NVS. Not an error.
+        ESP_LOGD(TAG, "Entry %s.%s not found in NVS", namespace->key, entry->key); // Todo: Should this be a warning, informational or just debug?
+        e = ESP_OK;
+    } else {
+        ESP_LOGW(TAG, "Entry %s.%s could not be read from NVS. It will be erased.", namespace->key, entry->key); // Something went wrong
+    }
+
+    return e;
+}
+
+/**
+ * Reads the value of an entry from NVS, with the NVS type esp32_manager_commit_to_nvs() stores it with
+ */
+static esp_err_t esp32_manager_entry_read_from_nvs(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    esp_err_t e;
+    size_t blob_length; // length parameter for blob values
+
+    switch(entry->type) {
+        case i8:
+            e = nvs_get_i8(namespace->nvs_handle, entry->key, (int8_t *) entry->value);
+        break;
+        case u8:
+        case single_choice:
+            e = nvs_get_u8(namespace->nvs_handle, entry->key, (uint8_t *) entry->value);
+        break;
+        case i16:
+            e = nvs_get_i16(namespace->nvs_handle, entry->key, (int16_t *) entry->value);
+        break;
+        case u16:
+            e = nvs_get_u16(namespace->nvs_handle, entry->key, (uint16_t *) entry->value);
+        break;
+        case i32:
+            e = nvs_get_i32(namespace->nvs_handle, entry->key, (int32_t *) entry->value);
+        break;
+        case u32:
+            e = nvs_get_u32(namespace->nvs_handle, entry->key, (uint32_t *) entry->value);
+        break;
+        case multiple_choice:
+            blob_length = ESP32_MANAGER_CHOICES_BITSET_SIZE(entry->choices->size);
+            e = nvs_get_blob(namespace->nvs_handle, entry->key, entry->value, &blob_length);
+            if(e == ESP_ERR_NVS_NOT_FOUND) { // Values saved by older versions are stored as u32 with the same bit order
+                uint32_t legacy_value;
+                e = nvs_get_u32(namespace->nvs_handle, entry->key, &legacy_value);
+                if(e == ESP_OK) {
+                    memset(entry->value, 0, blob_length);
+                    for(uint8_t b=0; b < MIN(blob_length, sizeof(legacy_value)); ++b) {
+                        ((uint8_t *) entry->value)[b] = (uint8_t) (legacy_value >> (8 * b));
+                    }
                 }
-            } else { // If this is the first attempt to read the entry, try to read it again.
-                ESP_LOGD(TAG, "Retrying to read entry %s.%s", namespace->key, entry->key);
-                --i; // Decrement i so it the loop goes over the same entry again
-                ++error_counter; // Count it as an error
             }
+        break;
+        case i64:
+            e = nvs_get_i64(namespace->nvs_handle, entry->key, (int64_t *) entry->value);
+        break;
+        case u64:
+            e = nvs_get_u64(namespace->nvs_handle, entry->key, (uint64_t *) entry->value);
+        break;
+        case flt:
+            blob_length = sizeof(float);
+            e = nvs_get_blob(namespace->nvs_handle, entry->key, entry->value, &blob_length);
+        break;
+        case dbl:
+            blob_length = sizeof(double);
+            e = nvs_get_blob(namespace->nvs_handle, entry->key, entry->value, &blob_length);
+        break;
+        case text:
+        case password: ; // ; is an empty statement because labels need to be followed by a statement, not a declaration.
+            // Compressed values are blobs. Try the format the entry is configured for first, then the other one,
+            // so values stored before compression was enabled or disabled still load.
+            bool compressed = (entry->attributes & ESP32_MANAGER_ATTR_COMPRESS) != 0;
+            e = compressed ? esp32_manager_entry_read_compressed(namespace, entry) : ESP_ERR_NVS_NOT_FOUND;
+            if(e == ESP_ERR_NVS_NOT_FOUND) {
+                size_t len;
+                e = nvs_get_str(namespace->nvs_handle, entry->key, NULL, &len);
+                if(e == ESP_OK && len > entry->size) {
+                    ESP_LOGE(TAG, "Entry %s.%s: stored value of %u bytes does not fit its buffer of %u", namespace->key, entry->key, len, entry->size);
+                    e = ESP_ERR_INVALID_SIZE;
+                }
+                if(e == ESP_OK) {
+                    e = nvs_get_str(namespace->nvs_handle, entry->key, (char *) entry->value, &len);
+                }
+            }
+            if(e == ESP_ERR_NVS_NOT_FOUND && !compressed) {
+                e = esp32_manager_entry_read_compressed(namespace, entry);
+            }
+        break;
+        case blob:
+        case image:
+            ESP_LOGE(TAG, "Blob and image support not implemented yet");
+            e = ESP_FAIL;
+            //nvs_set_blob(namespace->nvs_handle, entry->key, entry->value, size);
+        break;
+        default:
+            ESP_LOGE(TAG, "Entry %s.%s is of an unknown type", namespace->key, entry->key);
+            e = ESP_OK;
+        break;
+    }
+
+    return e;
+}
+
+/**
+ * Stores a text value as a blob compressed by esp32_manager_compress()
+ */
+static esp_err_t esp32_manager_entry_commit_compressed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    uint8_t * buffer;
+    size_t length;
+    size_t legacy_length;
+    size_t value_length = strlen((char *) entry->value) +1;
+
+    int64_t start_time = esp_timer_get_time();
+    esp_err_t e = esp32_manager_compress((const uint8_t *) entry->value, value_length, &buffer, &length);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error compressing entry %s.%s: %s", namespace->key, entry->key, esp_err_to_name(e));
+        return e;
+    }
+    ESP_LOGD(TAG, "Entry %s.%s compressed from %u to %u bytes (%u%%) in %u us", namespace->key, entry->key,
+            value_length, length, (uint32_t) (100 * length / value_length), (uint32_t) (esp_timer_get_time() - start_time));
+
+    // A string stored before compression was enabled would stay in NVS along the blob
+    if(nvs_get_str(namespace->nvs_handle, entry->key, NULL, &legacy_length) == ESP_OK) {
+        nvs_erase_key(namespace->nvs_handle, entry->key);
+    }
 
+    e = nvs_set_blob(namespace->nvs_handle, entry->key, buffer, length);
+    free(buffer);
+    return e;
+}
+
+/**
+ * Reads a text value stored by esp32_manager_entry_commit_compressed()
+ */
+static esp_err_t esp32_manager_entry_read_compressed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry)
+{
+    size_t length;
+    size_t value_length;
+
+    esp_err_t e = nvs_get_blob(namespace->nvs_handle, entry->key, NULL, &length);
+    if(e != ESP_OK) {
+        return e;
+    }
+
+    uint8_t * buffer = malloc(length);
+    if(buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    e = nvs_get_blob(namespace->nvs_handle, entry->key, buffer, &length);
+    if(e == ESP_OK) {
+        e = esp32_manager_compressed_length(buffer, length, &value_length);
+    }
+    if(e == ESP_OK && value_length > entry->size) {
+        ESP_LOGE(TAG, "Entry %s.%s: stored value of %u bytes does not fit its buffer of %u", namespace->key, entry->key, value_length, entry->size);
+        free(buffer);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Decompress aside, the entry keeps its value if the stored one turns out to be corrupted
+    uint8_t * value = NULL;
+    if(e == ESP_OK) {
+        value = malloc(value_length > 0 ? value_length : 1);
+        if(value == NULL) {
+            free(buffer);
+            return ESP_ERR_NO_MEM;
         }
+        e = esp32_manager_decompress(buffer, length, value, value_length);
+    }
+    if(e == ESP_OK && (value_length == 0 || value[value_length -1] != 0)) {
+        e = ESP_ERR_INVALID_SIZE; // Not a string
+    }
+    if(e == ESP_OK) {
+        memcpy(entry->value, value, value_length);
     }
+    free(value);
+    free(buffer);
 
-    return ESP_OK;
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Entry %s.%s decompressed from %u to %u bytes in %u us", namespace->key, entry->key,
+                length, value_length, (uint32_t) (esp_timer_get_time() - start_time));
+    } else {
+        ESP_LOGE(TAG, "Entry %s.%s: compressed value is corrupted", namespace->key, entry->key);
+    }
+
+    return e;
 }
 
 esp_err_t esp32_manager_namespace_nvs_erase(esp32_manager_namespace_t * namespace)
@@ -453,6 +1433,275 @@ esp_err_t esp32_manager_namespace_nvs_erase(esp32_manager_namespace_t * namespac
     }
 }
 
+esp_err_t esp32_manager_storage_gc(bool dry_run, esp32_manager_storage_gc_stats_t * stats)
+{
+    esp_err_t e = ESP_OK;
+    esp32_manager_storage_gc_stats_t total = {0};
+    esp32_manager_storage_orphan_t * orphans = NULL;
+    uint16_t orphans_count = 0, orphans_size = 0;
+    nvs_entry_info_t info;
+    nvs_handle record;
+    uint8_t flag;
+
+    // Namespaces esp32_manager created are recorded on registration. Only those are collected when unregistered,
+    // the partition is shared with other components.
+    bool recorded = (nvs_open(ESP32_MANAGER_STORAGE_NVS_NAMESPACES, dry_run ? NVS_READONLY : NVS_READWRITE, &record) == ESP_OK);
+
+    // Registrations stay as they are until the keys are erased. Readers are not held back by NVS writes.
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
+    // Collect orphaned keys of every namespace first, NVS must not be modified while iterating
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NULL, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it); // Releases the iterator at the end
+
+        if(!strcmp(info.namespace_name, ESP32_MANAGER_STORAGE_NVS_NAMESPACE)) continue;
+        if(!strcmp(info.namespace_name, ESP32_MANAGER_STORAGE_NVS_NAMESPACES)) continue;
+        if(!strncmp(info.namespace_name, ESP32_MANAGER_PROFILE_NVS_PREFIX, strlen(ESP32_MANAGER_PROFILE_NVS_PREFIX))) continue;
+
+        esp32_manager_namespace_t * namespace = NULL;
+        for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE && namespace == NULL; ++i) {
+            if(esp32_manager_namespaces[i] != NULL && !strcmp(esp32_manager_namespaces[i]->key, info.namespace_name)) {
+                namespace = esp32_manager_namespaces[i];
+            }
+        }
+        if(namespace != NULL) {
+            if(esp32_manager_find_entry(namespace, info.key) != NULL) continue;
+        } else if(!recorded || nvs_get_u8(record, info.namespace_name, &flag) != ESP_OK) {
+            continue; // Not an esp32_manager namespace
+        }
+
+        if(orphans_count == orphans_size) {
+            void * grown = realloc(orphans, (orphans_size + 8) * sizeof(*orphans));
+            if(grown == NULL) {
+                ESP_LOGE(TAG, "Not enough memory to collect orphaned keys");
+                nvs_release_iterator(it);
+                e = ESP_ERR_NO_MEM;
+                break;
+            }
+            orphans = grown;
+            orphans_size += 8;
+        }
+        strlcpy(orphans[orphans_count].namespace_key, info.namespace_name, NVS_KEY_NAME_MAX_SIZE);
+        strlcpy(orphans[orphans_count].key, info.key, NVS_KEY_NAME_MAX_SIZE);
+        orphans[orphans_count].type = info.type;
+        orphans[orphans_count].registered = (namespace != NULL);
+        ++orphans_count;
+    }
+
+    // Group them by namespace, then measure, erase and commit each namespace once
+    if(orphans_count > 0) {
+        qsort(orphans, orphans_count, sizeof(*orphans), esp32_manager_storage_orphan_compare);
+    }
+    for(uint16_t first=0, last; e == ESP_OK && first < orphans_count; first = last) {
+        for(last = first +1; last < orphans_count && !strcmp(orphans[last].namespace_key, orphans[first].namespace_key); ++last);
+
+        nvs_handle handle;
+        if(nvs_open(orphans[first].namespace_key, dry_run ? NVS_READONLY : NVS_READWRITE, &handle) != ESP_OK) {
+            ESP_LOGE(TAG, "Cannot open namespace %s", orphans[first].namespace_key);
+            e = ESP_FAIL;
+            break;
+        }
+
+        for(uint16_t j=first; j < last; ++j) {
+            // Primitive types take one NVS entry. Strings and blobs take one more per 32 bytes of data.
+            uint16_t entries = 1;
+            size_t length = 0;
+            if(orphans[j].type == NVS_TYPE_STR) {
+                nvs_get_str(handle, orphans[j].key, NULL, &length);
+            } else if(orphans[j].type == NVS_TYPE_BLOB) {
+                nvs_get_blob(handle, orphans[j].key, NULL, &length);
+            }
+            entries += (length + ESP32_MANAGER_STORAGE_NVS_ENTRY_SIZE -1) / ESP32_MANAGER_STORAGE_NVS_ENTRY_SIZE;
+            ESP_LOGI(TAG, "Orphaned key %s.%s uses %u NVS entries", orphans[j].namespace_key, orphans[j].key, entries);
+            ++total.keys;
+            total.entries += entries;
+
+            if(!dry_run && nvs_erase_key(handle, orphans[j].key) != ESP_OK) {
+                ESP_LOGE(TAG, "Error erasing orphaned key %s.%s", orphans[j].namespace_key, orphans[j].key);
+                e = ESP_FAIL;
+            }
+        }
+
+        if(!dry_run) {
+            if(nvs_commit(handle) != ESP_OK) {
+                ESP_LOGE(TAG, "Error committing namespace %s", orphans[first].namespace_key);
+                e = ESP_FAIL;
+            } else if(e == ESP_OK && !orphans[first].registered) { // Every key of the namespace is gone
+                nvs_erase_key(record, orphans[first].namespace_key);
+                nvs_commit(record);
+            }
+        }
+        nvs_close(handle);
+    }
+
+    xSemaphoreGive(esp32_manager_registry_mutex);
+
+    if(recorded) {
+        nvs_close(record);
+    }
+    free(orphans);
+
+    total.bytes = total.entries * ESP32_MANAGER_STORAGE_NVS_ENTRY_SIZE;
+    if(stats != NULL) {
+        *stats = total;
+    }
+
+    ESP_LOGI(TAG, "Storage GC%s: %u orphaned keys, %u bytes %s", dry_run ? " (dry run)" : "", total.keys, total.bytes, dry_run ? "reclaimable" : "reclaimed");
+    return e;
+}
+
+/**
+ * Orders orphaned keys by namespace, for esp32_manager_storage_gc()
+ */
+static int esp32_manager_storage_orphan_compare(const void * a, const void * b)
+{
+    return strcmp(((const esp32_manager_storage_orphan_t *) a)->namespace_key, ((const esp32_manager_storage_orphan_t *) b)->namespace_key);
+}
+
+/**
+ * Records that esp32_manager created an NVS namespace, so esp32_manager_storage_gc() can erase it once it is
+ * no longer registered. Written once, on the first registration.
+ */
+static void esp32_manager_storage_record_namespace(const char * key)
+{
+    nvs_handle handle;
+    uint8_t flag;
+
+    if(nvs_open(ESP32_MANAGER_STORAGE_NVS_NAMESPACES, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Cannot record namespace %s. It will not be collected once unregistered.", key);
+        return;
+    }
+    if(nvs_get_u8(handle, key, &flag) == ESP_ERR_NVS_NOT_FOUND) {
+        if(nvs_set_u8(handle, key, 1) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+            ESP_LOGW(TAG, "Cannot record namespace %s. It will not be collected once unregistered.", key);
+        }
+    }
+    nvs_close(handle);
+}
+
+esp_err_t esp32_manager_storage_schema_check()
+{
+    nvs_handle handle;
+    uint32_t version = 0;
+
+    esp_err_t e = nvs_open(ESP32_MANAGER_STORAGE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot open namespace %s: %s", ESP32_MANAGER_STORAGE_NVS_NAMESPACE, esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+
+    nvs_get_u32(handle, "schema", &version); // Not found on first boot, version stays 0
+    if(version != ESP32_MANAGER_SCHEMA_VERSION) {
+        ESP_LOGI(TAG, "Schema version changed from %u to %u. Collecting orphaned keys.", version, ESP32_MANAGER_SCHEMA_VERSION);
+        e = esp32_manager_storage_gc(false, NULL);
+        if(e == ESP_OK) { // Store the new version only once GC succeeded, so it is retried otherwise
+            e = nvs_set_u32(handle, "schema", ESP32_MANAGER_SCHEMA_VERSION);
+            if(e == ESP_OK) {
+                e = nvs_commit(handle);
+            }
+        }
+    }
+
+    nvs_close(handle);
+    return e;
+}
+
+esp_err_t esp32_manager_factory_reset()
+{
+    esp_err_t e;
+    uint8_t error_count = 0;
+    int64_t start_time = esp_timer_get_time();
+    esp32_manager_namespace_t * namespaces[ESP32_MANAGER_NAMESPACES_SIZE];
+    uint8_t * snapshots[ESP32_MANAGER_NAMESPACES_SIZE];
+
+    // Registrations and NVS handles cannot change while NVS is erased
+    xSemaphoreTake(esp32_manager_registry_mutex, portMAX_DELAY);
+
+#ifdef CONFIG_ESP32_MANAGER_FACTORY_RESET_ERASE_PARTITION
+    // The manager owns the partition: erase every namespace stored in it, not only the registered ones.
+    // NVS stays initialized, so handles held by readers and by other components remain valid.
+    nvs_iterator_t it;
+    while((it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NULL, NVS_TYPE_ANY)) != NULL) {
+        nvs_entry_info_t info;
+        nvs_handle handle;
+        nvs_entry_info(it, &info);
+        nvs_release_iterator(it); // Erasing invalidates the iterator, search again from the start
+
+        e = nvs_open(info.namespace_name, NVS_READWRITE, &handle);
+        if(e == ESP_OK) {
+            e = nvs_erase_all(handle);
+            if(e == ESP_OK) {
+                e = nvs_commit(handle);
+            }
+            nvs_close(handle);
+        }
+        if(e != ESP_OK) {
+            ESP_LOGE(TAG, "Error erasing namespace %s from NVS: %s", info.namespace_name, esp_err_to_name(e));
+            ++error_count;
+            break; // It would be found again
+        }
+    }
+#else
+    // Erase every namespace first and commit them together afterwards
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i];
+        if(namespace == NULL) continue; // Skip empty slots
+        if(nvs_erase_all(namespace->nvs_handle) != ESP_OK) {
+            ESP_LOGE(TAG, "Error erasing namespace %s from NVS", namespace->key);
+            ++error_count;
+        }
+    }
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i];
+        if(namespace == NULL) continue;
+        if(nvs_commit(namespace->nvs_handle) != ESP_OK) {
+            ESP_LOGE(TAG, "Error committing namespace %s to NVS", namespace->key);
+            ++error_count;
+        }
+    }
+#endif // CONFIG_ESP32_MANAGER_FACTORY_RESET_ERASE_PARTITION
+
+    // Restore defaults in RAM. Changes are notified once the mutex is released, listeners may register or unregister.
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i];
+        namespaces[i] = namespace;
+        snapshots[i] = NULL;
+        if(namespace == NULL) continue;
+        snapshots[i] = esp32_manager_entries_snapshot(namespace, 0, namespace->size);
+        for(uint16_t j=0; j < namespace->size; ++j) {
+            esp32_manager_entry_t * entry = namespace->entries[j];
+            if(entry == NULL || entry->default_value == NULL) continue;
+            if(esp32_manager_reset_entry(entry) != ESP_OK) {
+                ++error_count;
+            }
+        }
+    }
+
+    xSemaphoreGive(esp32_manager_registry_mutex);
+
+    // Outside of read-side sections too, so a listener can wait for registrations in other tasks
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        if(namespaces[i] == NULL) continue;
+        uint8_t parity = esp32_manager_read_enter();
+        bool registered = (esp32_manager_namespaces[i] == namespaces[i]); // Unregistered by a listener in the meantime
+        esp32_manager_read_exit(parity);
+        if(registered) {
+            esp32_manager_entries_notify(namespaces[i], snapshots[i], 0, namespaces[i]->size);
+        }
+        free(snapshots[i]);
+    }
+
+    if(error_count > 0) {
+        ESP_LOGE(TAG, "Factory reset finished with %u errors", error_count);
+        return ESP_FAIL;
+    } else {
+        ESP_LOGI(TAG, "Factory reset done in %u us", (uint32_t) (esp_timer_get_time() - start_time));
+        return ESP_OK;
+    }
+}
+
 esp_err_t esp32_manager_validate_namespace(esp32_manager_namespace_t * namespace)
 {
     if(namespace == NULL) {
@@ -515,15 +1764,31 @@ esp_err_t esp32_manager_validate_entry(esp32_manager_entry_t * entry)
 
 esp_err_t esp32_manager_reset_namespace(esp32_manager_namespace_t * namespace)
 {
-    esp_err_t e;
-    uint8_t error_count = 0;
-
     if(esp32_manager_validate_namespace(namespace) != ESP_OK) {
         ESP_LOGE(TAG, "Error: invalid argument");
         return ESP_ERR_INVALID_ARG;
     }
 
-    for(uint8_t i=0; i < namespace->size; ++i) {
+    if(esp32_manager_reset_entries(namespace, 0, namespace->size) != ESP_OK) {
+        ESP_LOGE(TAG, "Error resetting namespace %s. Some entries were not restored.", namespace->key);
+        return ESP_FAIL;
+    } else {
+        ESP_LOGD(TAG, "Namespace %s restored", namespace->key);
+        return ESP_OK;
+    }
+}
+
+esp_err_t esp32_manager_reset_entries(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count)
+{
+    esp_err_t e;
+    uint16_t error_count = 0;
+
+    if(namespace == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
+        if(namespace->entries[i] == NULL) continue; // Skip empty or unregistered slots
         e = esp32_manager_reset_entry(namespace->entries[i]);
         if(e == ESP_ERR_INVALID_ARG) {
             ++error_count;
@@ -532,13 +1797,7 @@ esp_err_t esp32_manager_reset_namespace(esp32_manager_namespace_t * namespace)
         }
     }
 
-    if(error_count > 0) {
-        ESP_LOGE(TAG, "Error resetting namespace %s. Some entries were not restored.", namespace->key);
-        return ESP_FAIL;
-    } else {
-        ESP_LOGD(TAG, "Namespace %s restored", namespace->key);
-        return ESP_OK;
-    }
+    return (error_count > 0) ? ESP_FAIL : ESP_OK;
 }
 
 esp_err_t esp32_manager_reset_entry(esp32_manager_entry_t * entry)
@@ -571,9 +1830,11 @@ esp_err_t esp32_manager_reset_entry(esp32_manager_entry_t * entry)
             *((int32_t *) entry->value) = *((int32_t *) entry->default_value);
         break;
         case u32:
-        case multiple_choice: // Change this to a different integral type to allow for other than 32 options
             *((uint32_t *) entry->value) = *((uint32_t *) entry->default_value);
         break;
+        case multiple_choice:
+            memcpy(entry->value, entry->default_value, ESP32_MANAGER_CHOICES_BITSET_SIZE(entry->choices->size));
+        break;
         case i64:
             *((int64_t *) entry->value) = *((int64_t *) entry->default_value);
         break;
@@ -602,4 +1863,291 @@ esp_err_t esp32_manager_reset_entry(esp32_manager_entry_t * entry)
 
     ESP_LOGD(TAG, "Entry %s reset to default", entry->key);
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+bool esp32_manager_entry_is_default(esp32_manager_entry_t * entry)
+{
+    if(entry == NULL || entry->default_value == NULL) {
+        return false;
+    }
+
+    switch(entry->type) {
+        case text:
+        case password:
+            return !strcmp((char *) entry->value, (char *) entry->default_value);
+        default: ; // Fixed size types
+            size_t size = esp32_manager_entry_value_size(entry);
+            return size > 0 && !memcmp(entry->value, entry->default_value, size);
+    }
+}
+
+size_t esp32_manager_entry_value_size(esp32_manager_entry_t * entry)
+{
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+        return 0; // Stays in its partition slot
+    }
+
+    switch(entry->type) {
+        case i8:
+        case u8:
+        case single_choice:
+            return sizeof(uint8_t);
+        case i16:
+        case u16:
+            return sizeof(uint16_t);
+        case i32:
+        case u32:
+            return sizeof(uint32_t);
+        case i64:
+        case u64:
+            return sizeof(uint64_t);
+        case flt:
+            return sizeof(float);
+        case dbl:
+            return sizeof(double);
+        case multiple_choice:
+            return ESP32_MANAGER_CHOICES_BITSET_SIZE(entry->choices->size);
+        case text:
+        case password:
+            return strlen((char *) entry->value) +1;
+        default:
+            return 0;
+    }
+}
+
+esp_err_t esp32_manager_namespace_serialize(esp32_manager_namespace_t * namespace, uint8_t * buffer, size_t buffer_size, size_t * length)
+{
+    if(namespace == NULL || buffer == NULL || length == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t position = 0;
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i];
+        if(entry == NULL) continue; // Skip empty or unregistered slots
+
+        size_t key_len = strlen(entry->key);
+        size_t value_size = esp32_manager_entry_value_size(entry);
+        if(value_size == 0 || value_size > UINT16_MAX) continue; // Not serializable
+
+        if(position + 1 + key_len + 2 + value_size > buffer_size) {
+            ESP_LOGE(TAG, "Namespace %s does not fit serialization buffer", namespace->key);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        buffer[position++] = (uint8_t) key_len;
+        memcpy(&buffer[position], entry->key, key_len);
+        position += key_len;
+        buffer[position++] = (uint8_t) value_size;
+        buffer[position++] = (uint8_t) (value_size >> 8);
+        memcpy(&buffer[position], entry->value, value_size);
+        position += value_size;
+    }
+
+    *length = position;
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_namespace_deserialize(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length)
+{
+    if(namespace == NULL || buffer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp32_manager_namespace_deserialize_records(namespace, buffer, length, true);
+}
+
+esp_err_t esp32_manager_namespace_check_serialized(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length)
+{
+    if(namespace == NULL || buffer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp32_manager_namespace_deserialize_records(namespace, buffer, length, false);
+}
+
+/**
+ * Walks the records of a serialized namespace. When apply is set, records that fit their entry are copied
+ * and the rest skipped. Otherwise nothing is copied, and the first record that would be skipped is an error.
+ */
+static esp_err_t esp32_manager_namespace_deserialize_records(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length, bool apply)
+{
+    size_t position = 0;
+    while(position < length) {
+        size_t key_len = buffer[position++];
+        if(position + key_len + 2 > length) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const char * key = (const char *) &buffer[position];
+        position += key_len;
+        size_t value_size = buffer[position] | (buffer[position +1] << 8);
+        position += 2;
+        if(position + value_size > length) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        for(uint16_t i=0; i < namespace->size; ++i) {
+            esp32_manager_entry_t * entry = namespace->entries[i];
+            if(entry == NULL) continue; // Skip empty or unregistered slots
+            if(strncmp(entry->key, key, key_len) != 0 || entry->key[key_len] != 0) continue;
+            if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) break; // Stays in its partition slot
+
+            if(entry->type == text || entry->type == password) {
+                if(value_size == 0 || buffer[position + value_size -1] != 0) {
+                    ESP_LOGW(TAG, "Entry %s.%s: serialized string is not terminated", namespace->key, entry->key);
+                    if(!apply) return ESP_ERR_INVALID_SIZE;
+                    break;
+                }
+                if(value_size > entry->size) {
+                    ESP_LOGW(TAG, "Entry %s.%s: serialized string does not fit its buffer", namespace->key, entry->key);
+                    if(!apply) return ESP_ERR_INVALID_SIZE;
+                    break;
+                }
+            } else if(value_size != esp32_manager_entry_value_size(entry)) {
+                ESP_LOGW(TAG, "Entry %s.%s: serialized size does not match its type", namespace->key, entry->key);
+                if(!apply) return ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            if(apply) {
+                memcpy(entry->value, &buffer[position], value_size);
+            }
+            break;
+        }
+        position += value_size;
+    }
+
+    return ESP_OK;
+}
+
+uint8_t * esp32_manager_entries_snapshot(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count)
+{
+    size_t size = 0;
+    size_t position = 0;
+
+    for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i];
+        if(entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) continue; // Never loaded nor reset
+        size += sizeof(entry) + sizeof(size_t) + esp32_manager_entry_value_size(entry);
+    }
+
+    uint8_t * snapshot = malloc(size + sizeof(esp32_manager_entry_t *)); // Ends with a NULL entry
+    if(snapshot == NULL) {
+        ESP_LOGW(TAG, "Not enough memory to detect changes in namespace %s", namespace->key);
+        return NULL;
+    }
+
+    for(uint16_t i=first; i < namespace->size && i < first + count && position < size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) continue;
+        size_t value_size = esp32_manager_entry_value_size(entry);
+        if(position + sizeof(entry) + sizeof(size_t) + value_size > size) break; // Registered in between
+        memcpy(&snapshot[position], &entry, sizeof(entry));
+        position += sizeof(entry);
+        memcpy(&snapshot[position], &value_size, sizeof(size_t));
+        position += sizeof(size_t);
+        memcpy(&snapshot[position], entry->value, value_size);
+        position += value_size;
+    }
+    memset(&snapshot[position], 0, sizeof(esp32_manager_entry_t *));
+
+    return snapshot;
+}
+
+void esp32_manager_entries_notify(esp32_manager_namespace_t * namespace, const uint8_t * snapshot, uint16_t first, uint16_t count)
+{
+    esp32_manager_entry_t * entry;
+    size_t value_size;
+    size_t position = 0;
+
+    if(snapshot == NULL) {
+        for(uint16_t i=first; i < namespace->size && i < first + count; ++i) {
+            entry = namespace->entries[i];
+            if(entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) continue;
+            esp32_manager_entry_changed(namespace, entry);
+        }
+        return;
+    }
+
+    while(1) {
+        memcpy(&entry, &snapshot[position], sizeof(entry));
+        if(entry == NULL) break;
+        position += sizeof(entry);
+        memcpy(&value_size, &snapshot[position], sizeof(size_t));
+        position += sizeof(size_t);
+        if(value_size != esp32_manager_entry_value_size(entry) || memcmp(&snapshot[position], entry->value, value_size) != 0) {
+            esp32_manager_entry_changed(namespace, entry);
+        }
+        position += value_size;
+    }
+}
+
+int32_t esp32_manager_choices_find(const esp32_manager_choices_t * choices, const char * key, size_t key_len)
+{
+    const uint16_t * lookup = (choices != NULL) ? esp32_manager_choices_lookup(choices) : NULL;
+    if(lookup == NULL || key == NULL) {
+        return -1;
+    }
+
+    // Binary search over the option indexes sorted by key
+    int32_t low = 0;
+    int32_t high = (int32_t) choices->size - 1;
+    while(low <= high) {
+        int32_t middle = (low + high) / 2;
+        const char * option = choices->keys[lookup[middle]];
+        int comparison = strncmp(option, key, key_len);
+        if(comparison == 0 && option[key_len] != 0) { // key is a prefix of option
+            comparison = 1;
+        }
+        if(comparison == 0) {
+            return lookup[middle];
+        } else if(comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Lookup of an options table: its own, or the one built for it on registration
+ */
+static const uint16_t * esp32_manager_choices_lookup(const esp32_manager_choices_t * choices)
+{
+    if(choices->lookup != NULL) {
+        return choices->lookup;
+    }
+    for(esp32_manager_choices_index_t * index = esp32_manager_choices_indexes; index != NULL; index = index->next) {
+        if(index->choices == choices) {
+            return index->lookup;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Builds the lookup of an options table in RAM. Call it holding the registry mutex.
+ */
+static esp_err_t esp32_manager_choices_build_lookup(const esp32_manager_choices_t * choices)
+{
+    esp32_manager_choices_index_t * index = malloc(sizeof(esp32_manager_choices_index_t) + choices->size * sizeof(uint16_t));
+    if(index == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    index->choices = choices;
+
+    // Insertion sort. Option lists are short and this runs only once per table.
+    for(uint16_t i=0; i < choices->size; ++i) {
+        uint16_t j = i;
+        while(j > 0 && strcmp(choices->keys[index->lookup[j-1]], choices->keys[i]) > 0) {
+            index->lookup[j] = index->lookup[j-1];
+            --j;
+        }
+        index->lookup[j] = i;
+    }
+
+    // Complete before it is reachable, readers walk the list without locks
+    index->next = esp32_manager_choices_indexes;
+    esp32_manager_choices_indexes = index;
+    return ESP_OK;
+}
@@ -9,6 +9,7 @@
 #define _ESP32_MANAGER_STORAGE_H_
 
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include "esp_system.h"
@@ -16,6 +17,9 @@
 #include "esp_log.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,6 +33,8 @@ extern "C" {
 #define ESP32_MANAGER_ATTR_WRITE        BIT1    /*!< WRITE flag */
 #define ESP32_MANAGER_ATTR_READWRITE    (BIT1 | BIT0)  /*!< READ & WRITE attributes. Meant for readability of the code because of both being commonly used together. */
 #define ESP32_MANAGER_ATTR_NO_FLASH     BIT3    /*!< Do not use flash/NVS */
+#define ESP32_MANAGER_ATTR_COMPRESS     BIT4    /*!< Compress text and password values in NVS */
+#define ESP32_MANAGER_ATTR_MMAP         BIT5    /*!< Value lives in a memory-mapped partition. See esp32_manager_mmap.h */
 
 /**
  * Settings type.
@@ -41,6 +47,35 @@ typedef enum {
 } esp32_manager_type_t;
 
 #define ESP32_MANAGER_TYPE_WIFI_SSID_MAX_LENGTH     32
+#define ESP32_MANAGER_NUMBER_MAX_LENGTH             320 /*!< Longest number string, the largest double printed with %lf */
+
+#define ESP32_MANAGER_CHOICES_SINGLE_MAX_SIZE       256 /*!< Maximum number of options of a single_choice entry (value is stored as an uint8_t index) */
+
+/**
+ * Options of single_choice and multiple_choice entries.
+ *
+ * Options tables, their keys and friendly names are meant to be declared const so they stay in flash.
+ * The value of a single_choice entry is the uint8_t index of the selected option.
+ * The value of a multiple_choice entry is a bitset of ESP32_MANAGER_CHOICES_BITSET_SIZE(size) bytes,
+ * where bit i is set when option i is selected.
+ */
+typedef struct {
+    const char * const * keys;      /*!< Option keys. Used on query strings, to_string and from_string */
+    const char * const * friendly;  /*!< Option friendly or human-readable names. NULL to show keys instead */
+    uint16_t size;                  /*!< Number of options */
+    const uint16_t * lookup;        /*!< Option indexes sorted by key with strcmp(). NULL to have it built in RAM on registration. */
+} esp32_manager_choices_t;
+
+/**
+ * Bitset helpers for multiple_choice values
+ */
+#define ESP32_MANAGER_CHOICES_BITSET_SIZE(n)        (((n) + 7) / 8)
+#define ESP32_MANAGER_CHOICES_BITSET_GET(bitset, i) ((((const uint8_t *) (bitset))[(i) / 8] >> ((i) % 8)) & 1)
+#define ESP32_MANAGER_CHOICES_BITSET_SET(bitset, i) (((uint8_t *) (bitset))[(i) / 8] |= (1 << ((i) % 8)))
+#define ESP32_MANAGER_CHOICES_BITSET_CLR(bitset, i) (((uint8_t *) (bitset))[(i) / 8] &= ~(1 << ((i) % 8)))
+
+struct esp32_manager_history; /*!< Defined in esp32_manager_history.h */
+struct esp32_manager_webconfig_chunk; /*!< Defined in esp32_manager_webconfig.h */
 
 /**
  * Settings entry
@@ -50,11 +85,15 @@ typedef struct esp32_manager_entry {
     const char * friendly;          /*!< Friendly or human-readable name */
     esp32_manager_type_t type;      /*!< type */
     void * value;                   /*!< pointer to the variable where the value of the setting is stored */
+    size_t size;                    /*!< Size of the buffer value points to. Required for text and password entries. */
     void * default_value;           /*!< Default value */
     uint32_t attributes;            /*!< attributes */
+    const esp32_manager_choices_t * choices;  /*!< Options for single_choice and multiple_choice entries */
+    struct esp32_manager_history * history; /*!< History of values of numeric entries. NULL to disable. */
+    uint32_t modified_seq;          /*!< Sequence number of the last change. Set by esp32_manager_entry_changed(). */
     esp_err_t (* from_string)(struct esp32_manager_entry *, char *);  /*!< function to read value from string */
-    esp_err_t (* to_string)(struct esp32_manager_entry *, char *);    /*!< function to write value to string */
-    esp_err_t (* html_form_widget)(char *, struct esp32_manager_entry *, size_t);   /*!< funtion to generate html form field/widget */
+    esp_err_t (* to_string)(struct esp32_manager_entry *, char *, size_t);  /*!< function to write value to a string buffer of the given size */
+    esp_err_t (* html_form_widget)(struct esp32_manager_webconfig_chunk *, struct esp32_manager_entry *);   /*!< funtion to generate html form field/widget */
 } esp32_manager_entry_t;
 
 /**
@@ -66,13 +105,41 @@ typedef struct {
     esp32_manager_entry_t ** entries;
     uint8_t size;
     nvs_handle nvs_handle;  /*!< NVS handle for this namespace */
+    uint32_t modified_seq;  /*!< Sequence number of the last change of any of its entries or of its registrations */
 } esp32_manager_namespace_t;
 
+#define ESP32_MANAGER_SCHEMA_VERSION        CONFIG_ESP32_MANAGER_SCHEMA_VERSION  /*!< Version of the registered entries layout */
+#define ESP32_MANAGER_STORAGE_NVS_NAMESPACE "esp32_manager" /*!< NVS namespace for esp32_manager's own data. Never registered. */
+#define ESP32_MANAGER_STORAGE_NVS_NAMESPACES "esp32_mgr_ns" /*!< NVS namespace recording the namespaces esp32_manager created */
+#define ESP32_MANAGER_STORAGE_NVS_ENTRY_SIZE 32             /*!< Bytes of an NVS entry */
+
+/**
+ * Results of a storage garbage collection
+ */
+typedef struct {
+    uint16_t keys;      /*!< Orphaned keys found */
+    uint16_t entries;   /*!< NVS entries used by orphaned keys, reclaimable once erased */
+    size_t bytes;       /*!< Bytes of NVS used by orphaned keys */
+} esp32_manager_storage_gc_stats_t;
+
 /**
  * Array to store namespace objects
  */
 extern esp32_manager_namespace_t * esp32_manager_namespaces[ESP32_MANAGER_NAMESPACES_SIZE];
 
+/**
+ * Callback for directory queries. Returning anything but ESP_OK stops the query.
+ */
+typedef esp_err_t (* esp32_manager_query_cb_t)(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg);
+
+#define ESP32_MANAGER_CHANGE_LISTENERS_SIZE     4   /*!< Maximum number of change listeners */
+
+/**
+ * Change listener. Called by esp32_manager_entry_changed() in the task that made the change, so it
+ * must return quickly and not block: queue the work and do it somewhere else.
+ */
+typedef void (* esp32_manager_change_cb_t)(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg);
+
 /**
  * @brief   Initialize esp32_manager
  *
@@ -104,15 +171,198 @@ esp_err_t esp32_manager_register_namespace(esp32_manager_namespace_t * namespace
  */
 esp_err_t esp32_manager_register_entry(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
 
+/**
+ * @brief   Unregister namespace from esp32_manager
+ *
+ *          Removes the namespace from the registry, waits for readers that might still be
+ *          using it to finish, and closes its NVS handle. The slot can be reused right away.
+ *          Once this function returns, the namespace and its entries can be freed.
+ *
+ *          Must not be called from inside a read-side section.
+ *
+ * @param   namespace pointer to the namespace
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND namespace not registered
+ *          ESP_ERR_INVALID_ARG namespace pointer is not valid
+ */
+esp_err_t esp32_manager_unregister_namespace(esp32_manager_namespace_t * namespace);
+
+/**
+ * @brief   Unregister entry from a namespace
+ *
+ *          Removes the entry from the namespace and waits for readers that might still be
+ *          using it to finish. Once this function returns, the entry can be freed.
+ *
+ *          Must not be called from inside a read-side section.
+ *
+ * @param   namespace pointer to the namespace the entry belongs to
+ * @param   entry entry to be unregistered
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND entry not registered in this namespace
+ *          ESP_ERR_INVALID_ARG namespace or entry pointers are not valid
+ */
+esp_err_t esp32_manager_unregister_entry(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Enter a read-side section of the namespace registry
+ *
+ *          Namespaces and entries found in the registry stay valid until the matching call to
+ *          esp32_manager_read_exit(). Lock-free, it never blocks. Sections can be nested.
+ *
+ * @return  Parity to pass to esp32_manager_read_exit()
+ */
+uint8_t esp32_manager_read_enter();
+
+/**
+ * @brief   Leave a read-side section of the namespace registry
+ *
+ * @param   parity Value returned by the matching esp32_manager_read_enter()
+ */
+void esp32_manager_read_exit(uint8_t parity);
+
+/**
+ * @brief   Wait for a grace period
+ *
+ *          Returns once every read-side section that was active when it was called has finished.
+ *          Pointers unpublished from the registry before calling it are no longer in use afterwards.
+ */
+void esp32_manager_synchronize();
+
+/**
+ * @brief   Find entries by namespace and entry key prefixes
+ *
+ *          Uses the sorted directory of registered entries, so the cost depends on the number of
+ *          matches and not on the number of registered entries. Entries are visited sorted by
+ *          namespace key and entry key. The callback runs inside a read-side section.
+ *
+ * @param   namespace_prefix Prefix of the namespace keys. NULL or "" matches all namespaces.
+ * @param   entry_prefix Prefix of the entry keys. NULL or "" matches all entries.
+ * @param   cb Callback called for each matching entry
+ * @param   arg Argument passed to the callback
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG cb is NULL
+ *          Any other value returned by the callback
+ */
+esp_err_t esp32_manager_query_prefix(const char * namespace_prefix, const char * entry_prefix, esp32_manager_query_cb_t cb, void * arg);
+
+/**
+ * @brief   Find entries with keys in a range, in namespaces matching a prefix
+ *
+ *          Same as esp32_manager_query_prefix(), but entry keys are matched against [entry_first, entry_last).
+ *
+ * @param   namespace_prefix Prefix of the namespace keys. NULL or "" matches all namespaces.
+ * @param   entry_first First entry key of the range, inclusive. NULL for no lower bound.
+ * @param   entry_last Last entry key of the range, exclusive. NULL for no upper bound.
+ * @param   cb Callback called for each matching entry
+ * @param   arg Argument passed to the callback
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG cb is NULL
+ *          Any other value returned by the callback
+ */
+esp_err_t esp32_manager_query_range(const char * namespace_prefix, const char * entry_first, const char * entry_last, esp32_manager_query_cb_t cb, void * arg);
+
+/**
+ * @brief   Find a registered namespace by key
+ *
+ *          Call it inside a read-side section and use the namespace only until the section ends.
+ *
+ * @param   key namespace key
+ * @return  pointer to the namespace or NULL if not found
+ */
+esp32_manager_namespace_t * esp32_manager_find_namespace(const char * key);
+
+/**
+ * @brief   Find a registered entry of a namespace by key
+ *
+ *          Call it inside a read-side section and use the entry only until the section ends.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   key entry key
+ * @return  pointer to the entry or NULL if not found
+ */
+esp32_manager_entry_t * esp32_manager_find_entry(esp32_manager_namespace_t * namespace, const char * key);
+
+/**
+ * @brief   Set the value of an entry from a string and notify the change
+ *
+ *          Common set path for the web interface and other frontends. Uses the entry's from_string
+ *          method and calls esp32_manager_entry_changed() on success.
+ *
+ * @param   namespace pointer to the namespace the entry belongs to
+ * @param   entry pointer to the entry
+ * @param   source input string
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG invalid arguments
+ *          Any error returned by from_string
+ */
+esp_err_t esp32_manager_entry_set_from_string(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, char * source);
+
+/**
+ * @brief   Notify that the value of an entry has changed
+ *
+ *          Called by esp32_manager_entry_set_from_string(). Applications that change values directly
+ *          should call it too, so the history, the change journal and other consumers are kept up to date.
+ *
+ * @param   namespace pointer to the namespace the entry belongs to
+ * @param   entry pointer to the entry
+ */
+void esp32_manager_entry_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Add a listener called on every change notified with esp32_manager_entry_changed()
+ *
+ * @param   cb listener
+ * @param   arg argument passed to the listener
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_ARG cb is NULL
+ *          ESP_ERR_NO_MEM ESP32_MANAGER_CHANGE_LISTENERS_SIZE listeners already added
+ */
+esp_err_t esp32_manager_add_change_listener(esp32_manager_change_cb_t cb, void * arg);
+
+/**
+ * @brief   Remove a listener added with esp32_manager_add_change_listener()
+ *
+ *          The listener can still be running in other tasks when this function returns.
+ *
+ * @param   cb listener
+ * @param   arg argument it was added with
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND listener not added
+ */
+esp_err_t esp32_manager_remove_change_listener(esp32_manager_change_cb_t cb, void * arg);
+
 /**
  * @brief   Default method for converting entry value to string
  *
+ *          Never writes more than size bytes. Use esp32_manager_entry_string_length() to size the buffer.
+ *
  * @param   entry Pointer to entry
  * @param   dest Output buffer
+ * @param   size Size of the output buffer, including the null terminator
  * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE the value does not fit. dest holds it truncated.
+ *          ESP_ERR_NOT_SUPPORTED memory-mapped entry
  *          ESP_FAIL error
  */
-esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, char * dest);
+esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, char * dest, size_t size);
+
+/**
+ * @brief   Length of the string esp32_manager_entry_to_string_default() writes for an entry
+ *
+ * @param   entry Pointer to entry
+ * @return  length without the null terminator, or 0 if the value cannot be converted
+ */
+size_t esp32_manager_entry_string_length(esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Longest string an entry can hold, whatever its current value
+ *
+ *          Sizes buffers that receive values before they are set with esp32_manager_entry_set_from_string().
+ *
+ * @param   entry Pointer to entry
+ * @return  length without the null terminator
+ */
+size_t esp32_manager_entry_string_max_length(esp32_manager_entry_t * entry);
 
 /**
  * @brief   Default method for converting string into entry value
@@ -120,6 +370,7 @@ esp_err_t esp32_manager_entry_to_string_default(esp32_manager_entry_t * entry, c
  * @param   entry Pointer to entry
  * @param   source Input string
  * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE text does not fit the entry's buffer
  *          ESP_FAIL error
  */
 esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry, char * source);
@@ -127,6 +378,9 @@ esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry,
 /**
  * @brief   Commits all esp32 under a namespace to NVS for permanent storage
  *
+ *          With ESP32_MANAGER_SPARSE_PERSISTENCE enabled in menuconfig, only values that differ from
+ *          their default are stored. Keys of entries set back to their default are erased.
+ *
  * @param   namespace pointer to the namespace
  * @return  ESP_OK success
  *          ESP_FAIL error
@@ -134,9 +388,29 @@ esp_err_t esp32_manager_entry_from_string_default(esp32_manager_entry_t * entry,
  */
 esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace);
 
+/**
+ * @brief   Set a range of entries of a namespace for NVS commit
+ *
+ *          Building block of esp32_manager_commit_to_nvs() and its chunked version. Entries are set,
+ *          but nvs_commit() must still be called on the namespace handle once all ranges are set.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   first index of the first entry slot
+ * @param   count number of entry slots
+ * @param   set_count incremented for every key set or erased, to know whether a commit is needed
+ * @return  ESP_OK success
+ *          ESP_FAIL some entries could not be set
+ *          ESP_ERR_INVALID_ARG invalid handle
+ */
+esp_err_t esp32_manager_commit_entries_to_nvs(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count, uint16_t * set_count);
+
 /**
  * @brief   Read all esp32 under a namespace from NVS
  *
+ *          With ESP32_MANAGER_SPARSE_PERSISTENCE enabled in menuconfig, entries are reset to their
+ *          defaults first and only the keys stored are read. esp32_manager_entry_changed() is called
+ *          for every entry whose value changed.
+ *
  * @param   namespace pointer to the namespace
  * @return  ESP_OK success
  *          ESP_FAIL error
@@ -144,6 +418,22 @@ esp_err_t esp32_manager_commit_to_nvs(esp32_manager_namespace_t * namespace);
  */
 esp_err_t esp32_manager_read_from_nvs(esp32_manager_namespace_t * namespace);
 
+/**
+ * @brief   Read a range of entries of a namespace from NVS
+ *
+ *          Looks up every entry by key. With ESP32_MANAGER_SPARSE_PERSISTENCE, the keys stored in the
+ *          namespace are listed first and only those are looked up. Entries that cannot be read are
+ *          erased from NVS.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   first index of the first entry slot
+ * @param   count number of entry slots
+ * @return  ESP_OK success
+ *          ESP_FAIL error
+ *          ESP_ERR_INVALID_ARG invalid handle
+ */
+esp_err_t esp32_manager_read_entries_from_nvs(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count);
+
 /**
  * @brief   Erase all namespace content from NVS
  *
@@ -154,6 +444,53 @@ esp_err_t esp32_manager_read_from_nvs(esp32_manager_namespace_t * namespace);
  */
 esp_err_t esp32_manager_namespace_nvs_erase(esp32_manager_namespace_t * namespace);
 
+/**
+ * @brief   Erase keys stored in NVS that do not belong to any registered entry
+ *
+ *          Keys stay in NVS when firmware drops or renames entries or namespaces. This function walks
+ *          every namespace of the default NVS partition and erases keys without a registered entry, with
+ *          one commit per namespace. Namespaces that are not registered are only erased if esp32_manager
+ *          created them, as recorded on registration; profiles, esp32_manager's own data and namespaces
+ *          of other components are left alone. Registrations wait until it is done.
+ *          Call it once all namespaces and entries are registered, outside of read-side sections.
+ *
+ * @param   dry_run true to only report orphaned keys without erasing them
+ * @param   stats output statistics. Can be NULL.
+ * @return  ESP_OK success
+ *          ESP_ERR_NO_MEM not enough memory
+ *          ESP_FAIL error erasing keys
+ */
+esp_err_t esp32_manager_storage_gc(bool dry_run, esp32_manager_storage_gc_stats_t * stats);
+
+/**
+ * @brief   Run the garbage collection if the schema version changed
+ *
+ *          Compares ESP32_MANAGER_SCHEMA_VERSION (menuconfig) with the version stored in NVS on the
+ *          last run. Bump it when entries are dropped or renamed, and call this function once all
+ *          namespaces and entries are registered.
+ *
+ * @return  ESP_OK success, or nothing to do
+ *          Any error returned by esp32_manager_storage_gc()
+ */
+esp_err_t esp32_manager_storage_schema_check();
+
+/**
+ * @brief   Reset all registered entries to their defaults without rebooting
+ *
+ *          Erases the NVS content of all registered namespaces in one pass, or every namespace in the
+ *          NVS partition if ESP32_MANAGER_FACTORY_RESET_ERASE_PARTITION is enabled in menuconfig, so
+ *          every value reads as default from then on. The latter also erases profiles, the stored
+ *          schema version and data of other components, like WiFi and PHY calibration data. Entry
+ *          values in RAM are then reset in place, so the application keeps running with the defaults.
+ *          A change is notified for each entry whose value changed once registrations are unlocked,
+ *          and outside of read-side sections, so listeners can register and unregister.
+ *          Entries without a default value keep their current value until the next boot.
+ *
+ * @return  ESP_OK success
+ *          ESP_FAIL some namespaces could not be erased or reset
+ */
+esp_err_t esp32_manager_factory_reset();
+
 /**
  * @brief   Validate namespace pointer.
  *
@@ -195,6 +532,18 @@ esp_err_t esp32_manager_validate_entry(esp32_manager_entry_t * entry);
  */
 esp_err_t esp32_manager_reset_namespace(esp32_manager_namespace_t * namespace);
 
+/**
+ * @brief   Reset a range of entries of a namespace to their defaults
+ *
+ * @param   namespace pointer to the namespace
+ * @param   first index of the first entry slot
+ * @param   count number of entry slots
+ * @return  ESP_OK success
+ *          ESP_FAIL some entries were not restored
+ *          ESP_ERR_INVALID_ARG invalid handle
+ */
+esp_err_t esp32_manager_reset_entries(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count);
+
 /**
  * @brief   Reset entry value to default
  *
@@ -205,6 +554,107 @@ esp_err_t esp32_manager_reset_namespace(esp32_manager_namespace_t * namespace);
  */
 esp_err_t esp32_manager_reset_entry(esp32_manager_entry_t * entry);
 
+/**
+ * @brief   Check whether an entry holds its default value
+ *
+ * @param   entry pointer to entry
+ * @return  true if the value equals default_value, false otherwise or if the entry has no default
+ */
+bool esp32_manager_entry_is_default(esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Size in bytes of an entry value
+ *
+ *          Fixed for numeric and choice types. For text and password entries it is the length
+ *          of the current string including its null terminator.
+ *
+ * @param   entry pointer to entry
+ * @return  size of the value, or 0 for types that do not support it (blob, image)
+ */
+size_t esp32_manager_entry_value_size(esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Serialize the values of all entries of a namespace into a buffer
+ *
+ *          Each entry is stored as a record: key length (1 byte), key, value length (2 bytes), value.
+ *          Entries of types without a fixed representation (blob, image) are skipped.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   buffer output buffer
+ * @param   buffer_size size of the output buffer
+ * @param   length number of bytes written to buffer
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE buffer too small
+ *          ESP_ERR_INVALID_ARG invalid arguments
+ */
+esp_err_t esp32_manager_namespace_serialize(esp32_manager_namespace_t * namespace, uint8_t * buffer, size_t buffer_size, size_t * length);
+
+/**
+ * @brief   Restore entry values of a namespace from a buffer generated by esp32_manager_namespace_serialize
+ *
+ *          Records for keys not registered in the namespace, records whose size does not match the
+ *          entry type and strings that do not fit the entry's buffer are skipped. Entries without a
+ *          record keep their current value.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   buffer serialized values
+ * @param   length length of buffer
+ * @return  ESP_OK success
+ *          ESP_ERR_INVALID_SIZE buffer is truncated or corrupted
+ *          ESP_ERR_INVALID_ARG invalid arguments
+ */
+esp_err_t esp32_manager_namespace_deserialize(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length);
+
+/**
+ * @brief   Check that esp32_manager_namespace_deserialize would restore every record of a buffer
+ *
+ *          Nothing is changed. Records for keys not registered in the namespace are not an error.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   buffer serialized values
+ * @param   length length of buffer
+ * @return  ESP_OK every record fits its entry
+ *          ESP_ERR_INVALID_SIZE buffer is truncated or corrupted, or a record would be skipped
+ *          ESP_ERR_INVALID_ARG invalid arguments
+ */
+esp_err_t esp32_manager_namespace_check_serialized(esp32_manager_namespace_t * namespace, const uint8_t * buffer, size_t length);
+
+/**
+ * @brief   Copy the values of a range of entries, to find out later which ones changed
+ *
+ *          Memory-mapped entries are skipped. Pass the copy to esp32_manager_entries_notify() and free it.
+ *
+ * @param   namespace pointer to the namespace
+ * @param   first index of the first entry slot
+ * @param   count number of entry slots
+ * @return  copy of the values, allocated with malloc
+ *          NULL not enough memory
+ */
+uint8_t * esp32_manager_entries_snapshot(esp32_manager_namespace_t * namespace, uint16_t first, uint16_t count);
+
+/**
+ * @brief   Call esp32_manager_entry_changed() for every entry whose value differs from a snapshot
+ *
+ * @param   namespace pointer to the namespace
+ * @param   snapshot copy returned by esp32_manager_entries_snapshot(). If NULL, every entry in the range is notified.
+ * @param   first index of the first entry slot, same as for the snapshot
+ * @param   count number of entry slots, same as for the snapshot
+ */
+void esp32_manager_entries_notify(esp32_manager_namespace_t * namespace, const uint8_t * snapshot, uint16_t first, uint16_t count);
+
+/**
+ * @brief   Find an option of a single_choice or multiple_choice entry by its key
+ *
+ *          Binary search over the lookup of the options table, or the one built on registration, so key does not
+ *          need to be null-terminated.
+ *
+ * @param   choices pointer to the options
+ * @param   key option key
+ * @param   key_len length of the key
+ * @return  index of the option or -1 if not found
+ */
+int32_t esp32_manager_choices_find(const esp32_manager_choices_t * choices, const char * key, size_t key_len);
+
 /**
  * Checks whether a character x is a hexadecimal digit or not.
  */
@@ -5,62 +5,178 @@
  * This code is licensed under the MIT License.
  */
 
+ #include <stdarg.h>
+ #include <unistd.h>
+
  #include "esp32_manager_webconfig.h"
 
 static const char * TAG = "esp32_manager_webconfig";
 
+/**
+ * Form parser states
+ */
+enum {
+    WEBCONFIG_MANAGER_FORM_KEY = 0, /*!< In a field name */
+    WEBCONFIG_MANAGER_FORM_VALUE    /*!< In a field value */
+};
+
 httpd_uri_t * esp32_manager_webconfig_uris[];
 
+static uint32_t esp32_manager_webconfig_boot_id; /*!< Random on every boot, so ETags of sequence numbers restarting from 0 never match */
+
 httpd_handle_t esp32_manager_webconfig_webserver;
 
-char esp32_manager_webconfig_content[];
-char esp32_manager_webconfig_buffer[] = "";
+static esp32_manager_webconfig_ctx_t esp32_manager_webconfig_ctx_pool[WEBCONFIG_MANAGER_CONTEXTS_SIZE];
+static SemaphoreHandle_t esp32_manager_webconfig_ctx_available = NULL;  /*!< Counts free contexts */
+static portMUX_TYPE esp32_manager_webconfig_ctx_lock = portMUX_INITIALIZER_UNLOCKED;
 
 httpd_uri_t esp32_manager_webconfig_uri_root = {
     .uri = WEBCONFIG_MANAGER_URI_ROOT_URL,
     .method = HTTP_GET,
-    .handler = esp32_manager_webconfig_uri_handler_root,
-    .user_ctx = NULL
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_root
 };
 
+const esp32_manager_webconfig_asset_t esp32_manager_webconfig_asset_css = WEBCONFIG_MANAGER_ASSET(WEBCONFIG_MANAGER_URI_CSS_URL, "text/css", style_min_css);
+
+static const esp32_manager_webconfig_asset_t * esp32_manager_webconfig_assets[WEBCONFIG_MANAGER_ASSETS_SIZE];
+
 httpd_uri_t esp32_manager_webconfig_uri_css = {
     .uri = WEBCONFIG_MANAGER_URI_CSS_URL,
     .method = HTTP_GET,
-    .handler = esp32_manager_webconfig_uri_handler_style,
-    .user_ctx = NULL
+    .handler = esp32_manager_webconfig_uri_handler_asset,
+    .user_ctx = (void *) &esp32_manager_webconfig_asset_css
 };
 
 httpd_uri_t esp32_manager_webconfig_uri_setup = {
     .uri = WEBCONFIG_MANAGER_URI_SETUP_URL,
     .method = HTTP_GET,
-    .handler = esp32_manager_webconfig_uri_handler_setup,
-    .user_ctx = NULL
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_setup
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_setup_post = {
+    .uri = WEBCONFIG_MANAGER_URI_SETUP_URL,
+    .method = HTTP_POST,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_setup
 };
 
 httpd_uri_t esp32_manager_webconfig_uri_get = {
     .uri = WEBCONFIG_MANAGER_URI_GET_URL,
     .method = HTTP_GET,
-    .handler = esp32_manager_webconfig_uri_handler_get,
-    .user_ctx = NULL
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_get
 };
 
 httpd_uri_t esp32_manager_webconfig_uri_factory = {
     .uri = WEBCONFIG_MANAGER_URI_FACTORY_URL,
     .method = HTTP_GET,
-    .handler = esp32_manager_webconfig_uri_handler_factory,
-    .user_ctx = NULL
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_factory
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_history = {
+    .uri = WEBCONFIG_MANAGER_URI_HISTORY_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_history
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_changes = {
+    .uri = WEBCONFIG_MANAGER_URI_CHANGES_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_changes
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_api_namespaces = {
+    .uri = WEBCONFIG_MANAGER_URI_API_NAMESPACES_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_api_namespaces
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_api_namespace = {
+    .uri = WEBCONFIG_MANAGER_URI_API_NAMESPACE_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_api_namespace
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_api_namespace_put = {
+    .uri = WEBCONFIG_MANAGER_URI_API_NAMESPACE_URL,
+    .method = HTTP_PUT,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_api_update
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_api_namespace_patch = {
+    .uri = WEBCONFIG_MANAGER_URI_API_NAMESPACE_URL,
+    .method = HTTP_PATCH,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_api_update
+};
+
+httpd_uri_t esp32_manager_webconfig_uri_api_networks = {
+    .uri = WEBCONFIG_MANAGER_URI_API_NETWORKS_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_webconfig_uri_handler_ctx,
+    .user_ctx = esp32_manager_webconfig_uri_handler_api_networks
+};
+
+/** JSON names of esp32_manager_type_t, same as tools/esp32_manager_nvs_gen.py */
+static const char * const esp32_manager_webconfig_type_names[] = {
+    "i8", "u8", "i16", "u16", "i32", "u32", "i64", "u64", "flt", "dbl",
+    "multiple_choice", "single_choice",
+    "text", "password",
+    "blob", "image"
 };
 
 esp_err_t esp32_manager_webconfig_init()
 {
     esp_err_t e;
 
+    esp32_manager_webconfig_boot_id = esp_random();
+
+    // Request contexts
+    if(esp32_manager_webconfig_ctx_available == NULL) {
+        esp32_manager_webconfig_ctx_available = xSemaphoreCreateCounting(WEBCONFIG_MANAGER_CONTEXTS_SIZE, WEBCONFIG_MANAGER_CONTEXTS_SIZE);
+        if(esp32_manager_webconfig_ctx_available == NULL) {
+            ESP_LOGE(TAG, "Error creating request context pool");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     // Create uris
     esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_ROOT_INDEX] = &esp32_manager_webconfig_uri_root;
     esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_CSS_INDEX] = &esp32_manager_webconfig_uri_css;
     esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_SETUP_INDEX] = &esp32_manager_webconfig_uri_setup;
     esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_GET_INDEX] = &esp32_manager_webconfig_uri_get;
     esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_FACTORY_INDEX] = &esp32_manager_webconfig_uri_factory;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_HISTORY_INDEX] = &esp32_manager_webconfig_uri_history;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_CHANGES_INDEX] = &esp32_manager_webconfig_uri_changes;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_API_NAMESPACES_INDEX] = &esp32_manager_webconfig_uri_api_namespaces;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_API_NAMESPACE_INDEX] = &esp32_manager_webconfig_uri_api_namespace;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_API_NAMESPACE_PUT_INDEX] = &esp32_manager_webconfig_uri_api_namespace_put;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_API_NAMESPACE_PATCH_INDEX] = &esp32_manager_webconfig_uri_api_namespace_patch;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_SETUP_POST_INDEX] = &esp32_manager_webconfig_uri_setup_post;
+    esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URI_API_NETWORKS_INDEX] = &esp32_manager_webconfig_uri_api_networks;
+
+#ifdef CONFIG_ESP32_MANAGER_WS
+    e = esp32_manager_ws_init();
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error initializing WebSocket updates");
+        return e;
+    }
+#endif
+#ifdef CONFIG_ESP32_MANAGER_SSE
+    e = esp32_manager_sse_init();
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error initializing event streams");
+        return e;
+    }
+#endif
 
     // Register events relevant to the webserver
     e = esp_event_handler_register(ESP32_MANAGER_NETWORK_EVENT_BASE, ESP32_MANAGER_NETWORK_EVENT_STA_GOT_IP, esp32_manager_webconfig_event_handler, NULL);
@@ -98,13 +214,38 @@ esp_err_t esp32_manager_webconfig_init()
     return ESP_OK;
 }
 
+#if defined(CONFIG_ESP32_MANAGER_WS) || defined(CONFIG_ESP32_MANAGER_SSE)
+/**
+ * Called by the server for every socket it closes
+ */
+static void esp32_manager_webconfig_close_fn(httpd_handle_t server, int fd)
+{
+#ifdef CONFIG_ESP32_MANAGER_WS
+    esp32_manager_ws_closed(fd);
+#endif
+#ifdef CONFIG_ESP32_MANAGER_SSE
+    esp32_manager_sse_closed(fd);
+#endif
+    close(fd); // Left to the close function when there is one
+}
+#endif
+
 httpd_handle_t esp32_manager_webconfig_webserver_start()
 {
     esp_err_t e;
 
     /* Generate default configuration */
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_uri_handlers = WEBCONFIG_MANAGER_URIS_SIZE;
+    config.max_uri_handlers = WEBCONFIG_MANAGER_URIS_SIZE + WEBCONFIG_MANAGER_ASSETS_SIZE;
+    config.uri_match_fn = httpd_uri_match_wildcard; // For uris followed by a key, such as the JSON API
+#ifdef CONFIG_ESP32_MANAGER_WS
+    config.max_uri_handlers += 1;
+    config.close_fn = esp32_manager_webconfig_close_fn;
+#endif
+#ifdef CONFIG_ESP32_MANAGER_SSE
+    config.max_uri_handlers += 1;
+    config.close_fn = esp32_manager_webconfig_close_fn;
+#endif
 
     /* Empty handle to esp_http_server */
     httpd_handle_t server = NULL;
@@ -121,6 +262,27 @@ httpd_handle_t esp32_manager_webconfig_webserver_start()
                 return NULL;
             }
         }
+        // Register static files added by the application
+        for(uint16_t i=0; i < WEBCONFIG_MANAGER_ASSETS_SIZE && esp32_manager_webconfig_assets[i] != NULL; ++i) {
+            httpd_uri_t uri = {
+                .uri = esp32_manager_webconfig_assets[i]->uri,
+                .method = HTTP_GET,
+                .handler = esp32_manager_webconfig_uri_handler_asset,
+                .user_ctx = (void *) esp32_manager_webconfig_assets[i]
+            };
+            e = httpd_register_uri_handler(server, &uri);
+            if(e == ESP_OK) {
+                ESP_LOGD(TAG, "Registered asset %s", uri.uri);
+            } else {
+                ESP_LOGE(TAG, "Error registering asset %s: %s", uri.uri, esp_err_to_name(e));
+            }
+        }
+#ifdef CONFIG_ESP32_MANAGER_WS
+        esp32_manager_ws_start(server);
+#endif
+#ifdef CONFIG_ESP32_MANAGER_SSE
+        esp32_manager_sse_start(server);
+#endif
         ESP_LOGD(TAG, "Webserver started");
     } else {
         ESP_LOGE(TAG, "Error starting webserver");
@@ -132,6 +294,12 @@ httpd_handle_t esp32_manager_webconfig_webserver_start()
 void esp32_manager_webconfig_webserver_stop(httpd_handle_t * server)
 {
     if(*server != NULL) {
+#ifdef CONFIG_ESP32_MANAGER_WS
+        esp32_manager_ws_stop();
+#endif
+#ifdef CONFIG_ESP32_MANAGER_SSE
+        esp32_manager_sse_stop();
+#endif
         httpd_stop(*server);
         *server = NULL;
         ESP_LOGD(TAG, "Webserver stopped");
@@ -159,343 +327,215 @@ void esp32_manager_webconfig_event_handler(void * handler_arg, esp_event_base_t
     }
 }
 
-esp_err_t esp32_manager_webconfig_uri_handler_root(httpd_req_t *req)
+esp32_manager_webconfig_ctx_t * esp32_manager_webconfig_ctx_acquire()
 {
-    esp_err_t e;
+    esp32_manager_webconfig_ctx_t * ctx = NULL;
 
-    // Calculate size of request query
-    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(esp32_manager_webconfig_content)-1);
-    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+    if(esp32_manager_webconfig_ctx_available == NULL
+            || xSemaphoreTake(esp32_manager_webconfig_ctx_available, WEBCONFIG_MANAGER_CONTEXT_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE) {
+        return NULL;
+    }
 
-    // Get request query
-    e = httpd_req_get_url_query_str(req, esp32_manager_webconfig_content, recv_size);
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Query string: %s", esp32_manager_webconfig_content);
-        // Search for reboot key
-        e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-        if(e == ESP_OK) { // Reboot parameter found in query
-            e = esp32_manager_webconfig_page_reboot(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH); // Generate HTML
-            if(e == ESP_OK) {
-                ESP_LOGD(TAG, "Reboot page generated");
-            } else {
-                ESP_LOGE(TAG, "Error generating reboot page");
-                httpd_resp_set_status(req, HTTPD_500);
-            }
-            e = httpd_resp_send(req, esp32_manager_webconfig_buffer, strlen(esp32_manager_webconfig_buffer)); // Send it to client
-            if(e == ESP_OK) {
-                ESP_LOGD(TAG, "Page reboot response sent to client");
-            } else {
-                ESP_LOGE(TAG, "Error sending page reboot response to client");
-            }
-            ESP_LOGD(TAG, "Restarting in %d seconds", WEBCONFIG_MANAGER_REBOOT_DELAY / 1000);
-            vTaskDelay(WEBCONFIG_MANAGER_REBOOT_DELAY / portTICK_PERIOD_MS); // Wait before rebooting
-            esp_restart();
+    portENTER_CRITICAL(&esp32_manager_webconfig_ctx_lock);
+    for(uint8_t i=0; i < WEBCONFIG_MANAGER_CONTEXTS_SIZE; ++i) {
+        if(!esp32_manager_webconfig_ctx_pool[i].in_use) {
+            ctx = &esp32_manager_webconfig_ctx_pool[i];
+            ctx->in_use = true;
+            break;
         }
     }
+    portEXIT_CRITICAL(&esp32_manager_webconfig_ctx_lock);
 
-    e = esp32_manager_webconfig_page_root(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH);
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Root document generated");
-    } else {
-        ESP_LOGE(TAG, "Error generating root document");
-        httpd_resp_set_status(req, HTTPD_500);
+    if(ctx != NULL) {
+        ctx->etag[0] = 0; // Responses without ETag leave it empty
     }
+    return ctx;
+}
 
-    e = httpd_resp_send(req, esp32_manager_webconfig_buffer, strlen(esp32_manager_webconfig_buffer));
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Response sent");
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Error sending response");
-        return ESP_FAIL;
+void esp32_manager_webconfig_ctx_release(esp32_manager_webconfig_ctx_t * ctx)
+{
+    if(ctx == NULL) {
+        return;
     }
+
+    portENTER_CRITICAL(&esp32_manager_webconfig_ctx_lock);
+    ctx->in_use = false;
+    portEXIT_CRITICAL(&esp32_manager_webconfig_ctx_lock);
+    xSemaphoreGive(esp32_manager_webconfig_ctx_available);
 }
 
-esp_err_t esp32_manager_webconfig_uri_handler_style(httpd_req_t *req)
+esp_err_t esp32_manager_webconfig_uri_handler_ctx(httpd_req_t * req)
 {
-    esp_err_t e;
-
-    e = httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    e += httpd_resp_set_hdr(req, "Expires", "0");
-    if(e != ESP_OK) {
-        ESP_LOGE(TAG, "Error settings cache headers");
+    esp32_manager_webconfig_handler_t handler = (esp32_manager_webconfig_handler_t) req->user_ctx;
+
+    esp32_manager_webconfig_ctx_t * ctx = esp32_manager_webconfig_ctx_acquire();
+    if(ctx == NULL) {
+        ESP_LOGE(TAG, "No request context available for %s", req->uri);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_send(req, "ERROR: Busy", -1);
     }
 
-    e = httpd_resp_send(req, (const char *) style_min_css_start, style_min_css_end-style_min_css_start);
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Response sent");
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Error sending response");
-        return ESP_FAIL;
-    }
+    ctx->content[0] = 0;
+    ctx->buffer[0] = 0;
+    esp_err_t e = handler(req, ctx);
+
+    esp32_manager_webconfig_ctx_release(ctx);
+    return e;
 }
 
-esp_err_t esp32_manager_webconfig_uri_handler_setup(httpd_req_t * req)
+esp_err_t esp32_manager_webconfig_uri_handler_root(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
 {
     esp_err_t e;
+    esp32_manager_webconfig_chunk_t chunk;
+    bool reboot = false;
 
     // Calculate size of request query
-    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(esp32_manager_webconfig_content)-1);
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
     ESP_LOGD(TAG, "Request header size: %d", recv_size);
 
     // Get request query
-    e = httpd_req_get_url_query_str(req, esp32_manager_webconfig_content, recv_size);
+    e = httpd_req_get_url_query_str(req, ctx->content, recv_size);
     if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Query string: %s", esp32_manager_webconfig_content);
-        // Search for namespace key
-        e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-        if(e == ESP_OK) { // Requesting namespace page
-            // Get namespace
-            esp32_manager_namespace_t * namespace = NULL;
-            for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
-                if(esp32_manager_namespaces[i] != NULL) {
-                    if(!strcmp(esp32_manager_webconfig_buffer, esp32_manager_namespaces[i]->key)) {
-                        namespace = esp32_manager_namespaces[i];
-                        break;
-                    }
-                }
-            }
-            // if namespace requested exists
-            if(namespace != NULL) {
-                ESP_LOGD(TAG, "Selected namespace %s", namespace->key);
-                // Check if there are settings to update
-                uint16_t entry_updated = 0; // Flag to mark if any settings were changed
-                e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-                if(e == ESP_OK) {
-                    e = esp32_manager_reset_namespace(namespace);
-                    if(e == ESP_OK) {
-                        ESP_LOGD(TAG, "Namespace %s entry values reset", namespace->key);
-                        e = esp32_manager_namespace_nvs_erase(namespace);
-                        if(e == ESP_OK) {
-                            ESP_LOGD(TAG, "Namespace %s erased from NVS", namespace->key);
-                        } else {
-                            ESP_LOGD(TAG, "Error erasing namespace %s from NVS", namespace->key);
-                        }
-                    } else {
-                        ESP_LOGE(TAG, "Error resetting namespace %s entry values", namespace->key);
-                    }
-                } else {
-                    for(uint16_t i=0; i < namespace->size; ++i) {
-                        esp32_manager_entry_t * entry = namespace->entries[i];
-                        char encoded[100]; // FIXME Magic number
-                        ESP_LOGD(TAG, "Searching for entry %s.%s", namespace->key, entry->key);
-                        e = httpd_query_key_value(esp32_manager_webconfig_content, entry->key, encoded, sizeof(encoded));
-                        if(e == ESP_OK) { // There is a setting to update
-                            ESP_LOGD(TAG, "Value before decoding: %s", encoded);
-                            esp32_manager_webconfig_urldecode(esp32_manager_webconfig_buffer, encoded); // Decode value from URL
-                            ESP_LOGD(TAG, "Value after decoding: %s", esp32_manager_webconfig_buffer);
-                            e = entry->from_string(entry, esp32_manager_webconfig_buffer);
-                            if(e == ESP_OK) {
-                                ESP_LOGD(TAG, "Entry %s.%s updated", namespace->key, entry->key);
-                                ++entry_updated;
-                            } else {
-                                ESP_LOGE(TAG, "Error updating entry %s.%s to %s", namespace->key, entry->key, esp32_manager_webconfig_buffer);
-                            }
-                            e = entry->to_string(entry, encoded);
-                            if(e == ESP_OK) {
-                                ESP_LOGD(TAG, "Entry %s.%s content %s", namespace->key, entry->key, encoded);
-                            } else {
-                                ESP_LOGE(TAG, "Error converting entry %s.%s to string", namespace->key, entry->key);
-                            }
-                        } // Nothing to do if setting is not found in query string
-                    }
-                }
-                if(entry_updated > 0) {
-                    e = esp32_manager_commit_to_nvs(namespace); // Commit changes to namespace
-                    if(e == ESP_OK) {
-                        ESP_LOGD(TAG, "Entries updated and commited to NVS");
-                    } else {
-                        ESP_LOGE(TAG, "Error commiting changes to NVS: %s", esp_err_to_name(e));
-                    }
-                }
-                // Generate response
-                ESP_LOGD(TAG, "Generating response");
-                e = esp32_manager_webconfig_page_setup_namespace(esp32_manager_webconfig_buffer, req, namespace, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH);
-                if(e == ESP_OK) {
-                    ESP_LOGD(TAG, "Setup namespace page generated");
-                } else {
-                    ESP_LOGE(TAG, "Error generating namespace page: %s", esp_err_to_name(e));
-                }
-            } else { // namespace does not exist
-                ESP_LOGW(TAG, "Requested namespace does not exist");
-                e = esp32_manager_webconfig_page_setup(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH);
-                if(e == ESP_OK) {
-                    ESP_LOGD(TAG, "Setup page generated");
-                } else {
-                    ESP_LOGE(TAG, "Error generating setup page");
-                    httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
-                }
-            }
-        } else if(e == ESP_ERR_NOT_FOUND) { // no namespace requested
-            e = esp32_manager_webconfig_page_setup(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH); // Return setup page
-            if(e == ESP_OK) {
-                ESP_LOGD(TAG, "Setup page generated");
-            } else {
-                ESP_LOGE(TAG, "Error generating setup page: %s", esp_err_to_name(e));
-                httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
-            }
-        } else {
-            ESP_LOGE(TAG, "Error: query does not fit buffer: %s", esp_err_to_name(e));
-            httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
-        }
-    } else if(e == ESP_ERR_NOT_FOUND) { // there is no query string
-        ESP_LOGD(TAG, "No query string. Returning setup page.");
-        e = esp32_manager_webconfig_page_setup(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH); // Return setup page
-        if(e == ESP_OK) {
-            ESP_LOGD(TAG, "Setup page generated");
-        } else {
-            ESP_LOGE(TAG, "Error generating setup page: %s", esp_err_to_name(e));
-            httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
-        }
-    } else {
-        ESP_LOGE(TAG, "Error processing query string: %s", esp_err_to_name(e));
-        httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
+        ESP_LOGD(TAG, "Query string: %s", ctx->content);
+        // Search for reboot key
+        reboot = (httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, ctx->buffer, sizeof(ctx->buffer)) == ESP_OK);
     }
 
-    e = httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    e += httpd_resp_set_hdr(req, "Expires", "0");
-    if(e != ESP_OK) {
-        ESP_LOGE(TAG, "Error settings cache headers");
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    if(reboot) { // Reboot parameter found in query
+        e = esp32_manager_webconfig_page_reboot(&chunk); // Generate HTML
+    } else {
+        e = esp32_manager_webconfig_page_root(&chunk);
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_chunk_end(&chunk);
     }
-
-    e = httpd_resp_send(req, esp32_manager_webconfig_buffer, strlen(esp32_manager_webconfig_buffer));
     if(e == ESP_OK) {
         ESP_LOGD(TAG, "Response sent");
-        return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Error sending response");
-        return ESP_FAIL;
     }
+
+    if(reboot) {
+        ESP_LOGD(TAG, "Restarting in %d seconds", WEBCONFIG_MANAGER_REBOOT_DELAY / 1000);
+        vTaskDelay(WEBCONFIG_MANAGER_REBOOT_DELAY / portTICK_PERIOD_MS); // Wait before rebooting
+        esp_restart();
+    }
+
+    return (e == ESP_OK) ? ESP_OK : ESP_FAIL;
 }
 
-esp_err_t esp32_manager_webconfig_uri_handler_get(httpd_req_t * req)
+esp_err_t esp32_manager_webconfig_add_asset(const esp32_manager_webconfig_asset_t * asset)
 {
-    esp_err_t e;
-
-    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(esp32_manager_webconfig_content)-1);
-    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+    if(asset == NULL || asset->uri == NULL || asset->type == NULL || asset->start == NULL || asset->end < asset->start || asset->etag == NULL) {
+        ESP_LOGE(TAG, "Invalid asset");
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    // Get request query
-    e = httpd_req_get_url_query_str(req, esp32_manager_webconfig_content, recv_size);
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Query string: %s", esp32_manager_webconfig_content);
-        // Search for namespace key
-        e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-        if(e == ESP_OK) { // Requesting namespace page
-            // Get namespace handle
-            esp32_manager_namespace_t * namespace = NULL;
-            for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
-                if(esp32_manager_namespaces[i] != NULL) {
-                    if(!strcmp(esp32_manager_webconfig_buffer, esp32_manager_namespaces[i]->key)) {
-                        namespace = esp32_manager_namespaces[i];
-                        break;
-                    }
-                }
-            }
-            // if requested namespace exists
-            if(namespace != NULL) {
-                e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_ENTRY, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-                esp32_manager_entry_t * entry = NULL;
-                for(uint8_t i=0; i < namespace->size; ++i) {
-                    if(!strcmp(esp32_manager_webconfig_buffer, namespace->entries[i]->key)) {
-                        entry = namespace->entries[i];
-                        break;
-                    }
-                }
-                // if requested entry exists
-                if(entry != NULL) {
-                    // Print raw value on response buffer
-                    e = entry->to_string(entry, esp32_manager_webconfig_buffer);
-                    if(e == ESP_OK) {
-                        ESP_LOGD(TAG, "Entry %s.%s converted to %s", namespace->key, entry->key, esp32_manager_webconfig_buffer);
-                    } else {
-                        ESP_LOGE(TAG, "Error converting entry %s.%s to string", namespace->key, entry->key);
-                        strcpy(esp32_manager_webconfig_buffer, "Error: invalid format");
-                        httpd_resp_set_status(req, HTTPD_500);
-                    }
-                    ESP_LOGD(TAG, "Response content: %s", esp32_manager_webconfig_buffer);
-                } else {
-                    ESP_LOGE(TAG, "Requested namespace does not exist");
-                    strcpy(esp32_manager_webconfig_buffer, "ERROR: Requested setting does not exist");
-                    httpd_resp_set_status(req, HTTPD_404);
-                }
-            } else { // namespace does not exist
-                ESP_LOGE(TAG, "Requested namespace does not exist");
-                strcpy(esp32_manager_webconfig_buffer, "ERROR: Requested namespace does not exist");
-                httpd_resp_set_status(req, HTTPD_404);
-            }
-        } else if(e == ESP_ERR_NOT_FOUND) { // no namespace requested
-            ESP_LOGE(TAG, "No namespace found");
-            strcpy(esp32_manager_webconfig_buffer, "ERROR: No namespace found");
-            httpd_resp_set_status(req, HTTPD_404);
-        } else {
-            ESP_LOGE(TAG, "Error: query does not fit buffer: %s", esp_err_to_name(e));
-            strcpy(esp32_manager_webconfig_buffer, "ERROR: Query does not fit buffer");
-            httpd_resp_set_status(req, HTTPD_500);
+    for(uint8_t i=0; i < WEBCONFIG_MANAGER_ASSETS_SIZE; ++i) {
+        if(esp32_manager_webconfig_assets[i] == NULL) {
+            esp32_manager_webconfig_assets[i] = asset;
+            ESP_LOGD(TAG, "Asset %s added", asset->uri);
+            return ESP_OK;
         }
-    } else {
-        ESP_LOGE(TAG, "Error: no query string");
-        httpd_resp_set_status(req, HTTPD_404);
     }
 
-    e = httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    e += httpd_resp_set_hdr(req, "Expires", "0");
-    if(e != ESP_OK) {
-        ESP_LOGE(TAG, "Error settings cache headers");
-    }
+    ESP_LOGE(TAG, "No room for asset %s", asset->uri);
+    return ESP_ERR_NO_MEM;
+}
 
-    e = httpd_resp_send(req, esp32_manager_webconfig_buffer, strlen(esp32_manager_webconfig_buffer));
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Response sent");
-        return ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Error sending response");
-        return ESP_FAIL;
+/**
+ * Sets the ETag of a dynamic response, built from the sequence number of the last change of its
+ * content, and checks whether the client already has it. Call it inside the read-side section and
+ * before generating the response, so the content sent is never older than its ETag.
+ */
+static bool esp32_manager_webconfig_etag_match(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx, uint32_t seq)
+{
+    char if_none_match[48];
+
+    snprintf(ctx->etag, sizeof(ctx->etag), "\"%08x-%u\"", esp32_manager_webconfig_boot_id, seq);
+    if(httpd_resp_set_hdr(req, "ETag", ctx->etag) != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting ETag");
     }
+
+    return httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+            && strstr(if_none_match, ctx->etag) != NULL;
 }
 
-esp_err_t esp32_manager_webconfig_uri_handler_factory(httpd_req_t * req)
+/**
+ * Responds 304 Not Modified, with the headers already set
+ */
+static esp_err_t esp32_manager_webconfig_send_not_modified(httpd_req_t * req)
 {
-    esp_err_t e;
+    httpd_resp_set_status(req, "304 Not Modified");
+    return (httpd_resp_send(req, NULL, 0) == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
 
-    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(esp32_manager_webconfig_content)-1);
-    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+/**
+ * Checks whether the client accepts gzip. Without Accept-Encoding any encoding is acceptable.
+ * Codings with q=0 are refused, other weights are not compared.
+ */
+static bool esp32_manager_webconfig_accepts_gzip(httpd_req_t * req)
+{
+    char accept_encoding[96];
 
-    // Get request query
-    e = httpd_req_get_url_query_str(req, esp32_manager_webconfig_content, recv_size);
-    if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Query string: %s", esp32_manager_webconfig_content);
-        // Search for operation key
-        e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-        if(e == ESP_OK) { // Reboot requested
-            esp32_manager_webconfig_page_reboot(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH);
-            esp32_manager_webconfig_deferred_reboot(WEBCONFIG_MANAGER_REBOOT_DELAY);
-        }
-        e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-        if(e == ESP_OK) { // Factory reset requested
-            e = httpd_query_key_value(esp32_manager_webconfig_content, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, esp32_manager_webconfig_buffer, sizeof(esp32_manager_webconfig_buffer));
-            for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
-                esp32_manager_namespace_nvs_erase(esp32_manager_namespaces[i]);
-            }
-            esp32_manager_webconfig_page_reboot(esp32_manager_webconfig_buffer, req, WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH);
-            esp32_manager_webconfig_deferred_reboot(WEBCONFIG_MANAGER_REBOOT_DELAY);
+    if(httpd_req_get_hdr_value_len(req, "Accept-Encoding") == 0) {
+        return true;
+    }
+    if(httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding)) != ESP_OK) {
+        return false; // Too long to check, send it as if not accepted
+    }
+
+    char * saveptr;
+    for(char * coding = strtok_r(accept_encoding, ",", &saveptr); coding != NULL; coding = strtok_r(NULL, ",", &saveptr)) {
+        while(*coding == ' ' || *coding == '\t') ++coding;
+        size_t length = strcspn(coding, " \t;");
+        if(!((length == 4 && !strncasecmp(coding, "gzip", 4)) || (length == 6 && !strncasecmp(coding, "x-gzip", 6))
+                || (length == 1 && coding[0] == '*'))) continue;
+
+        const char * q = strstr(&coding[length], "q=");
+        if(q == NULL || strtod(&q[2], NULL) > 0) {
+            return true;
         }
     }
 
-    e = httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
-    e += httpd_resp_set_hdr(req, "Expires", "0");
+    return false;
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_asset(httpd_req_t *req)
+{
+    const esp32_manager_webconfig_asset_t * asset = (const esp32_manager_webconfig_asset_t *) req->user_ctx;
+    char if_none_match[48];
+    esp_err_t e;
+
+    e = httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=" WEBCONFIG_MANAGER_ASSET_MAX_AGE);
+    e += httpd_resp_set_hdr(req, "ETag", asset->etag);
+    e += httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
     if(e != ESP_OK) {
         ESP_LOGE(TAG, "Error settings cache headers");
     }
 
-    e = httpd_resp_send(req, esp32_manager_webconfig_buffer, strlen(esp32_manager_webconfig_buffer));
+    // Browser already has this version
+    if(httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+            && strstr(if_none_match, asset->etag) != NULL) {
+        ESP_LOGD(TAG, "Asset %s not modified", asset->uri);
+        return esp32_manager_webconfig_send_not_modified(req);
+    }
+
+    // Assets are only embedded gzipped, there is no other version to send
+    if(!esp32_manager_webconfig_accepts_gzip(req)) {
+        ESP_LOGW(TAG, "Asset %s requested without gzip support", asset->uri);
+        httpd_resp_set_status(req, "406 Not Acceptable");
+        httpd_resp_set_type(req, "text/plain");
+        return (httpd_resp_send(req, "gzip encoding required", 22) == ESP_OK) ? ESP_OK : ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    e = httpd_resp_send(req, (const char *) asset->start, asset->end - asset->start);
     if(e == ESP_OK) {
-        ESP_LOGD(TAG, "Response sent");
+        ESP_LOGD(TAG, "Asset %s sent", asset->uri);
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Error sending response");
@@ -503,133 +543,1452 @@ esp_err_t esp32_manager_webconfig_uri_handler_factory(httpd_req_t * req)
     }
 }
 
-esp_err_t esp32_manager_webconfig_page_root(char * buffer, httpd_req_t * req, size_t buffer_size)
+/**
+ * Receives a piece of a request body. Timeouts are retried WEBCONFIG_MANAGER_RECV_RETRIES times, so a
+ * client that stops sending does not keep the handler forever.
+ */
+static int esp32_manager_webconfig_recv(httpd_req_t * req, char * buffer, size_t length)
 {
-    if(req == NULL || buffer == NULL) {
-        ESP_LOGE(TAG, "req and buffer cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
+    int received = HTTPD_SOCK_ERR_TIMEOUT;
+    for(uint8_t retry=0; retry <= WEBCONFIG_MANAGER_RECV_RETRIES && received == HTTPD_SOCK_ERR_TIMEOUT; ++retry) {
+        received = httpd_req_recv(req, buffer, length);
     }
+    return received;
+}
 
-    // FIXME Buffer overrun protection
-
-    // TODO Show featured values on home page
-    // For now it is just a link to setup
-
-    strlcpy(buffer, "<html><head><link rel=\"stylesheet\" href=\"style.min.css\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_WEB_TITLE, buffer_size);
-    strlcat(buffer, "</head><body><p><a class=\"button\" href=\"/setup\">Setup</a></a></body>", buffer_size);
+/**
+ * Values received and not set yet. Request bodies are parsed into it outside of read-side sections,
+ * since receiving can block, and its values are set at once afterwards. Each entry of the namespace
+ * has a slot with the last value received for it, so it never holds more than the entries can.
+ */
+typedef struct {
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];
+    char ** records;    /*!< Per entry slot: type (1 byte), key and value, both null-terminated. NULL if not received. */
+    uint16_t size;      /*!< Slots, one per entry of the namespace */
+    uint16_t rejected;  /*!< Values without an entry or too long for it */
+    size_t value_size;  /*!< Longest value an entry of the namespace holds, and a number at least */
+} esp32_manager_webconfig_staging_t;
 
-    if(strlen(buffer) == (buffer_size -1)) {
-        return ESP_ERR_HTTPD_RESULT_TRUNC;
+/**
+ * Prepares a slot per entry of the namespace
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NOT_FOUND namespace not registered
+ *          ESP_ERR_NO_MEM not enough memory
+ */
+static esp_err_t esp32_manager_webconfig_staging_init(esp32_manager_webconfig_staging_t * staging, const char * namespace_key)
+{
+    memset(staging, 0, sizeof(esp32_manager_webconfig_staging_t));
+    strlcpy(staging->namespace_key, namespace_key, sizeof(staging->namespace_key));
+    staging->value_size = ESP32_MANAGER_NUMBER_MAX_LENGTH;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(namespace_key);
+    if(namespace == NULL) {
+        esp32_manager_read_exit(parity);
+        return ESP_ERR_NOT_FOUND;
+    }
+    staging->size = namespace->size;
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry != NULL) {
+            staging->value_size = MAX(staging->value_size, esp32_manager_entry_string_max_length(entry));
+        }
     }
+    esp32_manager_read_exit(parity);
 
+    staging->records = calloc(MAX(staging->size, 1), sizeof(char *));
+    if(staging->records == NULL) {
+        ESP_LOGE(TAG, "Not enough memory to stage the request");
+        return ESP_ERR_NO_MEM;
+    }
     return ESP_OK;
 }
 
-esp_err_t esp32_manager_webconfig_page_reboot(char * buffer, httpd_req_t * req, size_t buffer_size)
+static void esp32_manager_webconfig_staging_free(esp32_manager_webconfig_staging_t * staging)
 {
-    if(req == NULL || buffer == NULL) {
-        ESP_LOGE(TAG, "req and buffer cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    // FIXME Buffer overrun protection
-
-    strlcpy(buffer, "<html><head><link rel=\"stylesheet\" href=\"style.min.css\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_WEB_TITLE, buffer_size);
-    strlcat(buffer, "</head><body><h2>Rebooting device</h2><p>Wait 10 seconds before clicking <a href=\"/setup\">back</a> (Link might not work if network settings were changed)</p></body>", buffer_size);
-
-    if(strlen(buffer) == (buffer_size -1)) {
-        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    for(uint16_t i=0; i < staging->size && staging->records != NULL; ++i) {
+        free(staging->records[i]);
     }
-
-    return ESP_OK;
+    free(staging->records);
+    staging->records = NULL;
 }
 
-esp_err_t esp32_manager_webconfig_page_setup(char * buffer, httpd_req_t * req, size_t buffer_size)
+/**
+ * Stages a value in the slot of its entry, replacing one received before. Values without an entry,
+ * or longer than their entry holds, are counted as rejected.
+ */
+static esp_err_t esp32_manager_webconfig_staging_add(esp32_manager_webconfig_staging_t * staging, const char * key, const char * value, uint8_t type)
 {
-    if(req == NULL || buffer == NULL) {
-        ESP_LOGE(TAG, "req and buffer cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
+    uint16_t slot = staging->size;
+    size_t value_size = strlen(value) +1;
+    bool fits = false;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(staging->namespace_key);
+    for(uint16_t i=0; namespace != NULL && i < namespace->size && i < staging->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry != NULL && !strcmp(entry->key, key)) {
+            slot = i;
+            fits = (value_size -1 <= esp32_manager_entry_string_max_length(entry));
+            break;
+        }
     }
+    esp32_manager_read_exit(parity);
 
-    // FIXME Buffer overrun protection
-    ESP_LOGD(TAG, "Generating setup page");
-
-    strlcpy(buffer, "<html><head><link rel=\"stylesheet\" href=\"style.min.css\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_WEB_TITLE, buffer_size);
-    strlcat(buffer, "</head><body><ul>", buffer_size);
-    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
-        if(esp32_manager_namespaces[i] != NULL) {
-            strlcat(buffer, "<li><a href=\"/setup?namespace=", buffer_size);
-            strlcat(buffer, esp32_manager_namespaces[i]->key, buffer_size);
-            strlcat(buffer, "\">", buffer_size);
-            strlcat(buffer, esp32_manager_namespaces[i]->friendly, buffer_size);
-            strlcat(buffer, "</a></li>", buffer_size);
-        }
+    if(slot == staging->size || !fits) {
+        ESP_LOGD(TAG, "Field %s not staged: no entry, or too long for it", key);
+        ++staging->rejected;
+        return ESP_OK;
     }
-    strlcat(buffer, "</ul><a class=\"button button-outline\" href=\"/factory?", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, buffer_size);
-    strlcat(buffer, "=1\">Reboot device</a><a class=\"button button-clear\" href=\"/factory?", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, buffer_size);
-    strlcat(buffer, "=1\">Factory reset</a></body></html>", buffer_size);
 
-    if(strlen(buffer) == (buffer_size -1)) {
-        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    size_t key_size = strlen(key) +1;
+    char * record = malloc(1 + key_size + value_size);
+    if(record == NULL) {
+        ESP_LOGE(TAG, "Not enough memory to stage the request");
+        return ESP_ERR_NO_MEM;
     }
+    record[0] = (char) type;
+    memcpy(&record[1], key, key_size);
+    memcpy(&record[1 + key_size], value, value_size);
 
+    free(staging->records[slot]);
+    staging->records[slot] = record;
     return ESP_OK;
 }
 
-esp_err_t esp32_manager_webconfig_page_setup_namespace(char * buffer, httpd_req_t * req, esp32_manager_namespace_t * namespace, size_t buffer_size)
-{
-    if(req == NULL || buffer == NULL || namespace == NULL) {
+/**
+ * Reads the record of the next slot with a value from position on and moves position after it
+ *
+ * @return  false once there are no more records
+ */
+static bool esp32_manager_webconfig_staging_next(esp32_manager_webconfig_staging_t * staging, size_t * position, uint8_t * type, const char ** key, char ** value)
+{
+    while(*position < staging->size && staging->records[*position] == NULL) {
+        ++*position;
+    }
+    if(*position >= staging->size) {
+        return false;
+    }
+    char * record = staging->records[(*position)++];
+    *type = (uint8_t) record[0];
+    *key = &record[1];
+    *value = &record[1 + strlen(*key) +1];
+    return true;
+}
+
+/**
+ * Form parser callback. Fields are staged and set once the whole form is received.
+ */
+static esp_err_t esp32_manager_webconfig_setup_field(const char * key, char * value, void * arg)
+{
+    ESP_LOGD(TAG, "Value after decoding: %s", value);
+    return esp32_manager_webconfig_staging_add((esp32_manager_webconfig_staging_t *) arg, key, value, 0);
+}
+
+/**
+ * Receives and parses the setup form into the staging buffer. ctx->content holds the query string.
+ */
+static esp_err_t esp32_manager_webconfig_setup_receive(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx, esp32_manager_webconfig_staging_t * staging)
+{
+    esp32_manager_webconfig_form_parser_t parser;
+    esp_err_t e = ESP_OK;
+
+    // Fields are decoded into the value buffer as they are parsed, and staged in the slot of their entry.
+    // The buffer holds the longest value of the namespace, longer fields could not be set anyway.
+    char * value = ctx->buffer;
+    size_t value_size = staging->value_size;
+    if(value_size > WEBCONFIG_MANAGER_BUFFER_SIZE) {
+        value = malloc(value_size +1);
+        if(value == NULL) {
+            ESP_LOGE(TAG, "Not enough memory to receive the form");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    esp32_manager_webconfig_form_parser_init(&parser, value, value_size, esp32_manager_webconfig_setup_field, staging);
+    if(req->method == HTTP_POST) { // Form submitted in the body, received in pieces into the no longer needed query buffer
+        size_t remaining = req->content_len;
+        while(remaining > 0 && e == ESP_OK) {
+            int received = esp32_manager_webconfig_recv(req, ctx->content, MIN(remaining, sizeof(ctx->content) -1));
+            if(received <= 0) {
+                ESP_LOGE(TAG, "Error receiving form");
+                e = ESP_FAIL;
+                break;
+            }
+            remaining -= received;
+            e = esp32_manager_webconfig_form_parse(&parser, ctx->content, received);
+        }
+    } else { // Form submitted in the query string
+        e = esp32_manager_webconfig_form_parse(&parser, ctx->content, strlen(ctx->content));
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_form_parser_end(&parser);
+    }
+
+    if(value != ctx->buffer) {
+        free(value);
+    }
+    return e;
+}
+
+/**
+ * Sets the entries of a namespace staged from the setup form. Other fields are ignored.
+ *
+ * @return  number of entries set
+ */
+static uint16_t esp32_manager_webconfig_setup_apply(esp32_manager_namespace_t * namespace, esp32_manager_webconfig_staging_t * staging)
+{
+    uint16_t updated = 0;
+    size_t position = 0;
+    uint8_t type;
+    const char * key;
+    char * value;
+
+    while(esp32_manager_webconfig_staging_next(staging, &position, &type, &key, &value)) {
+        esp32_manager_entry_t * entry = esp32_manager_find_entry(namespace, key);
+        if(entry == NULL) { // namespace and other parameters
+            continue;
+        }
+
+        if(esp32_manager_entry_set_from_string(namespace, entry, value) == ESP_OK) {
+            ESP_LOGD(TAG, "Entry %s.%s updated", namespace->key, entry->key);
+            ++updated;
+        } else {
+            ESP_LOGE(TAG, "Error updating entry %s.%s to %s", namespace->key, entry->key, value);
+        }
+    }
+    return updated;
+}
+
+/**
+ * Resets the entries of a namespace to their defaults and erases them from NVS. Only entries whose value
+ * changed are notified.
+ */
+static esp_err_t esp32_manager_webconfig_restore_defaults(const char * namespace_key)
+{
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(namespace_key);
+    if(namespace == NULL) {
+        esp32_manager_read_exit(parity);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t * snapshot = esp32_manager_entries_snapshot(namespace, 0, namespace->size);
+    esp_err_t e = esp32_manager_reset_namespace(namespace);
+    esp32_manager_entries_notify(namespace, snapshot, 0, namespace->size); // Entries reset before an error changed too
+    free(snapshot);
+    esp32_manager_read_exit(parity);
+
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error resetting namespace %s entry values", namespace_key);
+        return e;
+    }
+    ESP_LOGD(TAG, "Namespace %s entry values reset", namespace_key);
+
+    // Erasing can wait on flash, so not in the read-side section. With a handle of its own, the namespace
+    // can be unregistered in the meantime.
+    nvs_handle handle;
+    e = nvs_open(namespace_key, NVS_READWRITE, &handle);
+    if(e == ESP_OK) {
+        e = nvs_erase_all(handle);
+        if(e == ESP_OK) {
+            e = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Namespace %s erased from NVS", namespace_key);
+    } else {
+        ESP_LOGE(TAG, "Error erasing namespace %s from NVS: %s", namespace_key, esp_err_to_name(e));
+    }
+    return e;
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_setup(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    esp32_manager_namespace_t * page_namespace = NULL; // Namespace page to respond with, setup page if NULL
+    bool cacheable = (req->method == HTTP_GET); // Page can be revalidated with its ETag
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1] = ""; // Namespace requested, empty for the setup page
+    bool factory_reset = false;
+    esp32_manager_webconfig_staging_t staging = { 0 };
+
+    // Calculate size of request query
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+
+    // Get request query. The form is received before entering the read-side section, receiving can block.
+    e = httpd_req_get_url_query_str(req, ctx->content, recv_size);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Query string: %s", ctx->content);
+        // Search for namespace key
+        e = httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, ctx->buffer, sizeof(ctx->buffer));
+        if(e == ESP_OK) { // Requesting namespace page
+            if(strlen(ctx->buffer) < sizeof(namespace_key)) { // Longer keys are not registered
+                strcpy(namespace_key, ctx->buffer);
+            }
+            // Check if there are settings to update
+            factory_reset = (httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, ctx->buffer, sizeof(ctx->buffer)) == ESP_OK);
+            if(!factory_reset && namespace_key[0] != 0) {
+                e = esp32_manager_webconfig_staging_init(&staging, namespace_key);
+                if(e == ESP_OK) {
+                    e = esp32_manager_webconfig_setup_receive(req, ctx, &staging);
+                }
+                if(e != ESP_OK && e != ESP_ERR_NOT_FOUND) { // Nothing is set from an incomplete form. Unknown namespaces are answered below.
+                    ESP_LOGE(TAG, "Error receiving setup form: %s", esp_err_to_name(e));
+                    esp32_manager_webconfig_staging_free(&staging);
+                    if(e == ESP_ERR_INVALID_SIZE || e == ESP_ERR_NO_MEM) {
+                        httpd_resp_set_status(req, HTTPD_500);
+                        return (httpd_resp_send(req, "Form too large", 14) == ESP_OK) ? ESP_OK : ESP_FAIL;
+                    }
+                    return ESP_FAIL; // Connection lost or timed out, it is closed
+                }
+            }
+        } else if(e != ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "Error: query does not fit buffer: %s", esp_err_to_name(e));
+            httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
+            cacheable = false;
+        } // no namespace requested, return setup page
+    } else if(e == ESP_ERR_NOT_FOUND) { // there is no query string
+        ESP_LOGD(TAG, "No query string. Returning setup page.");
+    } else {
+        ESP_LOGE(TAG, "Error processing query string: %s", esp_err_to_name(e));
+        httpd_resp_set_status(req, HTTPD_500); // Set response to error 500
+        cacheable = false;
+    }
+
+    if(factory_reset && namespace_key[0] != 0) {
+        esp32_manager_webconfig_restore_defaults(namespace_key);
+    }
+
+    // Namespaces and entries looked up below stay valid until the response is generated
+    uint8_t parity = esp32_manager_read_enter();
+
+    if(namespace_key[0] != 0) {
+        esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(namespace_key);
+        // if namespace requested exists
+        if(namespace != NULL) {
+            ESP_LOGD(TAG, "Selected namespace %s", namespace->key);
+            uint16_t entry_updated = 0; // Flag to mark if any settings were changed
+            if(!factory_reset) { // Defaults were restored above
+                entry_updated = esp32_manager_webconfig_setup_apply(namespace, &staging);
+            }
+            if(entry_updated > 0) {
+                e = esp32_manager_commit_to_nvs(namespace); // Commit changes to namespace
+                if(e == ESP_OK) {
+                    ESP_LOGD(TAG, "Entries updated and commited to NVS");
+                } else {
+                    ESP_LOGE(TAG, "Error commiting changes to NVS: %s", esp_err_to_name(e));
+                }
+            }
+            page_namespace = namespace;
+        } else { // namespace does not exist
+            ESP_LOGW(TAG, "Requested namespace does not exist");
+        }
+    }
+    esp32_manager_webconfig_staging_free(&staging);
+
+    uint32_t seq = esp32_manager_journal_seq(); // Namespaces listed change with registrations, which take a sequence number too
+    if(page_namespace != NULL) {
+        seq = page_namespace->modified_seq;
+        for(uint16_t i=0; i < page_namespace->size && cacheable; ++i) {
+            esp32_manager_entry_t * entry = page_namespace->entries[i];
+            // Custom widgets can show anything, such as the networks in range, not only entry values
+            cacheable = (entry == NULL || entry->html_form_widget == NULL);
+        }
+    }
+
+    // Cacheable pages are kept by browsers and revalidated on every visit
+    e = httpd_resp_set_hdr(req, "Cache-Control", cacheable ? "no-cache" : "no-cache, no-store, must-revalidate");
+    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
+    e += httpd_resp_set_hdr(req, "Expires", "0");
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error settings cache headers");
+    }
+
+    if(cacheable && esp32_manager_webconfig_etag_match(req, ctx, seq)) {
+        esp32_manager_read_exit(parity);
+        ESP_LOGD(TAG, "Setup page not modified");
+        return esp32_manager_webconfig_send_not_modified(req);
+    }
+
+    // Generate response, sent as it is generated
+    esp32_manager_webconfig_chunk_t chunk;
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    if(page_namespace != NULL) {
+        e = esp32_manager_webconfig_page_setup_namespace(&chunk, page_namespace);
+    } else {
+        e = esp32_manager_webconfig_page_setup(&chunk);
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_chunk_end(&chunk);
+    }
+
+    esp32_manager_read_exit(parity);
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Response sent");
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending response: %s", esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * Cache headers of single entry reads
+ */
+static void esp32_manager_webconfig_get_cache_headers(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    // Values with an ETag are kept by clients and revalidated on every read
+    esp_err_t e = httpd_resp_set_hdr(req, "Cache-Control", (ctx->etag[0] != 0) ? "no-cache" : "no-cache, no-store, must-revalidate");
+    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
+    e += httpd_resp_set_hdr(req, "Expires", "0");
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error settings cache headers");
+    }
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_get(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+
+    // Namespaces and entries looked up below stay valid until the response is generated
+    uint8_t parity = esp32_manager_read_enter();
+
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+
+    // Get request query
+    e = httpd_req_get_url_query_str(req, ctx->content, recv_size);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Query string: %s", ctx->content);
+        // Search for prefix key
+        char prefix[ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH +1];
+        e = httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_PREFIX, prefix, sizeof(prefix));
+        if(e == ESP_OK) { // Bulk read of entries by key prefix, optionally within a namespace. Sent in chunks.
+            esp32_manager_webconfig_chunk_t chunk;
+            esp32_manager_webconfig_query_t query = {
+                .chunk = &chunk
+            };
+            if(httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, query.namespace_key, sizeof(query.namespace_key)) != ESP_OK) {
+                query.namespace_key[0] = 0; // No namespace, search all of them
+            }
+            httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+            esp32_manager_namespace_t * namespace = (query.namespace_key[0] != 0) ? esp32_manager_find_namespace(query.namespace_key) : NULL;
+            if(esp32_manager_webconfig_etag_match(req, ctx, (namespace != NULL) ? namespace->modified_seq : esp32_manager_journal_seq())) {
+                esp32_manager_read_exit(parity);
+                ESP_LOGD(TAG, "Bulk read of prefix %s not modified", prefix);
+                return esp32_manager_webconfig_send_not_modified(req);
+            }
+            esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+            e = esp32_manager_query_prefix(query.namespace_key, prefix, esp32_manager_webconfig_query_prefix_cb, &query);
+            if(e == ESP_OK) {
+                e = esp32_manager_webconfig_chunk_end(&chunk);
+            }
+            esp32_manager_read_exit(parity);
+            if(e == ESP_OK) {
+                ESP_LOGD(TAG, "Bulk read of prefix %s sent", prefix);
+                return ESP_OK;
+            } else {
+                ESP_LOGE(TAG, "Error reading entries with prefix %s: %s", prefix, esp_err_to_name(e));
+                return ESP_FAIL;
+            }
+        } else {
+            // Search for namespace key
+            e = httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, ctx->buffer, sizeof(ctx->buffer));
+            if(e == ESP_OK) { // Requesting namespace page
+                // Get namespace handle
+                esp32_manager_namespace_t * namespace = NULL;
+                for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+                    esp32_manager_namespace_t * candidate = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+                    if(candidate != NULL) {
+                        if(!strcmp(ctx->buffer, candidate->key)) {
+                            namespace = candidate;
+                            break;
+                        }
+                    }
+                }
+                // if requested namespace exists
+                if(namespace != NULL) {
+                    e = httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_ENTRY, ctx->buffer, sizeof(ctx->buffer));
+                    esp32_manager_entry_t * entry = NULL;
+                    for(uint8_t i=0; i < namespace->size; ++i) {
+                        esp32_manager_entry_t * candidate = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+                        if(candidate != NULL && !strcmp(ctx->buffer, candidate->key)) {
+                            entry = candidate;
+                            break;
+                        }
+                    }
+                    // Value not changed since the client read it, nothing to convert or send
+                    if(entry != NULL && esp32_manager_webconfig_etag_match(req, ctx, entry->modified_seq)) {
+                        esp32_manager_read_exit(parity);
+                        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+                        ESP_LOGD(TAG, "Entry %s.%s not modified", namespace->key, entry->key);
+                        return esp32_manager_webconfig_send_not_modified(req);
+                    }
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+                    if(entry != NULL && (entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+                        // Sent straight from mapped flash. The slot is not erased until the read-side section ends.
+                        e = esp32_manager_webconfig_send_mmap(req, entry);
+                        esp32_manager_read_exit(parity);
+                        return e;
+                    }
+#endif
+                    if(entry != NULL && (entry->type == text || entry->type == password)) {
+                        // Strings can be longer than the buffer, they are streamed as they are
+                        esp32_manager_webconfig_chunk_t chunk;
+                        esp32_manager_webconfig_get_cache_headers(req, ctx);
+                        esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+                        esp32_manager_webconfig_chunk_puts(&chunk, (char *) entry->value);
+                        e = esp32_manager_webconfig_chunk_end(&chunk);
+                        esp32_manager_read_exit(parity);
+                        if(e != ESP_OK) {
+                            ESP_LOGE(TAG, "Error sending entry %s.%s", namespace->key, entry->key);
+                            return ESP_FAIL;
+                        }
+                        ESP_LOGD(TAG, "Entry %s.%s sent", namespace->key, entry->key);
+                        return ESP_OK;
+                    }
+                    // if requested entry exists
+                    if(entry != NULL) {
+                        // Numbers are short, print raw value on response buffer
+                        e = entry->to_string(entry, ctx->buffer, sizeof(ctx->buffer));
+                        if(e == ESP_OK) {
+                            ESP_LOGD(TAG, "Entry %s.%s converted to %s", namespace->key, entry->key, ctx->buffer);
+                        } else {
+                            ESP_LOGE(TAG, "Error converting entry %s.%s to string", namespace->key, entry->key);
+                            strcpy(ctx->buffer, "Error: invalid format");
+                            httpd_resp_set_status(req, HTTPD_500);
+                        }
+                        ESP_LOGD(TAG, "Response content: %s", ctx->buffer);
+                    } else {
+                        ESP_LOGE(TAG, "Requested namespace does not exist");
+                        strcpy(ctx->buffer, "ERROR: Requested setting does not exist");
+                        httpd_resp_set_status(req, HTTPD_404);
+                    }
+                } else { // namespace does not exist
+                    ESP_LOGE(TAG, "Requested namespace does not exist");
+                    strcpy(ctx->buffer, "ERROR: Requested namespace does not exist");
+                    httpd_resp_set_status(req, HTTPD_404);
+                }
+            } else if(e == ESP_ERR_NOT_FOUND) { // no namespace requested
+                ESP_LOGE(TAG, "No namespace found");
+                strcpy(ctx->buffer, "ERROR: No namespace found");
+                httpd_resp_set_status(req, HTTPD_404);
+            } else {
+                ESP_LOGE(TAG, "Error: query does not fit buffer: %s", esp_err_to_name(e));
+                strcpy(ctx->buffer, "ERROR: Query does not fit buffer");
+                httpd_resp_set_status(req, HTTPD_500);
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Error: no query string");
+        httpd_resp_set_status(req, HTTPD_404);
+    }
+
+    esp32_manager_read_exit(parity);
+
+    esp32_manager_webconfig_get_cache_headers(req, ctx);
+    e = httpd_resp_send(req, ctx->buffer, strlen(ctx->buffer));
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Response sent");
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending response");
+        return ESP_FAIL;
+    }
+}
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+esp_err_t esp32_manager_webconfig_send_mmap(httpd_req_t * req, esp32_manager_entry_t * entry)
+{
+    const void * data;
+    size_t length;
+
+    if(esp32_manager_mmap_get(entry, &data, &length) != ESP_OK) {
+        httpd_resp_set_status(req, HTTPD_404);
+        return httpd_resp_send(req, "ERROR: Value not set", -1);
+    }
+
+    httpd_resp_set_type(req, (entry->type == text || entry->type == password) ? "text/plain" : "application/octet-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache"); // Revalidated with the ETag of the entry
+    if(httpd_resp_send(req, (const char *) data, length) != ESP_OK) {
+        ESP_LOGE(TAG, "Error sending entry %s", entry->key);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Entry %s: %u bytes sent from mapped flash", entry->key, length);
+    return ESP_OK;
+}
+#endif
+
+esp_err_t esp32_manager_webconfig_query_prefix_cb(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg)
+{
+    esp32_manager_webconfig_query_t * query = (esp32_manager_webconfig_query_t *) arg;
+
+    if(query->namespace_key[0] != 0 && strcmp(namespace->key, query->namespace_key) != 0) {
+        return ESP_OK; // Only a namespace key prefix match
+    }
+
+    // [namespace.key].[entry.key]=[value]\n
+    esp32_manager_webconfig_chunk_printf(query->chunk, "%s.%s=", namespace->key, entry->key);
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) { // Read on its own with the get uri
+        esp32_manager_webconfig_chunk_puts(query->chunk, "NULL");
+    } else if(entry->type == text || entry->type == password) { // Streamed, whatever its length
+        esp32_manager_webconfig_chunk_puts(query->chunk, (char *) entry->value);
+    } else if(entry->type == single_choice) {
+        uint8_t selected = *((uint8_t *) entry->value);
+        esp32_manager_webconfig_chunk_puts(query->chunk, (selected < entry->choices->size) ? entry->choices->keys[selected] : "NULL");
+    } else if(entry->type == multiple_choice) { // Comma-separated list of selected option keys
+        bool first = true;
+        for(uint16_t i=0; i < entry->choices->size; ++i) {
+            if(ESP32_MANAGER_CHOICES_BITSET_GET(entry->value, i)) {
+                if(!first) esp32_manager_webconfig_chunk_puts(query->chunk, ",");
+                esp32_manager_webconfig_chunk_puts(query->chunk, entry->choices->keys[i]);
+                first = false;
+            }
+        }
+    } else if(esp32_manager_webconfig_chunk_entry_value(query->chunk, entry) != ESP_OK) {
+        esp32_manager_webconfig_chunk_puts(query->chunk, "NULL");
+    }
+
+    return esp32_manager_webconfig_chunk_puts(query->chunk, "\n");
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_history(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];
+    char entry_key[ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH +1];
+    char param[8];
+    uint8_t tier = 0;
+    bool binary = false;
+
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    e = httpd_req_get_url_query_str(req, ctx->content, recv_size);
+    if(e != ESP_OK
+            || httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE, namespace_key, sizeof(namespace_key)) != ESP_OK
+            || httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_ENTRY, entry_key, sizeof(entry_key)) != ESP_OK) {
+        ESP_LOGE(TAG, "Error: history requires namespace and entry");
+        httpd_resp_set_status(req, HTTPD_404);
+        return httpd_resp_send(req, "ERROR: namespace and entry required", -1);
+    }
+    if(httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_TIER, param, sizeof(param)) == ESP_OK) {
+        tier = (uint8_t) atoi(param);
+    }
+    if(httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_FORMAT, param, sizeof(param)) == ESP_OK) {
+        binary = !strcmp(param, "bin");
+    }
+
+    uint8_t parity = esp32_manager_read_enter();
+
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(namespace_key);
+    esp32_manager_entry_t * entry = esp32_manager_find_entry(namespace, entry_key);
+    if(entry == NULL || entry->history == NULL || tier >= entry->history->size) {
+        esp32_manager_read_exit(parity);
+        ESP_LOGE(TAG, "Requested history does not exist");
+        httpd_resp_set_status(req, HTTPD_404);
+        return httpd_resp_send(req, "ERROR: Requested history does not exist", -1);
+    }
+
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "text/csv");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
+
+    // Stream samples in chunks, oldest first, so the response does not need to fit a buffer
+    esp32_manager_webconfig_chunk_t chunk;
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    esp32_manager_history_sample_t sample;
+    uint16_t count = esp32_manager_history_count(entry->history, tier);
+    e = ESP_OK;
+    for(uint16_t i=0; i < count && e == ESP_OK; ++i) {
+        if(esp32_manager_history_get(entry->history, tier, i, &sample) != ESP_OK) break; // Ring wrapped while streaming
+        if(binary) { // [timestamp u32 LE][value float LE]
+            e = esp32_manager_webconfig_chunk_write(&chunk, &sample, sizeof(sample));
+        } else {
+            e = esp32_manager_webconfig_chunk_printf(&chunk, "%u,%g\n", sample.timestamp, sample.value);
+        }
+    }
+
+    esp32_manager_read_exit(parity);
+
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_chunk_end(&chunk);
+    }
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "History of %s.%s sent: %u samples", namespace_key, entry_key, count);
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending history");
+        return ESP_FAIL;
+    }
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_changes(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    char param[12];
+    uint32_t since = 0;
+
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    if(httpd_req_get_url_query_str(req, ctx->content, recv_size) == ESP_OK
+            && httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_SINCE, param, sizeof(param)) == ESP_OK) {
+        since = strtoul(param, NULL, 10);
+    }
+
+    esp32_manager_webconfig_chunk_t chunk;
+    esp32_manager_webconfig_query_t query = {
+        .namespace_key = "",
+        .chunk = &chunk
+    };
+
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
+
+    uint8_t parity = esp32_manager_read_enter();
+
+    // Changes after seq are left for the next poll
+    uint32_t seq = esp32_manager_journal_seq();
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    esp32_manager_webconfig_chunk_printf(&chunk, "seq=%u\n", seq);
+    e = esp32_manager_journal_since(since, seq, esp32_manager_webconfig_query_prefix_cb, &query);
+    if(e == ESP_ERR_INVALID_STATE) { // Client is too far behind. Clients drop the lines before the resync marker.
+        ESP_LOGD(TAG, "Changes since %u not available, full resync needed", since);
+        e = esp32_manager_webconfig_chunk_puts(&chunk, "resync\n");
+    }
+
+    esp32_manager_read_exit(parity);
+
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_chunk_end(&chunk);
+    }
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Changes from %u to %u sent", since, seq);
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending changes");
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * Sends a JSON error response
+ */
+static esp_err_t esp32_manager_webconfig_api_error(httpd_req_t * req, const char * status, const char * message)
+{
+    esp32_manager_webconfig_chunk_t chunk;
+    char buffer[64];
+
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    esp32_manager_webconfig_chunk_init(&chunk, req, buffer, sizeof(buffer) -1);
+    esp32_manager_webconfig_chunk_puts(&chunk, "{\"error\":");
+    esp32_manager_webconfig_chunk_json_string(&chunk, message);
+    esp32_manager_webconfig_chunk_puts(&chunk, "}");
+    return (esp32_manager_webconfig_chunk_end(&chunk) == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * Finds the namespace whose key follows WEBCONFIG_MANAGER_URI_API_NAMESPACES_URL in the uri.
+ * Call it inside a read-side section.
+ */
+static esp32_manager_namespace_t * esp32_manager_webconfig_api_namespace(httpd_req_t * req)
+{
+    char key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];
+    const char * start = req->uri + strlen(WEBCONFIG_MANAGER_URI_API_NAMESPACES_URL "/");
+    size_t length = strcspn(start, "?/");
+
+    if(strlen(req->uri) < strlen(WEBCONFIG_MANAGER_URI_API_NAMESPACES_URL "/") || length == 0 || length >= sizeof(key)) {
+        return NULL;
+    }
+    memcpy(key, start, length);
+    key[length] = 0;
+
+    return esp32_manager_find_namespace(key);
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_api_namespaces(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    esp32_manager_webconfig_chunk_t chunk;
+    bool first = true;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    uint8_t parity = esp32_manager_read_enter();
+    if(esp32_manager_webconfig_etag_match(req, ctx, esp32_manager_journal_seq())) {
+        esp32_manager_read_exit(parity);
+        ESP_LOGD(TAG, "Namespace list not modified");
+        return esp32_manager_webconfig_send_not_modified(req);
+    }
+
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    esp32_manager_webconfig_chunk_puts(&chunk, "[");
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace == NULL) continue;
+
+        uint16_t entries = 0;
+        for(uint16_t j=0; j < namespace->size; ++j) {
+            if(namespace->entries[j] != NULL) ++entries;
+        }
+
+        // {"key":[key],"friendly":[friendly],"entries":[entries],"modified_seq":[modified_seq]}
+        esp32_manager_webconfig_chunk_puts(&chunk, first ? "{\"key\":" : ",{\"key\":");
+        esp32_manager_webconfig_chunk_json_string(&chunk, namespace->key);
+        esp32_manager_webconfig_chunk_puts(&chunk, ",\"friendly\":");
+        esp32_manager_webconfig_chunk_json_string(&chunk, namespace->friendly);
+        esp32_manager_webconfig_chunk_printf(&chunk, ",\"entries\":%u,\"modified_seq\":%u}", entries, namespace->modified_seq);
+        first = false;
+    }
+    esp32_manager_read_exit(parity);
+    esp32_manager_webconfig_chunk_puts(&chunk, "]");
+
+    e = esp32_manager_webconfig_chunk_end(&chunk);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Namespace list sent");
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending namespace list");
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * Adds an entry of a namespace as a JSON object
+ */
+static void esp32_manager_webconfig_api_entry(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_entry_t * entry)
+{
+    static const char * const attribute_names[] = { "read", "write", NULL, "no_flash", "compress", "mmap" };
+    bool first = true;
+
+    esp32_manager_webconfig_chunk_puts(chunk, "{\"key\":");
+    esp32_manager_webconfig_chunk_json_string(chunk, entry->key);
+    esp32_manager_webconfig_chunk_puts(chunk, ",\"friendly\":");
+    esp32_manager_webconfig_chunk_json_string(chunk, entry->friendly);
+    esp32_manager_webconfig_chunk_printf(chunk, ",\"type\":\"%s\",\"attributes\":[",
+            (entry->type <= image) ? esp32_manager_webconfig_type_names[entry->type] : "unknown");
+    for(uint8_t i=0; i < sizeof(attribute_names) / sizeof(attribute_names[0]); ++i) {
+        if(attribute_names[i] != NULL && (entry->attributes & (1 << i)) != 0) {
+            esp32_manager_webconfig_chunk_printf(chunk, first ? "\"%s\"" : ",\"%s\"", attribute_names[i]);
+            first = false;
+        }
+    }
+    esp32_manager_webconfig_chunk_printf(chunk, "],\"modified_seq\":%u", entry->modified_seq);
+
+    if(entry->type == single_choice || entry->type == multiple_choice) {
+        esp32_manager_webconfig_chunk_puts(chunk, ",\"choices\":[");
+        for(uint16_t i=0; i < entry->choices->size; ++i) {
+            if(i > 0) esp32_manager_webconfig_chunk_puts(chunk, ",");
+            esp32_manager_webconfig_chunk_json_string(chunk, entry->choices->keys[i]);
+        }
+        esp32_manager_webconfig_chunk_puts(chunk, "]");
+    }
+
+    esp32_manager_webconfig_chunk_puts(chunk, ",\"value\":");
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) { // Read with /get, only its size is listed
+        const void * data;
+        size_t length = 0;
+        esp32_manager_mmap_get(entry, &data, &length);
+        esp32_manager_webconfig_chunk_printf(chunk, "null,\"size\":%u}", length);
+        return;
+    }
+#endif
+    switch(entry->type) {
+        case flt:
+            if(isfinite(*((float *) entry->value))) {
+                esp32_manager_webconfig_chunk_entry_value(chunk, entry);
+            } else {
+                esp32_manager_webconfig_chunk_puts(chunk, "null"); // NaN and infinity are not valid JSON
+            }
+        break;
+        case dbl:
+            if(isfinite(*((double *) entry->value))) {
+                esp32_manager_webconfig_chunk_entry_value(chunk, entry);
+            } else {
+                esp32_manager_webconfig_chunk_puts(chunk, "null");
+            }
+        break;
+        case i8:
+        case u8:
+        case i16:
+        case u16:
+        case i32:
+        case u32:
+        case i64:
+        case u64:
+            esp32_manager_webconfig_chunk_entry_value(chunk, entry);
+        break;
+        case text:
+        case password:
+            esp32_manager_webconfig_chunk_json_string(chunk, (char *) entry->value);
+        break;
+        case single_choice:
+            if(*((uint8_t *) entry->value) < entry->choices->size) {
+                esp32_manager_webconfig_chunk_json_string(chunk, entry->choices->keys[*((uint8_t *) entry->value)]);
+            } else {
+                esp32_manager_webconfig_chunk_puts(chunk, "null");
+            }
+        break;
+        case multiple_choice: // Array of the selected option keys
+            first = true;
+            esp32_manager_webconfig_chunk_puts(chunk, "[");
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                if(ESP32_MANAGER_CHOICES_BITSET_GET(entry->value, i)) {
+                    if(!first) esp32_manager_webconfig_chunk_puts(chunk, ",");
+                    esp32_manager_webconfig_chunk_json_string(chunk, entry->choices->keys[i]);
+                    first = false;
+                }
+            }
+            esp32_manager_webconfig_chunk_puts(chunk, "]");
+        break;
+        default: // blob and image
+            esp32_manager_webconfig_chunk_puts(chunk, "null");
+        break;
+    }
+    esp32_manager_webconfig_chunk_puts(chunk, "}");
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_api_namespace(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    esp32_manager_webconfig_chunk_t chunk;
+    bool first = true;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_webconfig_api_namespace(req);
+    if(namespace == NULL) {
+        esp32_manager_read_exit(parity);
+        return esp32_manager_webconfig_api_error(req, HTTPD_404, "Namespace not found");
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if(esp32_manager_webconfig_etag_match(req, ctx, namespace->modified_seq)) {
+        esp32_manager_read_exit(parity);
+        ESP_LOGD(TAG, "Namespace %s not modified", namespace->key);
+        return esp32_manager_webconfig_send_not_modified(req);
+    }
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+
+    // {"key":[key],"friendly":[friendly],"modified_seq":[modified_seq],"entries":[...]}
+    esp32_manager_webconfig_chunk_puts(&chunk, "{\"key\":");
+    esp32_manager_webconfig_chunk_json_string(&chunk, namespace->key);
+    esp32_manager_webconfig_chunk_puts(&chunk, ",\"friendly\":");
+    esp32_manager_webconfig_chunk_json_string(&chunk, namespace->friendly);
+    esp32_manager_webconfig_chunk_printf(&chunk, ",\"modified_seq\":%u,\"entries\":[", namespace->modified_seq);
+    for(uint16_t i=0; i < namespace->size; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry == NULL) continue;
+        if(!first) esp32_manager_webconfig_chunk_puts(&chunk, ",");
+        esp32_manager_webconfig_api_entry(&chunk, entry);
+        first = false;
+    }
+    esp32_manager_webconfig_chunk_puts(&chunk, "]}");
+
+    e = esp32_manager_webconfig_chunk_end(&chunk);
+    esp32_manager_read_exit(parity);
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Namespace %s sent as JSON", namespace->key);
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending namespace as JSON");
+        return ESP_FAIL;
+    }
+}
+
+/**
+ * State of a bulk update
+ */
+typedef struct {
+    esp32_manager_namespace_t * namespace;
+    uint16_t updated;   /*!< Entries set */
+    uint16_t failed;    /*!< Members not matching a writable entry, or with invalid values */
+} esp32_manager_webconfig_api_update_t;
+
+/**
+ * JSON parser callback. Members are staged and set once the whole body is received and valid.
+ */
+static esp_err_t esp32_manager_webconfig_api_update_cb(const char * key, char * value, esp32_manager_json_type_t type, void * arg)
+{
+    return esp32_manager_webconfig_staging_add((esp32_manager_webconfig_staging_t *) arg, key, value, (uint8_t) type);
+}
+
+/**
+ * Sets the entry with the key of a staged member
+ */
+static void esp32_manager_webconfig_api_update_apply(esp32_manager_webconfig_api_update_t * update, const char * key, char * value, esp32_manager_json_type_t type)
+{
+    esp32_manager_entry_t * entry = esp32_manager_find_entry(update->namespace, key);
+    esp_err_t e;
+
+    if(entry == NULL || (entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) {
+        ESP_LOGW(TAG, "Entry %s.%s not found or read-only", update->namespace->key, key);
+        ++update->failed;
+        return;
+    }
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) { // Written with esp32_manager_mmap_write_begin()
+        ESP_LOGW(TAG, "Entry %s.%s is memory-mapped", update->namespace->key, key);
+        ++update->failed;
+        return;
+    }
+#endif
+
+    if(type == ESP32_MANAGER_JSON_NULL) {
+        e = esp32_manager_reset_entry(entry);
+        if(e == ESP_OK) {
+            esp32_manager_entry_changed(update->namespace, entry);
+        }
+    } else {
+        e = esp32_manager_entry_set_from_string(update->namespace, entry, value);
+    }
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Entry %s.%s updated", update->namespace->key, key);
+        ++update->updated;
+    } else {
+        ESP_LOGW(TAG, "Error updating entry %s.%s: %s", update->namespace->key, key, esp_err_to_name(e));
+        ++update->failed;
+    }
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_api_update(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e = ESP_OK;
+    esp32_manager_json_parser_t parser;
+    esp32_manager_webconfig_api_update_t update = { 0 };
+    esp32_manager_webconfig_staging_t staging;
+    size_t remaining = req->content_len;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_webconfig_api_namespace(req);
+    if(namespace != NULL) {
+        e = esp32_manager_webconfig_staging_init(&staging, namespace->key); // Nested read-side section
+    }
+    esp32_manager_read_exit(parity);
+    if(namespace == NULL) {
+        return esp32_manager_webconfig_api_error(req, HTTPD_404, "Namespace not found");
+    }
+    if(e != ESP_OK) {
+        return esp32_manager_webconfig_api_error(req, HTTPD_500, "Not enough memory");
+    }
+
+    // Values are parsed into a buffer that holds the longest value of the namespace, so anything read from it
+    // can be written back
+    char * value = ctx->content;
+    if(staging.value_size >= sizeof(ctx->content)) {
+        value = malloc(staging.value_size +1);
+        if(value == NULL) {
+            esp32_manager_webconfig_staging_free(&staging);
+            return esp32_manager_webconfig_api_error(req, HTTPD_500, "Not enough memory");
+        }
+    }
+
+    // Body is parsed as it arrives, one buffer at a time, outside of the read-side section since receiving can block
+    esp32_manager_json_parser_init(&parser, value, staging.value_size, esp32_manager_webconfig_api_update_cb, &staging);
+    while(remaining > 0 && e == ESP_OK) {
+        int received = esp32_manager_webconfig_recv(req, ctx->buffer, MIN(remaining, WEBCONFIG_MANAGER_BUFFER_SIZE));
+        if(received <= 0) {
+            ESP_LOGE(TAG, "Error receiving request body");
+            e = ESP_FAIL;
+            break;
+        }
+        remaining -= received;
+        e = esp32_manager_json_parse(&parser, ctx->buffer, received);
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_json_parser_end(&parser);
+    }
+    if(value != ctx->content) {
+        free(value);
+    }
+
+    // Nothing was set yet, an invalid body changes nothing
+    if(e != ESP_OK) {
+        esp32_manager_webconfig_staging_free(&staging);
+        if(e == ESP_FAIL) {
+            return ESP_FAIL; // Connection lost or timed out, it is closed
+        }
+        ESP_LOGE(TAG, "Invalid JSON body: %s", esp_err_to_name(e));
+        if(e == ESP_ERR_NO_MEM) {
+            return esp32_manager_webconfig_api_error(req, HTTPD_500, "Not enough memory");
+        }
+        return esp32_manager_webconfig_api_error(req, HTTPD_400, (e == ESP_ERR_INVALID_SIZE) ? "Key or value too long" : "Invalid JSON object");
+    }
+
+    parity = esp32_manager_read_enter();
+    update.namespace = esp32_manager_webconfig_api_namespace(req);
+    if(update.namespace == NULL) { // Unregistered while the body was received
+        esp32_manager_read_exit(parity);
+        esp32_manager_webconfig_staging_free(&staging);
+        return esp32_manager_webconfig_api_error(req, HTTPD_404, "Namespace not found");
+    }
+
+    size_t position = 0;
+    uint8_t type;
+    const char * key;
+    char * value_staged;
+    while(esp32_manager_webconfig_staging_next(&staging, &position, &type, &key, &value_staged)) {
+        esp32_manager_webconfig_api_update_apply(&update, key, value_staged, (esp32_manager_json_type_t) type);
+    }
+    update.failed += staging.rejected;
+    esp32_manager_webconfig_staging_free(&staging);
+
+    if(update.updated > 0) {
+        e = esp32_manager_commit_to_nvs(update.namespace); // Single commit for all entries
+        if(e != ESP_OK) {
+            ESP_LOGE(TAG, "Error commiting namespace %s to NVS: %s", update.namespace->key, esp_err_to_name(e));
+        }
+    }
+    ESP_LOGD(TAG, "Namespace %s: %u entries updated, %u failed", update.namespace->key, update.updated, update.failed);
+    esp32_manager_read_exit(parity);
+
+    if(e != ESP_OK) {
+        return esp32_manager_webconfig_api_error(req, HTTPD_500, "Error saving to NVS");
+    }
+
+    char response[48];
+    snprintf(response, sizeof(response), "{\"updated\":%u,\"failed\":%u}", update.updated, update.failed);
+    httpd_resp_set_type(req, "application/json");
+    return (httpd_resp_send(req, response, strlen(response)) == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_api_networks(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    esp32_manager_webconfig_chunk_t chunk;
+    esp32_manager_network_scan_t scan;
+
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    if(httpd_req_get_url_query_str(req, ctx->content, recv_size) == ESP_OK
+            && httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_SCAN, ctx->buffer, sizeof(ctx->buffer)) != ESP_ERR_NOT_FOUND) {
+        e = esp32_manager_network_scan_start();
+        if(e != ESP_OK) {
+            return esp32_manager_webconfig_api_error(req, "503 Service Unavailable", esp_err_to_name(e));
+        }
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    esp32_manager_network_scan_get(&scan);
+    if(esp32_manager_webconfig_etag_match(req, ctx, scan.seq)) {
+        ESP_LOGD(TAG, "Networks not modified");
+        return esp32_manager_webconfig_send_not_modified(req);
+    }
+
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    esp32_manager_webconfig_chunk_printf(&chunk, "{\"scanning\":%s,\"seq\":%u,\"networks\":[", scan.scanning ? "true" : "false", scan.seq);
+    for(uint8_t i=0; i < scan.size; ++i) {
+        // {"ssid":[ssid],"rssi":[rssi],"channel":[channel],"open":[open]}
+        esp32_manager_webconfig_chunk_puts(&chunk, (i == 0) ? "{\"ssid\":" : ",{\"ssid\":");
+        esp32_manager_webconfig_chunk_json_string(&chunk, scan.aps[i].ssid);
+        esp32_manager_webconfig_chunk_printf(&chunk, ",\"rssi\":%d,\"channel\":%u,\"open\":%s}",
+                scan.aps[i].rssi, scan.aps[i].channel, (scan.aps[i].authmode == WIFI_AUTH_OPEN) ? "true" : "false");
+    }
+    esp32_manager_webconfig_chunk_puts(&chunk, "]}");
+
+    e = esp32_manager_webconfig_chunk_end(&chunk);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Networks sent");
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending networks");
+        return ESP_FAIL;
+    }
+}
+
+esp_err_t esp32_manager_webconfig_uri_handler_factory(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx)
+{
+    esp_err_t e;
+    esp32_manager_webconfig_chunk_t chunk;
+    bool reboot = false;
+    bool factory_reset = false;
+    esp_err_t factory_reset_result = ESP_OK;
+
+    size_t recv_size = MIN(httpd_req_get_url_query_len(req)+1, sizeof(ctx->content)-1);
+    ESP_LOGD(TAG, "Request header size: %d", recv_size);
+
+    // Get request query
+    e = httpd_req_get_url_query_str(req, ctx->content, recv_size);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Query string: %s", ctx->content);
+        // Search for operation keys
+        reboot = (httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE, ctx->buffer, sizeof(ctx->buffer)) == ESP_OK);
+        factory_reset = (httpd_query_key_value(ctx->content, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, ctx->buffer, sizeof(ctx->buffer)) == ESP_OK);
+        if(factory_reset) { // Factory reset requested
+            // Defaults are restored in place, a reboot is only needed if requested too
+            factory_reset_result = esp32_manager_factory_reset();
+            if(factory_reset_result == ESP_OK) {
+                ESP_LOGD(TAG, "Factory reset done");
+            } else {
+                ESP_LOGE(TAG, "Error on factory reset");
+                httpd_resp_set_status(req, HTTPD_500);
+            }
+        }
+    }
+
+    e = httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
+    e += httpd_resp_set_hdr(req, "Pragma", "no-cache");
+    e += httpd_resp_set_hdr(req, "Expires", "0");
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error settings cache headers");
+    }
+
+    esp32_manager_webconfig_chunk_init(&chunk, req, ctx->buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    if(reboot) {
+        e = esp32_manager_webconfig_page_reboot(&chunk);
+        esp32_manager_webconfig_deferred_reboot(WEBCONFIG_MANAGER_REBOOT_DELAY);
+    } else if(factory_reset) {
+        e = esp32_manager_webconfig_page_factory_reset(&chunk, factory_reset_result == ESP_OK);
+    } else {
+        e = ESP_OK; // Nothing requested, empty response
+    }
+    if(e == ESP_OK) {
+        e = esp32_manager_webconfig_chunk_end(&chunk);
+    }
+
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Response sent");
+        return ESP_OK;
+    } else {
+        ESP_LOGE(TAG, "Error sending response");
+        return ESP_FAIL;
+    }
+}
+
+#define WEBCONFIG_MANAGER_HTML_HEAD "<html><head><link rel=\"stylesheet\" href=\"style.min.css\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />" WEBCONFIG_MANAGER_WEB_TITLE
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_root[] = {
+    WEBCONFIG_MANAGER_FRAGMENT(WEBCONFIG_MANAGER_HTML_HEAD "</head><body><p><a class=\"button\" href=\"/setup\">Setup</a></a></body>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_reboot[] = {
+    WEBCONFIG_MANAGER_FRAGMENT(WEBCONFIG_MANAGER_HTML_HEAD "</head><body><h2>Rebooting device</h2><p>Wait 10 seconds before clicking <a href=\"/setup\">back</a> (Link might not work if network settings were changed)</p></body>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_factory_reset_done[] = {
+    WEBCONFIG_MANAGER_FRAGMENT(WEBCONFIG_MANAGER_HTML_HEAD "</head><body><h2>Factory reset done</h2><p>All settings were restored to their defaults. Network settings take effect after a <a href=\"/factory?"
+            WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE "=1\">reboot</a>.</p><a class=\"button\" href=\"/setup\">Back</a></body></html>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_factory_reset_failed[] = {
+    WEBCONFIG_MANAGER_FRAGMENT(WEBCONFIG_MANAGER_HTML_HEAD "</head><body><h2>Factory reset failed</h2><p>Some settings could not be restored.</p><a class=\"button\" href=\"/setup\">Back</a></body></html>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_setup_begin[] = {
+    WEBCONFIG_MANAGER_FRAGMENT(WEBCONFIG_MANAGER_HTML_HEAD "</head><body><ul>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: namespace key, 1: namespace friendly name
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_setup_item[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<li><a href=\"/setup?namespace=", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\">", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("</a></li>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_setup_end[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("</ul><a class=\"button button-outline\" href=\"/factory?" WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE "=1\">Reboot device</a>"
+            "<a class=\"button button-clear\" href=\"/factory?" WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET "=1\">Factory reset</a></body></html>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: namespace key
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_namespace_begin[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<html><head><link rel=\"stylesheet\" href=\"style.min.css\" media=\"screen\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />" WEBCONFIG_MANAGER_WEB_TITLE
+            "</head><body><form method=\"post\" action=\"/setup?" WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE "=", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\"><br/>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: namespace key
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_namespace_end[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<input type=\"submit\" value=\"submit\"></form><a class=\"button button-outline\" href=\"/setup\">Back</a>"
+            "<a class=\"button button-clear\" href=\"/setup?namespace=", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("&" WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET "=1\">Restore defaults</a></body></html>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: entry friendly name
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_begin[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<div>", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("<br/>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: entry key. Followed by the value and esp32_manager_webconfig_template_widget_number_end.
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_number[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<input type=\"number\" name=\"", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\" value=\"", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: " disabled" or empty
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_number_end[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("\"", 0 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT(" /></div>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: input type, 1: entry key, 2: value, 3: " readonly" or empty
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_text[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<input type=\"", 0 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT("\" name=\"", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("\" value=\"", 2),
+    WEBCONFIG_MANAGER_FRAGMENT("\"", 3 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT(" /></div>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: entry key, 1: " disabled" or empty
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_select[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<select name=\"", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\"", 1 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT(">", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: option key, 1: " selected" or empty, 2: option friendly name
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_option[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<option value=\"", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\"", 1 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT(">", 2),
+    WEBCONFIG_MANAGER_FRAGMENT("</option>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: entry key. Hidden empty field first, so unchecking every option still submits the entry.
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_checkboxes[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<input type=\"hidden\" name=\"", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\" value=\"\" />", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+// 0: entry key, 1: option key, 2: " checked" or empty, 3: " disabled" or empty, 4: option friendly name
+static const esp32_manager_webconfig_fragment_t esp32_manager_webconfig_template_widget_checkbox[] = {
+    WEBCONFIG_MANAGER_FRAGMENT("<label><input type=\"checkbox\" name=\"", 0),
+    WEBCONFIG_MANAGER_FRAGMENT("\" value=\"", 1),
+    WEBCONFIG_MANAGER_FRAGMENT("\"", 2 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT("", 3 | WEBCONFIG_MANAGER_SLOT_RAW),
+    WEBCONFIG_MANAGER_FRAGMENT(" /> ", 4),
+    WEBCONFIG_MANAGER_FRAGMENT("</label>", WEBCONFIG_MANAGER_SLOT_NONE),
+    WEBCONFIG_MANAGER_FRAGMENT_END
+};
+
+esp_err_t esp32_manager_webconfig_page_root(esp32_manager_webconfig_chunk_t * chunk)
+{
+    if(chunk == NULL) {
+        ESP_LOGE(TAG, "chunk cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // TODO Show featured values on home page
+    // For now it is just a link to setup
+
+    return esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_root, NULL);
+}
+
+esp_err_t esp32_manager_webconfig_page_reboot(esp32_manager_webconfig_chunk_t * chunk)
+{
+    if(chunk == NULL) {
+        ESP_LOGE(TAG, "chunk cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_reboot, NULL);
+}
+
+esp_err_t esp32_manager_webconfig_page_factory_reset(esp32_manager_webconfig_chunk_t * chunk, bool success)
+{
+    if(chunk == NULL) {
+        ESP_LOGE(TAG, "chunk cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp32_manager_webconfig_render(chunk, success ? esp32_manager_webconfig_template_factory_reset_done : esp32_manager_webconfig_template_factory_reset_failed, NULL);
+}
+
+esp_err_t esp32_manager_webconfig_page_setup(esp32_manager_webconfig_chunk_t * chunk)
+{
+    if(chunk == NULL) {
+        ESP_LOGE(TAG, "chunk cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "Generating setup page");
+
+    esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_setup_begin, NULL);
+    uint8_t parity = esp32_manager_read_enter();
+    for(uint8_t i=0; i < ESP32_MANAGER_NAMESPACES_SIZE; ++i) {
+        esp32_manager_namespace_t * namespace = esp32_manager_namespaces[i]; // Read slot once, it can be cleared concurrently
+        if(namespace != NULL) {
+            const char * values[] = { namespace->key, namespace->friendly };
+            esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_setup_item, values);
+        }
+    }
+    esp32_manager_read_exit(parity);
+    return esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_setup_end, NULL);
+}
+
+esp_err_t esp32_manager_webconfig_page_setup_namespace(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_namespace_t * namespace)
+{
+    if(chunk == NULL || namespace == NULL) {
         ESP_LOGE(TAG, "Invalid arguments");
         return ESP_ERR_INVALID_ARG;
     }
 
-    // FIXME Buffer overrun protection
+    int64_t start_time = esp_timer_get_time();
+    const char * values[] = { namespace->key };
 
-    strlcpy(buffer, "<html><head><link rel=\"stylesheet\" href=\"style.min.css\" media=\"screen\" /><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_WEB_TITLE, buffer_size);
-    strlcat(buffer, "</head><body><form method=\"get\" action=\"/setup\"><br/><input name=\"namespace\" type=\"hidden\" value=\"", buffer_size);
-    strlcat(buffer, namespace->key, buffer_size);
-    strlcat(buffer, "\"><br/>", buffer_size);
+    esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_namespace_begin, values);
 
     for(uint16_t i=0; i < namespace->size; ++i) {
-        if(namespace->entries[i] == NULL) continue;
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry == NULL) continue;
 
-        char * buffer_tail = &buffer[strlen(buffer)];
-        esp32_manager_entry_t * entry = namespace->entries[i];
         if(entry->html_form_widget != NULL) {
-            entry->html_form_widget(buffer_tail, entry, buffer_size - (buffer_tail - buffer));
+            entry->html_form_widget(chunk, entry);
         } else {
-            esp32_manager_webconfig_html_form_widget_default(buffer_tail, entry, buffer_size - (buffer_tail - buffer));
+            esp32_manager_webconfig_html_form_widget_default(chunk, entry);
         }
     }
 
-    strlcat(buffer, "<input type=\"submit\" value=\"submit\"></form><a class=\"button button-outline\" href=\"/setup\">Back</a>", buffer_size);
-
-    strlcat(buffer, "<a class=\"button button-clear\" href=\"/setup?namespace=", buffer_size);
-    strlcat(buffer, namespace->key, buffer_size);
-    strlcat(buffer, "&", buffer_size);
-    strlcat(buffer, WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET, buffer_size);
-    strlcat(buffer, "=1\">Restore defaults</a>", buffer_size);
+    esp_err_t e = esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_namespace_end, values);
 
-    strlcat(buffer, "</body></html>", buffer_size);
+    // Includes the time spent sending full chunks
+    ESP_LOGD(TAG, "Namespace %s page with %u entries rendered in %u us", namespace->key, namespace->size, (uint32_t) (esp_timer_get_time() - start_time));
 
-    if(strlen(buffer) == (buffer_size -1)) {
-        return ESP_ERR_HTTPD_RESULT_TRUNC;
-    }
-
-    return ESP_OK;
+    return e;
 }
 
-esp_err_t esp32_manager_webconfig_html_form_widget_default(char * buffer, esp32_manager_entry_t * entry, size_t buffer_size)
+esp_err_t esp32_manager_webconfig_html_form_widget_default(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_entry_t * entry)
 {
-    strlcpy(buffer, "<div>", buffer_size);
-    strlcat(buffer, entry->friendly, buffer_size);
-    strlcat(buffer, "<br/>", buffer_size);
+    const char * values[5];
+    const char * disabled = ((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) ? " disabled" : "";
+
+    values[0] = entry->friendly;
+    esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_begin, values);
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+    if((entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) { // Too large for a form field, only its size is shown
+        const void * data;
+        size_t length = 0;
+        esp32_manager_mmap_get(entry, &data, &length);
+        return esp32_manager_webconfig_chunk_printf(chunk, "<i>%u bytes</i></div>", length);
+    }
+#endif
 
     switch(entry->type) {
         case i8:
@@ -643,42 +2002,43 @@ esp_err_t esp32_manager_webconfig_html_form_widget_default(char * buffer, esp32_
         case flt:
         case dbl:
             // <input type="number" name="[entry.key]" value="[entry.value]" />
-            strlcat(buffer, "<input type=\"number\" name=\"", buffer_size);
-            strlcat(buffer, entry->key, buffer_size);
-            strlcat(buffer, "\" value=\"", buffer_size);
-            uint16_t len = strlen(buffer);
-            entry->to_string(entry, &buffer[len]);
-            strlcat(buffer, "\"", buffer_size);
-            if((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) {
-                strlcat(buffer, "disabled", buffer_size);
-            }
-            strlcat(buffer, " />", buffer_size);
-            break;
+            values[0] = entry->key;
+            esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_number, values);
+            esp32_manager_webconfig_chunk_entry_value(chunk, entry);
+            values[0] = disabled;
+            return esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_number_end, values);
         case text: // This type needs to be null-terminated
-            strlcat(buffer, "<input type=\"text\" name=\"", buffer_size);
-            strlcat(buffer, entry->key, buffer_size);
-            strlcat(buffer, "\" value=\"", buffer_size);
-            strlcat(buffer, (char *) entry->value, buffer_size);
-            strlcat(buffer, "\"", buffer_size);
-            if((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) {
-                strlcat(buffer, "readonly", buffer_size);
-            }
-            strlcat(buffer, " />", buffer_size);
-            break;
         case password:
-            strlcat(buffer, "<input type=\"password\" name=\"", buffer_size);
-            strlcat(buffer, entry->key, buffer_size);
-            strlcat(buffer, "\" value=\"", buffer_size);
-            strlcat(buffer, (char *) entry->value, buffer_size);
-            strlcat(buffer, "\"", buffer_size);
-            if((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) {
-                strlcat(buffer, "readonly", buffer_size);
+            values[0] = (entry->type == password) ? "password" : "text";
+            values[1] = entry->key;
+            values[2] = (char *) entry->value;
+            values[3] = ((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0) ? " readonly" : "";
+            return esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_text, values);
+        case single_choice:
+            // <select name="[entry.key]"><option value="[option.key]" selected>[option.friendly]</option>...</select>
+            values[0] = entry->key;
+            values[1] = disabled;
+            esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_select, values);
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                values[0] = entry->choices->keys[i];
+                values[1] = (*((uint8_t *) entry->value) == i) ? " selected" : "";
+                values[2] = (entry->choices->friendly != NULL) ? entry->choices->friendly[i] : entry->choices->keys[i];
+                esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_option, values);
+            }
+            return esp32_manager_webconfig_chunk_puts(chunk, "</select></div>");
+        case multiple_choice:
+            values[0] = entry->key;
+            esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_checkboxes, values);
+            for(uint16_t i=0; i < entry->choices->size; ++i) {
+                // <label><input type="checkbox" name="[entry.key]" value="[option.key]" checked /> [option.friendly]</label>
+                values[1] = entry->choices->keys[i];
+                values[2] = ESP32_MANAGER_CHOICES_BITSET_GET(entry->value, i) ? " checked" : "";
+                values[3] = disabled;
+                values[4] = (entry->choices->friendly != NULL) ? entry->choices->friendly[i] : entry->choices->keys[i];
+                esp32_manager_webconfig_render(chunk, esp32_manager_webconfig_template_widget_checkbox, values);
             }
-            strlcat(buffer, " />", buffer_size);
             break;
         // TODO Implement these cases
-        case single_choice:
-        case multiple_choice:
         case blob: // Data structures, binary and other non-null-terminated types go here
         case image:
             ESP_LOGE(TAG, "Not implemented");
@@ -689,13 +2049,7 @@ esp_err_t esp32_manager_webconfig_html_form_widget_default(char * buffer, esp32_
         break;
     }
 
-    strlcat(buffer, "</div>", buffer_size);
-
-    if(strlen(buffer) == (buffer_size -1)) {
-        return ESP_ERR_HTTPD_RESULT_TRUNC;
-    }
-
-    return ESP_OK;
+    return esp32_manager_webconfig_chunk_puts(chunk, "</div>");
 }
 
 esp_err_t esp32_manager_webconfig_deferred_reboot(uint32_t delay)
@@ -739,4 +2093,352 @@ esp_err_t esp32_manager_webconfig_urldecode(char *__restrict__ dest, const char
         *index_dest = c; // Whether it is the original character, or one converted from + or hex, copy it to the destination string
 	}
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+void esp32_manager_webconfig_form_parser_init(esp32_manager_webconfig_form_parser_t * parser, char * value, size_t value_size, esp32_manager_webconfig_form_field_cb_t cb, void * arg)
+{
+    memset(parser, 0, sizeof(esp32_manager_webconfig_form_parser_t));
+    parser->state = WEBCONFIG_MANAGER_FORM_KEY;
+    parser->value = value;
+    parser->value_size = value_size;
+    parser->cb = cb;
+    parser->arg = arg;
+    parser->error = ESP_OK;
+}
+
+/**
+ * Passes the field in the value buffer to the callback
+ */
+static void esp32_manager_webconfig_form_emit(esp32_manager_webconfig_form_parser_t * parser)
+{
+    if(!parser->pending) {
+        return;
+    }
+    parser->pending = false;
+
+    if(parser->dropped) {
+        ESP_LOGW(TAG, "Field %s dropped: too long or wrongly encoded", parser->pending_key);
+        return;
+    }
+    parser->value[parser->value_length] = 0;
+    if(parser->cb != NULL) {
+        parser->error = parser->cb(parser->pending_key, parser->value, parser->arg);
+    }
+}
+
+/**
+ * Adds a decoded character to the field name or value
+ */
+static void esp32_manager_webconfig_form_append(esp32_manager_webconfig_form_parser_t * parser, char c)
+{
+    if(parser->state == WEBCONFIG_MANAGER_FORM_KEY) {
+        if(parser->key_length >= WEBCONFIG_MANAGER_FORM_KEY_MAX_LENGTH) {
+            parser->invalid = true;
+            return;
+        }
+        parser->key[parser->key_length++] = c;
+        parser->key[parser->key_length] = 0;
+    } else {
+        if(parser->value_length + (parser->separator ? 1 : 0) >= parser->value_size) {
+            parser->dropped = true;
+            return;
+        }
+        if(parser->separator) {
+            parser->value[parser->value_length++] = ',';
+            parser->separator = false;
+        }
+        parser->value[parser->value_length++] = c;
+    }
+}
+
+esp_err_t esp32_manager_webconfig_form_parse(esp32_manager_webconfig_form_parser_t * parser, const char * data, size_t length)
+{
+    for(size_t i=0; i < length && parser->error == ESP_OK; ++i) {
+        char c = data[i];
+
+        if(c == '&' || (c == '=' && parser->state == WEBCONFIG_MANAGER_FORM_KEY)) {
+            if(parser->hex_digits > 0) { // Escape cut short
+                parser->hex_digits = 0;
+                if(parser->state == WEBCONFIG_MANAGER_FORM_KEY) {
+                    parser->invalid = true;
+                } else {
+                    parser->dropped = true;
+                }
+            }
+            if(c == '=') { // Name complete. Values of consecutive fields with the same name are joined.
+                if(parser->pending && !parser->invalid && !strcmp(parser->key, parser->pending_key)) {
+                    parser->separator = (parser->value_length > 0);
+                } else {
+                    esp32_manager_webconfig_form_emit(parser);
+                    strcpy(parser->pending_key, parser->key);
+                    parser->pending = true;
+                    parser->dropped = parser->invalid;
+                    parser->separator = false;
+                    parser->value_length = 0;
+                }
+                parser->state = WEBCONFIG_MANAGER_FORM_VALUE;
+            } else { // Next field. Names without value are ignored.
+                parser->state = WEBCONFIG_MANAGER_FORM_KEY;
+            }
+            if(parser->state == WEBCONFIG_MANAGER_FORM_KEY) {
+                parser->key_length = 0;
+                parser->key[0] = 0;
+                parser->invalid = false;
+            }
+        } else if(parser->hex_digits > 0) {
+            if(!ISHEX(c)) {
+                parser->hex_digits = 0;
+                if(parser->state == WEBCONFIG_MANAGER_FORM_KEY) {
+                    parser->invalid = true;
+                } else {
+                    parser->dropped = true;
+                }
+                continue;
+            }
+            parser->hex = (parser->hex << 4) | ((c <= '9') ? (c - '0') : ((c | 0x20) - 'a' + 10));
+            if(--parser->hex_digits == 0) {
+                if(parser->hex == 0) { // Would cut the string short
+                    if(parser->state == WEBCONFIG_MANAGER_FORM_KEY) {
+                        parser->invalid = true;
+                    } else {
+                        parser->dropped = true;
+                    }
+                } else {
+                    esp32_manager_webconfig_form_append(parser, parser->hex);
+                }
+            }
+        } else if(c == '%') {
+            parser->hex = 0;
+            parser->hex_digits = 2;
+        } else {
+            esp32_manager_webconfig_form_append(parser, (c == '+') ? ' ' : c);
+        }
+    }
+
+    return parser->error;
+}
+
+esp_err_t esp32_manager_webconfig_form_parser_end(esp32_manager_webconfig_form_parser_t * parser)
+{
+    if(parser->error != ESP_OK) {
+        return parser->error;
+    }
+    if(parser->hex_digits > 0 && parser->state == WEBCONFIG_MANAGER_FORM_VALUE) {
+        parser->dropped = true;
+    }
+    esp32_manager_webconfig_form_emit(parser);
+    return parser->error;
+}
+
+void esp32_manager_webconfig_chunk_init(esp32_manager_webconfig_chunk_t * chunk, httpd_req_t * req, char * buffer, size_t buffer_size)
+{
+    chunk->req = req;
+    chunk->sink = NULL;
+    chunk->sink_arg = NULL;
+    chunk->buffer = buffer;
+    chunk->buffer_size = buffer_size;
+    chunk->length = 0;
+    chunk->error = ESP_OK;
+}
+
+void esp32_manager_webconfig_chunk_init_sink(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_webconfig_chunk_sink_t sink, void * arg, char * buffer, size_t buffer_size)
+{
+    esp32_manager_webconfig_chunk_init(chunk, NULL, buffer, buffer_size);
+    chunk->sink = sink;
+    chunk->sink_arg = arg;
+}
+
+/**
+ * Sends data as a chunk of the response, or ends it with NULL data
+ */
+static esp_err_t esp32_manager_webconfig_chunk_send(esp32_manager_webconfig_chunk_t * chunk, const char * data, size_t length)
+{
+    if(chunk->sink != NULL) {
+        return chunk->sink(chunk->sink_arg, data, length);
+    }
+    return httpd_resp_send_chunk(chunk->req, data, length);
+}
+
+/**
+ * Sends the content gathered as a chunk and empties the buffer
+ */
+static esp_err_t esp32_manager_webconfig_chunk_flush(esp32_manager_webconfig_chunk_t * chunk)
+{
+    if(chunk->error == ESP_OK && chunk->length > 0) {
+        if(esp32_manager_webconfig_chunk_send(chunk, chunk->buffer, chunk->length) != ESP_OK) {
+            ESP_LOGE(TAG, "Error sending chunk");
+            chunk->error = ESP_FAIL;
+        }
+    }
+    chunk->length = 0;
+    return chunk->error;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_write(esp32_manager_webconfig_chunk_t * chunk, const void * data, size_t length)
+{
+    if(chunk->error != ESP_OK) {
+        return chunk->error;
+    }
+
+    if(chunk->length + length > chunk->buffer_size) {
+        if(esp32_manager_webconfig_chunk_flush(chunk) != ESP_OK) {
+            return chunk->error;
+        }
+        if(length > chunk->buffer_size) { // Larger than the buffer, sent as a chunk of its own
+            if(esp32_manager_webconfig_chunk_send(chunk, data, length) != ESP_OK) {
+                ESP_LOGE(TAG, "Error sending chunk");
+                chunk->error = ESP_FAIL;
+            }
+            return chunk->error;
+        }
+    }
+
+    memcpy(&chunk->buffer[chunk->length], data, length);
+    chunk->length += length;
+    return ESP_OK;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_puts(esp32_manager_webconfig_chunk_t * chunk, const char * str)
+{
+    return esp32_manager_webconfig_chunk_write(chunk, str, strlen(str));
+}
+
+esp_err_t esp32_manager_webconfig_chunk_printf(esp32_manager_webconfig_chunk_t * chunk, const char * format, ...)
+{
+    va_list args;
+    int len;
+
+    if(chunk->error != ESP_OK) {
+        return chunk->error;
+    }
+
+    for(uint8_t attempt=0; attempt < 2; ++attempt) {
+        va_start(args, format);
+        len = vsnprintf(&chunk->buffer[chunk->length], chunk->buffer_size - chunk->length +1, format, args);
+        va_end(args);
+        if(len < 0) {
+            return ESP_FAIL;
+        }
+        if(chunk->length + len <= chunk->buffer_size) {
+            chunk->length += len;
+            return ESP_OK;
+        }
+        // Did not fit, send what was there before and try again with the whole buffer
+        if(esp32_manager_webconfig_chunk_flush(chunk) != ESP_OK) {
+            return chunk->error;
+        }
+    }
+
+    ESP_LOGE(TAG, "Formatted text larger than the buffer");
+    return ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_entry_value(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_entry_t * entry)
+{
+    if(chunk->error != ESP_OK) {
+        return chunk->error;
+    }
+
+    if(entry->type > dbl) { // Strings can be of any length, they are written with esp32_manager_webconfig_chunk_puts()
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Numbers are converted straight into the buffer. If they do not fit, what was there before is sent and
+    // they are converted again with the whole buffer.
+    for(uint8_t attempt=0; attempt < 2; ++attempt) {
+        char * value = &chunk->buffer[chunk->length];
+        esp_err_t e = entry->to_string(entry, value, chunk->buffer_size - chunk->length +1);
+        if(e == ESP_OK) {
+            chunk->length += strlen(value);
+            return ESP_OK;
+        } else if(e != ESP_ERR_INVALID_SIZE || chunk->length == 0) {
+            return ESP_FAIL;
+        }
+        if(esp32_manager_webconfig_chunk_flush(chunk) != ESP_OK) {
+            return chunk->error;
+        }
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_end(esp32_manager_webconfig_chunk_t * chunk)
+{
+    if(esp32_manager_webconfig_chunk_flush(chunk) == ESP_OK) {
+        if(esp32_manager_webconfig_chunk_send(chunk, NULL, 0) != ESP_OK) {
+            ESP_LOGE(TAG, "Error ending chunked response");
+            chunk->error = ESP_FAIL;
+        }
+    }
+    return chunk->error;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_escape(esp32_manager_webconfig_chunk_t * chunk, const char * str)
+{
+    const char * run = str; // Characters not needing escaping are written in runs
+
+    for(; *str != 0; ++str) {
+        const char * entity;
+        switch(*str) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            case '\'': entity = "&#39;"; break;
+            default: continue;
+        }
+        if(str > run) {
+            esp32_manager_webconfig_chunk_write(chunk, run, str - run);
+        }
+        esp32_manager_webconfig_chunk_puts(chunk, entity);
+        run = str +1;
+    }
+
+    if(str > run) {
+        esp32_manager_webconfig_chunk_write(chunk, run, str - run);
+    }
+    return chunk->error;
+}
+
+esp_err_t esp32_manager_webconfig_render(esp32_manager_webconfig_chunk_t * chunk, const esp32_manager_webconfig_fragment_t * template, const char * const * values)
+{
+    for(; template->text != NULL; ++template) {
+        esp32_manager_webconfig_chunk_write(chunk, template->text, template->length);
+        if(template->slot == WEBCONFIG_MANAGER_SLOT_NONE) continue;
+
+        const char * value = (values != NULL) ? values[template->slot & ~WEBCONFIG_MANAGER_SLOT_RAW] : NULL;
+        if(value == NULL) continue;
+        if(template->slot & WEBCONFIG_MANAGER_SLOT_RAW) {
+            esp32_manager_webconfig_chunk_puts(chunk, value);
+        } else {
+            esp32_manager_webconfig_chunk_escape(chunk, value);
+        }
+    }
+    return chunk->error;
+}
+
+esp_err_t esp32_manager_webconfig_chunk_json_string(esp32_manager_webconfig_chunk_t * chunk, const char * str)
+{
+    const char * run = str; // Characters not needing escaping are written in runs
+
+    esp32_manager_webconfig_chunk_write(chunk, "\"", 1);
+    for(; *str != 0; ++str) {
+        if(*str != '"' && *str != '\\' && (uint8_t) *str >= 0x20) continue;
+
+        if(str > run) {
+            esp32_manager_webconfig_chunk_write(chunk, run, str - run);
+        }
+        switch(*str) {
+            case '"': esp32_manager_webconfig_chunk_puts(chunk, "\\\""); break;
+            case '\\': esp32_manager_webconfig_chunk_puts(chunk, "\\\\"); break;
+            case '\n': esp32_manager_webconfig_chunk_puts(chunk, "\\n"); break;
+            case '\r': esp32_manager_webconfig_chunk_puts(chunk, "\\r"); break;
+            case '\t': esp32_manager_webconfig_chunk_puts(chunk, "\\t"); break;
+            default: esp32_manager_webconfig_chunk_printf(chunk, "\\u%04x", (uint8_t) *str); break;
+        }
+        run = str +1;
+    }
+    if(str > run) {
+        esp32_manager_webconfig_chunk_write(chunk, run, str - run);
+    }
+    return esp32_manager_webconfig_chunk_write(chunk, "\"", 1);
+}
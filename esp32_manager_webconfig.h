@@ -12,6 +12,11 @@
 
 #include "esp32_manager.h"
 #include "esp32_manager_network.h"
+#include "esp32_manager_history.h"
+#include "esp32_manager_journal.h"
+#include "esp32_manager_json.h"
+#include "esp32_manager_ws.h"
+#include "esp32_manager_sse.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,25 +41,181 @@ extern httpd_uri_t esp32_manager_webconfig_uri_setup;
 extern httpd_uri_t esp32_manager_webconfig_uri_get;
 #define WEBCONFIG_MANAGER_URI_FACTORY_INDEX 4           /*!< Position of the factory uri in the uris array */
 #define WEBCONFIG_MANAGER_URI_FACTORY_URL   "/factory"  /*!< uri of the factory page */
-#define WEBCONFIG_MANAGER_URIS_SIZE         5   /*!< Number of uris that will be registered */
+#define WEBCONFIG_MANAGER_URI_HISTORY_INDEX 5           /*!< Position of the history uri in the uris array */
+#define WEBCONFIG_MANAGER_URI_HISTORY_URL   "/history"  /*!< uri of the entry history */
+extern httpd_uri_t esp32_manager_webconfig_uri_history;
+#define WEBCONFIG_MANAGER_URI_CHANGES_INDEX 6           /*!< Position of the changes uri in the uris array */
+#define WEBCONFIG_MANAGER_URI_CHANGES_URL   "/changes"  /*!< uri of the change journal */
+extern httpd_uri_t esp32_manager_webconfig_uri_changes;
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACES_INDEX      7   /*!< Position of the JSON namespace list uri in the uris array */
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACES_URL        "/api/v1/namespaces"    /*!< uri of the JSON namespace list */
+extern httpd_uri_t esp32_manager_webconfig_uri_api_namespaces;
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACE_INDEX       8   /*!< Position of the JSON namespace uri in the uris array */
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACE_URL         "/api/v1/namespaces/*"  /*!< uri of a JSON namespace, followed by the namespace key */
+extern httpd_uri_t esp32_manager_webconfig_uri_api_namespace;
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACE_PUT_INDEX   9   /*!< Position of the JSON namespace bulk update uri (PUT) in the uris array */
+extern httpd_uri_t esp32_manager_webconfig_uri_api_namespace_put;
+#define WEBCONFIG_MANAGER_URI_API_NAMESPACE_PATCH_INDEX 10  /*!< Position of the JSON namespace bulk update uri (PATCH) in the uris array */
+extern httpd_uri_t esp32_manager_webconfig_uri_api_namespace_patch;
+#define WEBCONFIG_MANAGER_URI_SETUP_POST_INDEX          11  /*!< Position of the setup form submission uri (POST) in the uris array */
+extern httpd_uri_t esp32_manager_webconfig_uri_setup_post;
+#define WEBCONFIG_MANAGER_URI_API_NETWORKS_INDEX        12  /*!< Position of the JSON WiFi scan uri in the uris array */
+#define WEBCONFIG_MANAGER_URI_API_NETWORKS_URL          "/api/v1/networks"      /*!< uri of the JSON WiFi scan results */
+extern httpd_uri_t esp32_manager_webconfig_uri_api_networks;
+#define WEBCONFIG_MANAGER_URIS_SIZE         13  /*!< Number of uris that will be registered */
+
+#define WEBCONFIG_MANAGER_ETAG_MAX_LENGTH   24  /*!< Longest ETag of dynamic responses: "[boot id]-[sequence number]" */
 extern httpd_uri_t * esp32_manager_webconfig_uris[WEBCONFIG_MANAGER_URIS_SIZE]; /*!< Array to store uris */
 
 #define WEBCONFIG_MANAGER_URI_PARAM_NAMESPACE       "namespace" /*!< Query key to select namespace using the get uri */
 #define WEBCONFIG_MANAGER_URI_PARAM_ENTRY           "entry"     /*!< Query key to request a setting using the get uri */
+#define WEBCONFIG_MANAGER_URI_PARAM_PREFIX          "prefix"    /*!< Query key to request all entries whose key starts with a prefix using the get uri */
+#define WEBCONFIG_MANAGER_URI_PARAM_SINCE           "since"     /*!< Query key with the last sequence number known by the client on the changes uri */
+#define WEBCONFIG_MANAGER_URI_PARAM_SCAN            "scan"      /*!< Query key to start a WiFi scan on the networks uri */
+#define WEBCONFIG_MANAGER_URI_PARAM_TIER            "tier"      /*!< Query key to select the history tier. Defaults to 0. */
+#define WEBCONFIG_MANAGER_URI_PARAM_FORMAT          "format"    /*!< Query key to select the history format: csv (default) or bin */
 #define WEBCONFIG_MANAGER_URI_PARAM_REBOOT_DEVICE   "reboot"    /*!< Query key of the parameter for requesting a reboot */
 #define WEBCONFIG_MANAGER_URI_PARAM_FACTORY_RESET   "factory_reset" /*!< Query key of the parameter for requesting a factory reset */
 #define WEBCONFIG_MANAGER_URI_PARAM_CONFIRM         "confirm"   /*!< Query key for confirmation of factory requests (such as reboot or factory reset) */
 
 #define WEBCONFIG_MANAGER_REBOOT_DELAY      3000            /*!< Delay between serving the reboot page and rebooting the device */
 
-#define WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH    10240    /*!< Maximum lenght of an HTTP response */
+#define WEBCONFIG_MANAGER_BUFFER_SIZE                   1024     /*!< Size of the buffer responses are sent from, in chunks */
+#define WEBCONFIG_MANAGER_RECV_RETRIES                  3        /*!< Receive timeouts retried before a request body is given up */
 
-extern char esp32_manager_webconfig_content[CONFIG_HTTPD_MAX_REQ_HDR_LEN +1]; /*!< Buffer to store requests' content */
-extern char esp32_manager_webconfig_buffer[WEBCONFIG_MANAGER_RESPONSE_BUFFER_MAX_LENGTH +1]; /*!< Buffer to store responses */
+#define WEBCONFIG_MANAGER_CONTEXTS_SIZE     CONFIG_ESP32_MANAGER_WEBCONFIG_CONTEXTS /*!< Request buffers. The server task uses one at a time. */
+#define WEBCONFIG_MANAGER_CONTEXT_TIMEOUT   1000    /*!< Time in ms a request waits for a free context before getting a 503 */
+
+/**
+ * Request context. Holds the buffers a request is parsed into and its response is built in, so
+ * requests served at the same time do not share any state.
+ */
+typedef struct {
+    bool in_use;                                        /*!< Taken by a request */
+    char content[CONFIG_HTTPD_MAX_REQ_HDR_LEN +1];      /*!< Buffer to store the request's content */
+    char buffer[WEBCONFIG_MANAGER_BUFFER_SIZE +1];      /*!< Buffer to build the response */
+    char etag[WEBCONFIG_MANAGER_ETAG_MAX_LENGTH +1];    /*!< ETag of the response. Must outlive the handler's headers. */
+} esp32_manager_webconfig_ctx_t;
+
+/**
+ * URI handler served with a request context
+ */
+typedef esp_err_t (* esp32_manager_webconfig_handler_t)(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * Receives the content of a chunked response rendered without a request, such as in tests.
+ * Called with NULL data and 0 length at the end of the response.
+ */
+typedef esp_err_t (* esp32_manager_webconfig_chunk_sink_t)(void * arg, const char * data, size_t length);
+
+/**
+ * Chunked response. Content is gathered in a small buffer and sent as an HTTP chunk every time it
+ * fills up, so responses have no size limit and the client gets the first bytes early.
+ */
+typedef struct esp32_manager_webconfig_chunk {
+    httpd_req_t * req;      /*!< Request to respond to */
+    esp32_manager_webconfig_chunk_sink_t sink;  /*!< Receives chunks instead of the request when not NULL */
+    void * sink_arg;        /*!< Argument of the sink */
+    char * buffer;          /*!< Buffer */
+    size_t buffer_size;     /*!< Size of the buffer */
+    size_t length;          /*!< Bytes in the buffer not sent yet */
+    esp_err_t error;        /*!< First error sending a chunk. Later writes are dropped. */
+} esp32_manager_webconfig_chunk_t;
+
+#define WEBCONFIG_MANAGER_SLOT_NONE     0xFF    /*!< Fragment without a value after its text */
+#define WEBCONFIG_MANAGER_SLOT_RAW      0x80    /*!< Flag of a slot whose value is written as is instead of escaped */
+
+/**
+ * Fragment of a page template: literal text followed by the value in a slot. Templates are
+ * constant arrays of fragments ending with WEBCONFIG_MANAGER_FRAGMENT_END, so they stay in flash
+ * and the length of their text is known at compile time.
+ */
+typedef struct {
+    const char * text;  /*!< Literal text */
+    uint16_t length;    /*!< Length of the text */
+    uint8_t slot;       /*!< Index of the value written after the text, optionally with WEBCONFIG_MANAGER_SLOT_RAW, or WEBCONFIG_MANAGER_SLOT_NONE */
+} esp32_manager_webconfig_fragment_t;
+
+#define WEBCONFIG_MANAGER_FRAGMENT(text, slot)  { (text), sizeof(text) -1, (slot) }    /*!< Fragment from a string literal */
+#define WEBCONFIG_MANAGER_FRAGMENT_END          { NULL, 0, WEBCONFIG_MANAGER_SLOT_NONE }  /*!< End of a template */
+
+#define WEBCONFIG_MANAGER_FORM_KEY_MAX_LENGTH   31  /*!< Longest field name kept by the form parser. Longer ones never match an entry key. */
+
+/**
+ * Called for every field of a form, once its value is complete
+ *
+ * @param   key field name, decoded
+ * @param   value field value, decoded. Consecutive fields with the same name are joined with ','.
+ * @param   arg user argument
+ * @return  ESP_OK to go on. Other values stop the parser and are returned by esp32_manager_webconfig_form_parse().
+ */
+typedef esp_err_t (* esp32_manager_webconfig_form_field_cb_t)(const char * key, char * value, void * arg);
+
+/**
+ * Streaming parser of application/x-www-form-urlencoded data, used for both query strings and POST bodies
+ *
+ * Input is fed in pieces of any size and decoded as it arrives into the value buffer, so the whole
+ * form never needs to be in memory. Fields are passed on one at a time. Consecutive fields with the
+ * same name, such as the checkboxes of a multiple_choice entry, are joined with ',' skipping empty
+ * values. Fields whose value does not fit the buffer or is wrongly encoded are dropped, never truncated.
+ */
+typedef struct {
+    uint8_t state;                                          /*!< Parsing a field name or value */
+    uint8_t hex_digits;                                     /*!< Hex digits of a %XX escape left to parse */
+    uint8_t hex;                                            /*!< Byte of the %XX escape being parsed */
+    bool invalid;                                           /*!< Name of the field being parsed is too long or wrongly encoded */
+    char key[WEBCONFIG_MANAGER_FORM_KEY_MAX_LENGTH +1];     /*!< Name of the field being parsed */
+    size_t key_length;
+    bool pending;                                           /*!< There is a field in the value buffer, not passed on yet */
+    bool dropped;                                           /*!< Field in the value buffer is too long or wrongly encoded */
+    bool separator;                                         /*!< Add ',' before the next character of the value */
+    char pending_key[WEBCONFIG_MANAGER_FORM_KEY_MAX_LENGTH +1]; /*!< Name of the field in the value buffer */
+    char * value;                                           /*!< Value buffer, value_size +1 bytes */
+    size_t value_size;
+    size_t value_length;
+    esp32_manager_webconfig_form_field_cb_t cb;
+    void * arg;
+    esp_err_t error;                                        /*!< Error returned by the callback. The parser stops on it. */
+} esp32_manager_webconfig_form_parser_t;
+
+/**
+ * State of a bulk read by key prefix
+ */
+typedef struct {
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1]; /*!< Only return entries of this namespace. Empty for all namespaces. */
+    esp32_manager_webconfig_chunk_t * chunk; /*!< Response */
+} esp32_manager_webconfig_query_t;
+
+#define WEBCONFIG_MANAGER_ASSETS_SIZE       8           /*!< Static files that can be added besides the CSS file */
+#define WEBCONFIG_MANAGER_ASSET_MAX_AGE     "86400"     /*!< Seconds browsers use an asset before revalidating it with its ETag */
+
+/**
+ * Static file embedded gzipped in flash
+ */
+typedef struct {
+    const char * uri;       /*!< uri it is served at */
+    const char * type;      /*!< Content type */
+    const uint8_t * start;  /*!< Gzipped content */
+    const uint8_t * end;    /*!< End of the gzipped content */
+    const char * etag;      /*!< Quoted hash of the content, used as strong ETag */
+} esp32_manager_webconfig_asset_t;
+
+/**
+ * Declares the symbols of a file embedded with the esp32_manager asset build step, which adds
+ * [file].gz and its hash [file].etag to COMPONENT_EMBED_FILES and COMPONENT_EMBED_TXTFILES.
+ * name is the file name with dots replaced by underscores.
+ */
+#define WEBCONFIG_MANAGER_ASSET_DECLARE(name) \
+    extern const uint8_t name##_gz_start[] asm("_binary_" #name "_gz_start"); \
+    extern const uint8_t name##_gz_end[] asm("_binary_" #name "_gz_end"); \
+    extern const char name##_etag_start[] asm("_binary_" #name "_etag_start")
+
+/** Initializer of an esp32_manager_webconfig_asset_t declared with WEBCONFIG_MANAGER_ASSET_DECLARE() */
+#define WEBCONFIG_MANAGER_ASSET(uri, type, name) { (uri), (type), name##_gz_start, name##_gz_end, name##_etag_start }
 
 /** @brief  Milligram CSS file */
-extern const uint8_t style_min_css_start[] asm("_binary_style_min_css_start");
-extern const uint8_t style_min_css_end[] asm("_binary_style_min_css_end");
+WEBCONFIG_MANAGER_ASSET_DECLARE(style_min_css);
+extern const esp32_manager_webconfig_asset_t esp32_manager_webconfig_asset_css;
 
 /**
  * @brief   Initialize esp32_manager_webconfig
@@ -91,101 +252,380 @@ void esp32_manager_webconfig_webserver_stop(httpd_handle_t * server);
 void esp32_manager_webconfig_event_handler(void * handler_arg, esp_event_base_t base, int32_t id, void * event_data);
 
 /**
- * @brief   Handler to call when root document is requested ("/")
+ * @brief   Start a chunked response
+ *
+ *          Status and headers must be set before the first chunk is sent.
+ *
+ * @param   chunk Chunked response to initialize
+ * @param   req Pointer to the request handle
+ * @param   buffer Buffer to gather content in
+ * @param   buffer_size Size of the buffer, not counting one more byte for the null terminator
+ */
+void esp32_manager_webconfig_chunk_init(esp32_manager_webconfig_chunk_t * chunk, httpd_req_t * req, char * buffer, size_t buffer_size);
+
+/**
+ * @brief   Start a chunked response that goes to a function instead of a request
+ *
+ *          Renders pages without a client, for instance to measure them.
+ *
+ * @param   chunk Chunked response to initialize
+ * @param   sink Function receiving each chunk
+ * @param   arg Argument of the sink
+ * @param   buffer Buffer to gather content in
+ * @param   buffer_size Size of the buffer, not counting one more byte for the null terminator
+ */
+void esp32_manager_webconfig_chunk_init_sink(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_webconfig_chunk_sink_t sink, void * arg, char * buffer, size_t buffer_size);
+
+/**
+ * @brief   Add data to a chunked response
+ *
+ * @param   chunk Chunked response
+ * @param   data Data to add
+ * @param   length Length of the data
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_write(esp32_manager_webconfig_chunk_t * chunk, const void * data, size_t length);
+
+/**
+ * @brief   Add a string to a chunked response
+ *
+ * @param   chunk Chunked response
+ * @param   str Null-terminated string
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_puts(esp32_manager_webconfig_chunk_t * chunk, const char * str);
+
+/**
+ * @brief   Add formatted text to a chunked response
+ *
+ * @param   chunk Chunked response
+ * @param   format printf format, producing less than the buffer size
+ * @return  ESP_OK: success
+ *          ESP_ERR_HTTPD_RESULT_TRUNC: text does not fit the buffer
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_printf(esp32_manager_webconfig_chunk_t * chunk, const char * format, ...);
+
+/**
+ * @brief   Add the value of a numeric entry to a chunked response, as converted by its to_string function
+ *
+ *          Only for numeric types, whose text fits the buffer. Text and choice values can be of any length
+ *          and are written with esp32_manager_webconfig_chunk_puts() instead.
+ *
+ * @param   chunk Chunked response
+ * @param   entry Pointer to the entry
+ * @return  ESP_OK: success
+ *          ESP_ERR_NOT_SUPPORTED: not a numeric entry
+ *          ESP_FAIL: value could not be converted, or error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_entry_value(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_entry_t * entry);
+
+/**
+ * @brief   Send the content gathered and end a chunked response
+ *
+ * @param   chunk Chunked response
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk, now or earlier
+ */
+esp_err_t esp32_manager_webconfig_chunk_end(esp32_manager_webconfig_chunk_t * chunk);
+
+/**
+ * @brief   Add a string to a chunked response as a quoted, escaped JSON string
+ *
+ * @param   chunk Chunked response
+ * @param   str String to add
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_json_string(esp32_manager_webconfig_chunk_t * chunk, const char * str);
+
+/**
+ * @brief   Add a string to a chunked response, escaped to be used as HTML text or attribute value
+ *
+ * @param   chunk Chunked response
+ * @param   str String to add
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_chunk_escape(esp32_manager_webconfig_chunk_t * chunk, const char * str);
+
+/**
+ * @brief   Add a template to a chunked response, with the values of its slots
+ *
+ *          Values are escaped, except in slots flagged with WEBCONFIG_MANAGER_SLOT_RAW. NULL values
+ *          are left out.
+ *
+ * @param   chunk Chunked response
+ * @param   template Fragments, ending with WEBCONFIG_MANAGER_FRAGMENT_END
+ * @param   values Values of the slots. Can be NULL if the template has no slots.
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_render(esp32_manager_webconfig_chunk_t * chunk, const esp32_manager_webconfig_fragment_t * template, const char * const * values);
+
+/**
+ * @brief   Take a request context from the pool
+ *
+ *          Waits up to WEBCONFIG_MANAGER_CONTEXT_TIMEOUT ms for one to be released.
+ *
+ * @return  Pointer to the context or NULL if all of them are in use
+ */
+esp32_manager_webconfig_ctx_t * esp32_manager_webconfig_ctx_acquire();
+
+/**
+ * @brief   Return a request context to the pool
+ *
+ * @param   ctx Pointer to the context
+ */
+void esp32_manager_webconfig_ctx_release(esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   URI handler of the uris that need a request context
+ *
+ *          Takes a context from the pool, calls the esp32_manager_webconfig_handler_t in the
+ *          user_ctx of the uri with it and returns it to the pool. Responds with a 503 if all
+ *          contexts are in use.
  *
  * @param   req Pointer to the request handle
  * @return  ESP_OK: success
  *          ESP_FAIL: error
  */
-esp_err_t esp32_manager_webconfig_uri_handler_root(httpd_req_t *req);
+esp_err_t esp32_manager_webconfig_uri_handler_ctx(httpd_req_t * req);
 
 /**
- * @brief   Handler to call when CSS stylesheet is requested ("/res/style.min.css")
+ * @brief   Handler to call when root document is requested ("/")
  *
  * @param   req Pointer to the request handle
+ * @param   ctx Request context
  * @return  ESP_OK: success
  *          ESP_FAIL: error
  */
-esp_err_t esp32_manager_webconfig_uri_handler_style(httpd_req_t *req);
+esp_err_t esp32_manager_webconfig_uri_handler_root(httpd_req_t *req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Add a static file to serve
+ *
+ *          Must be called before the webserver starts. The asset must stay valid while it runs.
+ *
+ * @param   asset Pointer to the asset
+ * @return  ESP_OK: success
+ *          ESP_ERR_INVALID_ARG: asset is not valid
+ *          ESP_ERR_NO_MEM: WEBCONFIG_MANAGER_ASSETS_SIZE assets already added
+ */
+esp_err_t esp32_manager_webconfig_add_asset(const esp32_manager_webconfig_asset_t * asset);
+
+/**
+ * @brief   Handler to call when a static file is requested, such as the CSS stylesheet
+ *
+ *          Sends the gzipped content with its ETag, or a 304 if it matches If-None-Match. Clients that
+ *          do not accept gzip get a 406.
+ *
+ * @param   req Pointer to the request handle. Its user_ctx points to the esp32_manager_webconfig_asset_t.
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_asset(httpd_req_t *req);
 
 
 /**
  * @brief   Handler to call when setup page is requested
  *
  * @param   req Pointer to the request handle
+ * @param   ctx Request context
  * @return  ESP_OK: success
  *          ESP_FAIL: error
  */
-esp_err_t esp32_manager_webconfig_uri_handler_setup(httpd_req_t * req);
+esp_err_t esp32_manager_webconfig_uri_handler_setup(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
 
 /**
  * @brief   Handler to call when get page is requested
  *
  * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_get(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+#ifdef CONFIG_ESP32_MANAGER_MMAP
+/**
+ * @brief   Send the value of a memory-mapped entry as the response, without copying it
+ *
+ *          Must be called from inside a read-side section.
+ *
+ * @param   req request
+ * @param   entry entry flagged with ESP32_MANAGER_ATTR_MMAP
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending the response
+ */
+esp_err_t esp32_manager_webconfig_send_mmap(httpd_req_t * req, esp32_manager_entry_t * entry);
+#endif
+
+/**
+ * @brief   Directory query callback that prints [namespace].[entry]=[value] lines for the get uri
+ *
+ * @param   namespace Namespace of the entry
+ * @param   entry Entry found
+ * @param   arg Pointer to an esp32_manager_webconfig_query_t
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error sending a chunk
+ */
+esp_err_t esp32_manager_webconfig_query_prefix_cb(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg);
+
+/**
+ * @brief   Handler to call when the history of an entry is requested
+ *
+ *          Streams the samples of a tier, oldest first, as "timestamp,value" CSV lines or as
+ *          packed binary records (uint32_t timestamp, float value, little endian).
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_history(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Handler to call when the change journal is requested
+ *
+ *          Responds with the current sequence number on the first line ("seq=N"), followed by
+ *          [namespace].[entry]=[value] lines for the entries changed after the "since" parameter,
+ *          or a "resync" line if the journal cannot tell what changed.
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_changes(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Handler to call when the JSON namespace list is requested
+ *
+ *          Responds with an array of {"key", "friendly", "entries", "modified_seq"} objects.
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
  * @return  ESP_OK: success
  *          ESP_FAIL: error
  */
-esp_err_t esp32_manager_webconfig_uri_handler_get(httpd_req_t * req);
+esp_err_t esp32_manager_webconfig_uri_handler_api_namespaces(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Handler to call when a JSON namespace is requested
+ *
+ *          Responds with the namespace and all its entries, with their type, attributes and value.
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_api_namespace(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Handler to call when a namespace is updated with a JSON object (PUT or PATCH)
+ *
+ *          The body is parsed as it is received and its members staged. Once the whole body is valid,
+ *          each member sets the entry with the same key, and null resets an entry to its default.
+ *          Values are committed to NVS once at the end. If the body is not valid JSON, no value changes.
+ *          Responds with {"updated": N, "failed": N}.
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_api_update(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
+
+/**
+ * @brief   Handler to call when the WiFi scan results are requested
+ *
+ *          Responds with {"scanning": bool, "seq": N, "networks": [{"ssid", "rssi", "channel", "open"}]},
+ *          from the results of the last scan, so it never waits for one. With the scan parameter, a
+ *          scan is started first. The ETag changes when a scan starts or ends, so clients can poll
+ *          cheaply until the results are fresh.
+ *
+ * @param   req Pointer to the request handle
+ * @param   ctx Request context
+ * @return  ESP_OK: success
+ *          ESP_FAIL: error
+ */
+esp_err_t esp32_manager_webconfig_uri_handler_api_networks(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
 
 /**
  * @brief   Handler to call when factory page is requested
  *
  * @param   req Pointer to the request handle
+ * @param   ctx Request context
  * @return  ESP_OK: success
  *          ESP_FAIL: error
  */
-esp_err_t esp32_manager_webconfig_uri_handler_factory(httpd_req_t * req);
+esp_err_t esp32_manager_webconfig_uri_handler_factory(httpd_req_t * req, esp32_manager_webconfig_ctx_t * ctx);
 
 /**
  * @brief   Generates HTML code for root document
  *
- * @param   buffer String buffer to store the HTML generated
- * @param   req Pointer to the request handle
+ * @param   chunk Chunked response to send the HTML generated to
  * @return  ESP_OK: success
- *          ESP_ERR_INVALID_ARG: buffer or req are not valid
+ *          ESP_ERR_INVALID_ARG: chunk is not valid
+ *          ESP_FAIL: error sending the page
  */
-esp_err_t esp32_manager_webconfig_page_root(char * buffer, httpd_req_t * req, size_t buffer_size);
+esp_err_t esp32_manager_webconfig_page_root(esp32_manager_webconfig_chunk_t * chunk);
 
 /**
  * @brief   Generates HTML code for reboot page
  *
- * @param   buffer String buffer to store the HTML generated
- * @param   req Pointer to the request handle
+ * @param   chunk Chunked response to send the HTML generated to
+ * @return  ESP_OK: success
+ *          ESP_ERR_INVALID_ARG: chunk is not valid
+ *          ESP_FAIL: error sending the page
+ */
+esp_err_t esp32_manager_webconfig_page_reboot(esp32_manager_webconfig_chunk_t * chunk);
+
+/**
+ * @brief   Generates HTML code for the page shown after a factory reset
+ *
+ * @param   chunk Chunked response to send the HTML generated to
+ * @param   success Result of the factory reset
  * @return  ESP_OK: success
- *          ESP_ERR_INVALID_ARG: buffer or req are not valid
+ *          ESP_ERR_INVALID_ARG: chunk is not valid
+ *          ESP_FAIL: error sending the page
  */
-esp_err_t esp32_manager_webconfig_page_reboot(char * buffer, httpd_req_t * req, size_t buffer_size);
+esp_err_t esp32_manager_webconfig_page_factory_reset(esp32_manager_webconfig_chunk_t * chunk, bool success);
 
 /**
  * @brief   Generates HTML code for setup page
  *
- * @param   buffer String buffer to store the HTML generated
- * @param   req Pointer to the request handle
+ * @param   chunk Chunked response to send the HTML generated to
  * @return  ESP_OK: success
- *          ESP_ERR_INVALID_ARG: buffer or req are not valid
+ *          ESP_ERR_INVALID_ARG: chunk is not valid
+ *          ESP_FAIL: error sending the page
  */
-esp_err_t esp32_manager_webconfig_page_setup(char * buffer, httpd_req_t * req, size_t buffer_size);
+esp_err_t esp32_manager_webconfig_page_setup(esp32_manager_webconfig_chunk_t * chunk);
 
 /**
  * @brief   Generates HTML code for setup namespace page
  *
- * @param   buffer String buffer to store the HTML generated
- * @param   req Pointer to the request handle
+ * @param   chunk Chunked response to send the HTML generated to
  * @param   namespace Namespace to be edited
  * @return  ESP_OK: success
- *          ESP_ERR_INVALID_ARG: buffer, req or namespace are not valid
+ *          ESP_ERR_INVALID_ARG: chunk or namespace are not valid
+ *          ESP_FAIL: error sending the page
  */
-esp_err_t esp32_manager_webconfig_page_setup_namespace(char * buffer, httpd_req_t * req, esp32_manager_namespace_t * namespace, size_t buffer_size);
+esp_err_t esp32_manager_webconfig_page_setup_namespace(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_namespace_t * namespace);
 
 /**
  * @brief   Generates the right HTML form input code according to entry type
  *
+ * @param   chunk Chunked response to send the HTML generated to
  * @param   entry Pointer to entry
- * @param   dest Output buffer
  * @return  ESP_OK success
  *          ESP_FAIL error
  */
-esp_err_t esp32_manager_webconfig_html_form_widget_default(char * dest, esp32_manager_entry_t * entry, size_t buffer_size);
+esp_err_t esp32_manager_webconfig_html_form_widget_default(esp32_manager_webconfig_chunk_t * chunk, esp32_manager_entry_t * entry);
 
 /**
  * @brief   Starts the task that generates a delayed reboot so the webserver can finish up serving http requests
@@ -215,6 +655,37 @@ void esp32_manager_webconfig_deferred_reboot_task(void * pvParameter);
  */
 esp_err_t esp32_manager_webconfig_urldecode(char *__restrict__ dest, const char *__restrict__ src);
 
+/**
+ * @brief   Initialize a form parser
+ *
+ * @param   parser parser
+ * @param   value buffer for decoded values, of value_size +1 bytes
+ * @param   value_size longest value
+ * @param   cb called for every field
+ * @param   arg user argument for cb
+ */
+void esp32_manager_webconfig_form_parser_init(esp32_manager_webconfig_form_parser_t * parser, char * value, size_t value_size, esp32_manager_webconfig_form_field_cb_t cb, void * arg);
+
+/**
+ * @brief   Parse the next piece of a form
+ *
+ * @param   parser parser
+ * @param   data URL-encoded input
+ * @param   length length of the input
+ * @return  ESP_OK success
+ *          Error returned by the callback
+ */
+esp_err_t esp32_manager_webconfig_form_parse(esp32_manager_webconfig_form_parser_t * parser, const char * data, size_t length);
+
+/**
+ * @brief   Pass on the last field of a form
+ *
+ * @param   parser parser
+ * @return  ESP_OK success
+ *          Error returned by the callback
+ */
+esp_err_t esp32_manager_webconfig_form_parser_end(esp32_manager_webconfig_form_parser_t * parser);
+
 #ifdef __cplusplus
 }
 #endif
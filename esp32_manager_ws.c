@@ -0,0 +1,531 @@
+/**
+ * esp32_manager_ws.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "esp32_manager_ws.h"
+
+#ifdef CONFIG_ESP32_MANAGER_WS
+
+static const char * TAG = "esp32_manager_ws";
+
+static esp32_manager_ws_client_t esp32_manager_ws_clients[ESP32_MANAGER_WS_CLIENTS_SIZE];
+static portMUX_TYPE esp32_manager_ws_mux = portMUX_INITIALIZER_UNLOCKED;   /*!< Guards the clients, shared with the tasks making changes */
+static httpd_handle_t esp32_manager_ws_server = NULL;
+static TaskHandle_t esp32_manager_ws_task_handle = NULL;
+
+/** Frames received. Only used from the server task, which runs handlers one at a time. */
+static char esp32_manager_ws_buffer[sizeof(esp32_manager_ws_key_t) + ESP32_MANAGER_WS_BUFFER_SIZE +1];
+
+/** Only used by the sender task, the only one sending frames, so they go out one at a time */
+static char esp32_manager_ws_update[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH + ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH + ESP32_MANAGER_WS_BUFFER_SIZE +3];
+
+static const httpd_uri_t esp32_manager_ws_uri = {
+    .uri = ESP32_MANAGER_WS_URL,
+    .method = HTTP_GET,
+    .handler = esp32_manager_ws_uri_handler,
+    .user_ctx = NULL,
+    .is_websocket = true
+};
+
+static void esp32_manager_ws_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg);
+static void esp32_manager_ws_task(void * arg);
+
+esp_err_t esp32_manager_ws_init()
+{
+    if(esp32_manager_ws_task_handle != NULL) {
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE; ++i) {
+        esp32_manager_ws_clients[i].fd = -1;
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    if(xTaskCreate(esp32_manager_ws_task, "esp32_manager_ws", ESP32_MANAGER_WS_TASK_STACK_SIZE, NULL, ESP32_MANAGER_WS_TASK_PRIORITY, &esp32_manager_ws_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Error creating sender task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return esp32_manager_add_change_listener(esp32_manager_ws_changed, NULL);
+}
+
+esp_err_t esp32_manager_ws_start(httpd_handle_t server)
+{
+    esp_err_t e;
+
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE; ++i) {
+        esp32_manager_ws_clients[i].fd = -1;
+    }
+    esp32_manager_ws_server = server;
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    e = httpd_register_uri_handler(server, &esp32_manager_ws_uri);
+    if(e == ESP_OK) {
+        ESP_LOGD(TAG, "Registered uri %s", esp32_manager_ws_uri.uri);
+    } else {
+        ESP_LOGE(TAG, "Error registering uri %s: %s", esp32_manager_ws_uri.uri, esp_err_to_name(e));
+    }
+    return e;
+}
+
+void esp32_manager_ws_stop()
+{
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE; ++i) {
+        esp32_manager_ws_clients[i].fd = -1;
+    }
+    esp32_manager_ws_server = NULL;
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+}
+
+/**
+ * Finds the client of a socket. Call it inside the critical section.
+ */
+static esp32_manager_ws_client_t * esp32_manager_ws_find_client(int fd)
+{
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE; ++i) {
+        if(esp32_manager_ws_clients[i].fd == fd) {
+            return &esp32_manager_ws_clients[i];
+        }
+    }
+    return NULL;
+}
+
+void esp32_manager_ws_closed(int fd)
+{
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    esp32_manager_ws_client_t * client = (fd >= 0) ? esp32_manager_ws_find_client(fd) : NULL;
+    if(client != NULL) {
+        client->fd = -1;
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    if(client != NULL) {
+        ESP_LOGD(TAG, "Client %d disconnected", fd);
+    }
+}
+
+/**
+ * Splits [namespace] or [namespace].[entry]
+ */
+static bool esp32_manager_ws_parse_key(const char * src, size_t length, esp32_manager_ws_key_t * key)
+{
+    const char * dot = memchr(src, '.', length);
+    size_t namespace_length = (dot != NULL) ? (size_t) (dot - src) : length;
+    size_t entry_length = (dot != NULL) ? length - namespace_length -1 : 0;
+
+    if(namespace_length == 0 || namespace_length > ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH
+            || (dot != NULL && entry_length == 0) || entry_length > ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH) {
+        return false;
+    }
+
+    memcpy(key->namespace_key, src, namespace_length);
+    key->namespace_key[namespace_length] = 0;
+    memcpy(key->entry_key, src + namespace_length +1, entry_length);
+    key->entry_key[entry_length] = 0;
+    return true;
+}
+
+/**
+ * Queues an update, unless the entry is already queued. Call it inside the critical section.
+ *
+ * @return  true if the client has something new to send
+ */
+static bool esp32_manager_ws_enqueue(esp32_manager_ws_client_t * client, const char * namespace_key, const char * entry_key)
+{
+    for(uint8_t i=0; i < client->count; ++i) {
+        esp32_manager_ws_key_t * queued = &client->queue[(client->head + i) % ESP32_MANAGER_WS_QUEUE_SIZE];
+        if(!strcmp(queued->entry_key, entry_key) && !strcmp(queued->namespace_key, namespace_key)) {
+            return false; // Value is read when sent, the latest one goes out
+        }
+    }
+
+    if(client->count < ESP32_MANAGER_WS_QUEUE_SIZE) {
+        esp32_manager_ws_key_t * queued = &client->queue[(client->head + client->count) % ESP32_MANAGER_WS_QUEUE_SIZE];
+        strcpy(queued->namespace_key, namespace_key);
+        strcpy(queued->entry_key, entry_key);
+        ++client->count;
+    } else {
+        client->overflow = true; // Client is too slow, it will be told to resync
+    }
+    return true;
+}
+
+/**
+ * Change listener. Only queues keys and wakes up the sender task, which reads the values.
+ */
+static void esp32_manager_ws_changed(esp32_manager_namespace_t * namespace, esp32_manager_entry_t * entry, void * arg)
+{
+    bool wake = false;
+
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE && esp32_manager_ws_server != NULL; ++i) {
+        esp32_manager_ws_client_t * client = &esp32_manager_ws_clients[i];
+        if(client->fd < 0) continue;
+        for(uint8_t j=0; j < ESP32_MANAGER_WS_SUBSCRIPTIONS_SIZE; ++j) {
+            esp32_manager_ws_key_t * subscription = &client->subscriptions[j];
+            if(subscription->namespace_key[0] != 0 && !strcmp(subscription->namespace_key, namespace->key)
+                    && (subscription->entry_key[0] == 0 || !strcmp(subscription->entry_key, entry->key))) {
+                wake |= esp32_manager_ws_enqueue(client, namespace->key, entry->key);
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    if(wake && esp32_manager_ws_task_handle != NULL) {
+        xTaskNotifyGive(esp32_manager_ws_task_handle);
+    }
+}
+
+/**
+ * Sends a text frame to a client from the sender task, if its socket is still the same WebSocket connection.
+ * Blocks for up to ESP32_MANAGER_WS_SEND_TIMEOUT milliseconds, the send timeout of the socket.
+ */
+static esp_err_t esp32_manager_ws_send(httpd_handle_t server, int fd, const char * text, size_t length)
+{
+    esp_err_t e;
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .fragmented = false,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *) text,
+        .len = length
+    };
+
+    if(httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        e = ESP_ERR_INVALID_STATE; // Closed, or reused by another connection
+    } else {
+        e = httpd_ws_send_frame_async(server, fd, &frame);
+    }
+    return e;
+}
+
+/**
+ * Sends the reply and the updates queued for a client
+ */
+static void esp32_manager_ws_send_updates(esp32_manager_ws_client_t * client)
+{
+    while(true) {
+        esp32_manager_ws_key_t key;
+        bool reply = false, resync = false;
+        httpd_handle_t server;
+        char * update = esp32_manager_ws_update;
+        size_t length;
+        int fd;
+
+        portENTER_CRITICAL(&esp32_manager_ws_mux);
+        fd = client->fd;
+        server = esp32_manager_ws_server;
+        if(fd < 0 || server == NULL || (client->reply[0] == 0 && client->count == 0 && !client->overflow)) {
+            portEXIT_CRITICAL(&esp32_manager_ws_mux);
+            return;
+        }
+        if(client->reply[0] != 0) { // Replies first, the client is waiting for them
+            strcpy(update, client->reply);
+            client->reply[0] = 0;
+            reply = true;
+        } else if(client->overflow) { // Updates still queued are covered by the resync
+            client->overflow = false;
+            client->count = 0;
+            resync = true;
+        } else {
+            key = client->queue[client->head];
+            client->head = (client->head +1) % ESP32_MANAGER_WS_QUEUE_SIZE;
+            --client->count;
+        }
+        portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+        if(reply) {
+            length = strlen(update);
+        } else if(resync) {
+            length = sprintf(update, "resync");
+        } else { // [namespace].[entry]=[value]
+            uint8_t parity = esp32_manager_read_enter();
+            esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(key.namespace_key);
+            esp32_manager_entry_t * entry = (namespace != NULL) ? esp32_manager_find_entry(namespace, key.entry_key) : NULL;
+            if(entry == NULL) { // Unregistered since it changed
+                esp32_manager_read_exit(parity);
+                continue;
+            }
+            length = snprintf(update, sizeof(esp32_manager_ws_update), "%s.%s=", key.namespace_key, key.entry_key);
+            esp_err_t e = entry->to_string(entry, update + length, sizeof(esp32_manager_ws_update) - length);
+            if(e == ESP_ERR_INVALID_SIZE) { // Longer than the buffer, formatted on the heap
+                size_t value_length = esp32_manager_entry_string_length(entry);
+                char * large = (value_length > 0) ? malloc(length + value_length +1) : NULL;
+                if(large != NULL) {
+                    memcpy(large, update, length);
+                    e = entry->to_string(entry, large + length, value_length +1);
+                    if(e == ESP_OK) {
+                        update = large;
+                    } else {
+                        free(large);
+                    }
+                }
+            }
+            if(e == ESP_OK) {
+                length += strlen(update + length);
+            } else { // No text value, such as memory-mapped ones, or no memory for it. Only the change is announced.
+                update[--length] = 0;
+            }
+            esp32_manager_read_exit(parity); // Sent outside of the read section, sending can block
+        }
+
+        esp_err_t e = esp32_manager_ws_send(server, fd, update, length);
+        if(update != esp32_manager_ws_update) {
+            free(update);
+        }
+        if(e != ESP_OK) {
+            ESP_LOGW(TAG, "Error sending to client %d, disconnecting", fd);
+            esp32_manager_ws_closed(fd);
+            httpd_sess_trigger_close(server, fd);
+            return;
+        }
+    }
+}
+
+/**
+ * Sender task. Wakes up on changes and sends the updates of every client.
+ */
+static void esp32_manager_ws_task(void * arg)
+{
+    while(true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for(uint8_t i=0; i < ESP32_MANAGER_WS_CLIENTS_SIZE; ++i) {
+            esp32_manager_ws_send_updates(&esp32_manager_ws_clients[i]);
+        }
+    }
+}
+
+/**
+ * sub [key]: subscribes and queues the current values
+ */
+static esp_err_t esp32_manager_ws_subscribe(int fd, const esp32_manager_ws_key_t * key)
+{
+    esp_err_t e = ESP_ERR_NO_MEM;
+    bool wake = false;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(key->namespace_key);
+    if(namespace == NULL || (key->entry_key[0] != 0 && esp32_manager_find_entry(namespace, key->entry_key) == NULL)) {
+        esp32_manager_read_exit(parity);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    esp32_manager_ws_client_t * client = esp32_manager_ws_find_client(fd);
+    if(client != NULL) {
+        esp32_manager_ws_key_t * free_slot = NULL;
+        for(uint8_t i=0; i < ESP32_MANAGER_WS_SUBSCRIPTIONS_SIZE; ++i) {
+            esp32_manager_ws_key_t * subscription = &client->subscriptions[i];
+            if(subscription->namespace_key[0] == 0) {
+                if(free_slot == NULL) free_slot = subscription;
+            } else if(!strcmp(subscription->namespace_key, key->namespace_key) && !strcmp(subscription->entry_key, key->entry_key)) {
+                free_slot = subscription; // Already subscribed, values are sent again
+                break;
+            }
+        }
+        if(free_slot != NULL) {
+            *free_slot = *key;
+            e = ESP_OK;
+        }
+    } else {
+        e = ESP_ERR_INVALID_STATE;
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    // Current values, through the queue so they are never sent after a newer change
+    for(uint16_t i=0; i < namespace->size && e == ESP_OK; ++i) {
+        esp32_manager_entry_t * entry = namespace->entries[i]; // Read slot once, it can be cleared concurrently
+        if(entry == NULL || (key->entry_key[0] != 0 && strcmp(entry->key, key->entry_key))) continue;
+        portENTER_CRITICAL(&esp32_manager_ws_mux);
+        if(client->fd == fd) {
+            wake |= esp32_manager_ws_enqueue(client, namespace->key, entry->key);
+        }
+        portEXIT_CRITICAL(&esp32_manager_ws_mux);
+    }
+    esp32_manager_read_exit(parity);
+
+    if(wake && esp32_manager_ws_task_handle != NULL) {
+        xTaskNotifyGive(esp32_manager_ws_task_handle);
+    }
+    return e;
+}
+
+/**
+ * unsub [key]
+ */
+static esp_err_t esp32_manager_ws_unsubscribe(int fd, const esp32_manager_ws_key_t * key)
+{
+    esp_err_t e = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    esp32_manager_ws_client_t * client = esp32_manager_ws_find_client(fd);
+    for(uint8_t i=0; i < ESP32_MANAGER_WS_SUBSCRIPTIONS_SIZE && client != NULL; ++i) {
+        esp32_manager_ws_key_t * subscription = &client->subscriptions[i];
+        if(!strcmp(subscription->namespace_key, key->namespace_key) && !strcmp(subscription->entry_key, key->entry_key)) {
+            subscription->namespace_key[0] = 0;
+            e = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    return e;
+}
+
+/**
+ * Logs commits of the worker task started by set
+ */
+static void esp32_manager_ws_committed(esp32_manager_namespace_t * namespace, esp32_manager_async_op_t op, esp_err_t result, void * arg)
+{
+    if(result != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing namespace %s: %s", namespace->key, esp_err_to_name(result));
+    }
+}
+
+/**
+ * set [key]=[value]. The commit runs on the worker task, outside of the read section and the server task.
+ */
+static esp_err_t esp32_manager_ws_set(const esp32_manager_ws_key_t * key, char * value)
+{
+    esp_err_t e;
+
+    uint8_t parity = esp32_manager_read_enter();
+    esp32_manager_namespace_t * namespace = esp32_manager_find_namespace(key->namespace_key);
+    esp32_manager_entry_t * entry = (namespace != NULL) ? esp32_manager_find_entry(namespace, key->entry_key) : NULL;
+    if(entry == NULL) {
+        e = ESP_ERR_NOT_FOUND;
+    } else if((entry->attributes & ESP32_MANAGER_ATTR_WRITE) == 0 || (entry->attributes & ESP32_MANAGER_ATTR_MMAP) != 0) {
+        e = ESP_ERR_NOT_SUPPORTED;
+    } else {
+        e = esp32_manager_entry_set_from_string(namespace, entry, value);
+        if(e == ESP_OK) {
+            e = esp32_manager_commit_to_nvs_async(namespace, esp32_manager_ws_committed, NULL); // Only queued
+        }
+    }
+    esp32_manager_read_exit(parity);
+
+    return e;
+}
+
+/**
+ * Runs a command received from a client
+ */
+static esp_err_t esp32_manager_ws_command(int fd, char * command)
+{
+    esp32_manager_ws_key_t key;
+
+    if(!strncmp(command, "sub ", 4)) {
+        if(!esp32_manager_ws_parse_key(command +4, strlen(command +4), &key)) return ESP_ERR_INVALID_ARG;
+        return esp32_manager_ws_subscribe(fd, &key);
+    } else if(!strncmp(command, "unsub ", 6)) {
+        if(!esp32_manager_ws_parse_key(command +6, strlen(command +6), &key)) return ESP_ERR_INVALID_ARG;
+        return esp32_manager_ws_unsubscribe(fd, &key);
+    } else if(!strncmp(command, "set ", 4)) {
+        char * value = strchr(command +4, '=');
+        if(value == NULL || !esp32_manager_ws_parse_key(command +4, value - (command +4), &key) || key.entry_key[0] == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return esp32_manager_ws_set(&key, value +1);
+    }
+
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp32_manager_ws_uri_handler(httpd_req_t * req)
+{
+    esp_err_t e;
+    int fd = httpd_req_to_sockfd(req);
+
+    if(req->method == HTTP_GET) { // Handshake done, new client
+        esp32_manager_ws_client_t * client = NULL;
+        portENTER_CRITICAL(&esp32_manager_ws_mux);
+        client = esp32_manager_ws_find_client(-1);
+        if(client != NULL) {
+            memset(client, 0, sizeof(esp32_manager_ws_client_t));
+            client->fd = fd;
+        }
+        portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+        if(client == NULL) {
+            ESP_LOGW(TAG, "No room for more clients");
+            return ESP_FAIL;
+        }
+        // A client not reading its frames fills the socket. Sends to it time out and it is dropped, instead of
+        // holding up the sender task and every other client.
+        struct timeval timeout = {
+            .tv_sec = ESP32_MANAGER_WS_SEND_TIMEOUT / 1000,
+            .tv_usec = (ESP32_MANAGER_WS_SEND_TIMEOUT % 1000) * 1000
+        };
+        if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+            ESP_LOGW(TAG, "Error setting send timeout of client %d", fd);
+        }
+        ESP_LOGD(TAG, "Client %d connected", fd);
+        return ESP_OK;
+    }
+
+    httpd_ws_frame_t frame;
+    memset(&frame, 0, sizeof(httpd_ws_frame_t));
+    e = httpd_ws_recv_frame(req, &frame, 0); // Length only
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error receiving frame: %s", esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+    if(frame.len > ESP32_MANAGER_WS_BUFFER_SIZE) {
+        ESP_LOGW(TAG, "Frame of %u bytes too long", frame.len);
+        return ESP_FAIL;
+    }
+    frame.payload = (uint8_t *) esp32_manager_ws_buffer;
+    e = httpd_ws_recv_frame(req, &frame, ESP32_MANAGER_WS_BUFFER_SIZE);
+    if(e != ESP_OK) {
+        ESP_LOGE(TAG, "Error receiving frame: %s", esp_err_to_name(e));
+        return ESP_FAIL;
+    }
+    if(frame.type != HTTPD_WS_TYPE_TEXT) {
+        return ESP_OK;
+    }
+    esp32_manager_ws_buffer[frame.len] = 0;
+
+    // Answered with the command, up to the value. Taken before running it, values can be modified while parsed.
+    char command[48];
+    char reply[ESP32_MANAGER_WS_REPLY_SIZE];
+    snprintf(command, sizeof(command), "%.*s", (int) strcspn(esp32_manager_ws_buffer, "="), esp32_manager_ws_buffer);
+    e = esp32_manager_ws_command(fd, esp32_manager_ws_buffer);
+    snprintf(reply, sizeof(reply), "%s %s", (e == ESP_OK) ? "ok" : "error", command);
+    if(e != ESP_OK) {
+        ESP_LOGW(TAG, "Command from client %d failed: %s", fd, esp_err_to_name(e));
+    }
+
+    // Sent by the sender task, so the server task never waits for the network or for an update going out
+    bool pending = false;
+    portENTER_CRITICAL(&esp32_manager_ws_mux);
+    esp32_manager_ws_client_t * client = esp32_manager_ws_find_client(fd);
+    if(client != NULL) {
+        pending = (client->reply[0] != 0);
+        if(!pending) {
+            strcpy(client->reply, reply);
+        }
+    }
+    portEXIT_CRITICAL(&esp32_manager_ws_mux);
+
+    if(client == NULL) {
+        return ESP_FAIL; // Dropped
+    }
+    if(pending) {
+        ESP_LOGW(TAG, "Client %d not reading replies, disconnecting", fd);
+        esp32_manager_ws_closed(fd);
+        return ESP_FAIL;
+    }
+    if(esp32_manager_ws_task_handle != NULL) {
+        xTaskNotifyGive(esp32_manager_ws_task_handle);
+    }
+    return ESP_OK;
+}
+
+#endif // CONFIG_ESP32_MANAGER_WS
@@ -0,0 +1,127 @@
+/**
+ * esp32_manager_ws.h
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#ifndef _ESP32_MANAGER_WS_H_
+#define _ESP32_MANAGER_WS_H_
+
+#include "esp_system.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "esp32_manager_storage.h"
+#include "esp32_manager_async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_ESP32_MANAGER_WS
+
+#define ESP32_MANAGER_WS_URL                "/ws"   /*!< uri of the WebSocket endpoint */
+#define ESP32_MANAGER_WS_CLIENTS_SIZE       CONFIG_ESP32_MANAGER_WS_CLIENTS     /*!< Clients connected at the same time */
+#define ESP32_MANAGER_WS_QUEUE_SIZE         CONFIG_ESP32_MANAGER_WS_QUEUE_SIZE  /*!< Updates waiting to be sent, per client */
+#define ESP32_MANAGER_WS_SUBSCRIPTIONS_SIZE 8       /*!< Subscriptions per client */
+#define ESP32_MANAGER_WS_BUFFER_SIZE        1024    /*!< Longest frame received. Longer values are sent from the heap. */
+#define ESP32_MANAGER_WS_REPLY_SIZE         64      /*!< Longest reply to a command, with the command up to the value */
+#define ESP32_MANAGER_WS_SEND_TIMEOUT       100     /*!< Milliseconds a frame can wait for room in the socket before the client is dropped */
+#define ESP32_MANAGER_WS_TASK_PRIORITY      5       /*!< Priority of the sender task, same as the server task */
+#define ESP32_MANAGER_WS_TASK_STACK_SIZE    3072    /*!< Stack of the sender task */
+
+/**
+ * Namespace and entry keys of a subscription or an update
+ */
+typedef struct {
+    char namespace_key[ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH +1];
+    char entry_key[ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH +1];  /*!< Empty for all entries of the namespace */
+} esp32_manager_ws_key_t;
+
+/**
+ * Connected client
+ *
+ * Changes are queued by key and the value is read when the sender task sends the update, so an entry changing
+ * again before its update goes out takes no more room in the queue. When the queue is full, updates
+ * are dropped and the client is told to resync instead. Replies to commands are sent by the sender task too,
+ * ahead of the queued updates.
+ */
+typedef struct {
+    int fd;                                                             /*!< Socket. -1 for a free slot. */
+    esp32_manager_ws_key_t subscriptions[ESP32_MANAGER_WS_SUBSCRIPTIONS_SIZE]; /*!< Empty namespace key for a free slot */
+    esp32_manager_ws_key_t queue[ESP32_MANAGER_WS_QUEUE_SIZE];          /*!< Entries changed, not sent yet */
+    uint8_t head;                                                       /*!< Oldest update in the queue */
+    uint8_t count;                                                      /*!< Updates in the queue */
+    bool overflow;                                                      /*!< Updates were dropped */
+    char reply[ESP32_MANAGER_WS_REPLY_SIZE];                            /*!< Reply to the last command, not sent yet. Empty if none. */
+} esp32_manager_ws_client_t;
+
+/**
+ * @brief   Initialize esp32_manager_ws
+ *
+ *          Starts the sender task and adds the change listener. Called by esp32_manager_webconfig_init().
+ *
+ * @return  ESP_OK success
+ *          ESP_ERR_NO_MEM could not create the task or add the change listener
+ */
+esp_err_t esp32_manager_ws_init();
+
+/**
+ * @brief   Register the WebSocket uri on a server
+ *
+ *          Called by esp32_manager_webconfig_webserver_start(). Clients of a previous server are dropped.
+ *
+ * @param   server server handle
+ * @return  ESP_OK success
+ *          Error returned by httpd_register_uri_handler()
+ */
+esp_err_t esp32_manager_ws_start(httpd_handle_t server);
+
+/**
+ * @brief   Drop all clients before the server stops
+ *
+ *          Called by esp32_manager_webconfig_webserver_stop().
+ */
+void esp32_manager_ws_stop();
+
+/**
+ * @brief   Forget a client whose socket is being closed
+ *
+ *          Called from the server's close function for every socket. Sockets of other clients are ignored.
+ *
+ * @param   fd socket
+ */
+void esp32_manager_ws_closed(int fd);
+
+/**
+ * @brief   Handler of the WebSocket uri
+ *
+ *          Registers the client on the handshake, and then runs the commands received in text frames:
+ *          - sub [namespace] or sub [namespace].[entry]: send the current value of the entries and
+ *            then every change of them, as [namespace].[entry]=[value]
+ *          - unsub [namespace] or unsub [namespace].[entry]: stop sending them
+ *          - set [namespace].[entry]=[value]: set an entry. Its namespace is committed to NVS in the
+ *            background, by the worker task of esp32_manager_async.
+ *          Commands are answered with "ok [command]" or "error [command]". A "resync" frame means
+ *          updates were dropped because the client did not keep up. Clients that do not read their
+ *          frames within ESP32_MANAGER_WS_SEND_TIMEOUT milliseconds, or send a command before the
+ *          reply to the previous one went out, are disconnected.
+ *
+ * @param   req request
+ * @return  ESP_OK success
+ *          ESP_FAIL error, the socket is closed
+ */
+esp_err_t esp32_manager_ws_uri_handler(httpd_req_t * req);
+
+#endif // CONFIG_ESP32_MANAGER_WS
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ESP32_MANAGER_WS_H_
@@ -13,8 +13,16 @@
 #include "esp_log.h"
 
 #include "esp32_manager_storage.h"
+#include "esp32_manager_async.h"
+#include "esp32_manager_mmap.h"
+#include "esp32_manager_rtc.h"
+#include "esp32_manager_history.h"
+#include "esp32_manager_journal.h"
+#include "esp32_manager_profile.h"
 #include "esp32_manager_network.h"
 #include "esp32_manager_webconfig.h"
+#include "esp32_manager_ws.h"
+#include "esp32_manager_sse.h"
 #include "esp32_manager_mqtt.h"
 
 #ifdef __cplusplus
@@ -0,0 +1,7 @@
+#
+# Component Makefile for the esp-idf unit test app
+#
+# Tests are built into the unit test app with: make TEST_COMPONENTS=esp32_manager
+#
+
+COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
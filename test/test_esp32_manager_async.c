@@ -0,0 +1,162 @@
+/**
+ * test_esp32_manager_async.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "unity.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp32_manager_storage.h"
+#include "esp32_manager_async.h"
+
+#ifdef CONFIG_ESP32_MANAGER_ASYNC
+
+#define TEST_ASYNC_ENTRIES_SIZE     200     /*!< Entries in the large test namespace */
+#define TEST_ASYNC_VALUE_SIZE       64      /*!< Size of each text value */
+#define TEST_ASYNC_PROBE_PERIOD     1000    /*!< Microseconds between wake-ups of the probe task */
+#define TEST_ASYNC_PROBE_PRIORITY   (ESP32_MANAGER_ASYNC_TASK_PRIORITY +1)  /*!< Above the worker */
+
+static char test_async_values[TEST_ASYNC_ENTRIES_SIZE][TEST_ASYNC_VALUE_SIZE];
+static char test_async_value_default[] = "";
+static char test_async_keys[TEST_ASYNC_ENTRIES_SIZE][8];
+static esp32_manager_entry_t test_async_entry_list[TEST_ASYNC_ENTRIES_SIZE];
+static esp32_manager_entry_t * test_async_entries[TEST_ASYNC_ENTRIES_SIZE];
+
+static esp32_manager_namespace_t test_async_namespace = {
+    .key = "async_test",
+    .friendly = "Async test",
+    .entries = test_async_entries,
+    .size = TEST_ASYNC_ENTRIES_SIZE
+};
+
+static SemaphoreHandle_t test_async_tick;           /*!< Given by the timer, taken by the probe */
+static SemaphoreHandle_t test_async_done;           /*!< Given by the commit callback */
+static volatile int64_t test_async_tick_time;       /*!< When the timer gave the last tick */
+static volatile uint32_t test_async_max_delay;      /*!< Longest time from a tick to the probe running, in microseconds */
+static volatile bool test_async_probing;
+static esp_err_t test_async_result;
+
+static void test_async_timer_cb(void * arg)
+{
+    test_async_tick_time = esp_timer_get_time();
+    xSemaphoreGive(test_async_tick);
+}
+
+/**
+ * Wakes up on every tick of the timer and records how late it runs
+ */
+static void test_async_probe_task(void * arg)
+{
+    while(test_async_probing) {
+        if(xSemaphoreTake(test_async_tick, pdMS_TO_TICKS(100)) != pdTRUE) continue;
+        uint32_t delay = (uint32_t) (esp_timer_get_time() - test_async_tick_time);
+        if(delay > test_async_max_delay) {
+            test_async_max_delay = delay;
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+static void test_async_committed_cb(esp32_manager_namespace_t * namespace, esp32_manager_async_op_t op, esp_err_t result, void * arg)
+{
+    test_async_result = result;
+    xSemaphoreGive(test_async_done);
+}
+
+static void test_async_register()
+{
+    memset(test_async_entries, 0, sizeof(test_async_entries));
+    TEST_ESP_OK(esp32_manager_storage_init());
+    TEST_ESP_OK(esp32_manager_async_init());
+    TEST_ESP_OK(esp32_manager_register_namespace(&test_async_namespace));
+    for(uint16_t i=0; i < TEST_ASYNC_ENTRIES_SIZE; ++i) {
+        snprintf(test_async_keys[i], sizeof(test_async_keys[i]), "e%u", i);
+        test_async_entry_list[i] = (esp32_manager_entry_t) {
+            .key = test_async_keys[i],
+            .friendly = test_async_keys[i],
+            .type = text,
+            .value = (void *) test_async_values[i],
+            .default_value = (void *) test_async_value_default,
+            .size = TEST_ASYNC_VALUE_SIZE,
+            .attributes = ESP32_MANAGER_ATTR_READWRITE
+        };
+        TEST_ESP_OK(esp32_manager_register_entry(&test_async_namespace, &test_async_entry_list[i]));
+    }
+}
+
+static void test_async_unregister()
+{
+    TEST_ESP_OK(esp32_manager_namespace_nvs_erase(&test_async_namespace));
+    nvs_commit(test_async_namespace.nvs_handle);
+    TEST_ESP_OK(esp32_manager_unregister_namespace(&test_async_namespace));
+}
+
+/**
+ * Max scheduling delay of the probe task while the worker idles for half a second, then while it commits the namespace
+ */
+static void test_async_probe_commit(uint32_t * idle_delay, uint32_t * commit_delay, uint32_t * commit_time)
+{
+    esp_timer_handle_t timer;
+    const esp_timer_create_args_t timer_args = {
+        .callback = test_async_timer_cb,
+        .name = "async_probe"
+    };
+
+    test_async_tick = xSemaphoreCreateBinary();
+    test_async_done = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(test_async_tick);
+    TEST_ASSERT_NOT_NULL(test_async_done);
+    TEST_ESP_OK(esp_timer_create(&timer_args, &timer));
+
+    // Pinned, so it measures the same core on every run. Flash writes stall both cores.
+    test_async_probing = true;
+    test_async_max_delay = 0;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(test_async_probe_task, "async_probe", 2048, NULL, TEST_ASYNC_PROBE_PRIORITY, NULL, 0));
+    TEST_ESP_OK(esp_timer_start_periodic(timer, TEST_ASYNC_PROBE_PERIOD));
+
+    vTaskDelay(pdMS_TO_TICKS(500)); // Baseline, with the worker idle
+    *idle_delay = test_async_max_delay;
+
+    test_async_max_delay = 0;
+    int64_t start_time = esp_timer_get_time();
+    TEST_ESP_OK(esp32_manager_commit_to_nvs_async(&test_async_namespace, test_async_committed_cb, NULL));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(test_async_done, pdMS_TO_TICKS(30000)));
+    *commit_time = (uint32_t) (esp_timer_get_time() - start_time);
+    *commit_delay = test_async_max_delay;
+    TEST_ESP_OK(test_async_result);
+
+    test_async_probing = false;
+    esp_timer_stop(timer);
+    esp_timer_delete(timer);
+    vTaskDelay(pdMS_TO_TICKS(200)); // Let the probe task end
+    vSemaphoreDelete(test_async_tick);
+    vSemaphoreDelete(test_async_done);
+}
+
+TEST_CASE("higher priority tasks keep running during a large async commit", "[esp32_manager][async][timing]")
+{
+    uint32_t idle_delay, commit_delay, commit_time;
+
+    test_async_register();
+
+    // Every value differs from the last commit, so every entry is written
+    for(uint16_t i=0; i < TEST_ASYNC_ENTRIES_SIZE; ++i) {
+        snprintf(test_async_values[i], TEST_ASYNC_VALUE_SIZE, "value %u of the asynchronous commit test", i);
+    }
+    test_async_probe_commit(&idle_delay, &commit_delay, &commit_time);
+
+    const esp32_manager_async_stats_t * stats = esp32_manager_async_get_stats();
+    printf("Async commit of %u entries in %u us, %u entries per step, longest step %u us. "
+            "Max scheduling delay of a priority %u task every %u us: %u us idle, %u us during the commit.\n",
+            TEST_ASYNC_ENTRIES_SIZE, commit_time, ESP32_MANAGER_ASYNC_CHUNK_SIZE, stats->last_busy_time,
+            TEST_ASYNC_PROBE_PRIORITY, TEST_ASYNC_PROBE_PERIOD, idle_delay, commit_delay);
+
+    test_async_unregister();
+}
+
+#endif // CONFIG_ESP32_MANAGER_ASYNC
@@ -0,0 +1,182 @@
+/**
+ * test_esp32_manager_rtc.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "unity.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+#include "esp32_manager_storage.h"
+#include "esp32_manager_rtc.h"
+
+#ifdef CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
+
+static uint32_t test_rtc_count = 0;
+static uint32_t test_rtc_count_default = 0;
+static RTC_NOINIT_ATTR int64_t test_rtc_cold_ready_time;    /*!< Microseconds from app start to values loaded on the cold boot */
+
+static esp32_manager_entry_t test_rtc_entry_count = {
+    .key = "count",
+    .friendly = "Count",
+    .type = u32,
+    .value = (void *) &test_rtc_count,
+    .default_value = (void *) &test_rtc_count_default,
+    .attributes = ESP32_MANAGER_ATTR_READWRITE
+};
+
+static esp32_manager_entry_t * test_rtc_entries[1];
+
+static esp32_manager_namespace_t test_rtc_namespace = {
+    .key = "rtc_test",
+    .friendly = "RTC test",
+    .entries = test_rtc_entries,
+    .size = 1
+};
+
+static void test_rtc_register()
+{
+    memset(test_rtc_entries, 0, sizeof(test_rtc_entries)); // Unregistering the namespace leaves its entry slots as they were
+    TEST_ESP_OK(esp32_manager_storage_init());
+    TEST_ESP_OK(esp32_manager_register_namespace(&test_rtc_namespace));
+    TEST_ESP_OK(esp32_manager_register_entry(&test_rtc_namespace, &test_rtc_entry_count));
+}
+
+static void test_rtc_unregister()
+{
+    TEST_ESP_OK(esp32_manager_namespace_nvs_erase(&test_rtc_namespace));
+    nvs_commit(test_rtc_namespace.nvs_handle);
+    TEST_ESP_OK(esp32_manager_unregister_namespace(&test_rtc_namespace));
+}
+
+/**
+ * Commits 1, takes a snapshot with 2 not committed and goes to deep sleep
+ */
+static void test_rtc_sleep()
+{
+    test_rtc_register();
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp32_manager_rtc_init()); // Power on, nothing to restore
+    TEST_ESP_OK(esp32_manager_read_from_nvs(&test_rtc_namespace));
+    test_rtc_cold_ready_time = esp_timer_get_time();
+
+    test_rtc_count = 1;
+    TEST_ESP_OK(esp32_manager_commit_to_nvs(&test_rtc_namespace));
+    test_rtc_count = 2;
+    TEST_ESP_OK(esp32_manager_rtc_snapshot());
+
+    esp_sleep_enable_timer_wakeup(100000);
+    esp_deep_sleep_start();
+}
+
+/**
+ * Restores 2 from the snapshot, then commits 3 and reloads it from NVS
+ */
+static void test_rtc_wake()
+{
+    TEST_ASSERT_EQUAL(ESP_SLEEP_WAKEUP_TIMER, esp_sleep_get_wakeup_cause());
+    test_rtc_register();
+    TEST_ESP_OK(esp32_manager_rtc_init());
+    TEST_ASSERT_TRUE(esp32_manager_rtc_get_stats()->warm);
+
+    test_rtc_count = 0;
+    TEST_ESP_OK(esp32_manager_read_from_nvs(&test_rtc_namespace));
+    int64_t warm_ready_time = esp_timer_get_time();
+    TEST_ASSERT_EQUAL_UINT32(2, test_rtc_count); // Value at sleep time, not the one committed
+
+    // Time since the app started, the same on both boots. The bootloader is not included.
+    printf("Ready after %lld us on the cold boot, %lld us on the warm restart. Restore took %u us, estimated saving %u us.\n",
+            test_rtc_cold_ready_time, warm_ready_time, esp32_manager_rtc_get_stats()->restore_time, esp32_manager_rtc_get_stats()->saved_time);
+
+    test_rtc_count = 3;
+    TEST_ESP_OK(esp32_manager_commit_to_nvs(&test_rtc_namespace));
+    test_rtc_count = 0;
+    TEST_ESP_OK(esp32_manager_read_from_nvs(&test_rtc_namespace));
+    TEST_ASSERT_EQUAL_UINT32(3, test_rtc_count); // The snapshot is not restored twice
+
+    test_rtc_unregister();
+}
+
+TEST_CASE_MULTIPLE_STAGES("warm restart restores each namespace from the snapshot once", "[esp32_manager][rtc][reset=DEEPSLEEP_RESET]", test_rtc_sleep, test_rtc_wake);
+
+/**
+ * Commits 1, takes a snapshot with 2 not committed, damages it through the region and goes to deep sleep
+ */
+static void test_rtc_sleep_damaged(void (* damage)(esp32_manager_rtc_header_t * header))
+{
+    size_t size;
+    esp32_manager_rtc_header_t * header = (esp32_manager_rtc_header_t *) esp32_manager_rtc_get_region(&size);
+    TEST_ASSERT_GREATER_THAN(sizeof(esp32_manager_rtc_header_t), size);
+
+    test_rtc_count = 1;
+    TEST_ESP_OK(esp32_manager_commit_to_nvs(&test_rtc_namespace));
+    test_rtc_count = 2;
+    TEST_ESP_OK(esp32_manager_rtc_snapshot());
+    TEST_ASSERT_EQUAL_UINT32(ESP32_MANAGER_RTC_MAGIC, header->magic);
+    damage(header);
+
+    esp_sleep_enable_timer_wakeup(100000);
+    esp_deep_sleep_start();
+}
+
+/**
+ * The damaged snapshot is ignored and the value committed to NVS is loaded
+ */
+static void test_rtc_check_fallback()
+{
+    TEST_ASSERT_EQUAL(ESP_SLEEP_WAKEUP_TIMER, esp_sleep_get_wakeup_cause());
+    test_rtc_register();
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp32_manager_rtc_init());
+    TEST_ASSERT_FALSE(esp32_manager_rtc_get_stats()->warm);
+
+    test_rtc_count = 0;
+    TEST_ESP_OK(esp32_manager_read_from_nvs(&test_rtc_namespace));
+    TEST_ASSERT_EQUAL_UINT32(1, test_rtc_count);
+}
+
+static void test_rtc_damage_magic(esp32_manager_rtc_header_t * header)
+{
+    header->magic ^= 1;
+}
+
+static void test_rtc_damage_crc(esp32_manager_rtc_header_t * header)
+{
+    ((uint8_t *) &header[1])[0] ^= 0xFF; // First payload byte
+}
+
+static void test_rtc_damage_firmware_id(esp32_manager_rtc_header_t * header)
+{
+    header->firmware_id[0] ^= 0xFF;
+}
+
+static void test_rtc_sleep_bad_magic()
+{
+    test_rtc_register();
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp32_manager_rtc_init()); // Power on, nothing to restore
+    test_rtc_sleep_damaged(test_rtc_damage_magic);
+}
+
+static void test_rtc_sleep_bad_crc()
+{
+    test_rtc_check_fallback();
+    test_rtc_sleep_damaged(test_rtc_damage_crc);
+}
+
+static void test_rtc_sleep_bad_firmware_id()
+{
+    test_rtc_check_fallback();
+    test_rtc_sleep_damaged(test_rtc_damage_firmware_id);
+}
+
+static void test_rtc_wake_bad_firmware_id()
+{
+    test_rtc_check_fallback();
+    test_rtc_unregister();
+}
+
+TEST_CASE_MULTIPLE_STAGES("damaged snapshots fall back to NVS", "[esp32_manager][rtc][reset=DEEPSLEEP_RESET,DEEPSLEEP_RESET,DEEPSLEEP_RESET]",
+        test_rtc_sleep_bad_magic, test_rtc_sleep_bad_crc, test_rtc_sleep_bad_firmware_id, test_rtc_wake_bad_firmware_id);
+
+#endif // CONFIG_ESP32_MANAGER_RTC_SNAPSHOT
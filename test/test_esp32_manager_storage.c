@@ -0,0 +1,112 @@
+/**
+ * test_esp32_manager_storage.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "unity.h"
+#include "esp_timer.h"
+
+#include "esp32_manager_storage.h"
+
+#define TEST_STORAGE_ENTRIES_SIZE   200     /*!< Entries in the large test namespace */
+#define TEST_STORAGE_LOAD_ROUNDS    10      /*!< Loads averaged per measurement */
+#define TEST_STORAGE_SPARSE_STEP    20      /*!< One entry stored every this many in the mostly-empty layout */
+
+static uint32_t test_storage_values[TEST_STORAGE_ENTRIES_SIZE];
+static uint32_t test_storage_value_default = 0;
+static char test_storage_keys[TEST_STORAGE_ENTRIES_SIZE][8];
+static esp32_manager_entry_t test_storage_entry_list[TEST_STORAGE_ENTRIES_SIZE];
+static esp32_manager_entry_t * test_storage_entries[TEST_STORAGE_ENTRIES_SIZE];
+
+static esp32_manager_namespace_t test_storage_namespace = {
+    .key = "storage_test",
+    .friendly = "Storage test",
+    .entries = test_storage_entries,
+    .size = TEST_STORAGE_ENTRIES_SIZE
+};
+
+static void test_storage_register()
+{
+    memset(test_storage_entries, 0, sizeof(test_storage_entries));
+    TEST_ESP_OK(esp32_manager_storage_init());
+    TEST_ESP_OK(esp32_manager_register_namespace(&test_storage_namespace));
+    for(uint16_t i=0; i < TEST_STORAGE_ENTRIES_SIZE; ++i) {
+        snprintf(test_storage_keys[i], sizeof(test_storage_keys[i]), "e%u", i);
+        test_storage_entry_list[i] = (esp32_manager_entry_t) {
+            .key = test_storage_keys[i],
+            .friendly = test_storage_keys[i],
+            .type = u32,
+            .value = (void *) &test_storage_values[i],
+            .default_value = (void *) &test_storage_value_default,
+            .attributes = ESP32_MANAGER_ATTR_READWRITE
+        };
+        TEST_ESP_OK(esp32_manager_register_entry(&test_storage_namespace, &test_storage_entry_list[i]));
+    }
+    TEST_ESP_OK(esp32_manager_namespace_nvs_erase(&test_storage_namespace));
+}
+
+static void test_storage_unregister()
+{
+    TEST_ESP_OK(esp32_manager_namespace_nvs_erase(&test_storage_namespace));
+    nvs_commit(test_storage_namespace.nvs_handle);
+    TEST_ESP_OK(esp32_manager_unregister_namespace(&test_storage_namespace));
+}
+
+/**
+ * Average time of loading the namespace with esp32_manager_read_from_nvs(), that walks the stored keys with
+ * CONFIG_ESP32_MANAGER_NVS_BULK_LOAD, and with esp32_manager_read_entries_from_nvs(), that looks up every key
+ */
+static void test_storage_measure_loads(const char * layout, uint16_t stored)
+{
+    int64_t bulk_time = 0, per_key_time = 0;
+
+    for(uint8_t round=0; round < TEST_STORAGE_LOAD_ROUNDS; ++round) {
+        memset(test_storage_values, 0, sizeof(test_storage_values));
+        int64_t start_time = esp_timer_get_time();
+        TEST_ESP_OK(esp32_manager_read_from_nvs(&test_storage_namespace));
+        bulk_time += esp_timer_get_time() - start_time;
+        for(uint16_t i=0; i < TEST_STORAGE_ENTRIES_SIZE; i += TEST_STORAGE_ENTRIES_SIZE / stored) {
+            TEST_ASSERT_EQUAL_UINT32(i +1, test_storage_values[i]);
+        }
+
+        memset(test_storage_values, 0, sizeof(test_storage_values));
+        start_time = esp_timer_get_time();
+        TEST_ESP_OK(esp32_manager_read_entries_from_nvs(&test_storage_namespace, 0, TEST_STORAGE_ENTRIES_SIZE));
+        per_key_time += esp_timer_get_time() - start_time;
+        for(uint16_t i=0; i < TEST_STORAGE_ENTRIES_SIZE; i += TEST_STORAGE_ENTRIES_SIZE / stored) {
+            TEST_ASSERT_EQUAL_UINT32(i +1, test_storage_values[i]);
+        }
+    }
+
+#ifdef CONFIG_ESP32_MANAGER_NVS_BULK_LOAD
+    const char * method = "bulk";
+#else
+    const char * method = "per-key";
+#endif
+    printf("%s namespace, %u of %u keys stored: read_from_nvs (%s) %u us, read_entries_from_nvs (per-key) %u us\n",
+            layout, stored, TEST_STORAGE_ENTRIES_SIZE, method,
+            (uint32_t) (bulk_time / TEST_STORAGE_LOAD_ROUNDS), (uint32_t) (per_key_time / TEST_STORAGE_LOAD_ROUNDS));
+}
+
+TEST_CASE("bulk and per-key loads on mostly-empty and fully-populated namespaces", "[esp32_manager][storage][timing]")
+{
+    test_storage_register();
+
+    // Mostly empty: a few customized values, the rest never saved
+    for(uint16_t i=0; i < TEST_STORAGE_ENTRIES_SIZE; i += TEST_STORAGE_SPARSE_STEP) {
+        TEST_ESP_OK(nvs_set_u32(test_storage_namespace.nvs_handle, test_storage_keys[i], i +1));
+    }
+    TEST_ESP_OK(nvs_commit(test_storage_namespace.nvs_handle));
+    test_storage_measure_loads("Mostly-empty", TEST_STORAGE_ENTRIES_SIZE / TEST_STORAGE_SPARSE_STEP);
+
+    // Fully populated: every value differs from its default, so it is stored with sparse persistence too
+    for(uint16_t i=0; i < TEST_STORAGE_ENTRIES_SIZE; ++i) {
+        test_storage_values[i] = i +1;
+    }
+    TEST_ESP_OK(esp32_manager_commit_to_nvs(&test_storage_namespace));
+    test_storage_measure_loads("Fully-populated", TEST_STORAGE_ENTRIES_SIZE);
+
+    test_storage_unregister();
+}
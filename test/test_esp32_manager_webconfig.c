@@ -0,0 +1,109 @@
+/**
+ * test_esp32_manager_webconfig.c
+ *
+ * (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+ * This code is licensed under the MIT License.
+ */
+
+#include "unity.h"
+#include "esp_timer.h"
+
+#include "esp32_manager_storage.h"
+#include "esp32_manager_webconfig.h"
+
+#define TEST_WEBCONFIG_ENTRIES_SIZE 200     /*!< Entries in the large test namespace */
+#define TEST_WEBCONFIG_TEXT_SIZE    32      /*!< Size of the text values */
+
+static uint32_t test_webconfig_numbers[TEST_WEBCONFIG_ENTRIES_SIZE];
+static char test_webconfig_texts[TEST_WEBCONFIG_ENTRIES_SIZE][TEST_WEBCONFIG_TEXT_SIZE];
+static uint32_t test_webconfig_number_default = 0;
+static char test_webconfig_text_default[] = "";
+static char test_webconfig_keys[TEST_WEBCONFIG_ENTRIES_SIZE][8];
+static char test_webconfig_friendly[TEST_WEBCONFIG_ENTRIES_SIZE][16];
+static esp32_manager_entry_t test_webconfig_entry_list[TEST_WEBCONFIG_ENTRIES_SIZE];
+static esp32_manager_entry_t * test_webconfig_entries[TEST_WEBCONFIG_ENTRIES_SIZE];
+
+static esp32_manager_namespace_t test_webconfig_namespace = {
+    .key = "web_test",
+    .friendly = "Webconfig test",
+    .entries = test_webconfig_entries,
+    .size = TEST_WEBCONFIG_ENTRIES_SIZE
+};
+
+/**
+ * What the page would have sent to a client
+ */
+typedef struct {
+    size_t bytes;
+    uint16_t chunks;
+    bool ended;
+} test_webconfig_sink_t;
+
+static esp_err_t test_webconfig_count(void * arg, const char * data, size_t length)
+{
+    test_webconfig_sink_t * sink = (test_webconfig_sink_t *) arg;
+
+    if(data == NULL) {
+        sink->ended = true;
+    } else {
+        sink->bytes += length;
+        ++sink->chunks;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Half numbers, half texts, so both kinds of widgets are rendered
+ */
+static void test_webconfig_register()
+{
+    memset(test_webconfig_entries, 0, sizeof(test_webconfig_entries));
+    TEST_ESP_OK(esp32_manager_storage_init());
+    TEST_ESP_OK(esp32_manager_register_namespace(&test_webconfig_namespace));
+    for(uint16_t i=0; i < TEST_WEBCONFIG_ENTRIES_SIZE; ++i) {
+        snprintf(test_webconfig_keys[i], sizeof(test_webconfig_keys[i]), "e%u", i);
+        snprintf(test_webconfig_friendly[i], sizeof(test_webconfig_friendly[i]), "Entry %u", i);
+        test_webconfig_entry_list[i] = (esp32_manager_entry_t) {
+            .key = test_webconfig_keys[i],
+            .friendly = test_webconfig_friendly[i],
+            .attributes = ESP32_MANAGER_ATTR_READWRITE
+        };
+        if(i % 2) {
+            snprintf(test_webconfig_texts[i], TEST_WEBCONFIG_TEXT_SIZE, "text <%u> & more", i); // Escaped
+            test_webconfig_entry_list[i].type = text;
+            test_webconfig_entry_list[i].value = (void *) test_webconfig_texts[i];
+            test_webconfig_entry_list[i].default_value = (void *) test_webconfig_text_default;
+            test_webconfig_entry_list[i].size = TEST_WEBCONFIG_TEXT_SIZE;
+        } else {
+            test_webconfig_numbers[i] = i * 1000;
+            test_webconfig_entry_list[i].type = u32;
+            test_webconfig_entry_list[i].value = (void *) &test_webconfig_numbers[i];
+            test_webconfig_entry_list[i].default_value = (void *) &test_webconfig_number_default;
+        }
+        TEST_ESP_OK(esp32_manager_register_entry(&test_webconfig_namespace, &test_webconfig_entry_list[i]));
+    }
+}
+
+TEST_CASE("namespace page of 200 entries is rendered in chunks", "[esp32_manager][webconfig][timing]")
+{
+    static char buffer[WEBCONFIG_MANAGER_BUFFER_SIZE +1];
+    esp32_manager_webconfig_chunk_t chunk;
+    test_webconfig_sink_t sink = {0};
+
+    test_webconfig_register();
+
+    esp32_manager_webconfig_chunk_init_sink(&chunk, test_webconfig_count, &sink, buffer, WEBCONFIG_MANAGER_BUFFER_SIZE);
+    int64_t start_time = esp_timer_get_time();
+    uint8_t parity = esp32_manager_read_enter();
+    TEST_ESP_OK(esp32_manager_webconfig_page_setup_namespace(&chunk, &test_webconfig_namespace));
+    esp32_manager_read_exit(parity);
+    TEST_ESP_OK(esp32_manager_webconfig_chunk_end(&chunk));
+    uint32_t render_time = (uint32_t) (esp_timer_get_time() - start_time);
+
+    TEST_ASSERT_TRUE(sink.ended);
+    TEST_ASSERT_GREATER_THAN(TEST_WEBCONFIG_ENTRIES_SIZE * 50, sink.bytes); // At least a label and an input per entry
+    printf("Namespace page of %u entries: %u bytes in %u chunks of up to %u bytes, rendered in %u us\n",
+            TEST_WEBCONFIG_ENTRIES_SIZE, sink.bytes, sink.chunks, WEBCONFIG_MANAGER_BUFFER_SIZE, render_time);
+
+    TEST_ESP_OK(esp32_manager_unregister_namespace(&test_webconfig_namespace));
+}
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+#
+# esp32_manager_nvs_gen.py
+#
+# (C) 2019 - Pablo Bacho <pablo@pablobacho.com>
+# This code is licensed under the MIT License.
+#
+# Generates NVS partition images with the values of esp32_manager entries, so devices can be
+# flashed already configured. Values are written with the same NVS types and keys used by
+# esp32_manager_commit_to_nvs(), so esp32_manager_read_from_nvs() loads them on first boot.
+#
+# Input is a JSON description of namespaces and entries with their defaults, and optionally a CSV
+# file with per-device overrides. Output is a CSV file per device in the format of ESP-IDF's
+# nvs_partition_gen.py, which is called to build the binary image when --size is given.
+
+import argparse
+import csv
+import json
+import os
+import struct
+import subprocess
+import sys
+
+NAMESPACE_KEY_MAX_LENGTH = 15   # ESP32_MANAGER_NAMESPACE_KEY_MAX_LENGTH
+ENTRY_KEY_MAX_LENGTH = 15       # ESP32_MANAGER_ENTRY_KEY_MAX_LENGTH
+CHOICES_SINGLE_MAX_SIZE = 256   # ESP32_MANAGER_CHOICES_SINGLE_MAX_SIZE
+
+# esp32_manager_type_t -> nvs_partition_gen.py encoding, as stored by esp32_manager_commit_to_nvs()
+INTEGER_TYPES = {
+    'i8': ('i8', -2**7, 2**7 - 1),
+    'u8': ('u8', 0, 2**8 - 1),
+    'i16': ('i16', -2**15, 2**15 - 1),
+    'u16': ('u16', 0, 2**16 - 1),
+    'i32': ('i32', -2**31, 2**31 - 1),
+    'u32': ('u32', 0, 2**32 - 1),
+    'i64': ('i64', -2**63, 2**63 - 1),
+    'u64': ('u64', 0, 2**64 - 1),
+}
+FLOAT_TYPES = {'flt': '<f', 'dbl': '<d'}   # Stored as blobs with the raw little endian value
+STRING_TYPES = ('text', 'password')
+UNSUPPORTED_TYPES = ('blob', 'image')   # Not stored by esp32_manager_commit_to_nvs() either
+
+# esp32_manager_compress.h
+COMPRESS_MAGIC = 0xC5
+COMPRESS_METHOD_NONE = 0
+COMPRESS_METHOD_LZSS = 1
+LZSS_WINDOW_SIZE = 1024
+LZSS_MIN_MATCH = 3
+LZSS_MAX_MATCH = LZSS_MIN_MATCH + 63
+
+
+class DescriptionError(Exception):
+    pass
+
+
+def lzss_encode(data):
+    """Same output as esp32_manager_lzss_encode()."""
+    out = bytearray()
+    position = 0
+    while position < len(data):
+        flags_position = len(out)
+        out.append(0)
+        for bit in range(8):
+            if position >= len(data):
+                break
+            best_length, best_distance = 0, 0
+            max_length = min(LZSS_MAX_MATCH, len(data) - position)
+            for candidate in range(max(0, position - LZSS_WINDOW_SIZE), position):
+                match_length = 0
+                while match_length < max_length and data[candidate + match_length] == data[position + match_length]:
+                    match_length += 1
+                if match_length > best_length:
+                    best_length, best_distance = match_length, position - candidate
+                    if match_length == max_length:
+                        break
+            if best_length >= LZSS_MIN_MATCH:
+                out.append((best_distance - 1) & 0xFF)
+                out.append((((best_distance - 1) >> 8) << 6) | (best_length - LZSS_MIN_MATCH))
+                position += best_length
+            else:
+                out[flags_position] |= 1 << bit
+                out.append(data[position])
+                position += 1
+    return bytes(out)
+
+
+def compress(data):
+    """Same output as esp32_manager_compress(): header and LZSS data, or the data as is if it does not get smaller."""
+    compressed = lzss_encode(data)
+    if 0 < len(compressed) < len(data):
+        return struct.pack('<BBH', COMPRESS_MAGIC, COMPRESS_METHOD_LZSS, len(data)) + compressed
+    return struct.pack('<BBH', COMPRESS_MAGIC, COMPRESS_METHOD_NONE, len(data)) + data
+
+
+def encode_entry(namespace, entry, value):
+    """Returns (encoding, value) for a row of the nvs_partition_gen.py CSV file."""
+    name = '%s.%s' % (namespace['key'], entry['key'])
+    entry_type = entry['type']
+
+    if entry_type in INTEGER_TYPES:
+        encoding, minimum, maximum = INTEGER_TYPES[entry_type]
+        value = int(value)
+        if value < minimum or value > maximum:
+            raise DescriptionError('%s: %d out of range for %s' % (name, value, entry_type))
+        return encoding, str(value)
+
+    if entry_type in FLOAT_TYPES:
+        return 'hex2bin', struct.pack(FLOAT_TYPES[entry_type], float(value)).hex()
+
+    if entry_type in STRING_TYPES:
+        if entry.get('compress'):   # ESP32_MANAGER_ATTR_COMPRESS: null-terminated string in a compressed blob
+            return 'hex2bin', compress(str(value).encode('utf-8') + b'\0').hex()
+        return 'string', str(value)
+
+    if entry_type in ('single_choice', 'multiple_choice'):
+        choices = entry.get('choices')
+        if not choices:
+            raise DescriptionError('%s: choice entries need "choices"' % name)
+        if entry_type == 'single_choice':
+            if len(choices) > CHOICES_SINGLE_MAX_SIZE:
+                raise DescriptionError('%s: too many choices' % name)
+            if value not in choices:
+                raise DescriptionError('%s: unknown choice "%s"' % (name, value))
+            return 'u8', str(choices.index(value))
+        # Bitset of (size + 7) / 8 bytes, bit i set when option i is selected
+        if not isinstance(value, list):
+            value = [v for v in str(value).split(',') if v]
+        bitset = bytearray((len(choices) + 7) // 8)
+        for key in value:
+            if key not in choices:
+                raise DescriptionError('%s: unknown choice "%s"' % (name, key))
+            index = choices.index(key)
+            bitset[index // 8] |= 1 << (index % 8)
+        return 'hex2bin', bytes(bitset).hex()
+
+    raise DescriptionError('%s: type %s not supported' % (name, entry_type))
+
+
+def load_description(path):
+    with open(path) as f:
+        description = json.load(f)
+
+    for namespace in description.get('namespaces', []):
+        if len(namespace['key']) > NAMESPACE_KEY_MAX_LENGTH:
+            raise DescriptionError('Namespace key %s is too long' % namespace['key'])
+        for entry in namespace.get('entries', []):
+            if len(entry['key']) > ENTRY_KEY_MAX_LENGTH:
+                raise DescriptionError('Entry key %s.%s is too long' % (namespace['key'], entry['key']))
+    return description
+
+
+def load_overrides(path):
+    """Returns a list of (device, {'namespace.entry': value}) from a CSV file with a 'device' column."""
+    devices = []
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            device = row.pop('device', None)
+            if not device:
+                raise DescriptionError('Overrides need a "device" column')
+            devices.append((device, dict((k, v) for k, v in row.items() if v != '')))
+    return devices
+
+
+def generate_rows(description, overrides, sparse=False):
+    rows = [('key', 'type', 'encoding', 'value')]
+    used = set()
+
+    for namespace in description.get('namespaces', []):
+        namespace_rows = []
+        for entry in namespace.get('entries', []):
+            name = '%s.%s' % (namespace['key'], entry['key'])
+            if entry.get('no_flash') or entry.get('mmap') or entry['type'] in UNSUPPORTED_TYPES:
+                continue    # ESP32_MANAGER_ATTR_NO_FLASH and ESP32_MANAGER_ATTR_MMAP entries are never stored in NVS
+            if name in overrides:
+                value = overrides[name]
+                used.add(name)
+            elif 'default' in entry:
+                value = entry['default']
+            else:
+                continue    # Entries without a value are left to esp32_manager_reset_entry()
+            encoding, value = encode_entry(namespace, entry, value)
+            if sparse and 'default' in entry and (encoding, value) == encode_entry(namespace, entry, entry['default']):
+                continue    # ESP32_MANAGER_SPARSE_PERSISTENCE: defaults are not stored
+            namespace_rows.append((entry['key'], 'data', encoding, value))
+        if namespace_rows:
+            rows.append((namespace['key'], 'namespace', '', ''))
+            rows.extend(namespace_rows)
+
+    unknown = set(overrides) - used
+    if unknown:
+        raise DescriptionError('Overrides for unknown or unstored entries: %s' % ', '.join(sorted(unknown)))
+    return rows
+
+
+def write_csv(path, rows):
+    with open(path, 'w') as f:
+        writer = csv.writer(f, lineterminator='\n')
+        writer.writerows(rows)
+
+
+def generate_image(nvs_gen, csv_path, bin_path, size):
+    # ESP-IDF v4.x uses subcommands. Fall back to the v3.x arguments.
+    commands = [
+        [sys.executable, nvs_gen, 'generate', csv_path, bin_path, size],
+        [sys.executable, nvs_gen, '--input', csv_path, '--output', bin_path, '--size', size],
+    ]
+    for command in commands:
+        if subprocess.call(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL) == 0:
+            return
+    raise DescriptionError('nvs_partition_gen.py failed for %s' % csv_path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate NVS partition images with esp32_manager entry values')
+    parser.add_argument('description', help='JSON description of namespaces and entries')
+    parser.add_argument('--overrides', help='CSV file with a "device" column and a "namespace.entry" column per value to override')
+    parser.add_argument('--output', default='nvs', help='Output directory (default: nvs)')
+    parser.add_argument('--size', help='NVS partition size, such as 0x6000. Generates binary images when given.')
+    parser.add_argument('--sparse', action='store_true', help='Only store values that differ from their default, as with ESP32_MANAGER_SPARSE_PERSISTENCE')
+    parser.add_argument('--nvs-gen', default=os.path.join(os.environ.get('IDF_PATH', ''), 'components', 'nvs_flash', 'nvs_partition_generator', 'nvs_partition_gen.py'),
+                        help='Path to nvs_partition_gen.py (default: from IDF_PATH)')
+    args = parser.parse_args()
+
+    try:
+        description = load_description(args.description)
+        devices = load_overrides(args.overrides) if args.overrides else [('nvs', {})]
+
+        if not os.path.isdir(args.output):
+            os.makedirs(args.output)
+
+        for device, overrides in devices:
+            csv_path = os.path.join(args.output, device + '.csv')
+            write_csv(csv_path, generate_rows(description, overrides, args.sparse))
+            if args.size:
+                generate_image(args.nvs_gen, csv_path, os.path.join(args.output, device + '.bin'), args.size)
+            print('Generated %s' % os.path.join(args.output, device + ('.bin' if args.size else '.csv')))
+    except (DescriptionError, KeyError, ValueError, IOError) as e:
+        print('Error: %s' % e, file=sys.stderr)
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())